@@ -0,0 +1,428 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contbench.cxx -- microbenchmarks for the contaminant code
+
+  Usage: contbench [-n sinks] [-m sources] [-k contaminants] [-g cohorts] [-e members]
+                   [-l kget_usec] [-q query_threads] [-a tolerance] [-p threads]
+                   [-t seconds] [-w env_work] [-s seed] [-f filter] [-o results.json]
+
+  Builds the synthetic scenario of scenario.hxx in the stand-in kernel
+  (standin/): n sinks and m sources, k contaminants, and two
+  populations of g cohorts.  Each hot path is then timed on its own,
+  Google Benchmark fashion: the iteration count is grown until a run
+  takes at least the minimum time, and that run is reported.  The sink
+  paths cycle through the sinks, so one iteration is one agent.
+  Nothing is checked here; contcheck (contcheck.cxx) runs the same
+  scenario through the checks that the faster paths get what the plain
+  ones do, and should be run before believing any of these figures.
+
+  Population/Tick ticks each cohort in turn, Population/CohortTick the
+  same population through Contamination's cohort path.  With -e every
+  sink carries a parameter ensemble of that many members
+  (contensemble.hxx), which the tick paths then include.
+
+  -l makes every KGET take that many microseconds, as a round trip to
+  another kernel would, and -q answers the sinks' source queries with
+  that many threads (contquery.hxx).  ContaminantSink/IntoxicateMany
+  then starts the queries for 64 sinks before finishing any of them.
+
+  -p runs Contamination/CommitMany, 256 sinks at a time, on that many
+  threads (contparallel.hxx).  On a NUMA machine (or with
+  $CONT_NUMA_NODES) the sinks move between nodes as they go; the
+  proportion of commits which found a sink away from home is reported
+  as remote_ratio.
+
+  Contamination/Ingest+Commit has every sink eat a prey (half of it,
+  the prey carrying all k contaminants) and then commit.
+
+  -a gives every contaminant an adaptive step with that tolerance
+  (between a minute and six hours).  Either way the number of steps a
+  sink takes over a day of steady low-level exposure, stepping as long
+  as it asks to, is reported as steps_per_day (72 with the fixed 20
+  minute contaminant_tick).
+
+  The results go to stdout (or -o) as JSON in the same shape as Google
+  Benchmark's, so the usual tools for tracking them over time work.
+  The stand-in evaluator's call counts are reported per iteration as
+  counters; -w sets how much work the stand-in does per Configure and
+  ValidateVariables call (see standin/prmenvexpr.hxx).
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "scenario.hxx"
+#include "prmenvexpr.hxx"
+#include "cube.hxx"
+#include "contparallel.hxx"
+#include "contquery.hxx"
+#include "contnuma.hxx"
+#include "memchk.h"
+
+/*-  Code  */
+
+/*-- the benchmarks */
+
+static double t_now = 0;
+static long cursor = 0;
+
+/*--- next_fish() -- round robin; time moves on after each sweep */
+static BenchFish *next_fish() {
+	BenchFish *f = fish[cursor];
+	if (++cursor >= N) {
+		cursor = 0;
+		t_now += DT;
+	}
+	return f;
+}
+
+static Cube *cube = 0;
+static double *levels = 0;
+
+/*--- bm_cube_adjustlevels(long n) -- */
+static void bm_cube_adjustlevels(long n) {
+	for (long i = 0; i < n; i++) cube->AdjustLevels(levels, 1, K);
+}
+
+/*--- bm_cube_adjustn(long n) -- */
+static void bm_cube_adjustn(long n) {
+	for (long i = 0; i < n; i++) cube->AdjustN(1e-3, 1 + i%K);
+}
+
+/*--- bm_cube_state(long n) -- */
+static void bm_cube_state(long n) {
+	for (long i = 0; i < n; i++) {
+		int sz;
+		void *d = cube->GetState(&sz);
+		cube->SetState(d, sz);
+		Free(d);
+	}
+}
+
+/*--- bm_intoxicate(long n) -- */
+static void bm_intoxicate(long n) {
+	for (long i = 0; i < n; i++) next_fish()->Intoxicate(t_now, DT);
+}
+
+/*--- bm_intoxicate_many(long n) -- 64 at a time */
+static void bm_intoxicate_many(long n) {
+	ContaminantSink *s[64];
+	double dts[64];
+
+	while (n > 0) {
+		int m = n < 64 ? n : 64;
+		for (int j = 0; j < m; j++) s[j] = next_fish();
+		ContaminantSink::IntoxicateMany(s, m, t_now, DT, dts);
+		n -= m;
+	}
+}
+
+/*--- bm_commit(long n) -- */
+static void bm_commit(long n) {
+	for (long i = 0; i < n; i++) {
+		BenchFish *f = next_fish();
+		f->Expose(1e-3);
+		f->Commit(t_now, DT);
+	}
+}
+
+/*--- bm_ingest(long n) -- */
+static ContaminantProfile *prey = 0;
+static ContaminantProfileView prey_view;
+
+static void bm_ingest(long n) {
+	for (long i = 0; i < n; i++) {
+		BenchFish *f = next_fish();
+		f->Expose(1e-3);
+		f->Eat(&prey_view, 0.5, t_now);
+		f->Commit(t_now, DT);
+	}
+}
+
+/*--- bm_commit_many(long n) -- 256 at a time */
+static void bm_commit_many(long n) {
+	Contamination *c[256];
+	double dts[256];
+
+	while (n > 0) {
+		int m = n < 256 ? n : 256;
+		for (int j = 0; j < m; j++) {
+			BenchFish *f = next_fish();
+			f->Expose(1e-3);
+			c[j] = f;
+			dts[j] = DT;
+		}
+		Contamination::CommitIntoxicateMany(c, m, t_now, DT, dts);
+		n -= m;
+	}
+}
+
+/*--- bm_tick(long n) -- Intoxicate then CommitIntoxicate */
+static void bm_tick(long n) {
+	for (long i = 0; i < n; i++) next_fish()->Tick(t_now, DT);
+}
+
+/*--- bm_pop_single(long n) -- each cohort ticked in turn */
+static void bm_pop_single(long n) {
+	static double t = 0;
+	for (long i = 0; i < n; i += G, t += DT) {
+		for (int j = 0; j < G; j++) ((BenchFish *)pop[0][j])->Tick(t, DT);
+	}
+}
+
+/*--- bm_pop_cohort(long n) -- the cohort path */
+static void bm_pop_cohort(long n) {
+	static double t = 0;
+	for (long i = 0; i < n; i += G, t += DT) {
+		double d = Contamination::IntoxicateCohort(pop[1], G, t, DT);
+		Contamination::CommitIntoxicateCohort(pop[1], G, t, DT, d);
+	}
+}
+
+/*--- steps_per_day() -- a day downstream of a source, each step as long as the sink asks for */
+static int steps_per_day() {
+	R3 p = src[0]->loc;
+	p.x += 300;
+	BenchFish *f = new BenchFish(p, 1);
+	StandinRegister(f);
+	if (!f->Init((char *)SINK_TAXON, (char *)"downstream")) fatal(1, "The downstream sink didn't initialise");
+
+	int n = 0;
+	for (double t = 0; t < 86400; n++) {
+		double h = f->Intoxicate(t, 86400 - t);
+		if (!(h > 0)) fatal(1, "Step %d of the day is %g", n, h);
+		f->Commit(t, h);
+		t += h;
+	}
+	return n;
+}
+
+/*--- bm_getstate(long n) -- */
+static void bm_getstate(long n) {
+	for (long i = 0; i < n; i++) {
+		int sz;
+		void *d = next_fish()->GetState(&sz);
+		Free(d);
+	}
+}
+
+/*--- bm_setstate(long n) -- */
+static void bm_setstate(long n) {
+	int sz;
+	void *d = fish[0]->GetState(&sz);
+	for (long i = 0; i < n; i++) scratch->SetState(d, sz);
+	Free(d);
+}
+
+/*--- bm_putstate(long n) -- */
+static void bm_putstate(long n) {
+	static char *buf = 0;
+	static int bufsz = 0;
+	for (long i = 0; i < n; i++) {
+		BenchFish *f = next_fish();
+		int sz = f->StateSize();
+		if (sz > bufsz) {
+			buf = (char *)Realloc(buf, sz);
+			if (!buf) abort();
+			bufsz = sz;
+		}
+		f->PutState(buf, sz);
+	}
+}
+
+/*--- bm_setstateinplace(long n) -- */
+static void bm_setstateinplace(long n) {
+	int sz = fish[0]->StateSize();
+	char *buf = (char *)Malloc(sz);
+	if (!buf) abort();
+	fish[0]->PutState(buf, sz);
+	for (long i = 0; i < n; i++) scratch->SetStateInPlace(buf, sz);
+	Free(buf);
+}
+
+typedef struct {
+	const char *name;
+	void (*fn)(long n);
+} Benchmark;
+
+static Benchmark benchmarks[] = {
+	{ "Cube/AdjustLevels", bm_cube_adjustlevels },
+	{ "Cube/AdjustN", bm_cube_adjustn },
+	{ "Cube/GetState+SetState", bm_cube_state },
+	{ "ContaminantSink/Intoxicate", bm_intoxicate },
+	{ "ContaminantSink/IntoxicateMany", bm_intoxicate_many },
+	{ "Contamination/CommitIntoxicate", bm_commit },
+	{ "Contamination/CommitMany", bm_commit_many },
+	{ "Contamination/Ingest+Commit", bm_ingest },
+	{ "Contamination/Tick", bm_tick },
+	{ "Contamination/GetState", bm_getstate },
+	{ "Contamination/SetState", bm_setstate },
+	{ "Contamination/PutState", bm_putstate },
+	{ "Contamination/SetStateInPlace", bm_setstateinplace },
+	{ "Population/Tick", bm_pop_single },
+	{ "Population/CohortTick", bm_pop_cohort },
+	{ 0, 0 }
+};
+
+
+/*-- timing */
+
+/*--- now(clockid_t c) -- seconds */
+static double now(clockid_t c) {
+	struct timespec ts;
+	clock_gettime(c, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+/*--- measure(Benchmark *b, double min_time, FILE *out, int first) -- */
+static void measure(Benchmark *b, double min_time, FILE *out, int first) {
+	long n = 1;
+	double real, cpu;
+	StandinCounters before;
+
+	for (;;) {
+		before = Standin;
+		double r0 = now(CLOCK_MONOTONIC), c0 = now(CLOCK_PROCESS_CPUTIME_ID);
+		b->fn(n);
+		real = now(CLOCK_MONOTONIC) - r0;
+		cpu = now(CLOCK_PROCESS_CPUTIME_ID) - c0;
+		if (real >= min_time || n >= 1000000000L) break;
+
+		// aim a little past min_time, but don't grow by more than 10x at once
+		double m = (real > 0)?1.4*min_time/real:10;
+		if (m > 10) m = 10;
+		if (m < 2) m = 2;
+		n = (long)(n*m);
+	}
+
+	fprintf(out, "%s    {\n", first?"":",\n");
+	fprintf(out, "      \"name\": \"%s\",\n", b->name);
+	fprintf(out, "      \"run_name\": \"%s\",\n", b->name);
+	fprintf(out, "      \"run_type\": \"iteration\",\n");
+	fprintf(out, "      \"iterations\": %ld,\n", n);
+	fprintf(out, "      \"real_time\": %.6g,\n", 1e9*real/n);
+	fprintf(out, "      \"cpu_time\": %.6g,\n", 1e9*cpu/n);
+	fprintf(out, "      \"time_unit\": \"ns\",\n");
+	fprintf(out, "      \"configure_per_iter\": %.6g,\n", (double)(Standin.configure - before.configure)/n);
+	fprintf(out, "      \"validate_per_iter\": %.6g,\n", (double)(Standin.validate - before.validate)/n);
+	fprintf(out, "      \"calculate_per_iter\": %.6g,\n", (double)(Standin.calculate - before.calculate)/n);
+	fprintf(out, "      \"kget_per_iter\": %.6g\n", (double)(Standin.kget - before.kget)/n);
+	fprintf(out, "    }");
+	fflush(out);
+
+	fprintf(stderr, "%-36s %12.1f ns %12.1f ns cpu %12ld iterations\n", b->name, 1e9*real/n, 1e9*cpu/n, n);
+}
+
+/*--- usage() -- */
+static void usage() {
+	fprintf(stderr, "Usage: contbench [-n sinks] [-m sources] [-k contaminants] [-g cohorts] [-e members]\n"
+		"                 [-l kget_usec] [-q query_threads] [-a tolerance] [-p threads]\n"
+		"                 [-t seconds] [-w env_work] [-s seed] [-f filter] [-o results.json]\n");
+	exit(1);
+}
+
+/*-- main */
+int main(int argc, char **argv) {
+	double min_time = 0.5;
+	long seed = 1;
+	char *filter = 0, *outfile = 0;
+	int c, threads = 0, pthreads = 0, steps;
+
+	Standin.env_work = 50;
+	while ((c = getopt(argc, argv, "n:m:k:g:e:l:q:a:p:t:w:s:f:o:")) != -1) {
+		switch (c) {
+		case 'n': N = atoi(optarg); break;
+		case 'm': M = atoi(optarg); break;
+		case 'k': K = atoi(optarg); break;
+		case 'g': G = atoi(optarg); break;
+		case 'e': E = atoi(optarg); break;
+		case 'l': Standin.kget_latency = atoi(optarg); break;
+		case 'q': threads = atoi(optarg); break;
+		case 'a': A = optarg; break;
+		case 'p': pthreads = atoi(optarg); break;
+		case 't': min_time = atof(optarg); break;
+		case 'w': Standin.env_work = atoi(optarg); break;
+		case 's': seed = atol(optarg); break;
+		case 'f': filter = optarg; break;
+		case 'o': outfile = optarg; break;
+		default: usage();
+		}
+	}
+	if (N < 1 || M < 0 || K < 1 || G < 1 || E < 1 || min_time <= 0) usage();
+
+	srand48(seed);
+	// the sinks are set up on the pool, so that they start out on its nodes
+	ContaminantParallel::Start(pthreads);
+	make_scenario();
+	ContaminantQuery::Start(threads);
+	steps = steps_per_day();
+	fprintf(stderr, "%d steps per day\n", steps);
+
+	prey = new ContaminantProfile();
+	for (int k = 0; k < K; k++) {
+		char name[32];
+		snprintf(name, sizeof(name), "c%d", k);
+		prey->AddContaminant(name, 1e-3);
+	}
+	prey_view.Borrow(prey);
+
+	cube = new Cube(K+1, 1e6);
+	levels = (double *)Calloc(K, sizeof(double));
+	if (!levels) abort();
+	for (int k = 0; k < K; k++) levels[k] = 1e-9;
+
+	FILE *out = stdout;
+	if (outfile && !(out = fopen(outfile, "w"))) fatal(1, "Unable to write %s", outfile);
+
+	char host[256] = "unknown", date[64];
+	time_t tt = time(0);
+	gethostname(host, sizeof(host));
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&tt));
+
+	fprintf(out, "{\n  \"context\": {\n");
+	fprintf(out, "    \"date\": \"%s\",\n", date);
+	fprintf(out, "    \"host_name\": \"%s\",\n", host);
+	fprintf(out, "    \"executable\": \"%s\",\n", argv[0]);
+	fprintf(out, "    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef NDEBUG
+	fprintf(out, "    \"library_build_type\": \"release\",\n");
+#else
+	fprintf(out, "    \"library_build_type\": \"debug\",\n");
+#endif
+#if defined(CONT_FLOAT_STORAGE)
+	fprintf(out, "    \"storage\": \"float\",\n");
+#else
+	fprintf(out, "    \"storage\": \"double\",\n");
+#endif
+	fprintf(out, "    \"sinks\": %d,\n    \"sources\": %d,\n    \"contaminants\": %d,\n    \"cohorts\": %d,\n", N, M, K, G);
+	fprintf(out, "    \"kget_latency_us\": %d,\n", Standin.kget_latency);
+	fprintf(out, "    \"query_threads\": %d,\n", ContaminantQuery::Threads());
+	fprintf(out, "    \"threads\": %d,\n", ContaminantParallel::Threads());
+	fprintf(out, "    \"numa_nodes\": %d,\n", ContaminantNuma::Nodes());
+	fprintf(out, "    \"adaptive_tolerance\": %s,\n    \"steps_per_day\": %d,\n", A?A:"0", steps);
+	fprintf(out, "    \"env_work\": %d,\n    \"seed\": %ld\n", Standin.env_work, seed);
+	fprintf(out, "  },\n  \"benchmarks\": [\n");
+
+	int first = 1;
+	for (Benchmark *b = benchmarks; b->name; b++) {
+		if (filter && !strstr(b->name, filter)) continue;
+		measure(b, min_time, out, first);
+		first = 0;
+	}
+	fprintf(out, "\n  ],\n  \"remote_ratio\": %g\n}\n", ContaminantNuma::RemoteRatio());
+	if (out != stdout) fclose(out);
+
+	// as at the end of a run, for $CONT_PRECISION_DUMP and $CONT_PROFILE
+	for (int i = 0; i < N; i++) fish[i]->Shutdown();
+	Contamination::ShutdownAll();
+	return 0;
+}
+
+/*-  The End  */
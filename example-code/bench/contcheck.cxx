@@ -0,0 +1,1439 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contcheck.cxx -- consistency checks for the contaminant code
+
+  Usage: contcheck [-n sinks] [-m sources] [-k contaminants] [-g cohorts] [-e members]
+                   [-l kget_usec] [-q query_threads] [-a tolerance] [-w env_work]
+                   [-s seed] [-f filter]
+
+  Builds contbench's scenario (scenario.hxx) and runs the checks on it
+  which have no place in a benchmark: that the faster paths get what
+  the plain ones do.  Each check stops the run with fatal() at the
+  first difference; otherwise its name is printed when it's done, and
+  the exit status is 0.  -f runs only the checks whose names contain
+  filter.
+
+  cohorts     the two populations, ticked one cohort at a time and
+              through Contamination's cohort path, agree.
+  ensemble    (with -e) ensemble member 1, which changes nothing,
+              matches the agent.
+  queries     IntoxicateMany, with its queries answered by -q threads
+              and -l microseconds per KGET, finds what Intoxicate one
+              sink at a time does, and that what asking every source
+              about every contaminant does; a second tick asks no
+              source for its list, and changing one's list (in more
+              ways than a taxon keeps) is noticed.
+  parallel    a separate set of sinks, set up through InitMany and
+              ticked through CommitIntoxicateMany on 1, 4 and as many
+              threads as there are processors from the same start, has
+              identical loads, members, death logs and totals.  They
+              are committed taking from the first and second halves
+              of the order they were set up in by turns, so with
+              $CONT_NUMA_NODES a chunk has agents from two nodes when
+              InitMany split them, and agents are moved.
+  halo        four forked kernels, each with a quarter of a separate
+              set of sinks (conthalo.hxx), ticked while the sources
+              drift and change strength, get the loads and members of
+              one kernel with everything, and none ever made a KGET of
+              another's source.
+  setup_cache kernels, one after another, set up a sink of a new
+              taxon with tabulated lethal surfaces through a setup cache
+              (contcache.hxx) keyed on the stand-in's parameters written
+              to a file.  A setup from the cache ticks its sink exactly
+              as one from the parameters did; a changed parameter, from
+              the start or after a reload, finds nothing; and a kernel
+              with the old file open can still read it after another
+              has started the file again.
+  ingest      a sink fed the same meals from four threads at once
+              matches another fed from one thread in reverse order.
+  handles     a parameter handle remembers its answer until
+              ParamHandle::Forget() (a parameter reload), and then
+              has the new one.
+  corpus      paramcc (from the same directory as contcheck) compiles
+              the stand-in's parameters, written to a file, and the
+              corpus answers as the tree does; it's still taken after
+              the file is rewritten unchanged, and dropped (by
+              Recheck(), as at a reload) or refused after a parameter
+              in it changes.
+  exprc       the translator (contnative.hxx) takes a bare name as a
+              constant only if the "const" block declares it, and
+              contexprc (from the same directory as contcheck) writes
+              out the programs it can translate.  What it writes is
+              compiled and loaded, and every function in it gives
+              what the evaluator does with the program it came from.
+
+  onset       a sink with an adaptive step, downstream of a source
+              which is switched on, off for two days while its load
+              decays, and on again, takes a step of no more than
+              min_tick whenever the plume comes back, and its load
+              stays within two tolerances of one held to min_tick.
+              Each step costs two evaluations of its load_update (the
+              halves).  Made to take six hour steps in the steady
+              plume, well outside its tolerance, it's three times as
+              close to that as a sink without an adaptive step.
+
+  shm         two forked kernels linked through shared memory
+              (contshm.hxx), each owning every other agent, ask each
+              other about their sources and sinks' profiles the whole
+              time, and get what asking their own copies does, without
+              a KGET; among the sources is one that asks the other
+              kernel in turn while it answers.  An agent read in place
+              from its message (Contamination::SetStateInPlace) is the
+              one that was written, after the message is reused.
+  stream      sinks on two threads, one of them a day ahead of the
+              other, write a contaminant stream summed by cell
+              (contstream.hxx), and contread (from the same directory
+              as contcheck) finds one row for each bin, cell and
+              contaminant, with every tick's rows counted in; only the
+              impairment asked for is worked out.
+  batch       a separate set of sinks, reattached with ReInitBatch,
+              keeps its programs rather than adding them again, and
+              moved with Get/SetBatchState into new agents on the
+              pool, goes on exactly as the ones it came from.
+  lc_table    tabulated lethal surfaces (endpointtab.hxx), swept on a
+              grid which is off theirs and beyond it, are never further
+              from the surface than the Error() they report, and that
+              is within the tolerance they were built to.
+
+  The checks which fork, and the setup cache's, leave nothing behind
+  in /tmp unless they fail.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#include "scenario.hxx"
+#include "prmenvexpr.hxx"
+#include "contparallel.hxx"
+#include "contnuma.hxx"
+#include "contquery.hxx"
+#include "conthalo.hxx"
+#include "contcache.hxx"
+#include "contshm.hxx"
+#include "contstream.hxx"
+#include "paramcorpus.hxx"
+#include "paramhandle.hxx"
+#include "conttaxon.hxx"
+#include "endpointtab.hxx"
+#include "contnative.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+static char *filter = 0;
+static char tools[256] = ".";   // where contcheck is, and so the tools
+
+/*-  Code  */
+
+/*-- the checks */
+
+/*--- check_cohorts(int ticks) -- the cohort path had better agree with the ordinary one */
+// Both take the population's step, the smallest any cohort asks for
+// (with -a they differ).
+static void check_cohorts(int ticks) {
+	double t = 0;
+	for (int k = 0; k < ticks; k++, t += DT) {
+		double d = DT;
+		for (int j = 0; j < G; j++) d = Min(d, pop[0][j]->Intoxicate(t, DT));
+		for (int j = 0; j < G; j++) ((BenchFish *)pop[0][j])->Commit(t, d);
+		d = Contamination::IntoxicateCohort(pop[1], G, t, DT);
+		Contamination::CommitIntoxicateCohort(pop[1], G, t, DT, d);
+	}
+	for (int j = 0; j < G; j++) {
+		BenchFish *a = (BenchFish *)pop[0][j], *b = (BenchFish *)pop[1][j];
+		for (int c = 0; c < K; c++) {
+			if (a->Load(c) != b->Load(c))
+				fatal(1, "Cohort %d: load %g one at a time, %g as a cohort", j, a->Load(c), b->Load(c));
+		}
+		if (a->Members() != b->Members())
+			fatal(1, "Cohort %d: %g members one at a time, %g as a cohort", j, a->Members(), b->Members());
+	}
+}
+
+/*--- check_parallel(int n, int ticks) -- CommitIntoxicateMany and InitMany had better not care how many threads they have */
+// Each thread count gets its own n sinks, placed the same way and set
+// up on that many threads, and they're all ticked from the same start.
+// g, the order they're ticked in, takes from the two halves of f in turn.
+static void check_parallel(int n, int ticks) {
+	int threads[3] = { 1, 4, (int)sysconf(_SC_NPROCESSORS_ONLN) };
+	BenchFish **f = (BenchFish **)Calloc(n, sizeof(BenchFish *)), **g = (BenchFish **)Calloc(n, sizeof(BenchFish *));
+	double *dts = (double *)Calloc(n, sizeof(double));
+	double *first = (double *)Calloc(n*(K+1), sizeof(double));
+	unsigned long long *trail = (unsigned long long *)Calloc(n, sizeof(unsigned long long));
+	char **taxa = (char **)Calloc(n, sizeof(char *)), **names = (char **)Calloc(n, sizeof(char *));
+	double lost0 = 0;
+	if (!f || !g || !dts || !first || !trail || !taxa || !names) abort();
+
+	for (int r = 0; r < 3; r++) {
+		long moved = ContaminantNuma::Moved();
+		unsigned short xsubi[3] = { 1, 2, 3 };
+		ContaminantParallel::Start(threads[r]);
+		for (int j = 0; j < n; j++) {
+			char name[32];
+			R3 p = src[j % M]->loc;
+			p.x += 200*(erand48(xsubi) - 0.5);
+			p.y += 200*(erand48(xsubi) - 0.5);
+			f[j] = new BenchFish(p, 0.5 + 5*erand48(xsubi));
+			StandinRegister(f[j]);
+			snprintf(name, sizeof(name), "par%d.%d", r, j);
+			taxa[j] = (char *)SINK_TAXON;
+			names[j] = Strdup(name);
+		}
+		if (Contamination::InitMany((Contamination **)f, n, taxa, names) != n)
+			fatal(1, "Not every sink initialised on %d threads", threads[r]);
+		for (int j = 0; j < n; j++) Free(names[j]);
+		for (int j = 0; j < n; j++) g[j] = f[(j%2)?(n+j)/2:j/2];
+
+		Standin.deaths_logged = 0;
+		double t = 0, lost = 0;
+		for (int k = 0; k < ticks; k++, t += DT) {
+			for (int j = 0; j < n; j++) dts[j] = g[j]->Intoxicate(t, DT);
+			lost += Contamination::CommitIntoxicateMany((Contamination **)g, n, t, DT, dts);
+		}
+		VERBOSE("contcheck", "%ld moved between nodes on %d threads", ContaminantNuma::Moved() - moved, threads[r]);
+
+		for (int j = 0; j < n; j++) {
+			double *v = first + j*(K+1);
+			if (!r) {
+				for (int c = 0; c < K; c++) v[c] = f[j]->Load(c);
+				v[K] = f[j]->Members();
+				trail[j] = f[j]->trail;
+				continue;
+			}
+			for (int c = 0; c < K; c++) {
+				if (f[j]->Load(c) != v[c])
+					fatal(1, "Sink %d: load %.17g on one thread, %.17g on %d", j, v[c], f[j]->Load(c), threads[r]);
+			}
+			if (f[j]->Members() != v[K])
+				fatal(1, "Sink %d: %.17g members on one thread, %.17g on %d", j, v[K], f[j]->Members(), threads[r]);
+			if (f[j]->trail != trail[j])
+				fatal(1, "Sink %d: the death log on %d threads isn't the one on one", j, threads[r]);
+		}
+		if (!r) lost0 = lost;
+		else if (lost != lost0) fatal(1, "%.17g lost on one thread, %.17g on %d", lost0, lost, threads[r]);
+		if (!r && !(lost > 0)) fatal(1, "Nobody died; the parallel check needs a scenario with some deaths");
+	}
+	Free(f);
+	Free(g);
+	Free(dts);
+	Free(first);
+	Free(trail);
+	Free(taxa);
+	Free(names);
+}
+
+/*--- check_batch(int n, int ticks) -- migrated agents had better carry on as they were */
+static void check_batch(int n, int ticks) {
+	BenchFish **a = (BenchFish **)Calloc(n, sizeof(BenchFish *)), **b = (BenchFish **)Calloc(n, sizeof(BenchFish *));
+	char **taxa = (char **)Calloc(n, sizeof(char *)), **names = (char **)Calloc(n, sizeof(char *));
+	int *prog = (int *)Calloc(n, sizeof(int));
+	unsigned short xsubi[3] = { 4, 5, 6 };
+	int j, k, len;
+	double t = 0;
+	if (!a || !b || !taxa || !names || !prog) abort();
+
+	ContaminantParallel::Start(4);
+	for (j = 0; j < n; j++) {
+		char name[32];
+		R3 p = src[j % M]->loc;
+		p.x += 200*(erand48(xsubi) - 0.5);
+		p.y += 200*(erand48(xsubi) - 0.5);
+		a[j] = new BenchFish(p, 0.5 + 5*erand48(xsubi));
+		StandinRegister(a[j]);
+		snprintf(name, sizeof(name), "batch%d", j);
+		taxa[j] = (char *)SINK_TAXON;
+		names[j] = Strdup(name);
+	}
+	if (Contamination::InitMany((Contamination **)a, n, taxa, names) != n) fatal(1, "Not every sink initialised");
+	for (j = 0; j < n; j++) Free(names[j]);
+	for (k = 0; k < ticks; k++, t += DT) {
+		for (j = 0; j < n; j++) a[j]->Tick(t, DT);
+	}
+
+	for (j = 0; j < n; j++) prog[j] = a[j]->Program(0);
+	for (k = 0; k < 2; k++) {
+		if (Contamination::ReInitBatch((Contamination **)a, n) != n) fatal(1, "Not every sink reattached");
+	}
+	for (j = 0; j < n; j++) {
+		if (a[j]->Program(0) != prog[j])
+			fatal(1, "Sink %d: update program %d, %d after reattaching", j, prog[j], a[j]->Program(0));
+	}
+
+	void *d = Contamination::GetBatchState((Contamination **)a, n, &len);
+	for (j = 0; j < n; j++) {
+		b[j] = new BenchFish(a[j]->loc, a[j]->imass);
+		b[j]->members = a[j]->members;
+		StandinRegister(b[j]);
+	}
+	if (Contamination::SetBatchState((Contamination **)b, n, d, len) != n) fatal(1, "Not every sink moved");
+	Free(d);
+
+	for (k = 0; k < ticks; k++, t += DT) {
+		for (j = 0; j < n; j++) a[j]->Tick(t, DT), b[j]->Tick(t, DT);
+	}
+	for (j = 0; j < n; j++) {
+		for (int c = 0; c < K; c++) {
+			if (a[j]->Load(c) != b[j]->Load(c))
+				fatal(1, "Sink %d: load %.17g, %.17g after moving", j, a[j]->Load(c), b[j]->Load(c));
+		}
+		if (a[j]->Members() != b[j]->Members())
+			fatal(1, "Sink %d: %.17g members, %.17g after moving", j, a[j]->Members(), b[j]->Members());
+	}
+	Free(a);
+	Free(b);
+	Free(taxa);
+	Free(names);
+	Free(prog);
+}
+
+/*--- halo_resolve(int xid, int cls) -- a source is ours if it's in our region now */
+static void *halo_resolve(int xid, int cls) {
+	for (int j = 0; j < M; j++) {
+		if (src[j]->kid == xid)
+			return (ContaminantHalo::RegionOf(src[j]->loc) == ContaminantHalo::Region())?src[j]:0;
+	}
+	return 0;
+}
+
+/*--- halo_copy(char *taxon) -- */
+static ContaminantSource *halo_copy(char *taxon) {
+	R3 p = { 0, 0, 0 };
+	BenchSource *s = new BenchSource(p, 0);
+	if (!s->Init(taxon)) fatal(1, "A halo copy of a %s didn't initialise", taxon);
+	return s;
+}
+
+/*--- wander(int k) -- the sources' tick k: half drift east (round to the west side), a third get stronger */
+static void wander(int k) {
+	for (int j = 0; j < M; j++) {
+		if (j%3 == k%3) src[j]->amp *= 1.1;
+		if (j%2 && (src[j]->loc.x += 60) > BOX) src[j]->loc.x -= BOX;
+	}
+}
+
+/*--- halo_ticks(BenchFish **f, int n, int ticks) -- our region's sinks, or all of them if we're not split */
+static void halo_ticks(BenchFish **f, int n, int ticks) {
+	int region = ContaminantHalo::Region();
+	double t = 0;
+
+	for (int k = 0; k < ticks; k++, t += DT) {
+		wander(k);
+		if (region >= 0) {
+			for (int j = 0; j < M; j++) {
+				if (ContaminantHalo::RegionOf(src[j]->loc) == region) ContaminantHalo::Publish(src[j]->kid, src[j]);
+				else ContaminantHalo::Withdraw(src[j]->kid);
+			}
+			ContaminantHalo::Sync();
+		}
+		for (int i = 0; i < n; i++) {
+			if (region < 0 || ContaminantHalo::RegionOf(f[i]->loc) == region) f[i]->Tick(t, DT);
+		}
+	}
+}
+
+/*--- check_halo(int n, int ticks) -- four kernels, a quarter each, had better get what one does */
+// The split is done first, while this is the only thread; the other
+// three kernels are forked from here and write their sinks' results
+// into a shared block, along with how many foreign KGETs they made.
+// They wait on a pipe until region 0 has made the rings.
+static void check_halo(int n, int ticks) {
+	const int nx = 2, ny = 2;
+	R3 lo = { 0, 0, 0 }, hi = { BOX, BOX, 0 };
+	BenchFish **f = (BenchFish **)Calloc(2*n, sizeof(BenchFish *));
+	R3 *loc = (R3 *)Calloc(M?M:1, sizeof(R3));
+	double *amp = (double *)Calloc(M?M:1, sizeof(double));
+	int sz = (n*(K+1) + 2*nx*ny)*sizeof(double);
+	double *got = (double *)mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	double *tally = got + n*(K+1);  // foreign KGETs and copies sent, by region
+	char base[64], go;
+	pid_t pid[nx*ny];
+	int ready[2];
+	unsigned short xsubi[3] = { 4, 5, 6 };
+	if (!f || !loc || !amp || got == MAP_FAILED || pipe(ready) < 0) abort();
+
+	for (int j = 0; j < M; j++) {
+		loc[j] = src[j]->loc;
+		amp[j] = src[j]->amp;
+	}
+	for (int i = 0; i < 2*n; i++) {
+		char name[32];
+		R3 p;
+		if (i < n) {
+			p.x = BOX*erand48(xsubi);
+			p.y = BOX*erand48(xsubi);
+			p.z = 0;
+		}
+		else p = f[i-n]->loc;
+		f[i] = new BenchFish(p, (i < n)?0.5 + 5*erand48(xsubi):f[i-n]->imass);
+		StandinRegister(f[i]);
+		snprintf(name, sizeof(name), "halo%d", i);
+		if (!f[i]->Init((char *)SINK_TAXON, name)) fatal(1, "Sink %s didn't initialise", name);
+	}
+
+	snprintf(base, sizeof(base), "/contbench.%d", (int)getpid());
+	ContaminantHalo::SetResolver(halo_resolve, halo_copy);
+	fflush(stdout);
+	fflush(stderr);
+	int r;
+	for (r = 1; r < nx*ny; r++) {
+		if ((pid[r] = fork()) < 0) fatal(1, "Unable to fork region %d", r);
+		if (!pid[r]) break;
+	}
+	if (r == nx*ny) r = 0;
+	if (r && read(ready[0], &go, 1) != 1) _exit(1);
+	if (!ContaminantHalo::Join(base, r, nx, ny, lo, hi, 1 << 16)) {
+		if (r) _exit(1);
+		fatal(1, "Unable to split the box");
+	}
+	if (!r && write(ready[1], "xxx", nx*ny-1) != nx*ny-1) abort();
+	close(ready[0]);
+	close(ready[1]);
+
+	int region = ContaminantHalo::Region();
+	BenchSource::foreign = 0;
+	halo_ticks(f, n, ticks);
+	for (int i = 0; i < n; i++) {
+		if (ContaminantHalo::RegionOf(f[i]->loc) != region) continue;
+		for (int c = 0; c < K; c++) got[i*(K+1) + c] = f[i]->Load(c);
+		got[i*(K+1) + K] = f[i]->Members();
+	}
+	tally[2*region] = BenchSource::foreign;
+	tally[2*region + 1] = ContaminantHalo::Updates();
+	if (region) _exit(0);
+
+	for (int r = 1; r < nx*ny; r++) {
+		int status;
+		if (waitpid(pid[r], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+			fatal(1, "Region %d's kernel didn't finish", r);
+	}
+	ContaminantHalo::Leave();
+	ContaminantHalo::SetResolver(0, 0);
+
+	for (int j = 0; j < M; j++) {
+		src[j]->loc = loc[j];
+		src[j]->amp = amp[j];
+	}
+	halo_ticks(f + n, n, ticks);
+
+	double any = 0, copies = 0;
+	for (int r = 0; r < nx*ny; r++) {
+		if (tally[2*r]) fatal(1, "Region %d's kernel made %g KGETs of other regions' sources", r, tally[2*r]);
+		copies += tally[2*r + 1];
+	}
+	if (!(copies > 0)) fatal(1, "No halo copies were sent");
+	for (int i = 0; i < n; i++) {
+		double *v = got + i*(K+1);
+		for (int c = 0; c < K; c++) {
+			if (f[n+i]->Load(c) != v[c])
+				fatal(1, "Sink %d: load %.17g in one kernel, %.17g split", i, f[n+i]->Load(c), v[c]);
+			any += v[c];
+		}
+		if (f[n+i]->Members() != v[K])
+			fatal(1, "Sink %d: %.17g members in one kernel, %.17g split", i, f[n+i]->Members(), v[K]);
+	}
+	if (!(any > 0)) fatal(1, "Nothing was taken up; the halo check needs a scenario with some exposure");
+
+	for (int j = 0; j < M; j++) {
+		src[j]->loc = loc[j];
+		src[j]->amp = amp[j];
+	}
+	munmap(got, sz);
+	Free(f);
+	Free(loc);
+	Free(amp);
+}
+
+#define CACHE_TAXON "cachefish"
+#define CACHE_TICK CACHE_TAXON "/ContaminantSink/contaminants/c0/contaminant_tick"
+
+/*--- cache_fish(char *name, int ticks) -- a sink of the new taxon, ticked */
+static BenchFish *cache_fish(char *name, int ticks) {
+	BenchFish *f = new BenchFish(src[0]->loc, 2);
+	f->members = 1e9;  // so that the smallest difference in survival shows
+	StandinRegister(f);
+	if (!f->Init((char *)CACHE_TAXON, name)) _exit(1);
+	double t = 0;
+	for (int k = 0; k < ticks; k++) {
+		double h = f->Intoxicate(t, 3*DT);  // as long as contaminant_tick allows
+		f->Expose(1);
+		f->Commit(t, h);
+		t += h;
+	}
+	return f;
+}
+
+/*--- cache_run(const char *file, int ticks, double *got, const char *reload) -- a kernel of its own, a child, ticks a sink of a new taxon */
+// got gets its loads, its members and the setups it found in the cache.
+// With reload, c0's contaminant_tick is then changed to that, the parameters
+// are reloaded (ContaminantTaxon::Flush, with the cache found through
+// $CONT_SETUP_CACHE after that) and a second sink takes the first's
+// place in got, with the setups found since the reload.  The first sink is
+// held through the reload, and its setups must still have their programs.
+static void cache_run(const char *file, int ticks, double *got, const char *reload) {
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	int status;
+	if (pid < 0) fatal(1, "Unable to fork for the setup cache");
+	if (!pid) {
+		unsigned long before = ContaminantSetupCache::Hits();  // ours, if we've looked
+		if (!ContaminantSetupCache::Open((char *)file, ContaminantSetupCache::Key())) _exit(1);
+		BenchFish *f = cache_fish((char *)"cached", ticks);
+		if (reload) {
+			before = ContaminantSetupCache::Hits();
+			StandinParam(CACHE_TICK, reload);
+			if (!StandinParamWrite(getenv("CONT_PARAM_FILES"))) _exit(1);
+			setenv("CONT_SETUP_CACHE", file, 1);
+			ContaminantTaxon::Flush();
+			BenchFish *held = f;
+			f = cache_fish((char *)"reloaded", ticks);
+			for (int c = 0; c < K; c++) {
+				if (strcmp(held->UpdateText(c), f->UpdateText(c))) _exit(1);
+			}
+		}
+		for (int c = 0; c < K; c++) got[c] = f->Load(c);
+		got[K] = f->Members();
+		got[K+1] = ContaminantSetupCache::Hits() - before;
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		fatal(1, "A setup cache run didn't finish");
+}
+
+/*--- same_run(double *a, double *b, const char *what) -- */
+static void same_run(double *a, double *b, const char *what) {
+	for (int c = 0; c <= K; c++) {
+		if (a[c] != b[c])
+			fatal(1, "%s %d: %.17g set up from the parameters, %.17g %s", (c < K)?"Load":"Members", c, a[c], b[c], what);
+	}
+}
+
+/*--- check_setup_cache(int ticks) -- a setup from the cache had better be the setup */
+// The new taxon's setups have tabulated surfaces.  The parameter "file"
+// is the stand-in's table, written out.  Each run is a kernel of its own:
+//   A  fills the cache;
+//   B  takes everything from it;
+//   C  takes everything from it, then has contaminant_tick changed and the
+//      parameters reloaded, which mustn't find anything, and starts the
+//      file again while we (standing for another kernel) have the old
+//      one mapped;
+//   D  has the changed contaminant_tick from the start and finds what C put
+//      in after its reload;
+//   E  has the first contaminant_tick back, and so mustn't find anything.
+static void check_setup_cache(int ticks) {
+	enum { A, B, C, D, E, RUNS };
+	char file[64], params[64];
+	struct stat st;
+	ContaminantSetupCache::Entry ce;
+	int sz = RUNS*(K+2)*sizeof(double);
+	double *got = (double *)mmap(0, sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (got == MAP_FAILED) abort();
+#define RUN(r) (got + (r)*(K+2))
+
+	for (int k = 0; k < K; k++) {
+		const char *c = CACHE_TAXON "/ContaminantSink/contaminants/c%d/";
+		char f[256];
+#define P(key, value) (snprintf(f, sizeof(f), "%s%s", c, key), param(value, f, k))
+		P("contaminant_tick", "1200[s]");
+		P("load_update", "ate * organic_uptake + volume * ode(dC/dt = exposure_rate  / volume - decay_rate * C(t), C(0) = current_load/volume, t/20, t)");
+		P("acute_lethal", "40% 120[mg/l] @ 48[hours], 75% 150[mg/l] @ 92[hours]");
+		P("chronic_lethal", "20% 60[ug/l] @ 200[hours], 50% 122[ug/l] @ 400[hours]");
+		P("const/decay_rate", "0.03");
+		P("const/organic_uptake", "0.95");
+		P("lc_table/acute_min", "0.1");
+		P("lc_table/acute_max", "100");
+		P("lc_table/chronic_min", "1e-6");
+		P("lc_table/chronic_max", "1e3");
+		P("lc_table/dt_max", "3600");
+		P("lc_table/tolerance", "1e-2");
+#undef P
+	}
+	snprintf(file, sizeof(file), "/tmp/contbench.%d.setup", (int)getpid());
+	snprintf(params, sizeof(params), "/tmp/contbench.%d.params", (int)getpid());
+	unlink(file);
+	if (!StandinParamWrite(params)) fatal(1, "Unable to write %s", params);
+	setenv("CONT_PARAM_FILES", params, 1);
+
+	cache_run(file, ticks, RUN(A), 0);
+	if (stat(file, &st) < 0 || st.st_size < (off_t)(K*2*17*17*sizeof(double)))
+		fatal(1, "The setup cache doesn't have the tables in it");
+	cache_run(file, ticks, RUN(B), 0);
+
+	if (!ContaminantSetupCache::Open(file, ContaminantSetupCache::Key())) fatal(1, "Unable to open the setup cache %s", file);
+	cache_run(file, ticks, RUN(C), "900[s]");
+	if (!ContaminantSetupCache::Find((char *)CACHE_TAXON, (char *)"c0", &ce) || ce.cont_tick != 1200)
+		fatal(1, "The setup cache we had open wasn't left alone when it was started again");
+	ContaminantSetupCache::Close();
+
+	StandinParam(CACHE_TICK, "900[s]");
+	if (!StandinParamWrite(params)) fatal(1, "Unable to write %s", params);
+	cache_run(file, ticks, RUN(D), 0);
+	StandinParam(CACHE_TICK, "1200[s]");
+	if (!StandinParamWrite(params)) fatal(1, "Unable to write %s", params);
+	cache_run(file, ticks, RUN(E), 0);
+
+	if (RUN(A)[K+1] != 0) fatal(1, "The first run found %g setups in an empty cache", RUN(A)[K+1]);
+	if (RUN(B)[K+1] != K) fatal(1, "The second run found %g of %d setups in the cache", RUN(B)[K+1], K);
+	if (RUN(C)[K+1] != 0) fatal(1, "The cache was used after the parameters were changed and reloaded");
+	if (RUN(D)[K+1] != K) fatal(1, "A run found %g of the %d setups made after a reload", RUN(D)[K+1], K);
+	if (RUN(E)[K+1] != 0) fatal(1, "The cache was used after a parameter changed");
+	same_run(RUN(A), RUN(B), "from the cache");
+	same_run(RUN(C), RUN(D), "from the cache after a reload");
+	same_run(RUN(A), RUN(E), "after the cache was started again");
+	if (RUN(C)[0] == RUN(A)[0]) fatal(1, "Changing contaminant_tick made no difference; the reload can't be told apart");
+	if (!(RUN(A)[0] > 0 && RUN(A)[K] > 0 && RUN(A)[K] < 1e9)) fatal(1, "The setup cache check needs some uptake and some deaths");
+#undef RUN
+
+	unsetenv("CONT_PARAM_FILES");
+	unlink(file);
+	unlink(params);
+	munmap(got, sz);
+}
+
+/*--- check_ingest(int meals) -- feeding from several threads had better not change what's eaten */
+// Meal m is m+1 grams of a prey with 1 + m%7 grams of each contaminant
+// per gram (scaled by the proportion eaten, 1/(m+1)).
+typedef struct {
+	BenchFish *f;
+	ContaminantProfileView *v;
+	int meals, from, step, posted;
+} Feeder;
+
+static void *feed(void *arg) {
+	Feeder *fd = (Feeder *)arg;
+	for (int m = fd->from; m >= 0 && m < fd->meals; m += fd->step)
+		fd->posted += fd->f->Eat(fd->v + m%7, 1.0/(m+1), 0);
+	return 0;
+}
+
+static void check_ingest(int meals) {
+	ContaminantProfile *p[7];
+	ContaminantProfileView v[7];
+	Feeder fd[5];
+	pthread_t th[4];
+	R3 loc = src[0]->loc;
+	BenchFish *f[2];
+
+	for (int j = 0; j < 7; j++) {
+		p[j] = new ContaminantProfile();
+		for (int c = 0; c < K; c++) {
+			char name[32];
+			snprintf(name, sizeof(name), "c%d", c);
+			p[j]->AddContaminant(name, 1 + j);
+		}
+		v[j].Borrow(p[j]);
+	}
+	for (int i = 0; i < 2; i++) {
+		char name[32];
+		f[i] = new BenchFish(loc, 2);
+		StandinRegister(f[i]);
+		snprintf(name, sizeof(name), "eater%d", i);
+		if (!f[i]->Init((char *)SINK_TAXON, name)) fatal(1, "Sink %s didn't initialise", name);
+	}
+
+	for (int i = 0; i < 5; i++) {
+		fd[i].f = f[i == 4];
+		fd[i].v = v;
+		fd[i].meals = meals;
+		fd[i].from = (i < 4)?i:meals-1;
+		fd[i].step = (i < 4)?4:-1;
+		fd[i].posted = 0;
+	}
+	for (int i = 0; i < 4; i++) {
+		if (pthread_create(&th[i], 0, feed, fd + i)) fatal(1, "Unable to start feeder %d", i);
+	}
+	feed(fd + 4);
+	for (int i = 0; i < 4; i++) pthread_join(th[i], 0);
+
+	int posted = fd[0].posted + fd[1].posted + fd[2].posted + fd[3].posted;
+	if (posted != fd[4].posted || posted != meals*K)
+		fatal(1, "%d meals' contaminants taken from four threads, %d from one (%d in all)", posted, fd[4].posted, meals*K);
+	for (int i = 0; i < 2; i++) {
+		f[i]->Expose(0);
+		f[i]->Commit(0, DT);
+	}
+	for (int c = 0; c < K; c++) {
+		if (f[0]->Load(c) != f[1]->Load(c))
+			fatal(1, "Load %.17g fed from four threads, %.17g from one", f[0]->Load(c), f[1]->Load(c));
+		if (!(f[0]->Load(c) > 0)) fatal(1, "Nothing eaten was taken up");
+	}
+	for (int j = 0; j < 7; j++) {
+		v[j].Release();
+		delete p[j];
+	}
+}
+
+/*--- same_queries(int n, ContaminantSink **s, double *dts, double *conc) -- one tick of the first n sinks, three ways */
+static void same_queries(int n, ContaminantSink **s, double *dts, double *conc) {
+	for (int i = 0; i < n; i++) {
+		fish[i]->Expose(0);
+		dts[n+i] = fish[i]->Reference(0, DT);
+		for (int c = 0; c < K; c++) conc[i*K + c] = fish[i]->Conc(c);
+		fish[i]->Expose(0);
+		double dt = fish[i]->Intoxicate(0, DT);
+		if (dt != dts[n+i]) fatal(1, "Sink %d: dt %g asking everything, %g by kind", i, dts[n+i], dt);
+		for (int c = 0; c < K; c++) {
+			if (fish[i]->Conc(c) != conc[i*K + c])
+				fatal(1, "Sink %d: conc %g asking everything, %g by kind", i, conc[i*K + c], fish[i]->Conc(c));
+		}
+		fish[i]->Expose(0);
+		s[i] = fish[i];
+	}
+	ContaminantSink::IntoxicateMany(s, n, 0, DT, dts);
+	for (int i = 0; i < n; i++) {
+		if (dts[i] != dts[n+i]) fatal(1, "Sink %d: dt %g one at a time, %g batched", i, dts[n+i], dts[i]);
+		for (int c = 0; c < K; c++) {
+			if (fish[i]->Conc(c) != conc[i*K + c])
+				fatal(1, "Sink %d: conc %g one at a time, %g batched", i, conc[i*K + c], fish[i]->Conc(c));
+		}
+		fish[i]->Expose(0);
+	}
+}
+
+/*--- check_queries(int n) -- the batched queries had better find what one at a time does, */
+// and that what asking every source about every contaminant does.  Once
+// the sinks have met their sources they don't ask for their lists again,
+// until one changes: source 0 then gives off all but one of ours, and
+// something nobody cares about, in more ways than a taxon keeps.
+static void check_queries(int n) {
+	ContaminantSink **s = (ContaminantSink **)Calloc(n, sizeof(ContaminantSink *));
+	double *dts = (double *)Calloc(2*n, sizeof(double));
+	double *conc = (double *)Calloc(n*K, sizeof(double));
+	if (!s || !dts || !conc) abort();
+
+	if (n > N) n = N;
+	same_queries(n, s, dts, conc);
+	long ids = BenchSource::ids;
+	for (int i = 0; i < n; i++) {
+		fish[i]->Intoxicate(0, DT);
+		fish[i]->Expose(0);
+	}
+	ContaminantSink::IntoxicateMany(s, n, 0, DT, dts);
+	for (int i = 0; i < n; i++) fish[i]->Expose(0);
+	if (BenchSource::ids != ids) fatal(1, "The sinks asked for %ld source lists they already had", BenchSource::ids - ids);
+
+	for (int v = 0; v < 80; v++) {
+		char name[32];
+		ContaminantList *l = src[0]->List();
+		l->ClearSources();
+		for (int c = 0; c < K; c++) {
+			snprintf(name, sizeof(name), "c%d", c);
+			if (c != v%K) l->RegisterAsContaminantSource(name);
+		}
+		snprintf(name, sizeof(name), "nobody%d", v);
+		l->RegisterAsContaminantSource(name);
+		same_queries(n, s, dts, conc);
+	}
+	if (!src[0]->Init((char *)SOURCE_TAXON)) fatal(1, "Source 0 didn't initialise again");
+	same_queries(n, s, dts, conc);
+	Free(s);
+	Free(dts);
+	Free(conc);
+}
+
+/*--- check_ensemble() -- member 1 changes nothing, so it had better match the agent */
+static void check_ensemble() {
+	if (E < 2) return;
+	for (int j = 0; j < G; j++) {
+		BenchFish *a = (BenchFish *)pop[0][j];
+		if (a->EnsembleMembers() != E) fatal(1, "Cohort %d has %d ensemble members, not %d", j, a->EnsembleMembers(), E);
+		for (int c = 0; c < K; c++) {
+			char name[16];
+			snprintf(name, sizeof(name), "c%d", c);
+			if (a->EnsembleLevel(name, 1) != a->Load(c))
+				fatal(1, "Cohort %d: load %g, ensemble member 1 %g", j, a->Load(c), a->EnsembleLevel(name, 1));
+		}
+		if (fabs(a->EnsembleSurvivors(1) - a->Members()) > 1e-9*a->Members())
+			fatal(1, "Cohort %d: %g members, ensemble member 1 %g", j, a->Members(), a->EnsembleSurvivors(1));
+	}
+}
+
+
+/*--- check_handles() -- a handle had better remember until it's told to forget */
+static void check_handles() {
+	const char *path = "handlefish/ContaminantSink/contaminants/c0/contaminant_tick";
+	StandinParam(path, "600[s]");
+	ParamHandle *h = ParamHandle::Resolve(PARAM_REQ, (char *)"handlefish", (char *)"ContaminantSink", (char *)"contaminants", (char *)"c0", (char *)"contaminant_tick", (char *)0);
+	if (h->N() != 600) fatal(1, "The handle found %g, not 600", h->N());
+	StandinParam(path, "900[s]");
+	if (h->N() != 600) fatal(1, "The handle walked the tree again");
+	ParamHandle::Forget();
+	if (h->N() != 900) fatal(1, "The handle still has %g after a reload, not 900", h->N());
+}
+
+/*--- check_corpus() -- a compiled corpus had better be the parameters, and only while it's up to date */
+static void check_corpus() {
+	char corpus[64], params[64], cmd[1024];
+	const char *c0 = SINK_TAXON "/ContaminantSink/contaminants/c0/const/decay_rate";
+	char *keys[6] = { (char *)SINK_TAXON, (char *)"ContaminantSink", (char *)"contaminants", (char *)"c0", 0, 0 };
+
+	snprintf(corpus, sizeof(corpus), "/tmp/contbench.%d.pc", (int)getpid());
+	snprintf(params, sizeof(params), "/tmp/contbench.%d.prm", (int)getpid());
+	if (!StandinParamWrite(params)) fatal(1, "Unable to write %s", params);
+	snprintf(cmd, sizeof(cmd), "STANDIN_PARAMS=%s %s/paramcc -o %s -p %s %s:ContaminantSink >/dev/null",
+		params, tools, corpus, params, SINK_TAXON);
+	if (system(cmd)) fatal(1, "paramcc failed: %s", cmd);
+
+	if (!ParamCorpus::Open(corpus)) fatal(1, "The corpus paramcc made wasn't taken");
+	char *prog = CPGetS(PARAM_OPT, SINK_TAXON, "ContaminantSink", "contaminants", "c0", "load_update", (char *)0);
+	char *tree = PGetS(PARAM_OPT, SINK_TAXON, "ContaminantSink", "contaminants", "c0", "load_update", (char *)0);
+	if (!ParamCorpus::Find(keys, 4) || !prog || !tree || strcmp(prog, tree)) fatal(1, "The corpus's load_update isn't the tree's");
+	if (CPGetN(PARAM_OPT, SINK_TAXON, "ContaminantSink", "contaminants", "c0", "const", "decay_rate", (char *)0) != 0.03)
+		fatal(1, "The corpus's decay_rate isn't 0.03");
+	keys[4] = (char *)"no_such_thing";
+	if (ParamCorpus::Find(keys, 5) || !ParamCorpus::Absent(keys, 5)) fatal(1, "The corpus has a parameter nobody set");
+
+	if (!StandinParamWrite(params) || !ParamCorpus::Open(corpus)) fatal(1, "The corpus was refused after its parameters were written out again unchanged");
+	if (!ParamCorpus::Recheck()) fatal(1, "The corpus was dropped with its parameters unchanged");
+	StandinParam(c0, "0.031");
+	if (!StandinParamWrite(params)) fatal(1, "Unable to write %s", params);
+	StandinParam(c0, "0.03");
+	if (ParamCorpus::Recheck() || ParamCorpus::Loaded()) fatal(1, "The corpus was kept after its parameters changed");
+	if (ParamCorpus::Open(corpus)) fatal(1, "The corpus was taken after its parameters changed");
+
+	ParamCorpus::Close();
+	unlink(corpus);
+	unlink(params);
+}
+
+#define EXPRC_TAXON "exprcfish"
+
+/*--- exprc_constants(const char *c) -- how many constants c's load_update binds; -1 if it stays with the evaluator */
+static int exprc_constants(const char *c) {
+	char *keys[4] = { (char *)EXPRC_TAXON, (char *)"ContaminantSink", (char *)"contaminants", (char *)c };
+	char *expr = PGetS(PARAM_OPT, EXPRC_TAXON, "ContaminantSink", "contaminants", c, "load_update", (char *)0);
+	char **names;
+	int nn;
+
+	if (!expr) fatal(1, "%s has no load_update", c);
+	ContaminantNative::Defs *defs = ContaminantNative::LoadDefs(keys, 4);
+	char *text = ContaminantNative::Translate(expr, defs, &names, &nn);
+	ContaminantNative::FreeDefs(defs);
+	if (!text) return -1;
+	for (int i = 0; i < nn; i++) Free(names[i]);
+	if (names) Free(names);
+	Free(text);
+	return nn;
+}
+
+/*--- exprc_compare(const char *c) -- c's compiled load_update against the evaluator; 0 if it isn't compiled */
+static int exprc_compare(const char *c) {
+	static const char *inputs[] = { "t", "dt", "conc", "imass", "ate", "current_load" };
+	char *keys[4] = { (char *)EXPRC_TAXON, (char *)"ContaminantSink", (char *)"contaminants", (char *)c };
+	char *expr = PGetS(PARAM_OPT, EXPRC_TAXON, "ContaminantSink", "contaminants", c, "load_update", (char *)0);
+	CCalc::CalcVar *in[6];
+
+	ContaminantNative::Defs *defs = ContaminantNative::LoadDefs(keys, 4);
+	ContaminantNativeProg *p = ContaminantNative::Bind(expr, keys, 4, defs);
+	if (!p) {
+		ContaminantNative::FreeDefs(defs);
+		return 0;
+	}
+
+	RCCalc cc;
+	int id = cc.AddProgram(expr);
+	for (int i = 0; i < 6; i++) in[i] = cc.GetVarRef2(inputs[i]);
+	for (int i = 0; i < defs->nconst; i++) {
+		CCalc::CalcVar *k = cc.GetVarRef2(defs->cname[i]);
+		cc.SetVarRef2(k, PGetN(PARAM_REQ, EXPRC_TAXON, "ContaminantSink", "contaminants", c, "const", defs->cname[i], (char *)0));
+		CCalc::FreeCalcVar(k);
+	}
+
+	for (int s = 0; s < 16; s++) {
+		ContaminantNativeArgs a;
+		a.t = 3600.0*s;
+		a.dt = 600.0*(1 + s%4);
+		a.conc = 0.07*s;
+		a.imass = 1 + 0.5*s;
+		a.ate = 0.25*(s%5);
+		a.current_load = 0.2*s;
+		double v[6] = { a.t, a.dt, a.conc, a.imass, a.ate, a.current_load };
+		for (int i = 0; i < 6; i++) cc.SetVarRef2(in[i], v[i]);
+
+		double x = ContaminantNative::Run(p, &a), y = cc.Calculate(id);
+		if (!(fabs(x - y) <= 1e-12*fmax(1.0, fabs(y))))
+			fatal(1, "%s's compiled load_update gives %g, and the evaluator %g (conc %g, current_load %g)",
+				c, x, y, a.conc, a.current_load);
+	}
+
+	for (int i = 0; i < 6; i++) CCalc::FreeCalcVar(in[i]);
+	ContaminantNative::Unbind(p);
+	ContaminantNative::FreeDefs(defs);
+	return 1;
+}
+
+/*--- check_exprc() -- a bare name is a constant only if it's declared one; the compiled programs are the evaluator's */
+static void check_exprc() {
+	char params[64], out[64], so[64], cmd[1024], line[256];
+
+	StandinParam(EXPRC_TAXON "/ContaminantSink/contaminants/a/load_update", "decay_rate * conc + 2[mg/l]");
+	StandinParam(EXPRC_TAXON "/ContaminantSink/contaminants/a/const/decay_rate", "0.5");
+	StandinParam(EXPRC_TAXON "/ContaminantSink/contaminants/b/load_update", "kg * conc");
+	StandinParam(EXPRC_TAXON "/ContaminantSink/contaminants/c/load_update", "kg * conc");
+	StandinParam(EXPRC_TAXON "/ContaminantSink/contaminants/c/const/kg", "1");
+	StandinParam(EXPRC_TAXON "/ContaminantSink/contaminants/d/load_update",
+		"current_load > 1 && conc < 0.5 ? exp(-decay_rate * dt / 3600) * current_load : sqrt(conc) ^ 2 + abs(ate - 1[mg/l]) / 2 - -imass");
+	StandinParam(EXPRC_TAXON "/ContaminantSink/contaminants/d/const/decay_rate", "0.03");
+	if (exprc_constants("a") != 2) fatal(1, "a's program doesn't bind its declared constant and its number with units");
+	if (exprc_constants("b") != -1) fatal(1, "b's program took the undeclared unit kg as a constant");
+	if (exprc_constants("c") != 1) fatal(1, "c's program didn't take kg, declared under const, as a constant");
+
+	snprintf(params, sizeof(params), "/tmp/contbench.%d.prm", (int)getpid());
+	snprintf(out, sizeof(out), "/tmp/contbench.%d.cxx", (int)getpid());
+	if (!StandinParamWrite(params)) fatal(1, "Unable to write %s", params);
+	snprintf(cmd, sizeof(cmd), "STANDIN_PARAMS=%s %s/contexprc -o %s %s 2>/dev/null", params, tools, out, EXPRC_TAXON);
+	FILE *f = popen(cmd, "r");
+	if (!f) fatal(1, "Unable to run %s", cmd);
+	int n = -1;
+	while (fgets(line, sizeof(line), f)) {
+		char *s = strstr(line, ": ");
+		if (s) sscanf(s, ": %d functions", &n);
+	}
+	if (pclose(f)) fatal(1, "contexprc failed: %s", cmd);
+	if (n != 3) fatal(1, "contexprc wrote %d functions, not a's, c's and d's", n);
+
+	// the functions register themselves as the library is loaded
+	snprintf(so, sizeof(so), "/tmp/contbench.%d.so", (int)getpid());
+	snprintf(cmd, sizeof(cmd), "%s -o %s %s", CONTCHECK_SHARED, so, out);
+	if (system(cmd)) fatal(1, "Unable to compile what contexprc wrote: %s", cmd);
+	if (!dlopen(so, RTLD_NOW)) fatal(1, "Unable to load %s: %s", so, dlerror());
+	int compared = 0;
+	const char *cs[] = { "a", "b", "c", "d" };
+	for (int i = 0; i < 4; i++) compared += exprc_compare(cs[i]);
+	if (compared != n) fatal(1, "Only %d of the %d functions contexprc wrote were taken", compared, n);
+
+	unlink(so);
+	unlink(out);
+	unlink(params);
+}
+
+#define ONSET_TAXON "onsetfish"
+#define ONSET_TOLERANCE 0.05
+#define ONSET_COARSE 0.002         // a tolerance six hour steps are well outside
+#define ONSET_MIN 60.0
+
+/*--- onset_fish(const char *taxon, const char *name, const char *tick, const char *tolerance, BenchSource *s) -- a sink sensitive to c0 only, downstream of s */
+// With a tolerance it has an adaptive step.
+static BenchFish *onset_fish(const char *taxon, const char *name, const char *tick, const char *tolerance, BenchSource *s) {
+	char c[256], f[512], v[32];
+	snprintf(c, sizeof(c), "%s/ContaminantSink/contaminants/c%%d/", taxon);
+#define P(key, value) (snprintf(f, sizeof(f), "%s%s", c, key), param(value, f, 0))
+	P("contaminant_tick", tick);
+	P("load_update", "ate * organic_uptake + volume * ode(dC/dt = exposure_rate  / volume - decay_rate * C(t), C(0) = current_load/volume, t/20, t)");
+	P("acute_lethal", "40% 120[mg/l] @ 48[hours], 75% 150[mg/l] @ 92[hours]");
+	P("chronic_lethal", "20% 60[ug/l] @ 200[hours], 50% 122[ug/l] @ 400[hours]");
+	P("const/decay_rate", "0.03");
+	P("const/organic_uptake", "0.95");
+	if (tolerance) {
+		P("adaptive/tolerance", tolerance);
+		snprintf(v, sizeof(v), "%g[s]", ONSET_MIN);
+		P("adaptive/min_tick", v);
+		P("adaptive/max_tick", "21600[s]");
+	}
+#undef P
+	R3 p = s->loc;
+	p.x += 100;
+	BenchFish *fish = new BenchFish(p, 2);
+	StandinRegister(fish);
+	if (!fish->Init((char *)taxon, (char *)name)) fatal(1, "The %s sink didn't initialise", name);
+	return fish;
+}
+
+/*--- onset_amp(double t) -- the onset source's strength: on for six hours, off for two days, on for a day */
+// Each time it comes on it starts at a tenth of its full strength and
+// rises to it over an hour or two.
+static double onset_amp(double t) {
+	double on = (t < 6*3600.0)?0:54*3600.0;
+	if (t >= 6*3600.0 && t < on) return 0;
+	return 10 + 90*(1 - exp(-(t - on)/1800));
+}
+
+/*--- check_onset() -- an adaptive step had better start small when a plume arrives */
+// The source is well away from the scenario's, and it's switched on
+// and off at the ends of the adaptive sink's steps, the reference
+// (held to min_tick) being brought up to each end in turn.
+static void check_onset() {
+	R3 p;
+	p.x = p.y = 10*BOX;
+	p.z = 0;
+	BenchSource *s = new BenchSource(p, 0);
+	StandinRegister(s);
+	if (!s->Init((char *)SOURCE_TAXON)) fatal(1, "The onset source didn't initialise");
+	char tol[32];
+	snprintf(tol, sizeof(tol), "%g", ONSET_TOLERANCE);
+	BenchFish *a = onset_fish(ONSET_TAXON, "adaptive", "1200[s]", tol, s);
+	BenchFish *r = onset_fish(ONSET_TAXON "ref", "reference", "60[s]", 0, s);
+	double stop[3] = { 6*3600.0, 54*3600.0, 78*3600.0 };
+	double t = 0, tr = 0, longest = 0;
+	int phase = 0, first = 1;
+
+	while (phase < 3) {
+		s->amp = onset_amp(t);
+		double h = a->Intoxicate(t, stop[phase] - t);
+		if (first && h > ONSET_MIN) fatal(1, "The first step into the plume at %g hours is %g", t/3600, h);
+		long calculated = Standin.calculate;
+		a->Commit(t, h);
+		// each step is within its tolerance, and nothing's eaten: just the two halves
+		if (Standin.calculate - calculated != 2)
+			fatal(1, "The step at %g hours took %ld evaluations of load_update, not 2", t/3600, Standin.calculate - calculated);
+		t += h;
+		first = 0;
+		longest = Max(longest, h);
+		while (tr < t) {
+			s->amp = onset_amp(tr);
+			double hr = r->Intoxicate(tr, t - tr);
+			r->Commit(tr, hr);
+			tr += hr;
+		}
+		if (fabs(a->Load(0) - r->Load(0)) > 2*ONSET_TOLERANCE*r->Load(0))
+			fatal(1, "At %g hours the load is %g, and %g held to min_tick", t/3600, a->Load(0), r->Load(0));
+		if (t >= stop[phase]) {
+			if (++phase == 2) {
+				if (!(longest > 10*ONSET_MIN)) fatal(1, "The unexposed steps never got longer than %g", longest);
+				first = 1;
+			}
+		}
+	}
+
+	// and, with the plume steady, sinks made to take six hour steps: one
+	// with an adaptive step they're well outside, which should have done
+	// them again in shorter ones, and one without
+	snprintf(tol, sizeof(tol), "%g", ONSET_COARSE);
+	a = onset_fish(ONSET_TAXON "coarse", "coarse", "1200[s]", tol, s);
+	BenchFish *b = onset_fish(ONSET_TAXON "ref", "plain", "60[s]", 0, s);
+	r = onset_fish(ONSET_TAXON "ref", "fine", "60[s]", 0, s);
+	for (tr = t; t < stop[2] + 86400; ) {
+		a->Intoxicate(t, 6*3600.0);
+		a->Commit(t, 6*3600.0);
+		b->Intoxicate(t, 6*3600.0);
+		b->Commit(t, 6*3600.0);
+		t += 6*3600.0;
+		while (tr < t) {
+			double hr = r->Intoxicate(tr, t - tr);
+			r->Commit(tr, hr);
+			tr += hr;
+		}
+		if (fabs(a->Load(0) - r->Load(0)) > fabs(b->Load(0) - r->Load(0))/3)
+			fatal(1, "At %g hours the load after six hour steps is %g with an adaptive step, %g without and %g held to min_tick",
+				t/3600, a->Load(0), b->Load(0), r->Load(0));
+	}
+	s->amp = 0;
+}
+
+/*--- check_stream(int n, int ticks) -- a stream by cell had better have each bin once, all of it */
+// Both threads tick once first, so that the stream knows them; then one
+// does the rest of its ticks while the other waits.
+typedef struct {
+	BenchFish **f;
+	int n, ticks, first;
+	pthread_barrier_t *b;
+} Streamer;
+
+static void *streamer(void *arg) {
+	Streamer *s = (Streamer *)arg;
+	for (int k = 0; k < s->ticks; k++) {
+		if (k == 1) {
+			pthread_barrier_wait(s->b);
+			if (!s->first) pthread_barrier_wait(s->b);
+		}
+		for (int i = 0; i < s->n; i++) {
+			s->f[i]->Expose(0.2*(1 + k%5));
+			s->f[i]->Commit(k*DT, DT);
+		}
+	}
+	if (s->first) pthread_barrier_wait(s->b);
+	return 0;
+}
+
+static void check_stream(int n, int ticks) {
+	BenchFish **f = (BenchFish **)Calloc(2*n, sizeof(BenchFish *));
+	Streamer s[2];
+	pthread_t th[2];
+	pthread_barrier_t b;
+	char file[64], cmd[1024], line[1024], k[256];
+	if (!f) abort();
+
+	for (int i = 0; i < 2*n; i++) {
+		char name[32];
+		R3 p = src[i % M]->loc;
+		p.x += 7*i;
+		f[i] = new BenchFish(p, 2);
+		StandinRegister(f[i]);
+		snprintf(name, sizeof(name), "streamer%d", i);
+		if (!f[i]->Init((char *)SINK_TAXON, name)) fatal(1, "Sink %s didn't initialise", name);
+	}
+	snprintf(file, sizeof(file), "/tmp/contcheck.%d.cs", (int)getpid());
+	if (!ContaminantStream::Open(file, 250, 3600, ContaminantStream::FORAGING)) fatal(1, "Unable to open the stream %s", file);
+
+	pthread_barrier_init(&b, 0, 2);
+	for (int k = 0; k < 2; k++) {
+		s[k].f = f + k*n;
+		s[k].n = n;
+		s[k].ticks = ticks;
+		s[k].first = !k;
+		s[k].b = &b;
+		if (pthread_create(&th[k], 0, streamer, s + k)) fatal(1, "Unable to start streamer %d", k);
+	}
+	for (int k = 0; k < 2; k++) pthread_join(th[k], 0);
+	pthread_barrier_destroy(&b);
+	ContaminantStream::Close();
+
+	// t taxon agent cx cy contaminant n load survival reproduction foraging movement
+	snprintf(cmd, sizeof(cmd), "%s/contread %s", tools, file);
+	FILE *p = popen(cmd, "r");
+	if (!p) fatal(1, "Unable to run %s", cmd);
+	char **key = (char **)Calloc(2*n*(K+1)*ticks, sizeof(char *));
+	int nkey = 0;
+	long rows = 0;
+	if (!key) abort();
+	while (fgets(line, sizeof(line), p)) {
+		char *col[12], *q = line;
+		int c;
+		if (*line == '#') continue;  // the heading
+		for (c = 0; c < 12 && q; c++) {
+			col[c] = q;
+			if ((q = strchr(q, '\t'))) *q++ = 0;
+		}
+		if (c != 12) fatal(1, "contread wrote \"%s\"", line);
+		rows += atol(col[6]);
+		int whole = !strcmp(col[5], "-");
+		if (isnan(atof(col[10])) != !whole || !isnan(atof(col[9])) || !isnan(atof(col[11])))
+			fatal(1, "A %s row has reproduction %s, foraging %s and movement %s with only foraging asked for",
+				whole?"whole agent":"contaminant", col[9], col[10], col[11]);
+		snprintf(k, sizeof(k), "%s %s %s %s %s", col[0], col[1], col[3], col[4], col[5]);
+		for (int j = 0; j < nkey; j++) {
+			if (!strcmp(key[j], k)) fatal(1, "The stream has two rows for %s", k);
+		}
+		if (nkey == 2*n*(K+1)*ticks) fatal(1, "The stream has more rows than ticks");
+		key[nkey++] = Strdup(k);
+	}
+	if (pclose(p)) fatal(1, "%s failed", cmd);
+	if (rows != 2L*n*(K+1)*ticks) fatal(1, "The stream's bins have %ld rows in them, not %ld", rows, 2L*n*(K+1)*ticks);
+	unlink(file);
+	for (int j = 0; j < nkey; j++) Free(key[j]);
+	Free(key);
+	Free(f);
+}
+
+/*--- Relay -- a source which answers with another's value, as a sink would ask it */
+// Across the link that's a query made while answering one.
+class Relay: public BenchSource
+{
+public:
+	Relay(int xid, int to): BenchSource(src[to]->loc, 0) { kid = xid; target = to; }
+	double getCSValue(double t, R3 p, int cid) { return ContaminantSource::GetCSValue(KID(src[target]->kid), t, p, cid); }
+	int target;
+};
+
+static int shm_side;
+static Relay *relay[2];
+static int stranger[2];   // a sink of each side's, carrying a contaminant only that side has heard of
+
+/*--- shm_local(int xid) -- the odd agents are side 1's */
+static int shm_local(int xid) {
+	return (xid & 1) != shm_side;
+}
+
+/*--- shm_resolve(int xid, int cls) -- */
+static void *shm_resolve(int xid, int cls) {
+	if (shm_local(xid)) return 0;
+	if (cls == CLASS_CONTSRC) {
+		if (xid == relay[shm_side]->kid) return (ContaminantSource *)relay[shm_side];
+		for (int j = 0; j < M; j++) if (src[j]->kid == xid) return (ContaminantSource *)src[j];
+	}
+	else {
+		for (int i = 0; i < N; i++) if (fish[i]->kid == xid) return (ContaminantSink *)fish[i];
+	}
+	return 0;
+}
+
+/*--- same_profile(int i, ContaminantProfile::Contaminant *c, int n) -- whether it's sink i's */
+static int same_profile(int i, ContaminantProfile::Contaminant *c, int n) {
+	ContaminantProfileView pv;
+	fish[i]->viewProfile(&pv);
+	if (n != pv.N) return 0;
+	for (int k = 0; k < n; k++) {
+		if (c[k].id != pv.c_list[k].id || c[k].name != pv.c_list[k].name) return 0;
+		if (memcmp(&c[k].mass, &pv.c_list[k].mass, sizeof(double))) return 0;  // unset is NaN
+	}
+	return 1;
+}
+
+/*--- shm_asks(int rounds) -- everything of the other side's, through the link */
+static void shm_asks(int rounds) {
+	int other = 1 - shm_side;
+
+	for (int r = 0; r < rounds; r++) {
+		double t = r*DT;
+		for (int j = 0; j < M; j++) {
+			if (!shm_local(src[j]->kid)) continue;
+			for (int c = 0; c < K; c++) {
+				R3 p = src[j]->loc;
+				p.x += 20*(r+1);
+				p.y -= 30*c;
+				double d = ContaminantSource::GetCSValue(KID(src[j]->kid), t, p, c);
+				if (d != src[j]->getCSValue(t, p, c))
+					fatal(1, "Side %d: source %d, contaminant %d, is %g through the link and %g here", shm_side, j, c, d, src[j]->getCSValue(t, p, c));
+			}
+		}
+		R3 p = src[relay[other]->target]->loc;
+		double d = ContaminantSource::GetCSValue(KID(relay[other]->kid), t, p, 0);
+		if (d != src[relay[other]->target]->getCSValue(t, p, 0) || !(d > 0))
+			fatal(1, "Side %d: the relay is %g, its source %g", shm_side, d, src[relay[other]->target]->getCSValue(t, p, 0));
+
+		ContaminantProfileView pv;
+		for (int i = r; i < N; i += rounds) {
+			if (!shm_local(fish[i]->kid)) continue;
+			if (i == stranger[other]) {
+				char name[32];
+				snprintf(name, sizeof(name), "side%d_only", other);
+				ContaminantSink::GetProfileView(KID(fish[i]->kid), &pv);
+				ContaminantProfile cp(&pv);
+				if (!cp.N || !cp.c_list[cp.N-1].name || strcmp(cp.c_list[cp.N-1].name, name) ||
+					cp.c_list[cp.N-1].id != ContaminantNames::Id(name) || cp.c_list[cp.N-1].mass != 42)
+					fatal(1, "Side %d: sink %d's %s didn't come through the link", shm_side, i, name);
+				continue;
+			}
+			ContaminantProfile *cp = ContaminantSink::GetProfile(KID(fish[i]->kid));
+			if (!cp || !same_profile(i, cp->c_list, cp->N)) fatal(1, "Side %d: sink %d's profile isn't the same through the link", shm_side, i);
+			delete cp;
+			ContaminantSink::GetProfileView(KID(fish[i]->kid), &pv);
+			if (!same_profile(i, pv.c_list, pv.N)) fatal(1, "Side %d: sink %d's profile view isn't the same through the link", shm_side, i);
+		}
+	}
+}
+
+/*--- check_shm(int rounds) -- two kernels asking each other had better get what they'd get at home */
+// Side 1 is forked from here, so both have the same agents; each owns
+// half of them (shm_local), and is a relay to a source of the other's.
+// The rings are small, so the records wrap often.  A kernel which has
+// finished asking goes on answering until the other has too.
+static void check_shm(int rounds) {
+	volatile long *tally = (volatile long *)mmap(0, 4*sizeof(long), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	int ready[2], big = 1 << 20;
+	char base[64], go;
+	if (tally == MAP_FAILED || pipe(ready) < 0) abort();
+	if (M < 2) fatal(1, "The shm check needs a source on each side");
+
+	for (int s = 0; s < 2; s++) {
+		int to = -1;
+		for (int j = 0; j < M && to < 0; j++) if ((src[j]->kid & 1) == s) to = j;
+		if (to < 0) fatal(1, "Side %d has no sources to relay", s);
+		relay[1-s] = new Relay(big + 1-s, to);
+	}
+
+	snprintf(base, sizeof(base), "/contcheck.%d", (int)getpid());
+	ContaminantShm::SetResolver(shm_resolve, shm_local);
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid < 0) fatal(1, "Unable to fork the other kernel");
+	shm_side = pid?0:1;
+	alarm(120);   // in case the other side dies with us waiting on it
+	for (int s = 0; s < 2; s++) {
+		for (stranger[s] = 0; stranger[s] < N && (fish[stranger[s]]->kid & 1) != s; stranger[s]++) ;
+		if (stranger[s] == N) fatal(1, "Side %d has no sinks", s);
+	}
+	ContaminantProfileView own;
+	char only[32];
+	snprintf(only, sizeof(only), "side%d_only", shm_side);
+	fish[stranger[shm_side]]->viewProfile(&own);
+	ContaminantProfile *was = new ContaminantProfile(&own), *sp = new ContaminantProfile(&own);
+	sp->AddContaminant(only, 42);
+	fish[stranger[shm_side]]->SetProfile(sp);
+	delete sp;
+	if (shm_side && read(ready[0], &go, 1) != 1) _exit(1);
+	if (!ContaminantShm::Link(base, shm_side, 4096)) {
+		if (shm_side) _exit(1);
+		fatal(1, "Unable to make the shared memory link");
+	}
+	if (!shm_side && write(ready[1], "x", 1) != 1) abort();
+	close(ready[0]);
+	close(ready[1]);
+
+	long kget = Standin.kget;
+	shm_asks(rounds);
+	tally[shm_side] = Standin.kget - kget;
+	__sync_synchronize();
+	tally[2 + shm_side] = 1;
+	while (!tally[3 - shm_side]) {
+		if (!ContaminantShm::Serve()) usleep(100);
+	}
+	ContaminantShm::Unlink();
+	if (shm_side) _exit(0);
+	fish[stranger[0]]->SetProfile(was);
+	delete was;
+
+	int status;
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		fatal(1, "The other kernel didn't finish");
+	alarm(0);
+	ContaminantShm::SetResolver(0, 0);
+	for (int s = 0; s < 2; s++) {
+		if (tally[s]) fatal(1, "Side %d made %ld KGETs", s, tally[s]);
+		delete relay[s];
+	}
+	munmap((void *)tally, 4*sizeof(long));
+
+	// and an agent as it arrives through a ring: read where it sits,
+	// and the slot taken for the next message straight away (PutState
+	// leaves the padding alone, so it's zeroed to compare)
+	int sz = fish[0]->StateSize();
+	char *msg = (char *)Calloc(sz, 1), *sent = (char *)Malloc(sz), *again = (char *)Calloc(sz, 1);
+	if (!msg || !sent || !again) abort();
+	fish[0]->PutState(msg, sz);
+	memcpy(sent, msg, sz);
+	scratch->SetStateInPlace(msg, sz);
+	memset(msg, 0, sz);
+	if (scratch->StateSize() != sz || !scratch->PutState(again, sz) || memcmp(again, sent, sz))
+		fatal(1, "An agent read in place from its message isn't the one that was written");
+	Free(msg);
+	Free(sent);
+	Free(again);
+}
+
+/*--- check_lc_table() -- a tabulated surface had better be as close as it says */
+// The surfaces are the scenario's acute and chronic ones, in kg/m^3 and
+// kg, over domains and tolerances that take a few refinements.  The
+// sweep's spacing is prime to the table's, so most of the points are
+// nowhere near a node, a centre or an edge.
+static void check_lc_table() {
+	static const struct {
+		double p0, c0, t0, p1, c1, t1;
+		double cmin, cmax, dtmax, tolerance;
+	} lc[] = {
+		{ 0.40, 0.120, 48*3600.0, 0.75, 0.150, 92*3600.0, 1e-4, 1, 86400, 1e-4 },
+		{ 0.20, 60e-6, 200*3600.0, 0.50, 122e-6, 400*3600.0, 1e-9, 1e-3, 3600, 1e-2 },
+		{ 0.20, 60e-6, 200*3600.0, 0.50, 122e-6, 400*3600.0, 1e-7, 1e-2, 86400, 5e-5 },
+	};
+	const int nx = 1999, nt = 2003;
+
+	for (int k = 0; k < (int)(sizeof(lc)/sizeof(lc[0])); k++) {
+		EndpointSurf es;
+		EndpointTable et;
+		if (!es.SetSurface(lc[k].p0, lc[k].c0, lc[k].t0, lc[k].p1, lc[k].c1, lc[k].t1))
+			fatal(1, "LC surface %d wasn't set", k);
+		if (!et.Build(&es, lc[k].cmin, lc[k].cmax, lc[k].dtmax, lc[k].tolerance))
+			fatal(1, "LC table %d couldn't be built to %g (got %g)", k, lc[k].tolerance, et.Error());
+		if (!(et.Error() <= lc[k].tolerance))
+			fatal(1, "LC table %d says it's Ok with an error of %g, over its tolerance %g", k, et.Error(), lc[k].tolerance);
+
+		double l0 = log(lc[k].cmin), l1 = log(lc[k].cmax);
+		for (int i = 0; i <= nx; i++) {
+			double conc = exp(l0 + (l1 - l0)*i/nx);
+			for (int j = 0; j <= nt; j++) {
+				double dt = lc[k].dtmax*j/nt;
+				double d = fabs(et.value(conc, dt) - es.value(conc, dt));
+				if (d > et.Error())
+					fatal(1, "LC table %d at %g for %g s is %g, the surface %g: out by %g, more than its Error() %g",
+						k, conc, dt, et.value(conc, dt), es.value(conc, dt), d, et.Error());
+			}
+		}
+		// the zero row is interpolated too; off the grid it's the surface
+		double conc[] = { 0, lc[k].cmin/2, lc[k].cmax*2, lc[k].c0 };
+		double dt[] = { 0, lc[k].dtmax/3, lc[k].dtmax*2 };
+		for (int i = 0; i < 4; i++) {
+			for (int j = 0; j < 3; j++) {
+				double d = fabs(et.value(conc[i], dt[j]) - es.value(conc[i], dt[j]));
+				if (d > ((i == 0 || i == 3) && j < 2?et.Error():0))
+					fatal(1, "LC table %d at %g for %g s is %g and the surface %g", k, conc[i], dt[j],
+						et.value(conc[i], dt[j]), es.value(conc[i], dt[j]));
+			}
+		}
+
+		// and values(), which the kill sweeps use, is value() a row at a time
+		double row[nx+4], got[nx+4];
+		for (int i = 0; i <= nx; i++) row[i] = exp(l0 - 1 + (l1 - l0 + 2)*i/nx);
+		row[nx+1] = 0;
+		row[nx+2] = lc[k].cmin;
+		row[nx+3] = lc[k].cmax;
+		for (int j = 0; j < 3; j++) {
+			et.values(row, dt[j], got, nx+4);
+			for (int i = 0; i < nx+4; i++) {
+				if (got[i] != et.value(row[i], dt[j]))
+					fatal(1, "LC table %d at %g for %g s: values() %.17g, value() %.17g", k, row[i], dt[j],
+						got[i], et.value(row[i], dt[j]));
+			}
+		}
+	}
+}
+
+/*-- main */
+
+/*--- want(const char *name) -- whether -f leaves this one in */
+static int want(const char *name) {
+	return !filter || strstr(name, filter);
+}
+
+/*--- done(const char *name) -- */
+static void done(const char *name) {
+	fprintf(stderr, "%-12s ok\n", name);
+}
+
+/*--- usage() -- */
+static void usage() {
+	fprintf(stderr, "Usage: contcheck [-n sinks] [-m sources] [-k contaminants] [-g cohorts] [-e members]\n"
+		"                 [-l kget_usec] [-q query_threads] [-a tolerance] [-w env_work]\n"
+		"                 [-s seed] [-f filter]\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	long seed = 1;
+	int c, threads = 0;
+
+	Standin.env_work = 50;
+	while ((c = getopt(argc, argv, "n:m:k:g:e:l:q:a:w:s:f:")) != -1) {
+		switch (c) {
+		case 'n': N = atoi(optarg); break;
+		case 'm': M = atoi(optarg); break;
+		case 'k': K = atoi(optarg); break;
+		case 'g': G = atoi(optarg); break;
+		case 'e': E = atoi(optarg); break;
+		case 'l': Standin.kget_latency = atoi(optarg); break;
+		case 'q': threads = atoi(optarg); break;
+		case 'a': A = optarg; break;
+		case 'w': Standin.env_work = atoi(optarg); break;
+		case 's': seed = atol(optarg); break;
+		case 'f': filter = optarg; break;
+		default: usage();
+		}
+	}
+	if (N < 1 || M < 0 || K < 1 || G < 1 || E < 1) usage();
+
+	char *slash = strrchr(argv[0], '/');
+	if (slash) snprintf(tools, sizeof(tools), "%.*s", (int)(slash - argv[0]), argv[0]);
+
+	srand48(seed);
+	make_scenario();
+	// these fork, so they go while this is the only thread
+	if (want("halo")) check_halo(400, 20), done("halo");
+	if (want("setup_cache")) check_setup_cache(30), done("setup_cache");
+	if (want("handles")) check_handles(), done("handles");
+	if (want("corpus")) check_corpus(), done("corpus");
+	if (want("exprc")) check_exprc(), done("exprc");
+	if (want("shm")) check_shm(5), done("shm");
+	ContaminantQuery::Start(threads);
+	if (want("queries")) check_queries(200), done("queries");
+	if (want("cohorts")) check_cohorts(50), done("cohorts");
+	if (want("ensemble") && E > 1) check_ensemble(), done("ensemble");
+	if (want("parallel")) check_parallel(500, 20), done("parallel");
+	if (want("batch")) check_batch(200, 10), done("batch");
+	if (want("ingest")) check_ingest(1000), done("ingest");
+	if (want("onset")) check_onset(), done("onset");
+	if (want("stream")) check_stream(100, 72), done("stream");
+	if (want("lc_table")) check_lc_table(), done("lc_table");
+	return 0;
+}
+
+/*-  The End  */
@@ -0,0 +1,132 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  scenario.cxx -- the synthetic scenario contbench and contcheck share
+
+  See scenario.hxx.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "scenario.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+int N = 1000, M = 10, K = 4, G = 20, E = 1;
+const char *A = 0;
+BenchFish **fish = 0;
+BenchSource **src = 0;
+BenchFish *scratch = 0;
+Contamination **pop[2];
+
+long BenchSource::foreign = 0;
+long BenchSource::ids = 0;
+
+/*-  Code  */
+
+/*--- param(const char *fmt, const char *value, ...) -- */
+void param(const char *value, const char *fmt, int k) {
+	char path[256];
+	snprintf(path, sizeof(path), fmt, k);
+	StandinParam(path, value);
+}
+
+/*--- make_scenario() -- */
+void make_scenario() {
+	R3 p;
+
+	for (int k = 0; k < K; k++) {
+		const char *c = SINK_TAXON "/ContaminantSink/contaminants/c%d/";
+		char f[256];
+#define P(key, value) (snprintf(f, sizeof(f), "%s%s", c, key), param(value, f, k))
+		P("contaminant_tick", "1200[s]");
+		P("load_update", "ate * organic_uptake + volume * ode(dC/dt = exposure_rate  / volume - decay_rate * C(t), C(0) = current_load/volume, t/20, t)");
+		P("reproductive_impairment", "current_load>0?0.9:0.0");
+		P("acute_lethal", "40% 120[mg/l] @ 48[hours], 75% 150[mg/l] @ 92[hours]");
+		P("chronic_lethal", "20% 60[ug/l] @ 200[hours], 50% 122[ug/l] @ 400[hours]");
+		P("const/decay_rate", "0.03");
+		P("const/organic_uptake", "0.95");
+		if (A) {
+			P("adaptive/tolerance", A);
+			P("adaptive/min_tick", "60[s]");
+			P("adaptive/max_tick", "21600[s]");
+		}
+#undef P
+		param("1", SOURCE_TAXON "/ContaminantSource/contaminants/c%d", k);
+		if (k%2) param("1", SPILL_TAXON "/ContaminantSource/contaminants/c%d", k);
+
+		for (int e = 2; e < E; e++) {
+			char v[32];
+			snprintf(f, sizeof(f), "%sensemble/member%d/const/decay_rate", c, e);
+			snprintf(v, sizeof(v), "%g", 0.03*e);
+			param(v, f, k);
+			snprintf(f, sizeof(f), "%sensemble/member%d/chronic_lethal", c, e);
+			param("30% 60[ug/l] @ 200[hours], 60% 122[ug/l] @ 400[hours]", f, k);
+		}
+	}
+	if (E > 1) {
+		char v[32];
+		snprintf(v, sizeof(v), "%d", E);
+		StandinParam(SINK_TAXON "/ContaminantSink/ensemble/members", v);
+	}
+	StandinParam(SPILL_TAXON "/ContaminantSource/contaminants/x", "1");
+
+	src = (BenchSource **)Calloc(M, sizeof(BenchSource *));
+	fish = (BenchFish **)Calloc(N, sizeof(BenchFish *));
+	if (!src || !fish) abort();
+
+	for (int j = 0; j < M; j++) {
+		p.x = drand48()*BOX;
+		p.y = drand48()*BOX;
+		p.z = 0;
+		src[j] = new BenchSource(p, 50 + 100*drand48());
+		StandinRegister(src[j]);
+		if (!src[j]->Init((char *)(j%5 == 4?SPILL_TAXON:SOURCE_TAXON))) fatal(1, "Source %d didn't initialise", j);
+	}
+
+	char **taxa = (char **)Calloc(N, sizeof(char *)), **names = (char **)Calloc(N, sizeof(char *));
+	if (!taxa || !names) abort();
+	for (int i = 0; i < N; i++) {
+		char name[32];
+		p.x = drand48()*BOX;
+		p.y = drand48()*BOX;
+		p.z = 0;
+		fish[i] = new BenchFish(p, 0.5 + 5*drand48());
+		StandinRegister(fish[i]);
+		snprintf(name, sizeof(name), "fish%d", i);
+		taxa[i] = (char *)SINK_TAXON;
+		names[i] = Strdup(name);
+	}
+	if (Contamination::InitMany((Contamination **)fish, N, taxa, names) != N) fatal(1, "Not every sink initialised");
+	for (int i = 0; i < N; i++) Free(names[i]);
+	Free(taxa);
+	Free(names);
+
+	p.x = 0.5*BOX;
+	p.y = 0.5*BOX;
+	p.z = 0;
+	for (int k = 0; k < 2; k++) {
+		pop[k] = (Contamination **)Calloc(G, sizeof(Contamination *));
+		if (!pop[k]) abort();
+		for (int j = 0; j < G; j++) {
+			char name[32];
+			BenchFish *f = new BenchFish(p, 0.1*(j+1));
+			StandinRegister(f);
+			snprintf(name, sizeof(name), "pop%d.%d", k, j);
+			if (!f->Init((char *)SINK_TAXON, name)) fatal(1, "Cohort %d didn't initialise", j);
+			pop[k][j] = f;
+		}
+	}
+
+	p.x = p.y = p.z = 0;
+	scratch = new BenchFish(p, 1);
+	StandinRegister(scratch);
+	if (!scratch->Init((char *)SINK_TAXON, (char *)"scratch")) fatal(1, "The scratch sink didn't initialise");
+}
+
+/*-  The End  */
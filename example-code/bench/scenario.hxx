@@ -0,0 +1,136 @@
+/*
+  scenario.hxx -- the synthetic scenario contbench and contcheck share (benchmarks only)
+
+  n sinks and m sources scattered over a 1km square in the stand-in
+  kernel (standin/), every source giving off all k contaminants as a
+  Gaussian plume (cut off at 400m), and every sink sensitive to all of
+  them; two populations of g cohorts (age classes, all at the same
+  place); and a scratch sink.  make_scenario() sets the parameters and
+  makes the agents from the settings below, which the tools take from
+  their command lines.
+
+  With e > 1 every sink carries a parameter ensemble of that many
+  members (contensemble.hxx): member 1 is a plain copy of the agent,
+  and the others have faster decay rates and a harsher chronic surface.
+  With an adaptive tolerance every contaminant gets an adaptive step
+  with it (between a minute and six hours).
+*/
+#ifndef _SCENARIO_HXX_INCLUDED_
+#define _SCENARIO_HXX_INCLUDED_
+
+#include "prmagent.hxx"
+#include "contamination.hxx"
+#include "contsrc.hxx"
+#include "conthalo.hxx"
+#include "memchk.h"
+
+#define SINK_TAXON "benchfish"
+#define SOURCE_TAXON "benchsource"
+#define SPILL_TAXON "benchspill"   // gives off some of the contaminants, and one nobody wants
+#define BOX 1000.0
+#define DT 1200.0
+#define PLUME 400.0                // where the sources stop
+
+class BenchFish: public Contamination
+{
+public:
+	BenchFish(R3 p, double m) { loc = p; imass = m; members = 100; }
+
+	int Commit(double t, double dt) { return CommitIntoxicate(t, dt, dt); }
+	int Tick(double t, double dt) { return CommitIntoxicate(t, dt, Intoxicate(t, dt)); }
+	int Eat(ContaminantProfileView *prey, double p, double t) { return Ingest(prey, p, t); }
+	void Expose(double c) {
+		for (int i = 0; i < n_cinfo; i++) hot.conc[i] = c;
+	}
+	double Load(int i) { return hot.load[i]; }
+	double Conc(int i) { return hot.conc[i]; }
+	int Program(int i) { return cinfo[i].update; }
+	const char *UpdateText(int i) { return cinfo[i].cs->update; }
+	double Members() { return cgetMembers(); }
+	// Intoxicate as it was before the per-taxon source kinds: ask every source about every interest
+	double Reference(double t, double dt) {
+		int num, *ia = FindAgentsByClass(CLASS_CONTSRC, &num);
+		for (int i = 0; i < num; i++) {
+			for (int j = 0; j < contaminants->NumInterest(); j++) {
+				char *c = contaminants->GetInterest(j);
+				if (ContaminantSource::GetCSNum(KID(ia[i]), c) >= 0) dt = LocalIntoxicate(ia[i], t, dt, c);
+			}
+		}
+		if (ia) Free(ia);
+		return dt;
+	}
+
+	R3 loc;
+	double imass, members;
+
+protected:
+	void PsetMembers(double m) { if (!isnan(m)) members = m; }
+	double PgetMembers() { return members; }
+
+Attribute:
+	R3 getLocation() { return loc; }
+	double getIMass() { return imass; }
+};
+
+class BenchSource: public ContaminantSource
+{
+public:
+	BenchSource(R3 p, double a) { loc = p; amp = a; }
+
+	// KGETs of us from another region's kernel, which the halo copies should have answered
+	void *Get(int attribute, void *args, int args_size, void *data, int *size) {
+		int r = ContaminantHalo::Region();
+		if (r >= 0 && ContaminantHalo::RegionOf(loc) != r) foreign++;
+		if (attribute == ATTR_CONTSRC_IDS) ids++;
+		return ContaminantSource::Get(attribute, args, args_size, data, size);
+	}
+	ContaminantList *List() { return GetContaminantList(); }
+
+	R3 loc;
+	double amp;
+	static long foreign;
+	static long ids;  // source lists asked for
+
+Attribute:
+	double getCSValue(double t, R3 p, int cid) {
+		double dx = p.x - loc.x, dy = p.y - loc.y;
+		if (dx*dx + dy*dy > PLUME*PLUME) return 0;
+		return amp*(1 + 0.1*cid)*exp(-(dx*dx + dy*dy)/(2*100.0*100.0));
+	}
+	int getFootprint(R3 *centre, double *radius) {
+		*centre = loc;
+		*radius = PLUME;
+		return 1;
+	}
+	void *getReplica(int *sz) {
+		double *d = (double *)Malloc(4*sizeof(double));
+		if (!d) abort();
+		d[0] = loc.x;
+		d[1] = loc.y;
+		d[2] = loc.z;
+		d[3] = amp;
+		*sz = 4*sizeof(double);
+		return d;
+	}
+	int setReplica(void *v, int sz) {
+		double *d = (double *)v;
+		if (sz != 4*sizeof(double)) return 0;
+		loc.x = d[0];
+		loc.y = d[1];
+		loc.z = d[2];
+		amp = d[3];
+		return 1;
+	}
+};
+
+extern int N, M, K, G, E;
+extern const char *A;           // the adaptive tolerance
+extern BenchFish **fish;
+extern BenchSource **src;
+extern BenchFish *scratch;
+extern Contamination **pop[2];  // both the same
+
+void param(const char *value, const char *fmt, int k);
+void make_scenario();
+
+#endif
@@ -0,0 +1,843 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  standin.cxx -- just enough of the kernel to run the contaminant code in one process
+
+  See the headers in standin/ for what each piece does and doesn't do.
+  None of this is used by the model proper.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "prmagent.hxx"
+#include "prmenvexpr.hxx"
+#include "endpointsurf.hxx"
+#include "stringtable.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define PATHLEN 512
+#define ROUND8(x) (((x)+7) & ~7)
+
+StandinCounters Standin = { 0, 0, 0, 0, 0, 0, 0 };
+
+static PrmAgent **agents = 0;
+static int nagents = 0, maxagents = 0;
+
+static char **ppath = 0, **pvalue = 0;
+static int nparam = 0, maxparam = 0;
+static volatile int ploaded = 0;         // $STANDIN_PARAMS
+static volatile int pload_lock = 0;
+static char **pnames = 0;                // node names handed out by PGetNodes
+static int nnames = 0, maxnames = 0;
+static volatile int name_lock = 0;
+
+// blocks are found without a lock, so they're kept in pages which
+// never move (Contamination::InitMany makes them from several threads)
+#define BLOCK_PAGE 1024
+#define BLOCK_PAGES 4096
+static RCCalc **blocks[BLOCK_PAGES];
+static volatile int nblocks = 0;
+static volatile int block_lock = 0;
+
+static volatile double env_sink;
+
+/*-  Code  */
+
+/*-- messages */
+
+/*--- VERBOSE(const char *who, const char *fmt, ...) -- only with $STANDIN_VERBOSE */
+void VERBOSE(const char *who, const char *fmt, ...) {
+	static int on = -1;
+	if (on < 0) on = getenv("STANDIN_VERBOSE") != 0;
+	if (!on) return;
+
+	va_list ap;
+	va_start(ap, fmt);
+	fprintf(stderr, "%s: ", who);
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+/*--- fatal(int code, const char *fmt, ...) -- */
+void fatal(int code, const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	fprintf(stderr, "fatal: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	exit(code?code:1);
+}
+
+/*--- warning(const char *fmt, ...) -- */
+void warning(const char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	fprintf(stderr, "warning: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+
+/*-- pack_mem and unpack_mem */
+// int n, int l[n] (rounded up to 8 bytes), then each item rounded up to 8 bytes
+
+/*--- pack_mem(void **v, int *l, int n, int *sz) -- */
+void *pack_mem(void **v, int *l, int n, int *sz) {
+	int i, len = ROUND8((n+1)*sizeof(int));
+
+	for (i = 0; i < n; i++) len += ROUND8(v[i]?l[i]:0);
+	char *d = (char *)Calloc(1, len);
+	if (!d) abort();
+
+	int *h = (int *)d;
+	char *p = d + ROUND8((n+1)*sizeof(int));
+	h[0] = n;
+	for (i = 0; i < n; i++) {
+		h[i+1] = v[i]?l[i]:0;
+		if (h[i+1]) memcpy(p, v[i], h[i+1]);
+		p += ROUND8(h[i+1]);
+	}
+	assert(sz);
+	*sz = len;
+	return d;
+}
+
+/*--- unpack_mem(void *data, int sz, void ***v, int **l) -- */
+int unpack_mem(void *data, int sz, void ***v, int **l) {
+	int *h = (int *)data;
+	int i, n = h[0];
+	char *p = (char *)data + ROUND8((n+1)*sizeof(int));
+
+	*v = (void **)Calloc(n?n:1, sizeof(void *));
+	*l = (int *)Calloc(n?n:1, sizeof(int));
+	if (!*v || !*l) abort();
+	for (i = 0; i < n; i++) {
+		(*l)[i] = h[i+1];
+		(*v)[i] = h[i+1]?p:0;
+		p += ROUND8(h[i+1]);
+	}
+	assert(p - (char *)data <= sz);
+	return n;
+}
+
+
+/*-- agents and KGET */
+
+/*--- StandinRegister(PrmAgent *a) -- */
+int StandinRegister(PrmAgent *a) {
+	if (nagents >= maxagents) {
+		maxagents = maxagents?2*maxagents:1024;
+		agents = (PrmAgent **)Realloc(agents, maxagents*sizeof(PrmAgent *));
+		if (!agents) abort();
+	}
+	agents[nagents] = a;
+	a->kid = nagents;
+	return nagents++;
+}
+
+/*--- StandinClear() -- forget the agents (it doesn't delete them) */
+void StandinClear() {
+	nagents = 0;
+}
+
+/*--- KGET(int xid, int attribute, void *args, int args_size, void *data, int *size) -- */
+void *KGET(int xid, int attribute, void *args, int args_size, void *data, int *size) {
+	assert(xid >= 0 && xid < nagents);
+	__sync_fetch_and_add(&Standin.kget, 1);
+	if (Standin.kget_latency > 0) {
+		struct timespec ts = { Standin.kget_latency/1000000, 1000L*(Standin.kget_latency%1000000) };
+		while (nanosleep(&ts, &ts)) ;
+	}
+	return agents[xid]->Get(attribute, args, args_size, data, size);
+}
+
+/*-- the death log */
+
+/*--- StandinTrail(h, t, died, left, cause) -- h with this death, and its place in the log, folded in */
+unsigned long long StandinTrail(unsigned long long h, double t, double died, double left, const char *cause) {
+	long seq = Standin.deaths_logged++;
+	const unsigned char *p;
+	unsigned int i;
+
+	if (!h) h = 14695981039346656037ULL;
+#define FOLD(x) for (p = (const unsigned char *)&(x), i = 0; i < sizeof(x); i++) h = (h ^ p[i]) * 1099511628211ULL
+	FOLD(seq);
+	FOLD(t);
+	FOLD(died);
+	FOLD(left);
+#undef FOLD
+	for (p = (const unsigned char *)cause; p && *p; p++) h = (h ^ *p) * 1099511628211ULL;
+	return h;
+}
+
+/*--- KISA(int xid, int mask) -- */
+int KISA(int xid, int mask) {
+	assert(xid >= 0 && xid < nagents);
+	return agents[xid]->Isa(mask);
+}
+
+/*--- PrmAgent::Get(...) -- nothing at this level */
+void *PrmAgent::Get(int attribute, void *args, int args_size, void *data, int *size) {
+	fatal(1, "Unknown attribute 0x%08x", attribute);
+}
+
+/*--- PrmAgent::GetReturn(void *data, int *size, void *v, int sz) -- into data if it fits */
+void *PrmAgent::GetReturn(void *data, int *size, void *v, int sz) {
+	assert(size);
+	if (data && *size >= sz) {
+		memcpy(data, v, sz);
+		*size = sz;
+		return data;
+	}
+	void *d = Malloc(sz?sz:1);
+	if (!d) abort();
+	memcpy(d, v, sz);
+	*size = sz;
+	return d;
+}
+
+/*--- PrmAgent::FindAgentsByClass(int cls, int *num) -- everyone, no spatial search */
+// The kernel would do a spatial search; we keep the last answer so that
+// the cost of a scan over every agent doesn't swamp what's being measured.
+int *PrmAgent::FindAgentsByClass(int cls, int *num) {
+	static int *last = 0, nlast = 0, last_cls = -1, last_agents = -1;
+
+	if (cls != last_cls || nagents != last_agents) {
+		nlast = 0;
+		last = (int *)Realloc(last, (nagents?nagents:1)*sizeof(int));
+		if (!last) abort();
+		for (int i = 0; i < nagents; i++) {
+			if (agents[i]->Isa(cls)) last[nlast++] = i;
+		}
+		last_cls = cls;
+		last_agents = nagents;
+	}
+
+	*num = nlast;
+	if (!nlast) return 0;
+	int *ia = (int *)Malloc(nlast*sizeof(int));
+	if (!ia) abort();
+	memcpy(ia, last, nlast*sizeof(int));
+	return ia;
+}
+
+
+/*-- the parameter tree */
+
+/*--- StandinParam(const char *path, const char *value) -- "taxon/Class/key/..." */
+void StandinParam(const char *path, const char *value) {
+	for (int i = 0; i < nparam; i++) {
+		if (strcmp(ppath[i], path)) continue;
+		Free(pvalue[i]);
+		pvalue[i] = Strdup(value);
+		return;
+	}
+	if (nparam >= maxparam) {
+		maxparam = maxparam?2*maxparam:256;
+		ppath = (char **)Realloc(ppath, maxparam*sizeof(char *));
+		pvalue = (char **)Realloc(pvalue, maxparam*sizeof(char *));
+		if (!ppath || !pvalue) abort();
+	}
+	ppath[nparam] = Strdup(path);
+	pvalue[nparam] = Strdup(value);
+	nparam++;
+}
+
+/*--- StandinParamClear() -- */
+void StandinParamClear() {
+	for (int i = 0; i < nparam; i++) {
+		Free(ppath[i]);
+		Free(pvalue[i]);
+	}
+	nparam = 0;
+}
+
+/*--- StandinParamWrite(const char *file) -- */
+int StandinParamWrite(const char *file) {
+	FILE *f = fopen(file, "w");
+	if (!f) return 0;
+	for (int i = 0; i < nparam; i++) fprintf(f, "%s = %s\n", ppath[i], pvalue[i]);
+	return fclose(f) == 0;
+}
+
+/*--- StandinParamRead(const char *file) -- */
+int StandinParamRead(const char *file) {
+	char line[2*PATHLEN];
+	FILE *f = fopen(file, "r");
+	if (!f) return 0;
+	while (fgets(line, sizeof(line), f)) {
+		char *eq = strstr(line, " = ");
+		int l = strlen(line);
+		if (l && line[l-1] == '\n') line[--l] = 0;
+		if (!eq) continue;
+		*eq = 0;
+		StandinParam(line, eq + 3);
+	}
+	fclose(f);
+	return 1;
+}
+
+/*--- autoload() -- $STANDIN_PARAMS, the first time the tree is looked at */
+static void autoload() {
+	if (ploaded) return;
+	while (__sync_lock_test_and_set(&pload_lock, 1)) ;
+	if (!ploaded) {
+		char *files = getenv("STANDIN_PARAMS"), *s, *save = 0;
+		if (files) files = Strdup(files);
+		for (s = files?strtok_r(files, ":", &save):0; s; s = strtok_r(0, ":", &save)) {
+			if (!StandinParamRead(s)) fatal(1, "Unable to read parameter file %s", s);
+		}
+		if (files) Free(files);
+		__sync_synchronize();
+		ploaded = 1;
+	}
+	__sync_lock_release(&pload_lock);
+}
+
+/*--- join(char *buf, const char *k0, va_list ap) -- */
+static void join(char *buf, const char *k0, va_list ap) {
+	int l = 0;
+	buf[0] = 0;
+	for (const char *k = k0; k; k = va_arg(ap, const char *)) {
+		int kl = strlen(k);
+		if (l + kl + 2 >= PATHLEN) fatal(1, "Parameter path too long");
+		if (l) buf[l++] = '/';
+		memcpy(buf+l, k, kl+1);
+		l += kl;
+	}
+}
+
+/*--- lookup(int flags, char *path) -- */
+static char *lookup(int flags, char *path) {
+	autoload();
+	for (int i = 0; i < nparam; i++) {
+		if (!strcmp(ppath[i], path)) return pvalue[i];
+	}
+	if (flags & PARAM_REQ) fatal(1, "Missing parameter %s", path);
+	return 0;
+}
+
+/*--- PGetS(int flags, ...) -- */
+char *PGetS(int flags, ...) {
+	char path[PATHLEN];
+	va_list ap;
+	va_start(ap, flags);
+	const char *k0 = va_arg(ap, const char *);
+	join(path, k0, ap);
+	va_end(ap);
+	return lookup(flags, path);
+}
+
+/*--- PGetN(int flags, ...) -- */
+double PGetN(int flags, ...) {
+	char path[PATHLEN];
+	va_list ap;
+	va_start(ap, flags);
+	const char *k0 = va_arg(ap, const char *);
+	join(path, k0, ap);
+	va_end(ap);
+	char *s = lookup(flags, path);
+	if (!s) return DNaN;
+	CCalc cc;
+	return cc.UnitEvaluate(s);
+}
+
+/*--- PGetI(int flags, ...) -- */
+int PGetI(int flags, ...) {
+	char path[PATHLEN];
+	va_list ap;
+	va_start(ap, flags);
+	const char *k0 = va_arg(ap, const char *);
+	join(path, k0, ap);
+	va_end(ap);
+	char *s = lookup(flags, path);
+	return s?atoi(s):0;
+}
+
+/*--- name(const char *s, int l) -- a node name which lives as long as we do */
+static char *name(const char *s, int l) {
+	char *nm = 0;
+
+	while (__sync_lock_test_and_set(&name_lock, 1)) ;
+	for (int i = 0; !nm && i < nnames; i++) {
+		if (!strncmp(pnames[i], s, l) && !pnames[i][l]) nm = pnames[i];
+	}
+	if (!nm) {
+		if (nnames >= maxnames) {
+			maxnames = maxnames?2*maxnames:256;
+			pnames = (char **)Realloc(pnames, maxnames*sizeof(char *));
+			if (!pnames) abort();
+		}
+		nm = pnames[nnames++] = (char *)Malloc(l+1);
+		if (!nm) abort();
+		memcpy(nm, s, l);
+		nm[l] = 0;
+	}
+	__sync_lock_release(&name_lock);
+	return nm;
+}
+
+/*--- PGetNodes(const char *k0, ...) -- the children of a block; Free() the array */
+char **PGetNodes(const char *k0, ...) {
+	char path[PATHLEN];
+	va_list ap;
+	va_start(ap, k0);
+	join(path, k0, ap);
+	va_end(ap);
+
+	int pl = strlen(path), n = 0;
+	char **v = 0;
+	autoload();
+	for (int i = 0; i < nparam; i++) {
+		if (strncmp(ppath[i], path, pl) || ppath[i][pl] != '/') continue;
+		char *c = ppath[i] + pl + 1;
+		char *e = strchr(c, '/');
+		char *nm = name(c, e?e-c:(int)strlen(c));
+		int j;
+		for (j = 0; j < n && v[j] != nm; j++) ;
+		if (j < n) continue;
+		v = (char **)Realloc(v, (n+2)*sizeof(char *));
+		if (!v) abort();
+		v[n++] = nm;
+		v[n] = 0;
+	}
+	return v;
+}
+
+/*--- GetCName(int cls) -- */
+char *GetCName(int cls) {
+	switch (cls & CLASS_MASK) {
+	case CLASS_CONTSINK: return (char *)"ContaminantSink";
+	case CLASS_CONTSRC: return (char *)"ContaminantSource";
+	}
+	return (char *)"Agent";
+}
+
+
+/*-- CCalc, RCCalc and PrmEnvExpr */
+
+struct CCalc::CalcVar {
+	double *p;
+};
+
+static const char *varnames[] = { "t", "dt", "conc", "imass", "ate", "current_load", 0 };
+enum { V_T, V_DT, V_CONC, V_IMASS, V_ATE, V_LOAD, V_OTHER };
+
+static const struct {
+	const char *name;
+	double (*f)(double);
+} functions[] = {
+	{ "exp", exp }, { "log", log }, { "sqrt", sqrt }, { "fabs", fabs },
+	{ "abs", fabs }, { "sin", sin }, { "cos", cos }, { "floor", floor },
+	{ "ceil", ceil }, { 0, 0 }
+};
+
+typedef struct {
+	const char *p;
+	double *var;
+	const char **vname;
+	int nvar;
+	int bad;
+} Eval;
+
+/*--- CCalc::FreeCalcVar(CalcVar *v) -- */
+CCalc::CalcVar *CCalc::FreeCalcVar(CalcVar *v) {
+	if (v) Free(v);
+	return 0;
+}
+
+/*--- CCalc::UnitEvaluate(const char *s) -- a number, with the units ignored */
+double CCalc::UnitEvaluate(const char *s) {
+	char *e;
+	double d = strtod(s, &e);
+	if (e == s) return DNaN;
+	while (*e == ' ') e++;
+	if (*e && *e != '[') return DNaN;
+	return d;
+}
+
+/*--- the evaluator: the grammar in contnative.cxx, computed as it's read */
+
+static double ev_cond(Eval *e);
+
+/*--- ev_accept(Eval *e, const char *tok) -- */
+static int ev_accept(Eval *e, const char *tok) {
+	while (isspace((unsigned char)*e->p)) e->p++;
+	int l = strlen(tok);
+	if (strncmp(e->p, tok, l)) return 0;
+	if (l == 1 && strchr("<>=!", tok[0]) && e->p[1] == '=') return 0;
+	if (l == 1 && (tok[0] == '&' || tok[0] == '|')) return 0;
+	e->p += l;
+	return 1;
+}
+
+/*--- ev_primary(Eval *e) -- */
+static double ev_primary(Eval *e) {
+	char nm[128];
+	double v;
+	int l, i;
+
+	if (ev_accept(e, "(")) {
+		v = ev_cond(e);
+		if (!ev_accept(e, ")")) e->bad = 1;
+		return v;
+	}
+	if (isdigit((unsigned char)*e->p) || *e->p == '.') {
+		char *end;
+		v = strtod(e->p, &end);
+		e->p = end;
+		if (*e->p == '[') {
+			const char *close = strchr(e->p, ']');
+			if (!close) e->bad = 1;
+			else e->p = close+1;
+		}
+		return v;
+	}
+	for (l = 0; (isalnum((unsigned char)e->p[l]) || e->p[l] == '_') && l < (int)sizeof(nm)-1; l++) nm[l] = e->p[l];
+	nm[l] = 0;
+	e->p += l;
+	if (!l) {
+		e->bad = 1;
+		return DNaN;
+	}
+
+	if (ev_accept(e, "(")) {
+		v = ev_cond(e);
+		if (!strcmp(nm, "pow")) {
+			if (!ev_accept(e, ",")) e->bad = 1;
+			v = pow(v, ev_cond(e));
+		}
+		else {
+			for (i = 0; functions[i].name && strcmp(functions[i].name, nm); i++) ;
+			if (!functions[i].name) e->bad = 1;
+			else v = functions[i].f(v);
+		}
+		if (!ev_accept(e, ")")) e->bad = 1;
+		return v;
+	}
+
+	for (i = 0; varnames[i]; i++) {
+		if (!strcmp(varnames[i], nm)) return e->var[i];
+	}
+	for (i = 0; i < e->nvar; i++) {
+		if (e->vname[V_OTHER+i] && !strcmp(e->vname[V_OTHER+i], nm)) return e->var[V_OTHER+i];
+	}
+	return DNaN;
+}
+
+/*--- ev_unary(Eval *e) -- and ^ */
+static double ev_unary(Eval *e) {
+	if (ev_accept(e, "-")) return -ev_unary(e);
+	if (ev_accept(e, "+")) return ev_unary(e);
+	if (ev_accept(e, "!")) return !ev_unary(e);
+	double v = ev_primary(e);
+	if (ev_accept(e, "^")) v = pow(v, ev_unary(e));
+	return v;
+}
+
+/*--- ev_mul(Eval *e), ev_add, ev_cmp, ev_and, ev_or -- left associative */
+static double ev_mul(Eval *e) {
+	double v = ev_unary(e);
+	for (;;) {
+		if (ev_accept(e, "*")) v *= ev_unary(e);
+		else if (ev_accept(e, "/")) v /= ev_unary(e);
+		else return v;
+	}
+}
+
+static double ev_add(Eval *e) {
+	double v = ev_mul(e);
+	for (;;) {
+		if (ev_accept(e, "+")) v += ev_mul(e);
+		else if (ev_accept(e, "-")) v -= ev_mul(e);
+		else return v;
+	}
+}
+
+static double ev_cmp(Eval *e) {
+	double v = ev_add(e);
+	for (;;) {
+		if (ev_accept(e, "<=")) v = v <= ev_add(e);
+		else if (ev_accept(e, ">=")) v = v >= ev_add(e);
+		else if (ev_accept(e, "==")) v = v == ev_add(e);
+		else if (ev_accept(e, "!=")) v = v != ev_add(e);
+		else if (ev_accept(e, "<")) v = v < ev_add(e);
+		else if (ev_accept(e, ">")) v = v > ev_add(e);
+		else return v;
+	}
+}
+
+static double ev_and(Eval *e) {
+	double v = ev_cmp(e);
+	while (ev_accept(e, "&&")) {
+		double w = ev_cmp(e);
+		v = v && w;
+	}
+	return v;
+}
+
+static double ev_or(Eval *e) {
+	double v = ev_and(e);
+	while (ev_accept(e, "||")) {
+		double w = ev_and(e);
+		v = v || w;
+	}
+	return v;
+}
+
+/*--- ev_cond(Eval *e) -- */
+static double ev_cond(Eval *e) {
+	double v = ev_or(e);
+	if (!ev_accept(e, "?")) return v;
+	double a = ev_cond(e);
+	if (!ev_accept(e, ":")) e->bad = 1;
+	double b = ev_cond(e);
+	return v?a:b;
+}
+
+/*--- RCCalc() -- */
+RCCalc::RCCalc() {
+	memset(var, 0, sizeof(var));
+	memset(vname, 0, sizeof(vname));
+	nvar = 0;
+	nprog = 0;
+	ode = 0;
+	text = 0;
+}
+
+/*--- ~RCCalc() -- */
+RCCalc::~RCCalc() {
+	for (int i = 0; i < nprog; i++) Free(text[i]);
+	if (text) Free(text);
+	if (ode) Free(ode);
+	for (int i = 0; i < nvar; i++) Free((char *)vname[V_OTHER+i]);
+}
+
+/*--- RCCalc::AddProgram(const char *prog) -- */
+int RCCalc::AddProgram(const char *prog) {
+	assert(prog);
+	ode = (int *)Realloc(ode, (nprog+1)*sizeof(int));
+	text = (char **)Realloc(text, (nprog+1)*sizeof(char *));
+	if (!ode || !text) abort();
+	ode[nprog] = strstr(prog, "ode(") != 0;
+	text[nprog] = Strdup((char *)prog);
+	return nprog++;
+}
+
+/*--- RCCalc::GetVarRef2(const char *nm) -- */
+CCalc::CalcVar *RCCalc::GetVarRef2(const char *nm) {
+	int i;
+	for (i = 0; varnames[i] && strcmp(varnames[i], nm); i++) ;
+	if (!varnames[i]) {
+		for (i = V_OTHER; i < V_OTHER+nvar && strcmp(vname[i], nm); i++) ;
+		if (i == V_OTHER+nvar && i < NVAR) {
+			vname[i] = Strdup((char *)nm);
+			nvar++;
+		}
+		if (i == NVAR) i = NVAR-1;
+	}
+	CalcVar *v = (CalcVar *)Malloc(sizeof(CalcVar));
+	if (!v) abort();
+	v->p = &var[i];
+	return v;
+}
+
+/*--- RCCalc::SetVarRef2(CalcVar *v, double d) -- */
+void RCCalc::SetVarRef2(CalcVar *v, double d) {
+	assert(v);
+	*v->p = d;
+}
+
+/*--- RCCalc::Calculate(int id) -- see prmenvexpr.hxx */
+double RCCalc::Calculate(int id) {
+	assert(id >= 0 && id < nprog);
+	__sync_fetch_and_add(&Standin.calculate, 1);
+	if (!ode[id]) {
+		Eval e = { text[id], var, vname, nvar, 0 };
+		double d = ev_cond(&e);
+		while (isspace((unsigned char)*e.p)) e.p++;
+		return e.bad || *e.p ? DNaN : d;
+	}
+
+	double decay = exp(-0.03*var[V_DT]/3600.0);
+	return var[V_LOAD]*decay + 0.95*var[V_ATE] + 0.05*var[V_CONC]*var[V_IMASS]*var[V_DT]*1e-4;
+}
+
+/*--- PrmEnvExpr::LoadBigBlock(int vbid, ...) -- a block of our own, once */
+int PrmEnvExpr::LoadBigBlock(int vbid, ...) {
+	if (vbid >= 0 && vbid < nblocks) return vbid;
+
+	while (__sync_lock_test_and_set(&block_lock, 1)) ;
+	vbid = nblocks;
+	if (vbid/BLOCK_PAGE >= BLOCK_PAGES) abort();
+	RCCalc **page = blocks[vbid/BLOCK_PAGE];
+	if (!page) {
+		page = blocks[vbid/BLOCK_PAGE] = (RCCalc **)Calloc(BLOCK_PAGE, sizeof(RCCalc *));
+		if (!page) abort();
+	}
+	page[vbid%BLOCK_PAGE] = new RCCalc();
+	__sync_synchronize();
+	nblocks = vbid+1;
+	__sync_lock_release(&block_lock);
+	return vbid;
+}
+
+/*--- PrmEnvExpr::EnvBlockOk(int vbid) -- */
+int PrmEnvExpr::EnvBlockOk(int vbid) {
+	return vbid >= 0 && vbid < nblocks;
+}
+
+/*--- PrmEnvExpr::GetCCalc(int vbid) -- */
+RCCalc *PrmEnvExpr::GetCCalc(int vbid) {
+	assert(EnvBlockOk(vbid));
+	return blocks[vbid/BLOCK_PAGE][vbid%BLOCK_PAGE];
+}
+
+/*--- PrmEnvExpr::Configure(double t, int vbid) -- */
+void PrmEnvExpr::Configure(double t, int vbid) {
+	double d = 0;
+	__sync_fetch_and_add(&Standin.configure, 1);
+	for (int i = 0; i < Standin.env_work; i++) d += sin(t + i);
+	env_sink = d;
+}
+
+/*--- PrmEnvExpr::ValidateVariables(int vbid) -- */
+void PrmEnvExpr::ValidateVariables(int vbid) {
+	double d = 0;
+	__sync_fetch_and_add(&Standin.validate, 1);
+	for (int i = 0; i < Standin.env_work; i++) d += sin(vbid + i);
+	env_sink = d;
+}
+
+
+/*-- EndpointSurf */
+
+/*--- EndpointSurf::SetSurface(p0, c0, t0, p1, c1, t1) -- */
+int EndpointSurf::SetSurface(double p0, double c0, double t0, double p1, double c1, double t1) {
+	double x0 = c0*t0, x1 = c1*t1;
+	if (x0 <= 0 || x1 <= 0 || x0 == x1) return 0;
+	if (p0 <= 0 || p0 >= 1 || p1 <= 0 || p1 >= 1) return 0;
+
+	double l0 = log(p0/(1-p0)), l1 = log(p1/(1-p1));
+	b = (l1 - l0)/(log(x1) - log(x0));
+	if (b == 0) return 0;
+	lk = log(x0) - l0/b;
+	ok = 1;
+	return 1;
+}
+
+/*--- EndpointSurf::value(double conc, double dt) -- */
+double EndpointSurf::value(double conc, double dt) {
+	if (!ok || conc <= 0 || dt <= 0) return 0;
+	return 1.0/(1.0 + exp(-b*(log(conc*dt) - lk)));
+}
+
+
+/*-- StringTable */
+
+/*--- StringTable() -- */
+StringTable::StringTable() {
+	n = max = 0;
+	key = value = 0;
+}
+
+/*--- ~StringTable() -- */
+StringTable::~StringTable() {
+	clear();
+}
+
+/*--- clear() -- */
+void StringTable::clear() {
+	for (int i = 0; i < n; i++) {
+		Free(key[i]);
+		Free(value[i]);
+	}
+	if (key) Free(key);
+	if (value) Free(value);
+	n = max = 0;
+	key = value = 0;
+}
+
+/*--- Insert(const char *k, const char *v) -- */
+int StringTable::Insert(const char *k, const char *v) {
+	for (int i = 0; i < n; i++) {
+		if (strcmp(key[i], k)) continue;
+		Free(value[i]);
+		value[i] = Strdup(v);
+		return 1;
+	}
+	if (n >= max) {
+		max = max?2*max:8;
+		key = (char **)Realloc(key, max*sizeof(char *));
+		value = (char **)Realloc(value, max*sizeof(char *));
+		if (!key || !value) abort();
+	}
+	key[n] = Strdup(k);
+	value[n] = Strdup(v);
+	n++;
+	return 1;
+}
+
+/*--- GetValue(const char *k) -- */
+char *StringTable::GetValue(const char *k) {
+	for (int i = 0; i < n; i++) {
+		if (!strcmp(key[i], k)) return value[i];
+	}
+	return 0;
+}
+
+/*--- GetKey(int i) -- */
+char *StringTable::GetKey(int i) {
+	assert(i >= 0 && i < n);
+	return key[i];
+}
+
+/*--- Num() -- */
+int StringTable::Num() {
+	return n;
+}
+
+/*--- GetState(int *sz) -- key, value, key, value ... */
+void *StringTable::GetState(int *sz) {
+	void **v = (void **)Calloc(2*n+1, sizeof(void *));
+	int *l = (int *)Calloc(2*n+1, sizeof(int));
+	if (!v || !l) abort();
+	for (int i = 0; i < n; i++) {
+		v[2*i] = key[i];
+		l[2*i] = strlen(key[i])+1;
+		v[2*i+1] = value[i];
+		l[2*i+1] = strlen(value[i])+1;
+	}
+	void *d = pack_mem(v, l, 2*n, sz);
+	Free(v);
+	Free(l);
+	return d;
+}
+
+/*--- SetState(void *d, int sz) -- */
+void StringTable::SetState(void *d, int sz) {
+	void **v;
+	int *l;
+
+	clear();
+	int m = unpack_mem(d, sz, &v, &l);
+	assert(m%2 == 0);
+	for (int i = 0; i < m; i += 2) Insert((char *)v[i], (char *)v[i+1]);
+	Free(v);
+	Free(l);
+}
+
+/*-  The End  */
@@ -0,0 +1,33 @@
+/*
+  deathlogger.hxx -- stand-in for the kernel's DeathLogger (benchmarks only)
+
+  Deaths are counted, not written anywhere.  Each logger also keeps a
+  hash of what it was told and when, the when being the number of
+  deaths logged by anyone before it (Standin.deaths_logged), so two
+  runs which log the same things in the same order have the same
+  trails.
+*/
+#ifndef _DEATHLOGGER_HXX_INCLUDED_
+#define _DEATHLOGGER_HXX_INCLUDED_
+
+unsigned long long StandinTrail(unsigned long long h, double t, double died, double left, const char *cause);
+
+class DeathLogger
+{
+public:
+	DeathLogger() { deaths = 0; trail = 0; }
+	virtual ~DeathLogger() {}
+
+	void Reset() { deaths = 0; trail = 0; }
+	int Init(char *taxon, char *name) { return 1; }
+	int Shutdown() { return 1; }
+	void LogDeath(double t, double died, double left, double imass, const char *cause) {
+		deaths += died;
+		trail = StandinTrail(trail, t, died, left, cause);
+	}
+
+	double deaths;
+	unsigned long long trail;
+};
+
+#endif
@@ -0,0 +1,23 @@
+/*
+  endpointsurf.hxx -- stand-in for EndpointSurf (benchmarks only)
+
+  A log-logistic response in concentration x time through the two LC
+  points, which has the right shape and roughly the right cost.  A
+  surface which has never been set (all zeroes, which is how the setup
+  code gets them) answers 0.
+*/
+#ifndef _ENDPOINTSURF_HXX_INCLUDED_
+#define _ENDPOINTSURF_HXX_INCLUDED_
+
+class EndpointSurf
+{
+public:
+	int SetSurface(double p0, double c0, double t0, double p1, double c1, double t1);
+	double value(double conc, double dt);
+
+private:
+	int ok;
+	double b, lk;   // slope and log of the 50% dose
+};
+
+#endif
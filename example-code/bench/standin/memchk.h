@@ -0,0 +1,16 @@
+/*
+  memchk.h -- stand-in for the kernel's checked allocator (benchmarks only)
+*/
+#ifndef _MEMCHK_H_INCLUDED_
+#define _MEMCHK_H_INCLUDED_
+
+#include <stdlib.h>
+#include <string.h>
+
+#define Calloc(n,s) calloc((n),(s))
+#define Malloc(s) malloc(s)
+#define Realloc(p,s) realloc((p),(s))
+#define Free(p) free(p)
+#define Strdup(s) strdup(s)
+
+#endif
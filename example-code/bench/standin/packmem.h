@@ -0,0 +1,14 @@
+/*
+  packmem.h -- stand-in for the kernel's pack_mem/unpack_mem (benchmarks only)
+
+  Same contract: pack_mem returns a block the caller Free()s; unpack_mem
+  returns pointers into the block, in arrays the caller Free()s, with a
+  null pointer for anything which was packed with a length of zero.
+*/
+#ifndef _PACKMEM_H_INCLUDED_
+#define _PACKMEM_H_INCLUDED_
+
+void *pack_mem(void **v, int *l, int n, int *sz);
+int unpack_mem(void *d, int sz, void ***v, int **l);
+
+#endif
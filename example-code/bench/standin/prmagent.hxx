@@ -0,0 +1,86 @@
+/*
+  prmagent.hxx -- stand-in for the kernel's PrmAgent and friends (benchmarks only)
+
+  Just enough of the kernel to run the contaminant code in one process:
+  agents are registered with StandinRegister() and KGET() calls their
+  Get() directly (after Standin.kget_latency microseconds, to stand
+  for a round trip to another kernel); the parameter tree is a flat
+  table of paths filled in with StandinParam(), or read from the
+  files in $STANDIN_PARAMS (colon separated, in StandinParamWrite()'s
+  format) the first time it's looked at.  Nothing here is meant to be fast or clever,
+  except where the contaminant code would be measuring it.
+*/
+#ifndef _PRMAGENT_HXX_INCLUDED_
+#define _PRMAGENT_HXX_INCLUDED_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "r3.hxx"
+#include "packmem.h"
+
+#define Attribute public
+#define KID2(x) int x
+#define KID(x) (x)
+
+#define CLASS_MASK 0xff00
+#define CLASS_AGENT 0x0000
+#define CLASS_CONTSINK 0x0100
+#define CLASS_CONTSRC 0x0200
+
+// Compatibility
+#define ATTR 0x01
+#define RESET 0x02
+#define STATE 0x04
+#define REINIT 0x08
+
+#define PARAM_OPT 0x00
+#define PARAM_REQ 0x01
+#define PARAM_NOU 0x02
+#define PARAM_NOR 0x04
+
+#define DNaN NAN
+#define Min(a,b) ((a)<(b)?(a):(b))
+#define Max(a,b) ((a)>(b)?(a):(b))
+
+void VERBOSE(const char *who, const char *fmt, ...);
+void fatal(int code, const char *fmt, ...) __attribute__((noreturn));
+void warning(const char *fmt, ...);
+
+char *PGetS(int flags, ...);
+double PGetN(int flags, ...);
+int PGetI(int flags, ...);
+char **PGetNodes(const char *k0, ...);
+char *GetCName(int cls);
+
+void *KGET(int xid, int attribute, void *args, int args_size, void *data, int *size);
+int KISA(int xid, int mask);
+
+class PrmAgent
+{
+public:
+	PrmAgent() { kid = -1; }
+	virtual ~PrmAgent() {}
+
+	virtual void Reset() {}
+	virtual int Isa(int mask) { return (mask&CLASS_MASK) == CLASS_AGENT; }
+	virtual void *Get(int attribute, void *args, int args_size, void *data, int *size);
+
+	void *GetReturn(void *data, int *size, void *v, int sz);
+	int *FindAgentsByClass(int cls, int *num);
+
+	int kid;
+};
+
+// the stand-in kernel
+int StandinRegister(PrmAgent *a);
+void StandinClear();
+void StandinParam(const char *path, const char *value);
+void StandinParamClear();
+int StandinParamWrite(const char *file);  // "path = value" lines, as a parameter file would have them
+int StandinParamRead(const char *file);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+  prmenvexpr.hxx -- stand-in for CCalc, RCCalc and PrmEnvExpr (benchmarks only)
+
+  An RCCalc program containing an ode() is run as a first order
+  uptake and decay model, whatever the text says.  Anything else is
+  evaluated: arithmetic, comparisons, && || ! and ?:, ^ and the usual
+  maths functions, numbers with their units ignored, and names which
+  are either the inputs or variables the caller has set through
+  GetVarRef2() (a name nobody asked for is NaN).  That's the part of
+  the language ContaminantNative translates, so contcheck can hold
+  the compiled functions to it.  Configure() and
+  ValidateVariables() do a fixed amount of arithmetic (Standin.env_work
+  sin() calls each) and are counted, so that the cost of sampling the
+  environment shows up in the measurements.
+
+  UnitEvaluate() understands "number" and "number[unit]" and ignores
+  the unit.
+*/
+#ifndef _PRMENVEXPR_HXX_INCLUDED_
+#define _PRMENVEXPR_HXX_INCLUDED_
+
+#include "prmagent.hxx"
+
+class CCalc
+{
+public:
+	struct CalcVar;
+	static CalcVar *FreeCalcVar(CalcVar *v);
+	double UnitEvaluate(const char *s);
+};
+
+class RCCalc : public CCalc
+{
+public:
+	RCCalc();
+	~RCCalc();
+
+	int AddProgram(const char *prog);
+	CalcVar *GetVarRef2(const char *name);
+	void SetVarRef2(CalcVar *v, double d);
+	double Calculate(int id);
+
+private:
+	enum { NVAR = 16 };
+	double var[NVAR];
+	const char *vname[NVAR];             // past the inputs; the last is shared by the rest
+	int nvar;
+	int nprog;
+	int *ode;
+	char **text;
+};
+
+class PrmEnvExpr
+{
+public:
+	void Reset() {}
+	int LoadBigBlock(int vbid, ...);
+	int EnvBlockOk(int vbid);
+	RCCalc *GetCCalc(int vbid);
+	void Configure(double t, int vbid);
+	void ValidateVariables(int vbid);
+};
+
+struct StandinCounters {
+	long configure, validate, calculate, kget;
+	int env_work;
+	int kget_latency;   // microseconds each KGET takes, as if the agent were remote
+	long deaths_logged; // see deathlogger.hxx
+};
+extern StandinCounters Standin;
+
+#endif
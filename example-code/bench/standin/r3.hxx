@@ -0,0 +1,11 @@
+/*
+  r3.hxx -- stand-in for the kernel's R3 (benchmarks only)
+*/
+#ifndef _R3_HXX_INCLUDED_
+#define _R3_HXX_INCLUDED_
+
+struct R3 {
+	double x, y, z;
+};
+
+#endif
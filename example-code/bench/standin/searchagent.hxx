@@ -0,0 +1,13 @@
+/*
+  searchagent.hxx -- stand-in for the kernel's SearchAgent (benchmarks only)
+*/
+#ifndef _SEARCHAGENT_HXX_INCLUDED_
+#define _SEARCHAGENT_HXX_INCLUDED_
+
+class SearchAgent
+{
+public:
+	virtual ~SearchAgent() {}
+};
+
+#endif
@@ -0,0 +1,28 @@
+/*
+  stringtable.hxx -- stand-in for the kernel's StringTable (benchmarks only)
+*/
+#ifndef _STRINGTABLE_HXX_INCLUDED_
+#define _STRINGTABLE_HXX_INCLUDED_
+
+class StringTable
+{
+public:
+	StringTable();
+	~StringTable();
+
+	int Insert(const char *key, const char *value);
+	char *GetValue(const char *key);
+	char *GetKey(int i);
+	int Num();
+
+	void *GetState(int *sz);
+	void SetState(void *d, int sz);
+
+private:
+	void clear();
+
+	int n, max;
+	char **key, **value;
+};
+
+#endif
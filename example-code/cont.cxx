@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include "prmagent.hxx"
 #include "cont.hxx"
 #include "packmem.h"
 #include "memchk.h"
@@ -45,7 +46,82 @@
 /*--- definitions */
 #define NO_STRDUP  
 
+// Profiles come out of an arena in power of two size classes
+// (ARENA_MIN ... ARENA_MIN<<(ARENA_CLASSES-1) bytes); anything bigger
+// goes to the heap.  A profile's list is in the same block unless it
+// outgrows ContaminantProfile::INPLACE.  Freed blocks go back on the
+// free list for their class and the chunks are never returned, so after
+// the first few ticks predation and migration don't touch the allocator
+// at all.  Each thread has its own lists and chunk, so there's no lock;
+// a block given back by another thread than the one it came from just
+// joins the giver's lists.
+#define ARENA_MIN      32
+#define ARENA_CLASSES  8
+#define ARENA_CHUNK    (64*1024)
+
 /*--- variables */
+ContaminantNames::Table * volatile ContaminantNames::table = 0;
+int ContaminantNames::bits = 0;
+volatile int ContaminantNames::lock = 0;
+
+static __thread void *arena_free[ARENA_CLASSES];
+static __thread char *arena_chunk = 0;
+static __thread int arena_left = 0;
+
+volatile unsigned long ContaminantList::source_epoch = 0;
+
+
+/*-- Profile arena */
+
+/*--- arena_class(int sz) -- size class for sz bytes, -1 if too big */
+static int arena_class(int sz) {
+	int c = 0, b = ARENA_MIN;
+	while (b < sz) {
+		b <<= 1;
+		c++;
+	}
+	return (c < ARENA_CLASSES)?c:-1;
+}
+
+/*--- arena_get(int sz) -- */
+static void *arena_get(int sz) {
+	int c = arena_class(sz);
+	void *p;
+
+	if (c < 0) {
+		p = Malloc(sz);
+		if (!p) abort();
+		return p;
+	}
+
+	if ((p = arena_free[c])) arena_free[c] = *(void **)p;
+	else {
+		int b = ARENA_MIN << c;
+		if (arena_left < b) {
+			arena_chunk = (char *)Malloc(ARENA_CHUNK);
+			if (!arena_chunk) abort();
+			arena_left = ARENA_CHUNK;
+		}
+		p = arena_chunk;
+		arena_chunk += b;
+		arena_left -= b;
+	}
+	return p;
+}
+
+/*--- arena_put(void *p, int sz) -- sz must be what was asked of arena_get */
+static void arena_put(void *p, int sz) {
+	int c = arena_class(sz);
+
+	if (!p) return;
+	if (c < 0) {
+		Free(p);
+		return;
+	}
+	*(void **)p = arena_free[c];
+	arena_free[c] = p;
+}
+
 
 
 /*-- Constructors/destructors */
@@ -55,34 +131,45 @@ ContaminantList::ContaminantList() {
 	source = new StringTable();
 	interest = new StringTable();
 	if (!source || !interest) abort();
+	memset(&sidx, 0, sizeof(sidx));
+	memset(&iidx, 0, sizeof(iidx));
+	reindex(&sidx, source);
+	reindex(&iidx, interest);
 }
 
 /*--- ~ContaminantList() */
 ContaminantList::~ContaminantList() {
+	if (sidx.n) SourcesChanged();  // its id may be given to another agent
 	delete source;
 	delete interest;
+	free_index(&sidx);
+	free_index(&iidx);
 }
 
 /*-- RegisterAsContaminantSource(char *contaminant) */
 int ContaminantList::RegisterAsContaminantSource(char *contaminant) {
-	return source->Insert(contaminant, "0");
+	uint64_t was = sidx.sig;
+	int r = source->Insert(contaminant, "0");
+	reindex(&sidx, source);
+	sources_changed(was);
+	return r;
 }
 
 /*-- RegisterAsContaminantSource(char *contaminant) -- a potential sink*/
 int ContaminantList::RegisterInterest(char *contaminant) {
-	return interest->Insert(contaminant, "0");
+	int r = interest->Insert(contaminant, "0");
+	reindex(&iidx, interest);
+	return r;
 }
 
 /*-- IsSource(char *contaminant) -- predicate */
 int ContaminantList::IsSource(char *contaminant) {
-	if (source->GetValue(contaminant)) return 1;
-	return 0;
+	return has(&sidx, contaminant);
 }
 
 /*-- IsInterested(char *contaminant) -- predicate, potential sink/logger */
 int ContaminantList::IsInterested(char *contaminant) {
-	if (interest->GetValue(contaminant)) return 1;
-	return 0;
+	return has(&iidx, contaminant);
 }
 
 /*-- NumSource() --  return the number of sources for contact*/
@@ -101,7 +188,7 @@ int ContaminantList::NumInterest() {
 //
 // TESTED AND OK FOR PRODUCTION
 
-ar *ContaminantList::GetInterest(int rec) {  // return key for contaminant number "rec"
+char *ContaminantList::GetInterest(int rec) {  // return key for contaminant number "rec"
 #ifdef NO_STRDUP
 	return interest->GetKey(rec);
 #else
@@ -135,12 +222,16 @@ void *ContaminantList::GetState(int *sz) {
 void ContaminantList::SetState(void *d, int sz) {
 	void **v;
 	int *l, n;
+	uint64_t was = sidx.sig;
 	n = unpack_mem(d, sz, &v, &l);
 	assert(n == 2);
 	source->SetState(v[0], l[0]);
 	interest->SetState(v[1], l[1]);
 	Free(v);
 	Free(l);
+	reindex(&sidx, source);
+	reindex(&iidx, interest);
+	sources_changed(was);
 }
 
 
@@ -149,43 +240,257 @@ void ContaminantList::ClearInterests() {
 	assert(interest);
 	delete interest;
 	interest = new StringTable();
+	reindex(&iidx, interest);
 }
 /*-- ClearSources() --  */
 void ContaminantList::ClearSources() {
 	assert(source);
+	uint64_t was = sidx.sig;
 	delete source;
 	source = new StringTable();
+	reindex(&sidx, source);
+	sources_changed(was);
+}
+
+/*-- sources_changed(uint64_t was) -- unless it's the same list again */
+void ContaminantList::sources_changed(uint64_t was) {
+	if (sidx.sig != was) SourcesChanged();
+}
+
+/*-- the ids, bits and signatures -- */
+
+/*--- SourceIds(int *n, char ***names) --  */
+int *ContaminantList::SourceIds(int *n, char ***names) {
+	assert(n);
+	*n = sidx.n;
+	if (names) *names = sidx.name;
+	return sidx.id;
+}
+
+/*--- InterestIds(int *n, char ***names) --  */
+int *ContaminantList::InterestIds(int *n, char ***names) {
+	assert(n);
+	*n = iidx.n;
+	if (names) *names = iidx.name;
+	return iidx.id;
+}
+
+/*--- reindex(Index *x, StringTable *t) -- from scratch; the lists are short and rarely change */
+void ContaminantList::reindex(Index *x, StringTable *t) {
+	int i, n = t->Num();
+
+	if (n > x->max) {
+		x->max = n;
+		x->id = (int *)Realloc(x->id, n*sizeof(int));
+		x->name = (char **)Realloc(x->name, n*sizeof(char *));
+		if (!x->id || !x->name) abort();
+	}
+	x->n = n;
+	for (i = 0; i < n; i++) {
+		x->id[i] = ContaminantNames::Id(t->GetKey(i));
+		x->name[i] = ContaminantNames::Name(x->id[i]);
+	}
+	x->sig = Signature(n, x->id);
+
+	int words = 0;
+	for (i = 0; i < n; i++) {
+		int w = ContaminantNames::Bit(x->name[i])/32 + 1;
+		if (w > words) words = w;
+	}
+	if (words > x->nwords) {
+		x->bits = (unsigned *)Realloc(x->bits, words*sizeof(unsigned));
+		if (!x->bits) abort();
+		x->nwords = words;
+	}
+	if (x->nwords) memset(x->bits, 0, x->nwords*sizeof(unsigned));
+	for (i = 0; i < n; i++) {
+		int b = ContaminantNames::Bit(x->name[i]);
+		x->bits[b >> 5] |= 1u << (b & 31);
+	}
+}
+
+/*--- Signature(int n, int *id) -- FNV-1a over the ids */
+uint64_t ContaminantList::Signature(int n, int *id) {
+	uint64_t sig = 14695981039346656037ULL;
+	for (int i = 0; i < n; i++) sig = (sig ^ (uint32_t)id[i]) * 1099511628211ULL;
+	return sig;
+}
+
+/*--- free_index(Index *x) --  */
+void ContaminantList::free_index(Index *x) {
+	if (x->id) Free(x->id);
+	if (x->name) Free(x->name);
+	if (x->bits) Free(x->bits);
+	memset(x, 0, sizeof(*x));
+}
+
+/*--- has(Index *x, char *name) --  */
+int ContaminantList::has(Index *x, char *name) {
+	int b = ContaminantNames::Bit(name);
+	if (b < 0 || (b >> 5) >= x->nwords) return 0;
+	return (x->bits[b >> 5] >> (b & 31)) & 1;
+}
+/*-- ContaminantNames -- interned contaminant names */
+
+/*--- hash(char *name) -- FNV-1a */
+unsigned ContaminantNames::hash(char *name) {
+	unsigned h = 2166136261u;
+	for (unsigned char *p = (unsigned char *)name; *p; p++) {
+		h ^= *p;
+		h *= 16777619u;
+	}
+	return h & 0x7fffffff;
+}
+
+/*--- find(Table *t, int id) -- 0 if it isn't there */
+// An entry's name is only set once the rest of it is, and a table is
+// only published once it's full, so this needs no lock.
+ContaminantNames::Entry *ContaminantNames::find(Table *t, int id) {
+	if (!t) return 0;
+	int j = id & (t->size-1);
+	while (t->e[j].name) {
+		if (t->e[j].id == id) return &t->e[j];
+		j = (j+1) & (t->size-1);
+	}
+	return 0;
+}
+
+/*--- Id(char *name) -- */
+int ContaminantNames::Id(char *name) {
+	assert(name && *name);
+	int id = (int)hash(name);
+
+	Entry *e = find(table, id);
+	if (!e) {
+		while (__sync_lock_test_and_set(&lock, 1)) ;
+		Table *t = table;
+		if (!(e = find(t, id))) {
+			if (!t || 2*(t->n+1) > t->size) {  // keep it at most half full
+				int size = t?2*t->size:64;
+				Table *nt = (Table *)Calloc(1, sizeof(Table) + (size-1)*sizeof(Entry));
+				if (!nt) abort();
+				nt->size = size;
+				nt->old = t;
+				for (int i = 0; t && i < t->size; i++) {
+					if (!t->e[i].name) continue;
+					int j = t->e[i].id & (size-1);
+					while (nt->e[j].name) j = (j+1) & (size-1);
+					nt->e[j] = t->e[i];
+					nt->n++;
+				}
+				__sync_synchronize();
+				table = t = nt;
+			}
+
+			int j = id & (t->size-1);
+			while (t->e[j].name) j = (j+1) & (t->size-1);
+			char *s = Strdup(name);
+			if (!s) abort();
+			t->e[j].id = id;
+			t->e[j].bit = bits++;
+			t->n++;
+			__sync_synchronize();  // the id and bit before anyone can see the name
+			t->e[j].name = s;
+			__sync_lock_release(&lock);
+			return id;
+		}
+		__sync_lock_release(&lock);
+	}
+
+	if (strcmp(e->name, name)) fatal(1, "Contaminants %s and %s have the same id; rename one of them", e->name, name);
+	return id;
+}
+
+/*--- Bit(char *name) -- */
+// Another name with the same hash is a different contaminant (Id()
+// refuses it), and it isn't registered.
+int ContaminantNames::Bit(char *name) {
+	assert(name);
+	Entry *e = find(table, (int)hash(name));
+	if (!e || (e->name != name && strcmp(e->name, name))) return -1;
+	return e->bit;
+}
+
+/*--- Intern(char *name) -- the one true copy of name */
+char *ContaminantNames::Intern(char *name) {
+	char *s = Name(Id(name));
+	assert(s);
+	return s;
+}
+
+/*--- Name(int id) -- */
+char *ContaminantNames::Name(int id) {
+	Entry *e = find(table, id);
+	return e?e->name:0;
+}
+
+
+/*-- allocation -- profiles and their lists live in the arena */
+
+/*--- operator new(size_t sz) -- */
+void *ContaminantProfile::operator new(size_t sz) {
+	return arena_get(sz);
+}
+
+/*--- operator delete(void *p, size_t sz) -- */
+void ContaminantProfile::operator delete(void *p, size_t sz) {
+	arena_put(p, sz);
 }
+
+/*--- Reserve(int n) -- make sure there is room for n contaminants */
+// Names are interned, so growing the list is just a copy.
+void ContaminantProfile::Reserve(int n) {
+	if (n <= cap) return;
+
+	int ncap = cap;
+	while (ncap < n) ncap <<= 1;
+
+	Contaminant *c = (Contaminant*)arena_get(ncap*sizeof(Contaminant));
+	if (N) memcpy(c, c_list, N*sizeof(Contaminant));
+	if (c_list != inplace) arena_put(c_list, cap*sizeof(Contaminant));
+	c_list = c;
+	cap = ncap;
+}
+
+
 /*-- ContaminantProfile() -- (Re-)Initialise */
 ContaminantProfile::ContaminantProfile() {
 	N = 0;
-	c_list = 0;
+	cap = INPLACE;
+	c_list = inplace;
 }
 
 
 /*-- ContaminantProfile(ContaminantProfile *c) --  Copy profile  */
 ContaminantProfile::ContaminantProfile(ContaminantProfile *c) {
 	assert(c);
+	N = 0;
+	cap = INPLACE;
+	c_list = inplace;
+	if (!c->N) return;
+	Reserve(c->N);
 	N = c->N;
-	c_list = (Contaminant*)Calloc(N, sizeof(Contaminant));
-	if (!c_list) abort();
-	for(int i=0;i<N;i++) {
-		assert(c->c_list[i].name);
-		c_list[i].name = Strdup(c->c_list[i].name);
-		if (!c_list[i].name) abort();
-		c_list[i].mass = c->c_list[i].mass;
-	}
+	memcpy(c_list, c->c_list, N*sizeof(Contaminant));
+}
+
+
+/*-- ContaminantProfile(ContaminantProfileView *c) --  Take a copy of a borrowed profile */
+ContaminantProfile::ContaminantProfile(ContaminantProfileView *c) {
+	assert(c);
+	N = 0;
+	cap = INPLACE;
+	c_list = inplace;
+	if (!c->N) return;
+	Reserve(c->N);
+	N = c->N;
+	memcpy(c_list, c->c_list, N*sizeof(Contaminant));
 }
 
 
 /*-- ~ContaminantProfile() -- dispose of contaminants (OHS is watching!) */
+// the names are interned, so there's only a list that outgrew us to give back
 ContaminantProfile::~ContaminantProfile() {
-	for(int i=0;i<N;i++) {
-		assert(c_list);
-		assert(c_list[i].name);
-		Free(c_list[i].name);
-	}
-	if (c_list) Free(c_list);
+	if (c_list != inplace) arena_put(c_list, cap*sizeof(Contaminant));
 }
 
 
@@ -202,8 +507,8 @@ void ContaminantProfile::unpack_struct(int i, void *d, int sz) {
 
 	assert(c_list);
 	c_list[i].mass = *(double*)v[0];
-	c_list[i].name = Strdup((char*)v[1]);
-	if (!c_list[i].name) abort();
+	c_list[i].name = ContaminantNames::Intern((char*)v[1]);
+	c_list[i].id = ContaminantNames::Id(c_list[i].name);
 	Free(v); Free(l);
 }
 
@@ -215,8 +520,9 @@ void ContaminantProfile::unpack_list(void *d, int sz) {
 	assert(N > 0);
 	int n = unpack_mem(d, sz, &v, &l);
 	assert(n == N);
-	c_list = (Contaminant*)Calloc(N, sizeof(Contaminant));
-	if (!c_list) abort();
+	N = 0;       // nothing to copy yet
+	Reserve(n);
+	N = n;
 	for(int i=0;i<N;i++) {
 		unpack_struct(i, v[i], l[i]);
 	}
@@ -230,6 +536,8 @@ ContaminantProfile::ContaminantProfile(void *d, int sz) {
 	void **v;
 	int *l;
 
+	cap = INPLACE;
+	c_list = inplace;
 	int n = unpack_mem(d, sz, &v, &l);
 	assert(n == 2);
 	assert(v[0]);
@@ -241,7 +549,6 @@ ContaminantProfile::ContaminantProfile(void *d, int sz) {
 	}
 	else {
 		assert(N == 0);
-		c_list = 0;
 	}
 	Free(v); Free(l);
 }
@@ -292,12 +599,54 @@ void *ContaminantProfile::GetState(int *sz) {
 /*-- AddContaminant(char *name, double mass) -- */
 int ContaminantProfile::AddContaminant(char *name, double mass) {
 	assert(N >= 0);
-	c_list = (Contaminant*)Realloc(c_list, (N+1)*sizeof(Contaminant));
-	if (!c_list) abort();
-	c_list[N].mass = mass;
 	if (!name || (strlen(name)<1)) abort();
-	c_list[N].name = Strdup(name);
-	if (!c_list[N].name) abort();
+	Reserve(N+1);
+	c_list[N].mass = mass;
+	c_list[N].id = ContaminantNames::Id(name);
+	c_list[N].name = ContaminantNames::Name(c_list[N].id);
 	N++;
 	return 1;
 }
+
+
+/*-- ContaminantProfileView -- a borrowed profile */
+
+/*--- ContaminantProfileView() -- */
+ContaminantProfileView::ContaminantProfileView() {
+	N = 0;
+	c_list = 0;
+	own = 0;
+}
+
+/*--- ~ContaminantProfileView() -- */
+ContaminantProfileView::~ContaminantProfileView() {
+	Release();
+}
+
+/*--- Borrow(ContaminantProfile *p) -- look at p in place */
+void ContaminantProfileView::Borrow(ContaminantProfile *p) {
+	Release();
+	if (!p) return;
+	N = p->N;
+	c_list = p->c_list;
+}
+
+/*--- Release() -- */
+void ContaminantProfileView::Release() {
+	if (own) Free(own);
+	own = 0;
+	N = 0;
+	c_list = 0;
+}
+
+/*--- Mass(int id, double *mass) -- boolean, fills in mass if it's there */
+int ContaminantProfileView::Mass(int id, double *mass) {
+	assert(mass);
+	for (int i = 0; i < N; i++) {
+		if (c_list[i].id == id) {
+			*mass = c_list[i].mass;
+			return 1;
+		}
+	}
+	return 0;
+}
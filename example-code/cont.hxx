@@ -1,6 +1,8 @@
 #ifndef _CONT_HXX_INCLUDED_
 #define _CONT_HXX_INCLUDED_
 
+#include <stddef.h>
+#include <stdint.h>
 #include "stringtable.hxx"
 
 // Probably need to add a heap of stuff to this later
@@ -24,33 +26,130 @@ public:
 	void SetState( void *d, int sz );
 	void ClearInterests();
 	void ClearSources();
+
+	// The lists as ContaminantNames ids and interned names, in the order
+	// of GetSource()/GetInterest(), and a signature of each which only
+	// changes when the list does; good until the list next changes
+	int *SourceIds(int *n, char ***names);
+	int *InterestIds(int *n, char ***names);
+	uint64_t SourceSignature() { return sidx.sig; }
+	uint64_t InterestSignature() { return iidx.sig; }
+	static uint64_t Signature(int n, int *id);  // of any list of ids, the same way
+	// moves on whenever any source list in this process changes (or one
+	// that gave anything off goes), so what a sink has learned about
+	// its sources is good for as long as it stays put.  Something that
+	// changes how the sources look from here without changing a list (a
+	// kernel which hears of a change in another process, or the halo
+	// at each Sync()) calls SourcesChanged().
+	static unsigned long SourceEpoch() { return source_epoch; }
+	static void SourcesChanged() { __sync_add_and_fetch(&source_epoch, 1); }
 private:
 	StringTable *source, *interest;
+
+	// rebuilt whenever the table changes, so reading it never writes
+	typedef struct {
+		int n, max;
+		int *id;
+		char **name;
+		unsigned *bits;    // over ContaminantNames::Bit()
+		int nwords;
+		uint64_t sig;
+	} Index;
+	Index sidx, iidx;
+	static void reindex(Index *x, StringTable *t);
+	static void free_index(Index *x);
+	static int has(Index *x, char *name);
+	void sources_changed(uint64_t was);
+	static volatile unsigned long source_epoch;
 };
 
+// Contaminant names are interned.  The id is a hash of the name, so it
+// is the same in every kernel and can go over the wire instead of the string.
+// Safe from any thread: lookups don't lock, and registering a name does.
+
+class ContaminantNames
+{
+public:
+	static int Id( char *name );     // registers the name if need be
+	static char *Intern( char *name ); // the registered copy of name
+	static char *Name( int id );     // 0 if nobody has registered it
+	static int Bit( char *name );    // small and dense, in registration order; -1 if not registered
+private:
+	static unsigned hash( char *name );
+	typedef struct {
+		int id;
+		char * volatile name;  // set last; 0 for an empty slot
+		int bit;
+	} Entry;
+	typedef struct Table {
+		int size, n;
+		struct Table *old;     // kept, since somebody may still be looking at it
+		Entry e[1];            // [size]
+	} Table;
+	static Entry *find(Table *t, int id);
+	static Table * volatile table;
+	static int bits;
+	static volatile int lock;
+};
+
+class ContaminantProfileView;
+
 class ContaminantProfile
 {
 public:
 	ContaminantProfile();
 	ContaminantProfile( ContaminantProfile* );
+	ContaminantProfile( ContaminantProfileView* );
 	ContaminantProfile( void*, int );
 	~ContaminantProfile();
 	void *GetState( int *sz );
 
+	static void *operator new( size_t );
+	static void operator delete( void*, size_t );
+
 	typedef struct _Contaminant {
-		char *name;
+		char *name;          // interned, don't free it
 		double mass;
+		int id;              // ContaminantNames::Id(name)
 	} Contaminant;
 	int N;
 	Contaminant *c_list;
 
 	int AddContaminant( char *name, double mass );
+	void Reserve( int n );
 
 private:
 	void *pack_list( int* );
 	void *pack_struct( int, int* );
 	void unpack_list( void*, int );
 	void unpack_struct( int, void*, int );
+	int cap;
+	// a short list is kept here, in the same arena block as the rest;
+	// 4 makes the whole of it fit 128 bytes on a 64 bit machine
+	enum { INPLACE = 4 };
+	Contaminant inplace[INPLACE];
+};
+
+// A borrowed, read only look at somebody else's profile.  It is only good
+// until the owner next changes its profile (i.e. for the current tick);
+// use ContaminantProfile(ContaminantProfileView*) to keep a copy.
+
+class ContaminantProfileView
+{
+public:
+	ContaminantProfileView();
+	~ContaminantProfileView();
+	void Borrow( ContaminantProfile *p );
+	void Release();
+	int Mass( int id, double *mass );  // boolean
+
+	int N;
+	ContaminantProfile::Contaminant *c_list;
+
+	// room to receive a small profile in place
+	enum { INPLACE = 8 };
+	ContaminantProfile::Contaminant buf[INPLACE];
+	void *own;                         // a bigger one we had to take
 };
 
 #endif
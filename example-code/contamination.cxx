@@ -146,11 +146,71 @@
 
 #include "contamination.hxx"
 #include "contsrc.hxx"
+#include "paramcorpus.hxx"
+#include "contstream.hxx"
+#include "contparallel.hxx"
+#include "contnuma.hxx"
 
 #include "memchk.h"
 
 /*-  Local variables, constants, and defines  */
 
+// the adaptive step: aim a little under the tolerance, and don't move
+// too far from the last step in one go
+#define STEP_SAFETY 0.9
+#define STEP_SHRINK 0.2
+#define STEP_GROW 5.0
+
+// CommitIntoxicateMany's chunks: fixed, so that they don't depend on
+// the number of threads
+#define MANY_CHUNK 32
+
+// how many concentrations (or loads) go to EndpointTable::values() at once
+#define LETHAL_BATCH 64
+
+// InitMany's and ReInitBatch's
+typedef struct {
+	Contamination **c;
+	int n;
+	char **taxon, **name; // 0 for ReInitBatch
+	int *ok;             // per agent; -1 until it's been done
+} InitJob;
+
+// how many commits in a row an agent has to be in chunks another node
+// owns before it's moved there
+#define REHOME_AFTER 4
+
+// what a chunk of CommitIntoxicateMany would have done in passing, to be
+// done in order once they've all finished
+typedef struct {
+	Contamination *who;
+	int stream;          // a stream_tick rather than a death
+	double t, died, left, imass;
+	char *cause;
+	R3 loc;
+} Deferred;
+
+typedef struct {
+	int n, max;
+	Deferred *d;
+	double lost;         // members, over the chunk's agents in order
+} DeferredLog;
+
+static __thread DeferredLog *deferring = 0;
+
+static Deferred *defer(Contamination *who) {
+	DeferredLog *l = deferring;
+	if (l->n >= l->max) {
+		l->max = l->max?2*l->max:16;
+		l->d = (Deferred *)Realloc(l->d, l->max*sizeof(Deferred));
+		if (!l->d) abort();
+	}
+	Deferred *d = l->d + l->n++;
+	memset(d, 0, sizeof(*d));
+	d->who = who;
+	return d;
+}
+
 /*-  Code  */
 
 /*-- serialisation code for the individual contaminants */
@@ -160,9 +220,10 @@ void *Contamination::Get_cinfo_State(int i, int *len) {
 	assert(len);
 	void *v[2];
 	int l[2];
+	double load = hot.load[i];   // always a double in the state, whatever we store
 
-	v[0] = &cinfo[i].current_load;
-	l[0] = sizeof(cinfo[i].current_load);
+	v[0] = &load;
+	l[0] = sizeof(load);
 	assert(cinfo[i].name);
 	v[1] = cinfo[i].name;
 	l[1] = strlen(cinfo[i].name)+1;
@@ -179,12 +240,12 @@ void Contamination::Set_cinfo_State(void *data, int len, int i) {
 
 	assert(v[0]);
 	assert(l[0] == sizeof(double));
-	cinfo[i].current_load = *(double *)v[0];
-	if (cinfo[i].name) Free(cinfo[i].name);
+	hot.load[i] = *(double *)v[0];
 
 	assert(v[1]);
 	assert(l[1] > 1);
-	cinfo[i].name = Strdup((char *)v[1]);
+	cinfo[i].id = ContaminantNames::Id((char *)v[1]);
+	cinfo[i].name = ContaminantNames::Name(cinfo[i].id);
 	Free(v);
 	Free(l);
 }
@@ -196,11 +257,35 @@ double Contamination::Level(char *name) {
 	if (!member_cube) return DNaN;
 	assert(cinfo);
 	for (i = 0; i < n_cinfo; i++) {
-		if (!strcmp(name, cinfo[i].name)) return cinfo[i].current_load;
+		if (!strcmp(name, cinfo[i].name)) return hot.load[i];
+	}
+	return DNaN;
+}
+
+/*-- the parameter ensemble -- member 0 is the agent itself */
+
+/*--- int Contamination::EnsembleMembers() -- */
+int Contamination::EnsembleMembers() {
+	return ensemble?ensemble->M+1:1;
+}
+
+/*--- double Contamination::EnsembleLevel(char *name, int m) -- Level() for member m */
+double Contamination::EnsembleLevel(char *name, int m) {
+	if (m == 0) return Level(name);
+	if (!ensemble || m < 0 || m > ensemble->M) return DNaN;
+	for (int i = 0; i < n_cinfo; i++) {
+		if (!strcmp(name, cinfo[i].name)) return ensemble->load[i*ensemble->M + m-1];
 	}
 	return DNaN;
 }
 
+/*--- double Contamination::EnsembleSurvivors(int m) -- cgetMembers() for member m */
+double Contamination::EnsembleSurvivors(int m) {
+	if (m == 0) return member_cube?cgetMembers():DNaN;
+	if (!ensemble || !member_cube || m < 0 || m > ensemble->M) return DNaN;
+	return ensemble->Members(m-1, member_cube);
+}
+
 
 /*-- serialisation code for the whole set of  contaminants */
 
@@ -210,9 +295,9 @@ void *Contamination::GetState(int* len) {
 	void **v = 0, *d = 0;
 	int i, *l = 0;
 
-	v = (void **)Calloc(n_cinfo + 4, sizeof(void *));
+	v = (void **)Calloc(n_cinfo + 5, sizeof(void *));
 	if (!v) abort();
-	l = (int *)Calloc(n_cinfo + 4, sizeof(int));
+	l = (int *)Calloc(n_cinfo + 5, sizeof(int));
 	if (!l) abort();
 
 
@@ -232,9 +317,17 @@ void *Contamination::GetState(int* len) {
 		v[i+4] = Get_cinfo_State(i, &l[i+4]);
 	}
 
-	d = pack_mem(v, l, 4 + n_cinfo, len);
+	// the ensemble, if there is one, goes on the end
+	if (ensemble) {
+		l[n_cinfo+4] = ensemble->StateSize();
+		v[n_cinfo+4] = Malloc(l[n_cinfo+4]);
+		if (!v[n_cinfo+4]) abort();
+		ensemble->PutState(v[n_cinfo+4]);
+	}
+
+	d = pack_mem(v, l, 4 + n_cinfo + (ensemble?1:0), len);
 	if (v[2]) Free(v[2]);
-	for (i = 0; i < n_cinfo; i++) {
+	for (i = 0; i < n_cinfo + 1; i++) {
 		if (v[i+4]) Free(v[i+4]);
 	}
 
@@ -256,10 +349,12 @@ void Contamination::SetState(void *data, int len) {
 	assert(l[1] == sizeof(int));
 			 
 	n_cinfo = *(int*)v[1];
-	assert(n_cinfo == n-4);
+	assert(n == n_cinfo+4 || n == n_cinfo+5);
 
 	if (cinfo) free_cinfo();
 	if (member_cube) delete member_cube;
+	if (ensemble) delete ensemble;
+	ensemble = 0;
 
 	if (ctaxon) {
 		Free(ctaxon);
@@ -279,15 +374,20 @@ void Contamination::SetState(void *data, int len) {
 		member_cube = new Cube(n_cinfo+1);
 		member_cube->SetState(v[2], l[2]);
 	}
+	if (n == n_cinfo+5) {
+		ensemble = new ContaminantEnsemble(v[n_cinfo+4], l[n_cinfo+4]);
+		if (!ensemble) abort();
+	}
 	if (n_cinfo > 0) {
 
 		cinfo = (_cinfo*)Calloc(n_cinfo, sizeof(_cinfo));
 		if (!cinfo) abort();
+		attach_hot();
 		
 		for (int i = 0; i < n_cinfo; i++) {
-			cinfo[i].vbid = -1;
+			cinfo[i].vbid = cinfo[i].programs.vbid = -1;
 			cinfo[i].name = 0;
-			cinfo[i].current_load = 0;
+			hot.load[i] = 0;
 		}
 
 		for (int i = 0; i < n_cinfo; i++) {
@@ -300,8 +400,140 @@ void Contamination::SetState(void *data, int len) {
 	// and should be done in ReInit or PostInit
 }
 
+/*-- flat serialisation -- written and read in place (shared memory transport) */
+/*
+  Layout, everything on eight byte boundaries:
+	int n_cinfo, taxon length, name length, cube length
+	cube state (as Cube::GetState)
+	ctaxon, cname
+	for each contaminant:	double current_load, int name length, int pad, name
+	int ensemble length, int pad, ensemble state (as ContaminantEnsemble::PutState)
+*/
+
+#define FLAT_ROUND(x) (((x)+7) & ~7)
+
+/*--- int Contamination::StateSize() -- bytes needed by PutState */
+int Contamination::StateSize() {
+	int sz = 4*sizeof(int);
+
+	if (member_cube) sz += member_cube->StateSize();
+	sz += FLAT_ROUND(ctaxon?strlen(ctaxon)+1:0);
+	sz += FLAT_ROUND(cname?strlen(cname)+1:0);
+	for (int i = 0; i < n_cinfo; i++) {
+		assert(cinfo[i].name);
+		sz += sizeof(double) + 2*sizeof(int) + FLAT_ROUND(strlen(cinfo[i].name)+1);
+	}
+	sz += 2*sizeof(int) + FLAT_ROUND(ensemble?ensemble->StateSize():0);
+	return sz;
+}
+
+/*--- int Contamination::PutState(void *data, int len) -- package things into a buffer we don't own */
+int Contamination::PutState(void *data, int len) {
+	char *p = (char *)data;
+	int *h = (int *)data;
+
+	assert(data);
+	if (len < StateSize()) return 0;
+
+	h[0] = n_cinfo;
+	h[1] = ctaxon?strlen(ctaxon)+1:0;
+	h[2] = cname?strlen(cname)+1:0;
+	h[3] = member_cube?member_cube->StateSize():0;
+	p += 4*sizeof(int);
+
+	if (member_cube) member_cube->PutState(p, h[3]);
+	p += h[3];
+	if (ctaxon) memcpy(p, ctaxon, h[1]);
+	p += FLAT_ROUND(h[1]);
+	if (cname) memcpy(p, cname, h[2]);
+	p += FLAT_ROUND(h[2]);
+
+	for (int i = 0; i < n_cinfo; i++) {
+		int l = strlen(cinfo[i].name)+1;
+		*(double *)p = hot.load[i];
+		p += sizeof(double);
+		((int *)p)[0] = l;
+		((int *)p)[1] = 0;
+		p += 2*sizeof(int);
+		memcpy(p, cinfo[i].name, l);
+		p += FLAT_ROUND(l);
+	}
+
+	((int *)p)[0] = ensemble?ensemble->StateSize():0;
+	((int *)p)[1] = 0;
+	p += 2*sizeof(int);
+	if (ensemble) {
+		ensemble->PutState(p);
+		p += FLAT_ROUND(ensemble->StateSize());
+	}
+
+	assert(p - (char *)data == StateSize());
+	return 1;
+}
+
+/*--- Contamination::SetStateInPlace(void *data, int len) -- unpackage from PutState without copying the message */
+void Contamination::SetStateInPlace(void *data, int len) {
+	char *p = (char *)data;
+	int *h = (int *)data;
+
+	assert(data);
+	assert(len >= (int)(4*sizeof(int)));
+
+	if (cinfo) free_cinfo();
+	if (member_cube) delete member_cube;
+	member_cube = 0;
+	if (ensemble) delete ensemble;
+	ensemble = 0;
+	if (ctaxon) Free(ctaxon);
+	ctaxon = 0;
+	if (cname) Free(cname);
+	cname = 0;
+
+	n_cinfo = h[0];
+	p += 4*sizeof(int);
+
+	if (h[3] > 0) {
+		member_cube = new Cube(n_cinfo+1);
+		member_cube->SetState(p, h[3]);
+	}
+	p += h[3];
+	if (h[1]) ctaxon = Strdup(p);
+	p += FLAT_ROUND(h[1]);
+	if (h[2]) cname = Strdup(p);
+	p += FLAT_ROUND(h[2]);
+
+	if (n_cinfo > 0) {
+		cinfo = (_cinfo*)Calloc(n_cinfo, sizeof(_cinfo));
+		if (!cinfo) abort();
+		attach_hot();
+
+		for (int i = 0; i < n_cinfo; i++) {
+			cinfo[i].vbid = cinfo[i].programs.vbid = -1;
+			hot.load[i] = *(double *)p;
+			p += sizeof(double);
+			int l = ((int *)p)[0];
+			assert(l > 1);
+			p += 2*sizeof(int);
+			cinfo[i].id = ContaminantNames::Id(p);  // the name is the registered copy, not the message's
+			cinfo[i].name = ContaminantNames::Name(cinfo[i].id);
+			p += FLAT_ROUND(l);
+		}
+	}
+
+	int el = ((int *)p)[0];
+	p += 2*sizeof(int);
+	if (el > 0) {
+		ensemble = new ContaminantEnsemble(p, el);
+		if (!ensemble) abort();
+	}
+	p += FLAT_ROUND(el);
+	assert(p - (char *)data <= len);
+}
+
+#undef FLAT_ROUND
+
 /*-- Contamination::Reset()  -- reset (zero) contamination data */
-void 
+void Contamination::Reset() {
 	PrmEnvExpr::Reset();
 	ContaminantSink::Reset();
 	DeathLogger::Reset();
@@ -310,6 +542,13 @@ void
 	cinfo = 0;
 	n_cinfo = 0;
 	member_cube = 0;
+	hot_pool = 0;
+	hot_slot = -1;
+	away = 0;
+	memset(&hot, 0, sizeof(hot));
+	memset(&stream, 0, sizeof(stream));
+	ensemble = 0;
+	ingested.head = 0;
 }
 
 /*-- int Contamination::ReInit(int attach) -- reinitialise after moving between kernels */
@@ -322,6 +561,114 @@ int Contamination::ReInit(int attach) {
 }
 
 
+/*-- batch migration -- many agents in one message */
+
+/*--- void *Contamination::GetBatchState(Contamination **agents, int n, int *len) -- package a group of agents */
+// Each agent contributes its sink state and its contamination state, in that order.
+void *Contamination::GetBatchState(Contamination **agents, int n, int *len) {
+	assert(agents);
+	assert(len);
+	assert(n > 0);
+	void **v = 0, *d = 0;
+	int i, *l = 0;
+
+	v = (void **)Calloc(2*n + 1, sizeof(void *));
+	if (!v) abort();
+	l = (int *)Calloc(2*n + 1, sizeof(int));
+	if (!l) abort();
+
+	v[0] = &n;
+	l[0] = sizeof(n);
+	for (i = 0; i < n; i++) {
+		assert(agents[i]);
+		v[2*i+1] = agents[i]->ContaminantSink::GetState(&l[2*i+1]);
+		v[2*i+2] = agents[i]->Contamination::GetState(&l[2*i+2]);
+	}
+
+	d = pack_mem(v, l, 2*n + 1, len);
+	for (i = 1; i < 2*n + 1; i++) {
+		if (v[i]) Free(v[i]);
+	}
+
+	Free(v);
+	Free(l);
+
+	return d;
+}
+
+/*--- int Contamination::SetBatchState(Contamination **agents, int n, void *data, int len) -- unpackage a group */
+// The agents must already exist (the kernel makes them); they are restored in
+// message order and then reattached with ReInitBatch.
+int Contamination::SetBatchState(Contamination **agents, int n, void *data, int len) {
+	assert(agents);
+	assert(data);
+	void **v;
+	int *l, m;
+
+	m = unpack_mem(data, len, &v, &l);
+	assert(m >= 1);
+	assert(v[0]);
+	assert(l[0] == sizeof(int));
+	if (*(int *)v[0] != n || m != 2*n + 1) {
+		warning("Batch of %d contaminated agents delivered to %d agents", *(int *)v[0], n);
+		Free(v); Free(l);
+		return 0;
+	}
+
+	for (int i = 0; i < n; i++) {
+		assert(agents[i]);
+		agents[i]->ContaminantSink::SetState(v[2*i+1], l[2*i+1]);
+		agents[i]->Contamination::SetState(v[2*i+2], l[2*i+2]);
+	}
+	Free(v); Free(l);
+
+	return ReInitBatch(agents, n);
+}
+
+/*--- int Contamination::ReInitBatch(Contamination **agents, int n) -- reattach a group in one pass */
+// As InitMany: the first agent of each taxon loads the per-taxon setup
+// (if it isn't already resident) on its own, and the rest, which only
+// find it and fill in their own blocks, go on the contaminantparallel
+// pool.  Returns the number of agents successfully reattached.
+int Contamination::ReInitBatch(Contamination **agents, int n) {
+	assert(agents);
+	if (n <= 0) return 0;
+
+	InitJob job;
+	int j, k, nseen = 0, done = 0;
+	char **seen = (char **)Calloc(n, sizeof(char *));
+	job.c = agents;
+	job.n = n;
+	job.taxon = job.name = 0;
+	job.ok = (int *)Malloc(n*sizeof(int));
+	if (!seen || !job.ok) abort();
+
+	for (j = 0; j < n; j++) {
+		assert(agents[j] && agents[j]->ctaxon);
+		job.ok[j] = -1;
+		for (k = 0; k < nseen && strcmp(seen[k], agents[j]->ctaxon); k++) ;
+		if (k < nseen) continue;
+		seen[nseen++] = agents[j]->ctaxon;
+		job.ok[j] = agents[j]->reinit_one();
+	}
+	VERBOSE("ContaminationReInitBatch", "%d agents of %d taxa", n, nseen);
+
+	ContaminantParallel::Run((n + MANY_CHUNK - 1) / MANY_CHUNK, init_chunk, &job);
+
+	for (j = 0; j < n; j++) done += job.ok[j];
+	Free(seen);
+	Free(job.ok);
+	return done;
+}
+
+/*--- int Contamination::reinit_one() -- ReInitBatch's ReInit(1), with the complaint */
+int Contamination::reinit_one() {
+	if (Contamination::ReInit(1)) return 1;
+	warning("Failed to reattach %s (%s) after migration", cname?cname:"?", ctaxon?ctaxon:"?");
+	return 0;
+}
+
+
 /*-- Contamination::zero() -- zero out data without freeing */
 void Contamination::zero()
 {
@@ -330,6 +677,13 @@ void Contamination::zero()
 	cinfo = 0;
 	n_cinfo = 0;
 	member_cube = 0;
+	hot_pool = 0;
+	hot_slot = -1;
+	away = 0;
+	memset(&hot, 0, sizeof(hot));
+	memset(&stream, 0, sizeof(stream));
+	ensemble = 0;
+	ingested.head = 0;
 }
 
 /*-- Constructors / destructors  for Contamination */
@@ -350,6 +704,11 @@ Contamination::~Contamination()
 		delete member_cube;
 		member_cube = 0;
 	}
+	if (ensemble) {
+		delete ensemble;
+		ensemble = 0;
+	}
+	ContaminantIngest::Discard(&ingested);
 }
 
 
@@ -412,14 +771,95 @@ ContaminantSink { # Juvenile sharks
 /*--- Contamination::Shutdown() -- make deathlogger spit out any unsaved data and close files */
 int Contamination::Shutdown()
 {
-	if (!DeathLogger::Shutdown()) return 0;;
+	if (!DeathLogger::Shutdown()) return 0;
 	for (int i=0;i<n_cinfo;i++) {
 		VERBOSE("Contamination::Shutdown", "ctaxon %s contaminant %s load %g",
-			ctaxon, cinfo[i].name, cinfo[i].current_load);
+			ctaxon, cinfo[i].name, hot.load[i]);
 	}
+	dump_precision();
 	return 1;
 }
 
+/*--- Contamination::ShutdownAll() -- once the agents have stopped ticking and been shut down */
+void Contamination::ShutdownAll()
+{
+	ContaminantNuma::Report();
+	ContaminantStream::Close();
+	CPROF_SHUTDOWN();
+}
+
+/*--- Contamination::dump_precision() -- final state to $CONT_PRECISION_DUMP, for contprec */
+// One line per value: taxon, agent, what, value.  Run the reference
+// scenario with and without CONT_FLOAT_STORAGE and compare the two files
+// with contprec to see how far the reduced precision run has drifted.
+void Contamination::dump_precision()
+{
+	static char *file = (char *)-1;
+	if (file == (char *)-1) file = getenv("CONT_PRECISION_DUMP");
+	if (!file || !ctaxon) return;
+
+	FILE *f = fopen(file, "a");
+	if (!f) {
+		warning("Unable to append to %s", file);
+		return;
+	}
+	char *agent = cname?cname:(char *)"-";
+	for (int i = 0; i < n_cinfo; i++) {
+		fprintf(f, "%s\t%s\tload:%s\t%.17g\n", ctaxon, agent, cinfo[i].name, (double)hot.load[i]);
+	}
+	if (member_cube) {
+		int sz;
+		double *d = (double *)member_cube->GetState(&sz);
+		fprintf(f, "%s\t%s\tmembers\t%.17g\n", ctaxon, agent, member_cube->Value());
+		for (int i = 2; i < sz/(int)sizeof(double); i++) {
+			fprintf(f, "%s\t%s\taxis:%d\t%.17g\n", ctaxon, agent, i-2, d[i]);
+		}
+		Free(d);
+	}
+	fclose(f);
+}
+
+/*--- Contamination::stream_tick(double t, R3 *loc) -- this tick's rows for the ContaminantStream */
+void Contamination::stream_tick(double t, R3 *loc)
+{
+	ContaminantStream::Row r;
+
+	// the names change when we migrate or are renamed, so check them
+	if (!stream.tname || !ctaxon || strcmp(stream.tname, ctaxon)) {
+		stream.taxon = ContaminantStream::Id(ctaxon);
+		stream.tname = ContaminantStream::Name(stream.taxon);
+	}
+	if (!stream.wname || !cname || strcmp(stream.wname, cname)) {
+		stream.who = ContaminantStream::Id(cname);
+		stream.wname = ContaminantStream::Name(stream.who);
+	}
+
+	r.t = t;
+	r.taxon = stream.taxon;
+	r.who = stream.who;
+	r.x = loc->x;
+	r.y = loc->y;
+	r.reproduction = r.foraging = r.movement = DNaN;
+
+	for (int i = 0; i < n_cinfo; i++) {
+		if (!cinfo[i].cs) continue;
+		// set with the setup, unless the stream was opened after it
+		r.contaminant = cinfo[i].cs->stream_id?cinfo[i].cs->stream_id:ContaminantStream::Id(cinfo[i].name);
+		r.load = hot.load[i];
+		r.survival = 1.0 - member_cube->level(i+1);
+		ContaminantStream::Add(&r);
+	}
+
+	r.contaminant = 0;
+	r.load = DNaN;
+	r.survival = cgetMembers();
+	int wanted = ContaminantStream::Columns();
+	if (wanted & ContaminantStream::REPRODUCTION) r.reproduction = getReproductiveImpairment(t);
+	if (wanted & ContaminantStream::FORAGING) r.foraging = getForagingImpairment(t);
+	if (wanted & ContaminantStream::MOVEMENT) r.movement = getMovementImpairment(t);
+	ContaminantStream::Add(&r);
+}
+
 /*--- Contamination::free_cinfo() -- free data */
 void Contamination::free_cinfo()
 {
@@ -429,19 +869,88 @@ void Contamination::free_cinfo()
 
 	for (int i=0;i<n_cinfo;i++) {
 		assert(cinfo[i].name);
-		Free(cinfo[i].name);
+		if (cinfo[i].cs) ContaminantTaxon::Drop(cinfo[i].cs);
 		if (cinfo[i].DT) CCalc::FreeCalcVar(cinfo[i].DT);
 		if (cinfo[i].imassv) CCalc::FreeCalcVar(cinfo[i].imassv);
 		if (cinfo[i].concv) CCalc::FreeCalcVar(cinfo[i].concv);
 		if (cinfo[i].atev) CCalc::FreeCalcVar(cinfo[i].atev);
 		if (cinfo[i].currentloadv) CCalc::FreeCalcVar(cinfo[i].currentloadv);
 	}
+	if (ensemble) ensemble->FreeRefs(); // they point into the evaluator blocks
 	Free(cinfo);
 	cinfo = 0;
+	detach_hot();
 	n_cinfo = 0;
 }
 
 
+/*-- Contamination::attach_hot() -- get a slot in the taxon's pool for conc, ate, current_load and tick */
+void Contamination::attach_hot() {
+	assert(ctaxon);
+	assert(n_cinfo > 0);
+	if (hot_pool) return;
+
+	hot_pool = ContaminantHot::Get(ctaxon, n_cinfo, ContaminantNuma::Here());
+	hot_slot = hot_pool->Alloc(&hot);
+}
+
+/*-- Contamination::rehome(int node) -- our state to node, from a thread there (see contnuma.hxx) */
+// The copies are all exact, so moving makes no difference to the results.
+// It's done on commit_chunk()'s worker; only the pools are shared, and
+// they lock.
+void Contamination::rehome(int node) {
+	assert(hot_pool);
+	if (hot_pool->Node() == node) return;
+	ContaminantNuma::Move();
+
+	ContaminantHot::Row r;
+	ContaminantHot *p = ContaminantHot::Get(ctaxon, n_cinfo, node);
+	int slot = p->Alloc(&r);
+	memcpy(r.conc, hot.conc, n_cinfo*sizeof(cont_real));
+	memcpy(r.ate, hot.ate, n_cinfo*sizeof(cont_real));
+	memcpy(r.load, hot.load, n_cinfo*sizeof(cont_real));
+	memcpy(r.tick, hot.tick, n_cinfo*sizeof(cont_real));
+	hot_pool->Release(hot_slot);
+	hot_pool = p;
+	hot_slot = slot;
+	hot = r;
+
+	_cinfo *c = (_cinfo *)Malloc(n_cinfo*sizeof(_cinfo));
+	if (!c) abort();
+	memcpy(c, cinfo, n_cinfo*sizeof(_cinfo));
+	Free(cinfo);
+	cinfo = c;
+
+	if (ensemble) ensemble->Rehome();
+	if (member_cube) {
+		int sz;
+		void *d = member_cube->GetState(&sz);
+		Cube *m = new Cube(1);
+		if (!m) abort();
+		m->SetState(d, sz);
+		Free(d);
+		delete member_cube;
+		member_cube = m;
+	}
+	if (profile) {
+		ContaminantProfile *q = new ContaminantProfile(profile);
+		if (!q) abort();
+		delete profile;
+		profile = q;
+	}
+}
+
+/*-- Contamination::detach_hot() -- */
+void Contamination::detach_hot() {
+	if (!hot_pool) return;
+	hot_pool->Release(hot_slot);
+	hot_pool = 0;
+	hot_slot = -1;
+	away = 0;
+	memset(&hot, 0, sizeof(hot));
+}
+
+
 /*-- Contamination::OverrideLocalMembers() -- boolean for presence of a member_cube  */
 int Contamination::OverrideLocalMembers()
 {
@@ -465,73 +974,352 @@ void Contamination::csetMembers(double m) {
 /*-- Contamination::load_LC(char *s, char *tag, EndpointSurf *ES) -- load the contaminant profile for the indicated vulnerable taxon */
 
 int Contamination::load_LC(char *s, char *tag, EndpointSurf *ES) {
-	char *points = PGetS(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, tag, (char *)0);
+	char *points = ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, tag, (char *)0)->S();
 
 	if (!points) {
 		// It's ok -- we don't have anything to load.
 		VERBOSE("Poisoning", "No contaminant stuff for %s", ctaxon);		
 		return 0;
 	}
-	else {
-		char conc0[30] = "", conc1[30] = "";
-		char time0[30] = "", time1[30] = "";
-		double p0= 0, p1 = 0, c0 = 0, c1 = 0, t0 = 0, t1 = 0;
+	return parse_LC(points, ES);
+}
+
+/*--- Contamination::parse_LC(char *points, EndpointSurf *ES) -- set ES from an LC string ("none" leaves it alone) */
+int Contamination::parse_LC(char *points, EndpointSurf *ES) {
+	char conc0[30] = "", conc1[30] = "";
+	char time0[30] = "", time1[30] = "";
+	double p0= 0, p1 = 0, c0 = 0, c1 = 0, t0 = 0, t1 = 0;
 
-		int n = sscanf(points, " %lf %% %[^@ ] @ %[^, ], %lf %% %[^@ ] @ %s", &p0, conc0, time0, &p1, conc1, time1);
-		if (n != 6) {
-			if (!strcasecmp(points,"none")) return 1;
+	int n = sscanf(points, " %lf %% %[^@ ] @ %[^, ], %lf %% %[^@ ] @ %s", &p0, conc0, time0, &p1, conc1, time1);
+	if (n != 6) {
+		if (!strcasecmp(points,"none")) return 1;
 	 
-			fatal(1,"The format of a LC string needs to be 'none' or like\n\t40%% 120[mg/l] @ 48[hours], 75%% 150[mg/l] @ 92[hours]\n"
-				"I parsed %d things in the string '%s'\n	#1 %f '%s' '%s'\n	#2 %f '%s' '%s'\n", n, points,
-				p0, conc0, time0, p1, conc1, time1);
-		}
-		p0 = p0/100.0;
-		p1 = p1/100.0;
+		fatal(1,"The format of a LC string needs to be 'none' or like\n\t40%% 120[mg/l] @ 48[hours], 75%% 150[mg/l] @ 92[hours]\n"
+			"I parsed %d things in the string '%s'\n	#1 %f '%s' '%s'\n	#2 %f '%s' '%s'\n", n, points,
+			p0, conc0, time0, p1, conc1, time1);
+	}
+	p0 = p0/100.0;
+	p1 = p1/100.0;
+
+	if (strlen(conc0) >= 30) fatal(1,"String too long in contaminant spec");
+	if (strlen(conc1) >= 30) fatal(1,"String too long in contaminant spec");
+	if (strlen(time0) >= 30) fatal(1,"String too long in contaminant spec");
+	if (strlen(time1) >= 30) fatal(1,"String too long in contaminant spec");
+
+	CCalc cc;
+	c0 = cc.UnitEvaluate(conc0);
+	t0 = cc.UnitEvaluate(time0);
+	c1 = cc.UnitEvaluate(conc1);
+	t1 = cc.UnitEvaluate(time1);
+	if (!ES->SetSurface(p0,c0,t0,p1,c1,t1)) abort();
+	return 1;
+}
+
+
+/*-- Contamination::load_LC_table(char *s, char *which, EndpointSurf *ES) -- tabulate a lethal surface */
+/*
+  Only if the contaminant block asks for it:
+
+			lc_table {
+				acute_min = 1[ug/l]		# grid limits for the water concentration
+				acute_max = 10[mg/l]
+				chronic_min = 1[ug]		# and for the tissue load
+				chronic_max = 1[g]
+				dt_max = 1[day]
+				tolerance = 1e-6		# absolute error in the proportion killed
+			}
+
+  If the table can't be made good to the tolerance we say so and use
+  the surface directly.
+*/
+
+EndpointTable *Contamination::load_LC_table(char *s, char *which, EndpointSurf *ES) {
+	char lo[32], hi[32];
+
+	snprintf(lo, sizeof(lo), "%s_min", which);
+	snprintf(hi, sizeof(hi), "%s_max", which);
+	if (!ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "lc_table", hi, (char *)0)->S()) return 0;
 
-		if (strlen(conc0) >= 30) fatal(1,"String too long in contaminant spec");
-		if (strlen(conc1) >= 30) fatal(1,"String too long in contaminant spec");
-		if (strlen(time0) >= 30) fatal(1,"String too long in contaminant spec");
-		if (strlen(time1) >= 30) fatal(1,"String too long in contaminant spec");
+	double cmin = ParamHandle::Resolve(PARAM_NOR|PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "lc_table", lo, (char *)0)->N();
+	double cmax = ParamHandle::Resolve(PARAM_NOR|PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "lc_table", hi, (char *)0)->N();
+	double dtmax = ParamHandle::Resolve(PARAM_NOR|PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "lc_table", "dt_max", (char *)0)->N();
+	double tol = ParamHandle::Resolve(PARAM_NOR|PARAM_NOU|PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "lc_table", "tolerance", (char *)0)->N();
 
-		CCalc cc;
-		c0 = cc.UnitEvaluate(conc0);
-		t0 = cc.UnitEvaluate(time0);
-		c1 = cc.UnitEvaluate(conc1);
-		t1 = cc.UnitEvaluate(time1);
-		if (!ES->SetSurface(p0,c0,t0,p1,c1,t1)) abort();
+	if (!(cmin > 0 && cmax > cmin && dtmax > 0 && tol > 0))
+		fatal(1, "The %s lc_table for %s in %s needs 0 < %s < %s, dt_max > 0 and tolerance > 0", which, s, ctaxon, lo, hi);
+
+	EndpointTable *et = new EndpointTable();
+	if (!et) abort();
+	if (!et->Build(ES, cmin, cmax, dtmax, tol)) {
+		warning("Unable to tabulate the %s LC surface for %s in %s to %g (got %g); using the surface",
+			which, s, ctaxon, tol, et->Error());
+		delete et;
+		return 0;
 	}
-	return 1;
+	VERBOSE("Poisoning", "%s LC surface for %s in %s tabulated, error %g", which, s, ctaxon, et->Error());
+	return et;
 }
 
 
 /*-- Contamination::ZapContaminantSetup(int i) -- get rid of all the machinery */
-
+// The program ids and variable references belong to the block, which
+// we keep (vbid), so they stay for ContaminantSetup to use again; they
+// go with free_cinfo().
 void Contamination::ZapContaminantSetup(int i) {
 	assert(i >= 0 && i < n_cinfo);
 	
 //	cinfo[i].vbid = -1;
 
-	cinfo[i].update.string = 0;
-	cinfo[i].update.id = -1;
+	if (cinfo[i].cs) ContaminantTaxon::Drop(cinfo[i].cs);
+	cinfo[i].cs = 0;
+
+	cinfo[i].env.configured = 0;
+
+	hot.tick[i] = DNaN;
+	hot.conc[i] = DNaN;
+	hot.ate[i] = 0;
+}
+
+
+/*--- prog_copy(char *s) -- a setup's own copy of a program */
+// The corpus, the parameter handles and the setup cache all go at a
+// reload, but a setup that agents still hold outlives them.
+static char *prog_copy(char *s) {
+	if (!s) return 0;
+	char *d = Strdup(s);
+	if (!d) abort();
+	return d;
+}
+
+/*-- Contamination::load_taxon_setup(char *s, ContaminantTaxon::Setup *cs) -- read the parameter corpus for contaminant s */
+int Contamination::load_taxon_setup(char *s, ContaminantTaxon::Setup *cs) {
+	assert(cs);
+
+	// What it all came to last time, if the parameters haven't changed
+	ContaminantSetupCache::Entry ce;
+	if (ContaminantSetupCache::Find(ctaxon, s, &ce)) return setup_from_cache(s, cs, &ce);
+
+	// Get parameters from the parameterisation corpus
+	cs->cont_tick = ParamHandle::Resolve(PARAM_NOR|PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "contaminant_tick", (char *)0)->N();
+	cs->update = prog_copy(ParamHandle::Resolve(PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "load_update", (char *)0)->S());
+
+	cs->reproduce = prog_copy(ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "reproductive_impairment", (char *)0)->S());
+	//if (!cs->reproduce) cs->reproduce = "0";
 
-	cinfo[i].reproduce.string = 0;
-	cinfo[i].reproduce.id = -1;
+	cs->forage = prog_copy(ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "foraging_impairment", (char *)0)->S());
+	//if (!cs->forage) cs->forage = "0";
 
-	cinfo[i].forage.string = 0;
-	cinfo[i].forage.id = -1;
+	cs->move = prog_copy(ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "movement_impairment", (char *)0)->S());
+	//if (!cs->move) cs->move = "0";
+	
+	// Load the LC% data here
+	int caught = 0;
+	caught += load_LC(s, "acute_lethal", &cs->acute_lethal);
+	caught += load_LC(s, "chronic_lethal", &cs->chronic_lethal);
+	caught += load_LC(s, "reproduction", &cs->reproduction);
+	caught += load_LC(s, "movement", &cs->movement);
+	caught += load_LC(s, "foraging", &cs->foraging);
+	if (!caught) fatal(1,"You didn't specify a response for %s to contaminant %s", ctaxon, s);
+	else VERBOSE("Poisoning", "%s is sensitive to %d different pathologies for %s", ctaxon, caught, s);
+
+	// Optionally tabulate the lethal surfaces
+	cs->acute_table = load_LC_table(s, "acute", &cs->acute_lethal);
+	cs->chronic_table = load_LC_table(s, "chronic", &cs->chronic_lethal);
+
+	// Compiled versions of the programs, if contexprc has seen this corpus
+	char *keys[] = { ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s };
+	ContaminantNative::Defs *defs = ContaminantNative::LoadDefs(keys, 4);
+	cs->nupdate = ContaminantNative::Bind(cs->update, keys, 4, defs);
+	cs->nreproduce = ContaminantNative::Bind(cs->reproduce, keys, 4, defs);
+	cs->nforage = ContaminantNative::Bind(cs->forage, keys, 4, defs);
+	cs->nmove = ContaminantNative::Bind(cs->move, keys, 4, defs);
+	ContaminantNative::FreeDefs(defs);
+	if (cs->nupdate) VERBOSE("Poisoning", "%s uses a compiled load_update for %s", ctaxon, s);
+
+#if defined(CONT_PROFILE)
+	cs->prof = ContaminantProf::Slot(ctaxon, s);
+#endif
+
+	if (!load_adaptive(s, cs) || !load_ensemble(s, cs)) return 0;
+	cache_setup(s, cs);
+	return 1;
+}
 
-	cinfo[i].move.string = 0;
-	cinfo[i].move.id = -1;
+// in ContaminantSetupCache's LC_ order
+static const char *lc_tag[ContaminantSetupCache::LCS] = {
+	"acute_lethal", "chronic_lethal", "reproduction", "movement", "foraging"
+};
+
+/*-- Contamination::cache_setup(char *s, ContaminantTaxon::Setup *cs) -- for the next run (see contcache.hxx) */
+// The LC strings are looked up again, as load_LC did; it's only once
+// per taxon and contaminant.
+void Contamination::cache_setup(char *s, ContaminantTaxon::Setup *cs) {
+	ContaminantSetupCache::Entry ce;
+	int i;
 
-	if (cinfo[i].DT) cinfo[i].DT = CCalc::FreeCalcVar(cinfo[i].DT);
-	if (cinfo[i].concv) cinfo[i].concv = CCalc::FreeCalcVar(cinfo[i].concv);
-	if (cinfo[i].imassv) cinfo[i].imassv = CCalc::FreeCalcVar(cinfo[i].imassv);
-	if (cinfo[i].atev) cinfo[i].atev = CCalc::FreeCalcVar(cinfo[i].atev);
-	if (cinfo[i].currentloadv) cinfo[i].currentloadv = CCalc::FreeCalcVar(cinfo[i].currentloadv);
+	if (!ContaminantSetupCache::Active()) return;
+	memset(&ce, 0, sizeof(ce));
+	ce.cont_tick = cs->cont_tick;
+	ce.tolerance = cs->tolerance;
+	ce.min_tick = cs->min_tick;
+	ce.max_tick = cs->max_tick;
+	ce.prog[ContaminantSetupCache::P_UPDATE] = cs->update;
+	ce.prog[ContaminantSetupCache::P_FORAGE] = cs->forage;
+	ce.prog[ContaminantSetupCache::P_REPRODUCE] = cs->reproduce;
+	ce.prog[ContaminantSetupCache::P_MOVE] = cs->move;
+	for (i = 0; i < ContaminantSetupCache::LCS; i++)
+		ce.lc[i] = ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, lc_tag[i], (char *)0)->S();
+	if (cs->acute_table) ce.table[0] = cs->acute_table->GetState(&ce.tablesz[0]);
+	if (cs->chronic_table) ce.table[1] = cs->chronic_table->GetState(&ce.tablesz[1]);
+
+	ContaminantNativeProg *np[ContaminantSetupCache::PROGS] = { cs->nupdate, cs->nforage, cs->nreproduce, cs->nmove };
+	for (i = 0; i < ContaminantSetupCache::PROGS; i++) {
+		if (!np[i]) continue;
+		ce.native[i] = (char *)np[i]->text;
+		ce.nk[i] = np[i]->nk;
+		ce.k[i] = np[i]->k;
+	}
 
-	cinfo[i].tick = DNaN;
-	cinfo[i].conc = DNaN;
-	cinfo[i].ate = 0;
+	ContaminantSetupCache::Add(ctaxon, s, &ce);
+	for (i = 0; i < 2; i++) {
+		if (ce.table[i]) Free(ce.table[i]);
+	}
+}
+
+/*-- Contamination::setup_from_cache(char *s, ContaminantTaxon::Setup *cs, ContaminantSetupCache::Entry *ce) -- */
+// What load_taxon_setup would have done, without asking the
+// parameters anything but the ensemble's.
+int Contamination::setup_from_cache(char *s, ContaminantTaxon::Setup *cs, ContaminantSetupCache::Entry *ce) {
+	EndpointSurf *surf[ContaminantSetupCache::LCS] = {
+		&cs->acute_lethal, &cs->chronic_lethal, &cs->reproduction, &cs->movement, &cs->foraging
+	};
+	EndpointTable **table[2] = { &cs->acute_table, &cs->chronic_table };
+	int i;
+
+	cs->cont_tick = ce->cont_tick;
+	cs->tolerance = ce->tolerance;
+	cs->min_tick = ce->min_tick;
+	cs->max_tick = ce->max_tick;
+	cs->update = prog_copy(ce->prog[ContaminantSetupCache::P_UPDATE]);
+	cs->forage = prog_copy(ce->prog[ContaminantSetupCache::P_FORAGE]);
+	cs->reproduce = prog_copy(ce->prog[ContaminantSetupCache::P_REPRODUCE]);
+	cs->move = prog_copy(ce->prog[ContaminantSetupCache::P_MOVE]);
+	if (!cs->update) fatal(1, "The setup cache has no load_update for %s in %s", s, ctaxon);
+
+	for (i = 0; i < ContaminantSetupCache::LCS; i++) {
+		if (ce->lc[i]) parse_LC(ce->lc[i], surf[i]);
+	}
+	for (i = 0; i < 2; i++) {
+		if (!ce->table[i]) continue;
+		*table[i] = new EndpointTable();
+		if (!*table[i]) abort();
+		if (!(*table[i])->SetState(i?&cs->chronic_lethal:&cs->acute_lethal, ce->table[i], ce->tablesz[i]))
+			fatal(1, "The setup cache's %s table for %s in %s is broken", i?"chronic":"acute", s, ctaxon);
+	}
+
+	ContaminantNativeProg **np[ContaminantSetupCache::PROGS] = { &cs->nupdate, &cs->nforage, &cs->nreproduce, &cs->nmove };
+	for (i = 0; i < ContaminantSetupCache::PROGS; i++) {
+		if (ce->native[i]) *np[i] = ContaminantNative::Lookup(ce->native[i], ce->nk[i], ce->k[i]);
+	}
+	if (cs->nupdate) VERBOSE("Poisoning", "%s uses a compiled load_update for %s", ctaxon, s);
+
+#if defined(CONT_PROFILE)
+	cs->prof = ContaminantProf::Slot(ctaxon, s);
+#endif
+	VERBOSE("Poisoning", "%s's setup for %s is from the setup cache", ctaxon, s);
+	return load_ensemble(s, cs);
+}
+
+/*-- Contamination::load_adaptive(char *s, ContaminantTaxon::Setup *cs) -- the step controller's bounds, if it has any */
+/*
+  Without an adaptive block an exposed agent's step is held to
+  contaminant_tick.  With one it starts there, or at min_tick when an
+  exposure begins, and is then chosen each tick from how much conc and
+  current_load moved in the last one (see adapt_step()).  A commit
+  whose load moved further than tolerance allows is done again in
+  shorter steps (see retry_load()):
+
+			adaptive {
+				tolerance = 0.05		# relative change in conc or load per step
+				min_tick = 1[min]
+				max_tick = 6[hours]
+			}
+*/
+int Contamination::load_adaptive(char *s, ContaminantTaxon::Setup *cs) {
+	if (!ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "adaptive", "tolerance", (char *)0)->S()) return 1;
+
+	cs->tolerance = ParamHandle::Resolve(PARAM_NOR|PARAM_NOU|PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "adaptive", "tolerance", (char *)0)->N();
+	cs->min_tick = ParamHandle::Resolve(PARAM_NOR|PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "adaptive", "min_tick", (char *)0)->N();
+	cs->max_tick = ParamHandle::Resolve(PARAM_NOR|PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "adaptive", "max_tick", (char *)0)->N();
+
+	if (!(cs->tolerance > 0 && cs->min_tick > 0 && cs->max_tick >= cs->min_tick))
+		fatal(1, "The adaptive step for %s in %s needs tolerance > 0 and 0 < min_tick <= max_tick", s, ctaxon);
+	VERBOSE("Poisoning", "%s has an adaptive step for %s, %g to %g", ctaxon, s, cs->min_tick, cs->max_tick);
+	return 1;
+}
+
+/*-- Contamination::load_ensemble(char *s, ContaminantTaxon::Setup *cs) -- the other members' parameters for contaminant s */
+// See contensemble.hxx.  A member which doesn't mention s is just a
+// copy of the agent (as far as s goes).
+int Contamination::load_ensemble(char *s, ContaminantTaxon::Setup *cs) {
+	char mname[32];
+	char *keys[PCORPUS_MAXDEPTH] = { ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "ensemble", mname, "const" };
+	char *base[PCORPUS_MAXDEPTH] = { ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "const" };
+	int i, j;
+
+	assert(cs);
+	cs->members = ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "ensemble", "members", (char *)0)->I();
+	cs->member = 0;
+	if (cs->members < 2) {
+		cs->members = 1;
+		return 1;
+	}
+	if (cs->members > ENSEMBLE_MAX) fatal(1, "%s asks for an ensemble of %d members; the most is %d", ctaxon, cs->members, ENSEMBLE_MAX);
+
+	cs->member = (ContaminantEnsemble::Member *)Calloc(cs->members-1, sizeof(ContaminantEnsemble::Member));
+	if (!cs->member) abort();
+
+	for (j = 1; j < cs->members; j++) {
+		ContaminantEnsemble::Member *m = cs->member + j-1;
+		snprintf(mname, sizeof(mname), "member%d", j);
+
+		char **c = ParamCorpus::GetNodes(keys, 7);
+		for (m->n = 0; c && c[m->n]; m->n++) ;
+		if (m->n) {
+			m->name = (char **)Calloc(m->n, sizeof(char *));
+			m->value = (double *)Calloc(m->n, sizeof(double));
+			m->base = (double *)Calloc(m->n, sizeof(double));
+			if (!m->name || !m->value || !m->base) abort();
+		}
+		for (i = 0; i < m->n; i++) {
+			m->name[i] = Strdup(c[i]);
+			if (!m->name[i]) abort();
+			keys[7] = c[i];
+			m->value[i] = ParamCorpus::GetN(PARAM_NOR|PARAM_REQ, keys, 8);
+			base[5] = c[i];
+			m->base[i] = ParamCorpus::GetN(PARAM_NOR|PARAM_OPT, base, 6);
+			if (isnan(m->base[i]))
+				warning("%s of %s in %s sets %s, which isn't one of its constants", mname, s, ctaxon, c[i]);
+		}
+		if (c) Free(c);
+
+		char *lc = ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "ensemble", mname, "acute_lethal", (char *)0)->S();
+		if (lc) {
+			m->acute = new EndpointSurf();
+			if (!m->acute) abort();
+			parse_LC(lc, m->acute);
+		}
+		lc = ParamHandle::Resolve(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "ensemble", mname, "chronic_lethal", (char *)0)->S();
+		if (lc) {
+			m->chronic = new EndpointSurf();
+			if (!m->chronic) abort();
+			parse_LC(lc, m->chronic);
+		}
+
+		if (cs->nupdate && m->n) m->nupdate = ContaminantNative::Rebind(cs->nupdate, m->n, m->name, m->value);
+	}
+	VERBOSE("Poisoning", "%s carries an ensemble of %d for %s", ctaxon, cs->members, s);
+	return 1;
 }
 
 
@@ -549,54 +1337,59 @@ int Contamination::ContaminantSetup(char *s, int i) {
 	assert(cc);
 	
 	if (!cinfo[i].name) {
-		cinfo[i].name = Strdup(s);
-		cinfo[i].current_load = 0;
+		cinfo[i].name = ContaminantNames::Intern(s);
+		hot.load[i] = 0;
 	}
 	else if (cinfo[i].name != s) { 
 		abort();
 	}
-	
-	// Get parameters from the parameterisation corpus
-	cinfo[i].cont_tick = PGetN(PARAM_NOR|PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "contaminant_tick", (char *)0);
-	cinfo[i].update.string = PGetS(PARAM_REQ, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "load_update", (char *)0);
-
-	cinfo[i].reproduce.string = PGetS(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "reproductive_impairment", (char *)0);
-	//if (!cinfo[i].reproduce.string) cinfo[i].reproduce.string = "0";
-
-	cinfo[i].forage.string = PGetS(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "foraging_impairment", (char *)0);
-	//if (!cinfo[i].forage.string) cinfo[i].forage.string = "0";
-
-	cinfo[i].move.string = PGetS(PARAM_OPT, ctaxon, GetCName(CLASS_CONTSINK), "contaminants", s, "movement_impairment", (char *)0);
-	//if (!cinfo[i].move.string) cinfo[i].move.string = "0";
-	
-	// Load the LC% data here
-	int caught = 0;
-	caught += load_LC(s, "acute_lethal", &cinfo[i].acute_lethal);
-	caught += load_LC(s, "chronic_lethal", &cinfo[i].chronic_lethal);
-	caught += load_LC(s, "reproduction", &cinfo[i].reproduction);
-	caught += load_LC(s, "movement", &cinfo[i].movement);
-	caught += load_LC(s, "foraging", &cinfo[i].foraging);
-	if (!caught) fatal(1,"You didn't specify a response for %s to contaminant %s", ctaxon, s);
-	else VERBOSE("Poisoning", "%s is sensitive to %d different pathologies for %s", ctaxon, caught, s);
+	cinfo[i].id = ContaminantNames::Id(cinfo[i].name);
+
+	// Only the first agent of a taxon walks the parameter tree
+	ContaminantTaxon *ct = ContaminantTaxon::Get(ctaxon);
+	ContaminantTaxon::Setup *cs = ct->GetSetup(s);
+	if (!cs) {
+		cs = ct->AddSetup(s);
+		if (!load_taxon_setup(s, cs)) return 0;
+		if (ContaminantStream::Active()) cs->stream_id = ContaminantStream::Id(s);
+	}
 
-	
-	// Specific impairments
-	cinfo[i].update.id = cc->AddProgram(cinfo[i].update.string);
-	if (cinfo[i].forage.string) cinfo[i].forage.id = cc->AddProgram(cinfo[i].forage.string);
-	if (cinfo[i].move.string) cinfo[i].move.id = cc->AddProgram(cinfo[i].move.string);
-	if (cinfo[i].reproduce.string) cinfo[i].reproduce.id = cc->AddProgram(cinfo[i].reproduce.string);
+	cinfo[i].cs = cs;
+	ContaminantTaxon::Hold(cs);
+
+	// Specific impairments; a block keeps its programs, so they're only
+	// added again for a new block or a new setup (after a reload)
+	int fresh = cinfo[i].programs.vbid != cinfo[i].vbid;
+	if (fresh || cinfo[i].programs.serial != cs->serial) {
+		cinfo[i].update = cc->AddProgram(cinfo[i].cs->update);
+		cinfo[i].forage = cinfo[i].cs->forage?cc->AddProgram(cinfo[i].cs->forage):-1;
+		cinfo[i].move = cinfo[i].cs->move?cc->AddProgram(cinfo[i].cs->move):-1;
+		cinfo[i].reproduce = cinfo[i].cs->reproduce?cc->AddProgram(cinfo[i].cs->reproduce):-1;
+		cinfo[i].programs.vbid = cinfo[i].vbid;
+		cinfo[i].programs.serial = cs->serial;
+	}
 
-	assert(cinfo[i].update.id >= 0);
+	assert(cinfo[i].update >= 0);
 
 	// and initialise the rest
-	cinfo[i].DT = cc->GetVarRef2("dt");
-	cinfo[i].concv = cc->GetVarRef2("conc");
-	cinfo[i].imassv = cc->GetVarRef2("imass");
-	cinfo[i].atev = cc->GetVarRef2("ate");
-	cinfo[i].currentloadv = cc->GetVarRef2("current_load");
-	cinfo[i].tick = 0;
-	cinfo[i].conc = 0;
-	cinfo[i].ate = 0;
+	if (fresh || !cinfo[i].DT) {
+		if (cinfo[i].DT) CCalc::FreeCalcVar(cinfo[i].DT);
+		if (cinfo[i].concv) CCalc::FreeCalcVar(cinfo[i].concv);
+		if (cinfo[i].imassv) CCalc::FreeCalcVar(cinfo[i].imassv);
+		if (cinfo[i].atev) CCalc::FreeCalcVar(cinfo[i].atev);
+		if (cinfo[i].currentloadv) CCalc::FreeCalcVar(cinfo[i].currentloadv);
+		cinfo[i].DT = cc->GetVarRef2("dt");
+		cinfo[i].concv = cc->GetVarRef2("conc");
+		cinfo[i].imassv = cc->GetVarRef2("imass");
+		cinfo[i].atev = cc->GetVarRef2("ate");
+		cinfo[i].currentloadv = cc->GetVarRef2("current_load");
+	}
+	hot.tick[i] = 0;
+	hot.conc[i] = 0;
+	hot.ate[i] = 0;
+	memset(&cinfo[i].na, 0, sizeof(cinfo[i].na));
+	memset(&cinfo[i].env, 0, sizeof(cinfo[i].env));
+	memset(&cinfo[i].step, 0, sizeof(cinfo[i].step));
 
 	return 1;
 }
@@ -635,11 +1428,12 @@ int Contamination::init_contaminant_stuff() {
 	if (!cinfo) {
 		cinfo = (_cinfo*)Calloc(n_cinfo, sizeof(_cinfo));
 		if (!cinfo) abort();
+		attach_hot();
 		
 		for (i = 0; i < n_cinfo; i++) {
-			cinfo[i].vbid = -1;
+			cinfo[i].vbid = cinfo[i].programs.vbid = -1;
 			cinfo[i].name = 0;
-			cinfo[i].current_load = 0;
+			hot.load[i] = 0;
 		}
 	}
 
@@ -647,10 +1441,11 @@ int Contamination::init_contaminant_stuff() {
 		ZapContaminantSetup(i);
 
 		if (cinfo[i].name) s = cinfo[i].name;
-		else s = contaminants->GetInterest(j);
+		else s = contaminants->GetInterest(i);
 
 		ContaminantSetup(s, i);
 	}
+	ensemble_attach();
 
 	PsetMembers(DNaN);
 
@@ -695,6 +1490,38 @@ int Contamination::Compatibility()
 //}
 
 
+/*-- Contamination::configure_env(int i, double t, R3 *loc) -- environment for contaminant i's programs */
+// The environment an agent sees only changes with time and place, so
+// Configure() is done once per tick and location, however many of the
+// contaminant's programs (the load update and the impairments) are run
+// in the tick.  ValidateVariables() depends on the inputs as well (the
+// "variables" block is in terms of imass, current_load and so on), so
+// it is redone whenever any of those have changed since it was last run.
+void Contamination::configure_env(int i, double t, R3 *loc) {
+	ContaminantNativeArgs *a = &cinfo[i].na;
+	ContaminantNativeArgs *in = &cinfo[i].env.in;
+
+	if (!cinfo[i].env.configured || cinfo[i].env.t != t ||
+		 memcmp(&cinfo[i].env.loc, loc, sizeof(R3))) {
+		PrmEnvExpr::Configure(t, cinfo[i].vbid);
+		CPROF_COUNT(cinfo[i].cs->prof, CPROF_CONFIGURE);
+		cinfo[i].env.t = t;
+		cinfo[i].env.loc = *loc;
+		cinfo[i].env.configured = 1;
+		cinfo[i].env.validated = 0;
+	}
+
+	if (!cinfo[i].env.validated || in->t != a->t || in->dt != a->dt ||
+		 in->conc != a->conc || in->imass != a->imass || in->ate != a->ate ||
+		 in->current_load != a->current_load) {
+		PrmEnvExpr::ValidateVariables(cinfo[i].vbid);
+		CPROF_COUNT(cinfo[i].cs->prof, CPROF_VALIDATE);
+		*in = *a;
+		cinfo[i].env.validated = 1;
+	}
+}
+
+
 /*-- CommitIntoxicate(double t, double dt, double actual_dt) --  Commit any intoxication post behaviour */
 int Contamination::CommitIntoxicate(double t, double dt, double actual_dt)
 {
@@ -703,104 +1530,772 @@ int Contamination::CommitIntoxicate(double t, double dt, double actual_dt)
 	if (isnan(actual_dt)) { // Oops, we've popped our cogs.
 		return 1;
 	}
+	CPROF_START(t_commit);
 
-	int i;
-	double new_load = 0;
-	double k, *K = 0;
+	double *K = 0;
 	double old_members = member_cube->Value();
+	R3 loc = getLocation();
 
+	take_ingested();
 	K = (double *)Malloc(n_cinfo * sizeof(*K));
 	if (!K) abort();
 
-	// Collect K
-	for (i = 0, k = 0; i < n_cinfo; i++) {
-		RCCalc *cc = PrmEnvExpr::GetCCalc(cinfo[i].vbid);
-		assert(cc);
+	// Adjust acute mortality based on water concentration, after the
+	// loads have been brought up to date
+	Contamination *me = this;
+	double k;
+	kills(&me, 1, actual_dt, 0, K, &k);
+	update_loads(t, actual_dt, &loc);
+	if (k > 0) kill(t, K, "AcutePoisoning"); // This is mostly pertinent for populations and schools
 
-		K[i] = cinfo[i].acute_lethal.value(cinfo[i].conc, actual_dt);
-		if (K[i] > 0) {
-			VERBOSE("Poisoning", "%s conc = %f, load = %f K = %f", cinfo[i].name, cinfo[i].conc, cinfo[i].current_load, K[i]);
-		}
-		k += K[i];
+	// Adjust chronic mortality based on tissue load here
+	kills(&me, 1, actual_dt, 1, K, &k);
+	if (k > 0) kill(t, K, "ChronicPoisoning");
 
-		cc->SetVarRef2(cinfo[i].imassv, getIMass());
-		cc->SetVarRef2(cinfo[i].DT, actual_dt);
+	Free(K);
+	end_tick(t, actual_dt, &loc, old_members);
 
-		cc->SetVarRef2(cinfo[i].concv, cinfo[i].conc);
-		cc->SetVarRef2(cinfo[i].atev, cinfo[i].ate); // We aren't eating t, stuff
-		cc->SetVarRef2(cinfo[i].currentloadv, cinfo[i].current_load);
+	CPROF_STOP(t_commit, prof_slot(), CPROF_COMMIT);
+	return 1; // For now we'll say it worked
+}
 
-		/* get environment info */
-		PrmEnvExpr::Configure(t, cinfo[i].vbid);
-		PrmEnvExpr::ValidateVariables(cinfo[i].vbid);
+/*--- lethal(EndpointTable *et, EndpointSurf *es, const double *x, double dt, double *K, int n) -- n of es at dt */
+// Through its table if it has one.
+static void lethal(EndpointTable *et, EndpointSurf *es, const double *x, double dt, double *K, int n) {
+	if (et) et->values(x, dt, K, n);
+	else for (int j = 0; j < n; j++) K[j] = es->value(x[j], dt);
+}
+
+/*--- Contamination::kills(Contamination **c, int n, double actual_dt, int chronic, double *K, double *k) -- */
+// K from the water concentrations (or with chronic, the tissue loads)
+// of n agents with the same setups (one, or a cohort): n_cinfo for each
+// agent, and k their sums.  Each contaminant is looked up for all of
+// them at once.
+void Contamination::kills(Contamination **c, int n, double actual_dt, int chronic, double *K, double *k)
+{
+	int i, j, b, nc = c[0]->n_cinfo;
+	double x[LETHAL_BATCH], out[LETHAL_BATCH];
+
+	for (j = 0; j < n; j++) k[j] = 0;
+	for (i = 0; i < nc; i++) {
+		ContaminantTaxon::Setup *cs = c[0]->cinfo[i].cs;
+		if (!cs) { // never set up (no environment agent)
+			for (j = 0; j < n; j++) K[j*nc + i] = 0;
+			continue;
+		}
+		CPROF_START(t0);
+		for (j = 0; j < n; j += LETHAL_BATCH) {
+			int m = Min(LETHAL_BATCH, n - j);
+			for (b = 0; b < m; b++) x[b] = chronic?c[j+b]->hot.load[i]:c[j+b]->hot.conc[i];
+			if (chronic) lethal(cs->chronic_table, &cs->chronic_lethal, x, actual_dt, out, m);
+			else lethal(cs->acute_table, &cs->acute_lethal, x, actual_dt, out, m);
+			for (b = 0; b < m; b++) {
+				K[(j+b)*nc + i] = out[b];
+				k[j+b] += out[b];
+				if (!chronic && out[b] > 0) {
+					VERBOSE("Poisoning", "%s conc = %f, load = %f K = %f", cs->name,
+						(double)c[j+b]->hot.conc[i], (double)c[j+b]->hot.load[i], out[b]);
+				}
+			}
+		}
+		CPROF_STOP(t0, cs->prof, CPROF_ENDPOINT);
+	}
+}
+
+/*--- Contamination::update_loads(double t, double actual_dt, R3 *loc) -- run the load_update programs */
+void Contamination::update_loads(double t, double actual_dt, R3 *loc)
+{
+	double new_load = 0;
+
+	for (int i = 0; i < n_cinfo; i++) {
+		if (!cinfo[i].cs) continue;
 
-		new_load = cc->Calculate(cinfo[i].update.id); // update load level
+		if (cinfo[i].cs->tolerance > 0 && actual_dt > 0) new_load = retry_load(i, t, actual_dt, loc);
+		else new_load = update_load(i, t, actual_dt, hot.ate[i], loc);
 		VERBOSE("CommitIntoxicate", "%s %f -> %f  conc = %f dt = %f imass = %f ate = %f", 
-			cinfo[i].name, cinfo[i].current_load, new_load, 
-			cinfo[i].conc, actual_dt, 
-			getIMass(), cinfo[i].ate);
-		cinfo[i].current_load = new_load; // change load for contaminant
+			cinfo[i].name, hot.load[i], new_load, 
+			hot.conc[i], actual_dt, 
+			getIMass(), hot.ate[i]);
+		hot.load[i] = new_load; // change load for contaminant
 	
 		for (int iq = 0; profile && iq < profile->N; iq++) {
-			if (!strcmp(profile->c_list[iq].name, cinfo[i].name)) {
+			if (profile->c_list[iq].id == cinfo[i].id) {
 				profile->c_list[iq].mass = new_load;
 				break;
 			}
 		}
 	}
-	 
-	if (k > 0) { // This is mostly pertinent for populations and schools
-		// Adjust acute mortality based on water concentration here
+}
+
+/*--- Contamination::update_load(int i, double t, double dt, double ate, R3 *loc) -- contaminant i's load_update program, from hot.load[i] over dt */
+double Contamination::update_load(int i, double t, double dt, double ate, R3 *loc)
+{
+	double new_load;
+	RCCalc *cc = PrmEnvExpr::GetCCalc(cinfo[i].vbid);
+	assert(cc);
 
-		double dk = cgetMembers(), ddk;
-		member_cube->AdjustLevels(K, 1, n_cinfo);
-		ddk = cgetMembers();
+	cc->SetVarRef2(cinfo[i].imassv, getIMass());
+	cc->SetVarRef2(cinfo[i].DT, dt);
+
+	cc->SetVarRef2(cinfo[i].concv, hot.conc[i]);
+	cc->SetVarRef2(cinfo[i].atev, ate); // We aren't eating t, stuff
+	cc->SetVarRef2(cinfo[i].currentloadv, hot.load[i]);
+
+	cinfo[i].na.t = t;
+	cinfo[i].na.imass = getIMass();
+	cinfo[i].na.dt = dt;
+	cinfo[i].na.conc = hot.conc[i];
+	cinfo[i].na.ate = ate;
+	cinfo[i].na.current_load = hot.load[i];
+
+	CPROF_START(t1);
+	if (cinfo[i].cs->nupdate) {
+		// no environment in it, so no need to configure
+		new_load = ContaminantNative::Run(cinfo[i].cs->nupdate, &cinfo[i].na);
+		CPROF_COUNT(cinfo[i].cs->prof, CPROF_NATIVE);
+	}
+	else {
+		/* get environment info */
+		configure_env(i, t, loc);
 
-		LogDeath(t, dk - ddk, ddk, getIMass(), "AcutePoisoning");
+		new_load = cc->Calculate(cinfo[i].update); // update load level
+		CPROF_COUNT(cinfo[i].cs->prof, CPROF_EVAL);
 	}
-	
-	// Adjust chronic mortality based on tissue load here
-	for (k = 0, i = 0; i < n_cinfo; i++) {
-		K[i] = cinfo[i].chronic_lethal.value(cinfo[i].current_load, actual_dt);
-		k += K[i];
+	CPROF_STOP(t1, cinfo[i].cs->prof, CPROF_LOAD_UPDATE);
+	return new_load;
+}
+
+/*--- rel_change(double a, double b) -- 0 if they're the same, 1 if one of them is 0 */
+static double rel_change(double a, double b) {
+	if (a == b) return 0;
+	return fabs(b - a) / Max(fabs(a), fabs(b));
+}
+
+/*--- Contamination::sub_steps(int i, double t, double dt, int n, R3 *loc) -- contaminant i's load after dt in n equal steps, from hot.load[i] */
+// What's been eaten goes in with the first.
+double Contamination::sub_steps(int i, double t, double dt, int n, R3 *loc)
+{
+	double load0 = hot.load[i], sub = dt / n;
+
+	for (int k = 0; k < n; k++) hot.load[i] = update_load(i, t + k*sub, sub, k?0:hot.ate[i], loc);
+	double load = hot.load[i];
+	hot.load[i] = load0;
+	return load;
+}
+
+/*--- Contamination::retry_load(int i, double t, double dt, R3 *loc) -- contaminant i's load after dt in two halves, or in shorter steps if they're too far out */
+// The error in the step is how far the one step over dt is from the
+// two halves, relative to the load; it goes as the square of the step.
+// Without a meal the one step isn't run: the first half, carried on
+// at the same rate, is what a first order update makes of it, so the
+// error is how far the second half's change is from the first's.  A
+// meal goes into the first half only, so with one the one step is run
+// and the meal goes into both the same way.  Within the tolerance, the
+// halves are taken.  Beyond it the kernel has already taken the step,
+// so it's done again here in as many equal steps as the error says it
+// needs, each no shorter than min_tick.  Either way the error is left
+// in cinfo[i].step for adapt_step().
+double Contamination::retry_load(int i, double t, double dt, R3 *loc)
+{
+	ContaminantTaxon::Setup *cs = cinfo[i].cs;
+	double load0 = hot.load[i], ate = hot.ate[i];
+
+	double half = update_load(i, t, dt/2, ate, loc);
+	hot.load[i] = half;
+	double halves = update_load(i, t + dt/2, dt/2, 0, loc);
+	hot.load[i] = load0;
+	double load = (ate == 0)?2*half - load0:update_load(i, t, dt, ate, loc);
+	double e = rel_change(load, halves);
+	int n = 2;
+
+	if (e > cs->tolerance) {
+		n = (int)Min(ceil(sqrt(e / cs->tolerance) / STEP_SAFETY), floor(dt / cs->min_tick));
+		if (n > 2) {
+			load = sub_steps(i, t, dt, n, loc);
+			CPROF_COUNT(cs->prof, CPROF_RETRY);
+		}
 	}
+	cinfo[i].step.e = e;
+	return (n > 2)?load:halves;
+}
+
+/*--- Contamination::kill(double t, double *K, char *cause) -- change the levels in the member_cube to reflect any mortality we've inflicted */
+void Contamination::kill(double t, double *K, char *cause)
+{
+	double dk = cgetMembers(), ddk;
+	CPROF_START(t0);
+	member_cube->AdjustLevels(K, 1, n_cinfo);
+	CPROF_STOP(t0, prof_slot(), CPROF_CUBE);
+	ddk = cgetMembers();
 
-	// Change the levels in the member_cube to reflect any mortality we've inflicted
-	if (k > 0) {
-		double dk = cgetMembers(), ddk;
-		member_cube->AdjustLevels(K, 1, n_cinfo);
-		ddk = cgetMembers();
+	log_death(t, dk - ddk, ddk, getIMass(), cause);
+}
+
+/*--- Contamination::log_death(double t, double died, double left, double imass, char *cause) -- LogDeath, or later */
+void Contamination::log_death(double t, double died, double left, double imass, char *cause)
+{
+	if (!deferring) {
+		LogDeath(t, died, left, imass, cause);
+		return;
+	}
+	Deferred *d = defer(this);
+	d->t = t;
+	d->died = died;
+	d->left = left;
+	d->imass = imass;
+	d->cause = cause;
+}
 
-		LogDeath(t, dk - ddk, ddk, getIMass(), "ChronicPoisoning");
+/*--- Contamination::adapt_step(int i, double actual_dt) -- contaminant i's next step, from how far things moved in this one */
+// From the load's error over the step (see retry_load()), or the
+// relative change in conc, whichever asks for the shorter step.  The
+// first goes as the square of the step, so a steady uptake or
+// depuration lets the step grow to max_tick; a plume's tail (conc
+// going from something to nothing) is an error of 1, which brings it
+// down fast.  Its front is step(i, conc)'s: the step is
+// chosen before the commit which would see it.
+void Contamination::adapt_step(int i, double actual_dt)
+{
+	ContaminantTaxon::Setup *cs = cinfo[i].cs;
+	double h = (actual_dt > 0)?actual_dt:step(i);  // what was taken, which may not be what we asked for
+
+	if (actual_dt > 0) {
+		double ec = rel_change(cinfo[i].step.conc, hot.conc[i]);
+		double next = STEP_GROW * h;
+		if (ec > 0) next = Min(next, STEP_SAFETY * actual_dt * sqrt(cs->tolerance / ec));
+		if (cinfo[i].step.e > 0) next = Min(next, STEP_SAFETY * actual_dt * sqrt(cs->tolerance / cinfo[i].step.e));
+		h = Max(next, STEP_SHRINK * h);
 	}
+	cinfo[i].step.h = Min(Max(h, cs->min_tick), cs->max_tick);
+	cinfo[i].step.conc = hot.conc[i];
+}
 
+/*--- Contamination::end_tick(double t, double actual_dt, R3 *loc, double old_members) -- tidy up after a CommitIntoxicate */
+void Contamination::end_tick(double t, double actual_dt, R3 *loc, double old_members)
+{
 #if defined(MAINTAIN_THINGS_MEMBERS)
 	PsetMembers(cgetMembers());
 #endif
 
-	
+	// the other members see the same exposure, so before it goes
+	if (ensemble) ensemble_tick(t, actual_dt, loc);
+
+	for (int i = 0; i < n_cinfo; i++) {
+		if (cinfo[i].cs && cinfo[i].cs->tolerance > 0) adapt_step(i, actual_dt);
+	}
+
 	// and don't carry *this* lot of contaminant across to the next iteration
-	for (i = 0; i < n_cinfo; i++) {
-		cinfo[i].conc = 0;
-		cinfo[i].ate = 0;
+	for (int i = 0; i < n_cinfo; i++) {
+		hot.conc[i] = 0;
+		hot.ate[i] = 0;
 	}
 
 	if (cgetMembers() - old_members < 0) {
 		VERBOSE("Poisoning", "%f %s died due to contaminants", old_members - cgetMembers(), ctaxon);
 	}
 
+	if (ContaminantStream::Active()) {
+		if (!deferring) stream_tick(t, loc);
+		else {
+			Deferred *d = defer(this);
+			d->stream = 1;
+			d->t = t;
+			d->loc = *loc;
+		}
+	}
+}
+
+
+/*--- Contamination::ensemble_attach() -- make (or keep) the ensemble and point it at our evaluator blocks */
+// A new ensemble starts with every member where the agent is.
+void Contamination::ensemble_attach()
+{
+	int i, m, members = 1;
+
+	for (i = 0; i < n_cinfo; i++) {
+		if (cinfo[i].cs) members = Max(members, cinfo[i].cs->members);
+	}
+	if (ensemble && (members < 2 || ensemble->M != members-1 || ensemble->nc != n_cinfo)) {
+		warning("%s's ensemble has changed shape; starting it again", ctaxon);
+		delete ensemble;
+		ensemble = 0;
+	}
+	if (members < 2) return;
+
+	if (!ensemble) {
+		ensemble = new ContaminantEnsemble(members, n_cinfo);
+		if (!ensemble) abort();
+		for (i = 0; i < n_cinfo; i++) {
+			for (m = 0; m < ensemble->M; m++) {
+				ensemble->load[i*ensemble->M + m] = hot.load[i];
+				ensemble->axis[i*ensemble->M + m] = member_cube->level(i+1);
+			}
+		}
+	}
+
+	// the replaced constants, for the members which go through the evaluator
+	int M = ensemble->M;
+	ensemble->FreeRefs();
+	ensemble->ref = (CCalc::CalcVar ***)Calloc(n_cinfo*M, sizeof(CCalc::CalcVar **));
+	if (!ensemble->ref) abort();
+	for (i = 0; i < n_cinfo; i++) {
+		ContaminantTaxon::Setup *cs = cinfo[i].cs;
+		if (!cs || cs->nupdate || !cs->member) continue;
+
+		RCCalc *cc = PrmEnvExpr::GetCCalc(cinfo[i].vbid);
+		assert(cc);
+		for (m = 0; m < M && m < cs->members-1; m++) {
+			ContaminantEnsemble::Member *mb = cs->member + m;
+			if (!mb->n) continue;
+			CCalc::CalcVar **r = (CCalc::CalcVar **)Calloc(mb->n+1, sizeof(CCalc::CalcVar *));
+			if (!r) abort();
+			for (int j = 0; j < mb->n; j++) r[j] = cc->GetVarRef2(mb->name[j]);
+			ensemble->ref[i*M + m] = r;
+		}
+	}
+}
+
+/*--- Contamination::ensemble_tick(double t, double actual_dt, R3 *loc) -- the other members' CommitIntoxicate */
+// The same steps as the agent's own, on the members' loads and axes,
+// and with this tick's exposure (which is still in hot.conc and
+// hot.ate) and the inputs the agent's load update saw.
+void Contamination::ensemble_tick(double t, double actual_dt, R3 *loc)
+{
+	int i, m, j, M = ensemble->M;
+	double *K = ensemble->K;
+
+	// acute, from the shared exposure; the members without a surface of
+	// their own share one value
+	for (i = 0; i < n_cinfo; i++) {
+		ContaminantTaxon::Setup *cs = cinfo[i].cs;
+		double *k = K + i*M, shared = DNaN;
+
+		for (m = 0; m < M; m++) {
+			ContaminantEnsemble::Member *mb = cs && m < cs->members-1 ? cs->member + m : 0;
+			if (!cs) k[m] = 0;
+			else if (mb && mb->acute) k[m] = mb->acute->value(hot.conc[i], actual_dt);
+			else {
+				if (isnan(shared)) {
+					if (cs->acute_table) shared = cs->acute_table->value(hot.conc[i], actual_dt);
+					else shared = cs->acute_lethal.value(hot.conc[i], actual_dt);
+				}
+				k[m] = shared;
+			}
+		}
+	}
+	ensemble->Adjust();
+
+	// the loads
+	for (i = 0; i < n_cinfo; i++) {
+		ContaminantTaxon::Setup *cs = cinfo[i].cs;
+		if (!cs) continue;
+		cont_real *load = ensemble->load + i*M;
+		ContaminantNativeArgs na = cinfo[i].na;
+
+		if (cs->nupdate) {
+			for (m = 0; m < M; m++) {
+				ContaminantEnsemble::Member *mb = m < cs->members-1 ? cs->member + m : 0;
+				na.current_load = load[m];
+				load[m] = ContaminantNative::Run(mb && mb->nupdate ? mb->nupdate : cs->nupdate, &na);
+				CPROF_COUNT(cs->prof, CPROF_NATIVE);
+			}
+			continue;
+		}
+
+		RCCalc *cc = PrmEnvExpr::GetCCalc(cinfo[i].vbid);
+		assert(cc);
+		for (m = 0; m < M; m++) {
+			ContaminantEnsemble::Member *mb = m < cs->members-1 ? cs->member + m : 0;
+			CCalc::CalcVar **ref = ensemble->ref ? ensemble->ref[i*M + m] : 0;
+
+			for (j = 0; ref && ref[j]; j++) cc->SetVarRef2(ref[j], mb->value[j]);
+			if (ref) cinfo[i].env.validated = 0; // the "variables" may use them
+			cc->SetVarRef2(cinfo[i].currentloadv, load[m]);
+			cinfo[i].na.current_load = load[m];
+			configure_env(i, t, loc);
+
+			load[m] = cc->Calculate(cinfo[i].update);
+			CPROF_COUNT(cs->prof, CPROF_EVAL);
+
+			for (j = 0; ref && ref[j]; j++) cc->SetVarRef2(ref[j], mb->base[j]);
+		}
+		// and leave things as the agent's update did
+		cc->SetVarRef2(cinfo[i].currentloadv, na.current_load);
+		cinfo[i].na = na;
+		cinfo[i].env.validated = 0;
+	}
+
+	// chronic, from the members' loads; those sharing the setup's surface
+	// are looked up together
+	double x[LETHAL_BATCH], out[LETHAL_BATCH];
+	int at[LETHAL_BATCH], nx;
+	for (i = 0; i < n_cinfo; i++) {
+		ContaminantTaxon::Setup *cs = cinfo[i].cs;
+		double *k = K + i*M;
+		cont_real *load = ensemble->load + i*M;
+
+		for (m = nx = 0; m < M; m++) {
+			ContaminantEnsemble::Member *mb = cs && m < cs->members-1 ? cs->member + m : 0;
+			if (!cs) k[m] = 0;
+			else if (mb && mb->chronic) k[m] = mb->chronic->value(load[m], actual_dt);
+			else {
+				at[nx] = m;
+				x[nx++] = load[m];
+			}
+			if (nx == LETHAL_BATCH || (nx && m == M-1)) {
+				lethal(cs->chronic_table, &cs->chronic_lethal, x, actual_dt, out, nx);
+				for (j = 0; j < nx; j++) k[at[j]] = out[j];
+				nx = 0;
+			}
+		}
+	}
+	ensemble->Adjust();
+}
+
+
+/*-- cohorts -- the age classes of a population, all at once */
+
+/*--- Contamination::same_setup(Contamination **c, int n) -- same taxon and contaminants, in the same place */
+// The cohort paths only make sense for agents which would see the same
+// sources: the age classes of one population, say.
+int Contamination::same_setup(Contamination **c, int n)
+{
+	assert(c && n > 0);
+	R3 loc = c[0]->getLocation();
+
+	for (int j = 1; j < n; j++) {
+		if (c[j]->n_cinfo != c[0]->n_cinfo) return 0;
+		for (int i = 0; i < c[0]->n_cinfo; i++) {
+			if (c[j]->cinfo[i].cs != c[0]->cinfo[i].cs) return 0;
+		}
+		R3 l = c[j]->getLocation();
+		if (memcmp(&l, &loc, sizeof(R3))) return 0;
+	}
+	return 1;
+}
+
+/*--- Contamination::IntoxicateCohort(Contamination **c, int n, double t, double dt) -- one exposure lookup for the lot */
+// The first cohort asks the sources; the rest are given what it found.
+// This is exactly what each would have found for itself, as they share
+// the setup and the place.  Returns the smallest dt, as Intoxicate does;
+// with an adaptive step that is the smallest any of them would take.
+double Contamination::IntoxicateCohort(Contamination **c, int n, double t, double dt)
+{
+	int i, j;
+
+	if (n < 2 || !c[0]->n_cinfo || !same_setup(c, n)) {
+		double d = dt;
+		for (j = 0; j < n; j++) d = Min(d, c[j]->Intoxicate(t, dt));
+		return d;
+	}
+
+	Contamination *a = c[0];
+	int nc = a->n_cinfo;
+	double *saved = (double *)Malloc(2*nc*sizeof(double));
+	if (!saved) abort();
+
+	// so that we can see what this lookup (and nothing earlier) did
+	for (i = 0; i < nc; i++) {
+		saved[i] = a->hot.conc[i];
+		saved[nc+i] = a->hot.tick[i];
+		a->hot.conc[i] = 0;
+		a->hot.tick[i] = DNaN;
+	}
+
+	double d = a->Intoxicate(t, dt);
+
+	for (i = 0; i < nc; i++) {
+		double exposure = a->hot.conc[i];
+		int hit = !isnan(a->hot.tick[i]);
+
+		a->hot.conc[i] = Max(saved[i], exposure);
+		if (!hit) {
+			a->hot.tick[i] = saved[nc+i];
+			continue;
+		}
+		for (j = 1; j < n; j++) {
+			c[j]->hot.conc[i] = Max(c[j]->hot.conc[i], exposure);
+			c[j]->hot.tick[i] = Min(c[j]->step(i, exposure), dt);
+			d = Min(d, c[j]->hot.tick[i]);
+		}
+	}
+	Free(saved);
+	return d;
+}
+
+/*--- Contamination::CommitIntoxicateCohort(Contamination **c, int n, double t, double dt, double actual_dt) -- */
+// As CommitIntoxicate for each, except that an acute kill is only
+// worked out once for cohorts with the same exposure, and the member
+// cubes are adjusted together.
+int Contamination::CommitIntoxicateCohort(Contamination **c, int n, double t, double dt, double actual_dt)
+{
+	int j;
+
+	if (n < 2 || !same_setup(c, n)) {
+		for (j = 0; j < n; j++) c[j]->CommitIntoxicate(t, dt, actual_dt);
+		return 1;
+	}
+
+	int nc = c[0]->n_cinfo;
+	if (!nc || isnan(actual_dt)) return 1;
+	CPROF_START(t_commit);
+
+	double *K = (double *)Malloc(n*nc*sizeof(double));
+	double *k = (double *)Malloc(n*sizeof(double));
+	double *old = (double *)Malloc(n*sizeof(double));
+	if (!K || !k || !old) abort();
+	R3 loc = c[0]->getLocation();
+
+	for (j = 0; j < n; j++) {
+		c[j]->take_ingested();
+		old[j] = c[j]->member_cube->Value();
+	}
+	kills(c, n, actual_dt, 0, K, k);
+
+	for (j = 0; j < n; j++) c[j]->update_loads(t, actual_dt, &loc);
+	kill_cohort(c, n, t, K, k, "AcutePoisoning");
+
+	kills(c, n, actual_dt, 1, K, k);
+	kill_cohort(c, n, t, K, k, "ChronicPoisoning");
+
+	for (j = 0; j < n; j++) c[j]->end_tick(t, actual_dt, &loc, old[j]);
+
 	Free(K);
+	Free(k);
+	Free(old);
 
-	return 1; // For now we'll say it worked
+	CPROF_STOP(t_commit, c[0]->prof_slot(), CPROF_COMMIT);
+	return 1;
+}
+
+/*--- Contamination::kill_cohort(Contamination **c, int n, double t, double *K, double *k, char *cause) -- */
+// K holds n_cinfo kills for each cohort and k their sums; the cohorts
+// with nothing to die of are left alone, as kill() would be.
+void Contamination::kill_cohort(Contamination **c, int n, double t, double *K, double *k, char *cause)
+{
+	int j, m = 0, nc = c[0]->n_cinfo;
+	Cube **cubes = (Cube **)Malloc(n*sizeof(Cube *));
+	double **levels = (double **)Malloc(n*sizeof(double *));
+	double *before = (double *)Malloc(n*sizeof(double));
+	if (!cubes || !levels || !before) abort();
+
+	for (j = 0; j < n; j++) {
+		if (k[j] <= 0) continue;
+		cubes[m] = c[j]->member_cube;
+		levels[m] = K + j*nc;
+		before[j] = c[j]->cgetMembers();
+		m++;
+	}
+
+	if (m) {
+		CPROF_START(t0);
+		Cube::AdjustLevels(cubes, levels, m, 1, nc);
+		CPROF_STOP(t0, c[0]->prof_slot(), CPROF_CUBE);
+
+		for (j = 0; j < n; j++) {
+			if (k[j] <= 0) continue;
+			double after = c[j]->cgetMembers();
+			c[j]->log_death(t, before[j] - after, after, c[j]->getIMass(), cause);
+		}
+	}
+	Free(cubes);
+	Free(levels);
+	Free(before);
+}
+
+
+/*-- many agents -- the deterministic parallel mode (contparallel.hxx) */
+
+typedef struct {
+	Contamination **c;
+	int n;
+	double t, dt, *actual_dt;
+	DeferredLog *log;    // one per chunk
+} ManyJob;
+
+/*--- Contamination::CommitIntoxicateMany(Contamination **c, int n, double t, double dt, double *actual_dt) -- */
+// Each agent's commit only touches the agent, so the chunks can go in
+// any order on any thread; what doesn't (the death log, the stream and
+// the sum) is kept per chunk and done here afterwards, chunk by chunk.
+double Contamination::CommitIntoxicateMany(Contamination **c, int n, double t, double dt, double *actual_dt)
+{
+	assert(c && actual_dt);
+	assert(!deferring);
+	if (n <= 0) return 0;
+
+	ManyJob job;
+	int chunks = (n + MANY_CHUNK - 1) / MANY_CHUNK;
+	job.c = c;
+	job.n = n;
+	job.t = t;
+	job.dt = dt;
+	job.actual_dt = actual_dt;
+	job.log = (DeferredLog *)Calloc(chunks, sizeof(DeferredLog));
+	if (!job.log) abort();
+
+	int *owner = many_owners(c, n, chunks);
+	ContaminantParallel::Run(chunks, commit_chunk, &job, owner);
+	if (owner) Free(owner);
+
+	double lost = 0;
+	for (int k = 0; k < chunks; k++) {
+		DeferredLog *l = job.log + k;
+		for (int i = 0; i < l->n; i++) {
+			Deferred *d = l->d + i;
+			if (d->stream) d->who->stream_tick(d->t, &d->loc);
+			else d->who->LogDeath(d->t, d->died, d->left, d->imass, d->cause);
+		}
+		lost += l->lost;
+		if (l->d) Free(l->d);
+	}
+	Free(job.log);
+	return lost;
+}
+
+/*--- Contamination::many_owners(Contamination **c, int n, int chunks) -- each chunk's node, the one most of its agents are on; 0 with one node */
+// Ties go to the lower node.  An agent's chunk changes with whatever
+// else the kernel hands over with it, so keying on where the agents are
+// (rather than on where the chunk is in the list) keeps most of them
+// where they are from one commit to the next.
+int *Contamination::many_owners(Contamination **c, int n, int chunks)
+{
+	int nodes = ContaminantNuma::Nodes();
+	if (nodes < 2) return 0;
+
+	int *owner = (int *)Malloc(chunks*sizeof(int)), *count = (int *)Malloc(nodes*sizeof(int));
+	if (!owner || !count) abort();
+	for (int k = 0; k < chunks; k++) {
+		int j0 = k*MANY_CHUNK, j1 = Min(j0 + MANY_CHUNK, n);
+		memset(count, 0, nodes*sizeof(int));
+		for (int j = j0; j < j1; j++) {
+			if (c[j]->hot_pool) count[c[j]->hot_pool->Node() % nodes]++;
+		}
+		owner[k] = 0;
+		for (int d = 1; d < nodes; d++) {
+			if (count[d] > count[owner[k]]) owner[k] = d;
+		}
+	}
+	Free(count);
+	return owner;
+}
+
+/*--- Contamination::commit_chunk(void *arg, int chunk) -- MANY_CHUNK agents, in order, on this thread */
+// An agent from another node is counted as remote.  If the chunk is this
+// node's it's moved here, but only once it's been in this node's chunks
+// for REHOME_AFTER commits in a row, so that one which the kernel hands
+// over with different company each time doesn't go back and forth.
+void Contamination::commit_chunk(void *arg, int chunk)
+{
+	ManyJob *job = (ManyJob *)arg;
+	int j0 = chunk*MANY_CHUNK, j1 = Min(j0 + MANY_CHUNK, job->n);
+	int here = ContaminantNuma::Here(), ours = (ContaminantParallel::Owner(chunk) == here);
+	long local = 0, remote = 0;
+
+	deferring = job->log + chunk;
+	for (int j = j0; j < j1; j++) {
+		Contamination *a = job->c[j];
+		if (a->hot_pool) {
+			if (a->hot_pool->Node() == here) {
+				local++;
+				if (ours) a->away = 0;
+			}
+			else {
+				remote++;
+				if (ours && ++a->away >= REHOME_AFTER) {
+					a->rehome(here);
+					a->away = 0;
+				}
+			}
+		}
+		if (!a->member_cube) { // nothing to lose
+			a->CommitIntoxicate(job->t, job->dt, job->actual_dt[j]);
+			continue;
+		}
+		double before = a->cgetMembers();
+		a->CommitIntoxicate(job->t, job->dt, job->actual_dt[j]);
+		deferring->lost += before - a->cgetMembers();
+	}
+	deferring = 0;
+	ContaminantNuma::Count(local, remote);
+}
+
+
+/*--- Contamination::InitMany(Contamination **c, int n, char **taxon, char **name) -- */
+// A taxon's first agent loads its setups, resolves its parameter
+// handles and registers its contaminants' names, and nothing after it
+// changes any of those, so once each taxon has had one agent done the
+// rest only read what's shared and can go in any order on any thread.
+// The chunks are CommitIntoxicateMany's, and an agent's hot row comes
+// from the node of the thread which does its Init(), so on a NUMA
+// machine agents mostly start out where they'll be committed.
+int Contamination::InitMany(Contamination **c, int n, char **taxon, char **name)
+{
+	assert(c && taxon && name);
+	if (n <= 0) return 0;
+
+	InitJob job;
+	int j, k, nseen = 0, done = 0;
+	char **seen = (char **)Calloc(n, sizeof(char *));
+	job.c = c;
+	job.n = n;
+	job.taxon = taxon;
+	job.name = name;
+	job.ok = (int *)Malloc(n*sizeof(int));
+	if (!seen || !job.ok) abort();
+
+	for (j = 0; j < n; j++) {
+		job.ok[j] = -1;
+		for (k = 0; k < nseen && strcmp(seen[k], taxon[j]); k++) ;
+		if (k < nseen) continue;
+		seen[nseen++] = taxon[j];
+		job.ok[j] = c[j]->Init(taxon[j], name[j])?1:0;
+	}
+	VERBOSE("ContaminationInitMany", "%d agents of %d taxa", n, nseen);
+
+	ContaminantParallel::Run((n + MANY_CHUNK - 1) / MANY_CHUNK, init_chunk, &job);
+
+	for (j = 0; j < n; j++) done += job.ok[j];
+	Free(seen);
+	Free(job.ok);
+	return done;
+}
+
+/*--- Contamination::init_chunk(void *arg, int chunk) -- MANY_CHUNK agents' Init() (or ReInit()) */
+void Contamination::init_chunk(void *arg, int chunk)
+{
+	InitJob *job = (InitJob *)arg;
+	int j0 = chunk*MANY_CHUNK, j1 = Min(j0 + MANY_CHUNK, job->n);
+
+	for (int j = j0; j < j1; j++) {
+		if (job->ok[j] >= 0) continue;  // a taxon's first
+		if (!job->taxon) job->ok[j] = job->c[j]->reinit_one();
+		else job->ok[j] = job->c[j]->Init(job->taxon[j], job->name[j])?1:0;
+	}
 }
 
+
 /*-- Contaminantion::LocalIntoxicate(agent, t, dt, contaminant) -- An individual has been hit */
 // We're about to get nuked by something
 // Note that dt is an estimate and the intoxication may need to be adjusted
 // in CommitIntoxicate if it is used
 double Contamination::LocalIntoxicate(int agent, double t, double dt, char *contaminant)
+{
+	assert(KISA(agent, CLASS_CONTSRC));
+
+	// Get the contaminant index
+	int cidx = ContaminantSource::GetCSNum(KID(agent), contaminant);
+	assert(cidx >= 0);
+	// Now get the value
+	double d = ContaminantSource::GetCSValue(KID(agent), 
+		t, getLocation(), cidx);
+	return LocalIntoxicate(agent, t, dt, contaminant, cidx, d);
+}
+
+/*-- Contamination::LocalIntoxicate(agent, t, dt, contaminant, cidx, d) -- as above, once the source has answered */
+double Contamination::LocalIntoxicate(int agent, double t, double dt, char *contaminant, int cidx, double d)
 {
 	VERBOSE("LocalIntoxicate", "Intoxicating %s", contaminant);
+	CPROF_START(t0);
 	int cx = -1;
 	
 	for (int i = 0; i < n_cinfo; i++) {
@@ -811,67 +2306,139 @@ double Contamination::LocalIntoxicate(int agent, double t, double dt, char *cont
 	}
 
 	assert(cx >= 0);
-	assert(KISA(agent, CLASS_CONTSRC));
-
-	// Get the contaminant index
-	int cidx = ContaminantSource::GetCSNum(KID(agent), contaminant);
 	assert(cidx >= 0);
-	// Now get the value
-	double d = ContaminantSource::GetCSValue(KID(agent), 
-		t, getLocation(), cidx);
-	if (isnan(d)) return dt; // not applicable
+	assert(cinfo[cx].cs);
+	if (isnan(d)) { // not applicable
+		CPROF_STOP(t0, cinfo[cx].cs->prof, CPROF_LOCAL);
+		return dt;
+	}
 
-	cinfo[cx].tick = Min(cinfo[cx].cont_tick, dt);
-	cinfo[cx].conc = Max(cinfo[cx].conc, d);
-//	cinfo[cx].ate = 0;
+	hot.tick[cx] = Min(step(cx, d), dt);
+	hot.conc[cx] = Max(hot.conc[cx], d);
+//	hot.ate[cx] = 0;
 
-	return cinfo[cx].tick;
+	CPROF_STOP(t0, cinfo[cx].cs->prof, CPROF_LOCAL);
+	return hot.tick[cx];
 }
 
 
 /*-- Contamination::Ingest(char *contaminant, double mass, double t) -- contamination by eating something a bit funny */
-// We're about to get nuked by something
-// Note that dt is an estimate and the intoxication may need to be adjusted
-// in CommitIntoxicate if it is used
+// Posted to ingested, and added to ate at the start of the next
+// CommitIntoxicate; safe from any thread, as long as our interests
+// aren't being changed.  Returns 1 if we care about it.
 int Contamination::Ingest(char *contaminant, double mass, double t)
 {
 	VERBOSE("Ingest", "Ingesting %s", contaminant);
-	int cx = -1;
-	
-	assert(mass > 0);
+	ContaminantIngest::Item item;
+	char **iname;
+	int ni, *iid;
 
-	for (int i = 0; i < n_cinfo; i++) {
-		if (!strcmp(cinfo[i].name, contaminant)) {
-			cx = i;
-			break;
+	assert(mass > 0);
+	if (!contaminants) return 0;
+
+	iid = contaminants->InterestIds(&ni, &iname);
+	for (int i = 0; i < ni; i++) {
+		if (iname[i] == contaminant || !strcmp(iname[i], contaminant)) {
+			item.id = iid[i];
+			item.mass = mass;
+			ContaminantIngest::Post(&ingested, 1, &item);
+			return 1;
 		}
 	}
-	if (cx <0) return 0;
+	return 0;
+}
 
-	assert(cx >= 0);
+/*-- Contamination::Ingest(ContaminantProfileView *prey, double proportion, double t) -- eat (some of) a whole prey profile */
+// proportion is the fraction of the prey that was eaten; returns the number of
+// the prey's contaminants we care about, which go to ingested as one event
+int Contamination::Ingest(ContaminantProfileView *prey, double proportion, double t)
+{
+	ContaminantIngest::Item small[ContaminantProfileView::INPLACE], *item = small;
+	int n = 0, ni, *iid;
 
-	cinfo[cx].ate += mass;
-	return 1;
+	assert(prey);
+	assert(proportion > 0);
+	if (!contaminants) return 0;
+
+	iid = contaminants->InterestIds(&ni, 0);
+	if (prey->N > ContaminantProfileView::INPLACE) {
+		item = (ContaminantIngest::Item *)Malloc(prey->N*sizeof(ContaminantIngest::Item));
+		if (!item) abort();
+	}
+	for (int j = 0; j < prey->N; j++) {
+		double mass = prey->c_list[j].mass * proportion;
+		if (isnan(mass) || mass <= 0) continue;
+
+		for (int i = 0; i < ni; i++) {
+			if (iid[i] == prey->c_list[j].id) {
+				VERBOSE("Ingest", "Ingesting %s", prey->c_list[j].name);
+				item[n].id = iid[i];
+				item[n].mass = mass;
+				n++;
+				break;
+			}
+		}
+	}
+	ContaminantIngest::Post(&ingested, n, item);
+	if (item != small) Free(item);
+	return n;
+}
+
+/*-- Contamination::take_ingested() -- what's been eaten since the last commit, into ate */
+// In order of contaminant and mass, whatever order it was posted in.
+void Contamination::take_ingested()
+{
+	ContaminantIngest::Event *e = ContaminantIngest::Take(&ingested);
+	if (!e) return;
+
+	int m, j = 0;
+	ContaminantIngest::Item *item = ContaminantIngest::Sorted(e, &m);
+	for (int k = 0; k < m; k++) {
+		if (j >= n_cinfo || cinfo[j].id != item[k].id) {  // usually the same one again
+			for (j = 0; j < n_cinfo && cinfo[j].id != item[k].id; j++) ;
+			if (j == n_cinfo) continue;  // our interests have changed since
+		}
+		hot.ate[j] += item[k].mass;
+	}
+	Free(item);
 }
 
 /*-- Contamination::getReproductiveImpairment(double t) -- service routine */
 double Contamination::getReproductiveImpairment(double t) {
 	double d = 1.0;
 	double v = 0;
+	R3 loc;
+	int have_loc = 0;
 
 	for (int i = 0; i < n_cinfo; i++) {
-		if (!cinfo[i].reproduce.string) continue;
+		if (!cinfo[i].cs || !cinfo[i].cs->reproduce) continue;
 
 		RCCalc *cc = PrmEnvExpr::GetCCalc(cinfo[i].vbid);
 		assert(cc);
 
 		cc->SetVarRef2(cinfo[i].imassv, getIMass());
-		cc->SetVarRef2(cinfo[i].currentloadv, cinfo[i].current_load);
+		cc->SetVarRef2(cinfo[i].currentloadv, hot.load[i]);
 
-		PrmEnvExpr::Configure(t, cinfo[i].vbid);
-		PrmEnvExpr::ValidateVariables(cinfo[i].vbid);
+		cinfo[i].na.t = t;
+		cinfo[i].na.imass = getIMass();
+		cinfo[i].na.current_load = hot.load[i];
 
-		v = cc->Calculate(cinfo[i].reproduce.id);
+		CPROF_START(t0);
+		if (cinfo[i].cs->nreproduce) {
+			v = ContaminantNative::Run(cinfo[i].cs->nreproduce, &cinfo[i].na);
+			CPROF_COUNT(cinfo[i].cs->prof, CPROF_NATIVE);
+		}
+		else {
+			if (!have_loc) {
+				loc = getLocation();
+				have_loc = 1;
+			}
+			configure_env(i, t, &loc);
+
+			v = cc->Calculate(cinfo[i].reproduce);
+			CPROF_COUNT(cinfo[i].cs->prof, CPROF_EVAL);
+		}
+		CPROF_STOP(t0, cinfo[i].cs->prof, CPROF_IMPAIR);
 
 		d *= (1.0 - v);
 	}
@@ -883,20 +2450,38 @@ double Contamination::getReproductiveImpairment(double t) {
 double Contamination::getForagingImpairment(double t) {
 	double d = 1.0;
 	double v = 0;
+	R3 loc;
+	int have_loc = 0;
 
 	for (int i = 0; i < n_cinfo; i++) {
-		if (!cinfo[i].forage.string) continue;
+		if (!cinfo[i].cs || !cinfo[i].cs->forage) continue;
 
 		RCCalc *cc = PrmEnvExpr::GetCCalc(cinfo[i].vbid);
 		assert(cc);
 
 		cc->SetVarRef2(cinfo[i].imassv, getIMass());
-		cc->SetVarRef2(cinfo[i].currentloadv, cinfo[i].current_load);
+		cc->SetVarRef2(cinfo[i].currentloadv, hot.load[i]);
 
-		PrmEnvExpr::Configure(t, cinfo[i].vbid);
-		PrmEnvExpr::ValidateVariables(cinfo[i].vbid);
+		cinfo[i].na.t = t;
+		cinfo[i].na.imass = getIMass();
+		cinfo[i].na.current_load = hot.load[i];
 
-		v = cc->Calculate(cinfo[i].forage.id);
+		CPROF_START(t0);
+		if (cinfo[i].cs->nforage) {
+			v = ContaminantNative::Run(cinfo[i].cs->nforage, &cinfo[i].na);
+			CPROF_COUNT(cinfo[i].cs->prof, CPROF_NATIVE);
+		}
+		else {
+			if (!have_loc) {
+				loc = getLocation();
+				have_loc = 1;
+			}
+			configure_env(i, t, &loc);
+
+			v = cc->Calculate(cinfo[i].forage);
+			CPROF_COUNT(cinfo[i].cs->prof, CPROF_EVAL);
+		}
+		CPROF_STOP(t0, cinfo[i].cs->prof, CPROF_IMPAIR);
 
 		d *= (1.0 - v);
 	}
@@ -908,20 +2493,38 @@ double Contamination::getForagingImpairment(double t) {
 double Contamination::getMovementImpairment(double t) {
 	double d = 1.0;
 	double v = 0;
+	R3 loc;
+	int have_loc = 0;
 
 	for (int i = 0; i < n_cinfo; i++) {
-		if (!cinfo[i].move.string) continue;
+		if (!cinfo[i].cs || !cinfo[i].cs->move) continue;
 
 		RCCalc *cc = PrmEnvExpr::GetCCalc(cinfo[i].vbid);
 		assert(cc);
 
 		cc->SetVarRef2(cinfo[i].imassv, getIMass());
-		cc->SetVarRef2(cinfo[i].currentloadv, cinfo[i].current_load);
+		cc->SetVarRef2(cinfo[i].currentloadv, hot.load[i]);
 
-		PrmEnvExpr::Configure(t, cinfo[i].vbid);
-		PrmEnvExpr::ValidateVariables(cinfo[i].vbid);
+		cinfo[i].na.t = t;
+		cinfo[i].na.imass = getIMass();
+		cinfo[i].na.current_load = hot.load[i];
 
-		v = cc->Calculate(cinfo[i].move.id);
+		CPROF_START(t0);
+		if (cinfo[i].cs->nmove) {
+			v = ContaminantNative::Run(cinfo[i].cs->nmove, &cinfo[i].na);
+			CPROF_COUNT(cinfo[i].cs->prof, CPROF_NATIVE);
+		}
+		else {
+			if (!have_loc) {
+				loc = getLocation();
+				have_loc = 1;
+			}
+			configure_env(i, t, &loc);
+
+			v = cc->Calculate(cinfo[i].move);
+			CPROF_COUNT(cinfo[i].cs->prof, CPROF_EVAL);
+		}
+		CPROF_STOP(t0, cinfo[i].cs->prof, CPROF_IMPAIR);
 
 		d *= (1.0 - v);
 	}
@@ -64,6 +64,12 @@
 #include "cube.hxx"
 #include "endpointsurf.hxx"
 #include "deathlogger.hxx"
+#include "conttaxon.hxx"
+#include "contnative.hxx"
+#include "conthot.hxx"
+#include "contensemble.hxx"
+#include "contingest.hxx"
+#include "contcache.hxx"
 
 
 class Contamination: virtual public PrmEnvExpr, virtual public ContaminantSink,
@@ -76,24 +82,65 @@ public:
 	virtual int Isa(int mask);
 	virtual int Compatibility();
 	virtual int Shutdown();
+	// what's shared by the whole process (the stream, the profile and the
+	// NUMA report); the driver calls it once, after the last Shutdown()
+	static void ShutdownAll();
 
 	virtual void *GetState(int*);
 	virtual void SetState(void*, int);
 	virtual void Reset();
 	virtual int ReInit(int);
 
+	// flat (in place) state for the shared memory transport
+	int StateSize();
+	int PutState(void *d, int sz);
+	void SetStateInPlace(void *d, int sz);
+
 	double Level(char *name);
+
+	// The parameter ensemble (see contensemble.hxx); member 0 is the agent
+	int EnsembleMembers();
+	double EnsembleLevel(char *name, int m);
+	double EnsembleSurvivors(int m);
+
+	// Moving lots of agents at once (load balancing)
+	static void *GetBatchState(Contamination **agents, int n, int *sz);
+	static int SetBatchState(Contamination **agents, int n, void *d, int sz);
+	static int ReInitBatch(Contamination **agents, int n);
+
+	// The age classes of a population (or anything else which shares a
+	// taxon and a place), ticked together; otherwise one at a time
+	static double IntoxicateCohort(Contamination **cohort, int n, double t, double dt);
+	static int CommitIntoxicateCohort(Contamination **cohort, int n, double t, double dt, double actual_dt);
+
+	// Lots of agents' CommitIntoxicate, spread over the contaminantparallel
+	// pool but with the same results, death log and stream whatever the
+	// thread count; returns the members lost, summed in agent order
+	static double CommitIntoxicateMany(Contamination **c, int n, double t, double dt, double *actual_dt);
+
+	// Lots of agents' Init(taxon[j], name[j]) over the same pool; each
+	// taxon's first agent is done first, on its own, so that what the
+	// taxon shares is loaded once.  Returns how many of them worked.
+	static int InitMany(Contamination **c, int n, char **taxon, char **name);
 	
 
 protected:
 	virtual int load_LC(char*, char*, EndpointSurf*);
+	virtual EndpointTable *load_LC_table(char*, char*, EndpointSurf*);
 	virtual void ZapContaminantSetup(int i);
 	virtual int ContaminantSetup(char *name, int i);
+	virtual int load_taxon_setup(char *name, ContaminantTaxon::Setup *cs);
+	virtual int load_ensemble(char *name, ContaminantTaxon::Setup *cs);
+	virtual int load_adaptive(char *name, ContaminantTaxon::Setup *cs);
 
 	virtual int CommitIntoxicate(double t, double dt, double actual_dt);
 	//virtual double Intoxicate(double t, double dt);
 	virtual double LocalIntoxicate(int agentid, double t, double dt, char* contaminant);
+	virtual double LocalIntoxicate(int agentid, double t, double dt, char* contaminant, int cidx, double value);
+	virtual int query_location(R3 *loc) { *loc = getLocation(); return 1; }
+	// posted to ingested from any thread; the loads see them at the next commit
 	virtual int Ingest(char* contaminant, double mass, double t);
+	virtual int Ingest(ContaminantProfileView *prey, double proportion, double t);
 
 	virtual void PsetMembers(double m)=0;
 	virtual double PgetMembers()=0;
@@ -111,30 +158,92 @@ protected:
 	char *ctaxon, *cname;
 
 	typedef struct {
-		EndpointSurf acute_lethal, chronic_lethal, foraging, reproduction, movement;
+		ContaminantTaxon::Setup *cs;         // the configuration; shared by the taxon
+		int update, forage, reproduce, move; // program ids in cc
 
-		double tick, conc, ate;
-		double current_load;
-		double cont_tick;
+		int vbid;
+		CCalc::CalcVar *concv, *imassv, *atev, *currentloadv, *DT;
+		struct {
+			int vbid, serial;                  // the block and the setup they were for
+		} programs;                          // see ContaminantSetup(); 0 until there are any
+		ContaminantNativeArgs na;            // what we've told cc, for the native versions
 
 		struct {
-			int id;
-			char *string;
-		} update, forage, reproduce, move;
+			int configured, validated;
+			double t;
+			R3 loc;
+			ContaminantNativeArgs in;          // the inputs ValidateVariables last saw
+		} env;                               // see configure_env()
 
-		int vbid;
-		CCalc::CalcVar *concv, *imassv, *atev, *currentloadv, *DT;
-		char *name;
+		struct {
+			double h;                          // the next step; 0 until the first commit
+			double conc;                       // at the last commit
+			double e;                          // the last commit's load error (see retry_load())
+		} step;                              // see adapt_step(); not part of the state
+
+		char *name;                          // ContaminantNames' copy, so not ours to free
+		int id;   // ContaminantNames::Id(name)
 	} _cinfo;
 
 	_cinfo *cinfo;
 	int n_cinfo;
 
+	// conc, ate, current_load and tick for each contaminant, in the taxon's
+	// pool on our home node (contnuma.hxx)
+	ContaminantHot::Row hot;
+	ContaminantHot *hot_pool;
+	int hot_slot;
+	int away;   // commits in a row in chunks another node owns (see commit_chunk())
+
+	// the other members' loads and cube axes; 0 without an ensemble
+	ContaminantEnsemble *ensemble;
+
+	// what we've eaten since the last commit (contingest.hxx)
+	ContaminantIngest::Queue ingested;
+
+	// our ContaminantStream ids, and the names they were for
+	struct {
+		uint32_t taxon, who;
+		const char *tname, *wname;
+	} stream;
+
 private:
 	void zero();
 	void free_cinfo();
 	void *Get_cinfo_State(int, int*);
 	void Set_cinfo_State(void*, int, int);
+	void configure_env(int i, double t, R3 *loc);
+	void attach_hot();
+	void detach_hot();
+	void rehome(int node);
+	void take_ingested();
+	void dump_precision();
+	void stream_tick(double t, R3 *loc);
+	int parse_LC(char *points, EndpointSurf *ES);
+	int setup_from_cache(char *name, ContaminantTaxon::Setup *cs, ContaminantSetupCache::Entry *ce);
+	void cache_setup(char *name, ContaminantTaxon::Setup *cs);
+	void ensemble_attach();
+	void ensemble_tick(double t, double actual_dt, R3 *loc);
+
+	// the pieces of CommitIntoxicate
+	static void kills(Contamination **c, int n, double actual_dt, int chronic, double *K, double *k);
+	void update_loads(double t, double actual_dt, R3 *loc);
+	double update_load(int i, double t, double dt, double ate, R3 *loc);
+	double sub_steps(int i, double t, double dt, int n, R3 *loc);
+	double retry_load(int i, double t, double dt, R3 *loc);
+	void kill(double t, double *K, char *cause);
+	void adapt_step(int i, double actual_dt);
+	double step(int i) { return (cinfo[i].cs->tolerance > 0 && cinfo[i].step.h > 0)?cinfo[i].step.h:cinfo[i].cs->cont_tick; }
+	// and for an exposure of conc: min_tick if the last commit had none
+	double step(int i, double conc) { return (cinfo[i].cs->tolerance > 0 && conc > 0 && !(cinfo[i].step.conc > 0))?cinfo[i].cs->min_tick:step(i); }
+	void end_tick(double t, double actual_dt, R3 *loc, double old_members);
+	void log_death(double t, double died, double left, double imass, char *cause);
+	static int *many_owners(Contamination **c, int n, int chunks);
+	static void commit_chunk(void *arg, int chunk);
+	static void init_chunk(void *arg, int chunk);
+	int reinit_one();
+	static int same_setup(Contamination **c, int n);
+	static void kill_cohort(Contamination **c, int n, double t, double *K, double *k, char *cause);
 
 Attribute:
 	virtual R3 getLocation()=0;
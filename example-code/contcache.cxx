@@ -0,0 +1,378 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contcache.cxx -- the per-taxon contaminant setups, kept between runs
+
+  See contcache.hxx.  The file is a Header and then Records, each
+  followed by a pack_mem block (padded to 8 bytes) of the items below.
+  A record is found by a scan of the mapping; there are only as many
+  as there are taxa times contaminants.  Records added in this run
+  aren't mapped, since this run already has them.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "prmagent.hxx"
+#include "packmem.h"
+#include "paramcorpus.hxx"
+#include "contnative.hxx"
+#include "contcache.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define CCACHE_MAGIC "CSETUP01"
+#define FNV_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define ROUND8(x) (((x) + 7) & ~7)
+
+// the items in a record's block
+enum {
+	I_FIXED, I_TAXON, I_CONTAMINANT,
+	I_PROG,
+	I_LC = I_PROG + ContaminantSetupCache::PROGS,
+	I_TABLE = I_LC + ContaminantSetupCache::LCS,
+	I_NATIVE = I_TABLE + 2,
+	I_K = I_NATIVE + ContaminantSetupCache::PROGS,
+	ITEMS = I_K + ContaminantSetupCache::PROGS
+};
+
+typedef struct {
+	double cont_tick, tolerance, min_tick, max_tick;
+	int nk[ContaminantSetupCache::PROGS];
+} Fixed;
+
+int ContaminantSetupCache::fd = -1;
+char *ContaminantSetupCache::name = 0;
+char *ContaminantSetupCache::map = 0;
+int ContaminantSetupCache::maplen = 0;
+int ContaminantSetupCache::mapsize = 0;
+uint64_t ContaminantSetupCache::key = 0;
+int ContaminantSetupCache::tried = 0;
+volatile int ContaminantSetupCache::lock = 0;
+unsigned long ContaminantSetupCache::hits = 0;
+
+/*-  Code  */
+
+/*-- opening and closing */
+
+/*--- Open(char *file, uint64_t k) -- */
+// A file for some other key (or none at all) is started again.  The
+// file we lock has to be the one under the name, since somebody may
+// have started it again while we waited.
+int ContaminantSetupCache::Open(char *file, uint64_t k) {
+	struct stat st;
+	Header h;
+
+	assert(file);
+	Close();
+	tried = 1;
+	if (!k) return 0;
+
+	uint64_t native = ContaminantNative::Signature();
+	key = hash(k, &native, sizeof(native));
+	name = Strdup(file);
+	if (!name) abort();
+
+	for (;;) {
+		fd = open(file, O_RDWR|O_CREAT, 0644);
+		if (fd < 0) {
+			warning("Unable to open the setup cache %s", file);
+			Close();
+			tried = 1;
+			return 0;
+		}
+		flock(fd, LOCK_EX);
+		if (current()) break;
+		close(fd);
+	}
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Header) &&
+		 pread(fd, &h, sizeof(h), 0) == sizeof(h) && !memcmp(h.magic, CCACHE_MAGIC, 8) && h.key == key) {
+		void *m = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (m != MAP_FAILED) {
+			map = (char *)m;
+			mapsize = st.st_size;
+			maplen = valid(map, mapsize);
+			if (maplen < mapsize) {
+				VERBOSE("ContaminantSetupCache", "%s: dropping %d bytes of a broken record", file, mapsize - maplen);
+				if (ftruncate(fd, maplen) < 0) warning("Unable to trim the setup cache %s", file);
+			}
+		}
+	}
+	if (!map) {
+		int nfd = start(file);
+		if (nfd < 0) {
+			warning("Unable to write the setup cache %s", file);
+			flock(fd, LOCK_UN);
+			Close();
+			tried = 1;
+			return 0;
+		}
+		VERBOSE("ContaminantSetupCache", "%s: starting again", file);
+		close(fd);  // and the lock with it
+		fd = nfd;
+		return 1;
+	}
+	flock(fd, LOCK_UN);
+	VERBOSE("ContaminantSetupCache", "%s: %d bytes of setups", file, maplen - (int)sizeof(Header));
+	return 1;
+}
+
+/*--- start(char *file) -- a new file with just our header, renamed over the old one */
+// Truncating the old one instead would pull it out from under anyone
+// still mapping it (SIGBUS on their next Find()).
+int ContaminantSetupCache::start(char *file) {
+	char tmp[4096];
+	Header h;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >= (int)sizeof(tmp)) return -1;
+	int nfd = mkstemp(tmp);
+	if (nfd < 0) return -1;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CCACHE_MAGIC, 8);
+	h.key = key;
+	if (fchmod(nfd, 0644) < 0 || pwrite(nfd, &h, sizeof(h), 0) != sizeof(h) || rename(tmp, file) < 0) {
+		close(nfd);
+		unlink(tmp);
+		return -1;
+	}
+	return nfd;
+}
+
+/*--- current() -- whether our file is still the one under the name */
+int ContaminantSetupCache::current() {
+	struct stat a, b;
+	return fd >= 0 && fstat(fd, &a) == 0 && stat(name, &b) == 0 && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+/*--- Close() -- */
+void ContaminantSetupCache::Close() {
+	if (map) munmap(map, mapsize);
+	if (fd >= 0) close(fd);
+	if (name) Free(name);
+	map = 0;
+	maplen = mapsize = 0;
+	fd = -1;
+	name = 0;
+	tried = 0;
+}
+
+/*--- autoload() -- look at $CONT_SETUP_CACHE the first time through */
+void ContaminantSetupCache::autoload() {
+	if (tried) return;
+	while (__sync_lock_test_and_set(&lock, 1)) ;
+	if (!tried) {
+		char *f = getenv("CONT_SETUP_CACHE");
+		uint64_t k;
+		if (!f || !*f) tried = 1;
+		else if (!(k = Key())) {
+			warning("$CONT_SETUP_CACHE wants $CONT_PARAM_FILES or a parameter corpus to key it on");
+			tried = 1;
+		}
+		else Open(f, k);
+	}
+	__sync_lock_release(&lock);
+}
+
+/*--- Active() -- */
+int ContaminantSetupCache::Active() {
+	autoload();
+	return fd >= 0;
+}
+
+
+/*-- keys */
+
+/*--- hash(uint64_t h, const void *d, int n) -- FNV-1a, carrying on from h */
+uint64_t ContaminantSetupCache::hash(uint64_t h, const void *d, int n) {
+	for (const unsigned char *p = (const unsigned char *)d; n-- > 0; p++) {
+		h ^= *p;
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+/*--- Key() -- the parameter files' contents, and the corpus's signature */
+// The files are those in $CONT_PARAM_FILES (colon separated), or else
+// those the corpus was made from.  The corpus alone isn't enough: any
+// path it doesn't have comes from the tree, and so from the files.
+uint64_t ContaminantSetupCache::Key() {
+	uint64_t h = FNV_BASIS, corpus = ParamCorpus::Signature();
+	char *files = getenv("CONT_PARAM_FILES"), *s;
+	int n = 0;
+
+	if (files && *files) {
+		char *l = Strdup(files), *save = 0;
+		if (!l) abort();
+		for (s = strtok_r(l, ":", &save); s; s = strtok_r(0, ":", &save), n++) {
+			if (!ParamCorpus::SumFile(s, &h)) break;
+			h = hash(h, "", 1);  // so that moving a line between files counts
+		}
+		if (s) warning("Unable to read %s for the setup cache's key", s);
+		Free(l);
+		if (s) return 0;
+	}
+	else {
+		for (; (s = ParamCorpus::SourceFile(n)); n++) {
+			if (!ParamCorpus::SumFile(s, &h)) {
+				warning("Unable to read %s for the setup cache's key", s);
+				return 0;
+			}
+			h = hash(h, "", 1);
+		}
+	}
+	if (!n) return 0;
+	h = hash(h, &corpus, sizeof(corpus));
+	return h?h:1;
+}
+
+
+/*-- records */
+
+/*--- valid(char *m, int len) -- the length of the good records at the start */
+int ContaminantSetupCache::valid(char *m, int len) {
+	Record r;
+	int off = sizeof(Header);
+
+	while (off + (int)sizeof(Record) <= len) {
+		memcpy(&r, m + off, sizeof(r));
+		if (r.size <= 0 || r.size > len - off - (int)sizeof(Record)) break;
+		if (hash(FNV_BASIS, m + off + sizeof(Record), r.size) != r.sum) break;
+		off += sizeof(Record) + r.size;
+	}
+	return off;
+}
+
+/*--- Find(char *taxon, char *contaminant, Entry *e) -- */
+int ContaminantSetupCache::Find(char *taxon, char *contaminant, Entry *e) {
+	char *k[2] = { taxon, contaminant };
+	Record r;
+	int found = 0, i;
+
+	assert(taxon && contaminant && e);
+	autoload();
+	if (!map) return 0;
+
+	uint64_t id = ParamCorpus::Hash(k, 2);
+	for (int off = sizeof(Header); !found && off < maplen; off += sizeof(Record) + r.size) {
+		memcpy(&r, map + off, sizeof(r));
+		if (r.id != id) continue;
+
+		void **v;
+		int *l;
+		int n = unpack_mem(map + off + sizeof(Record), r.size, &v, &l);
+		if (n == ITEMS && l[I_FIXED] == sizeof(Fixed) && v[I_TAXON] && v[I_CONTAMINANT] &&
+			 !strcmp((char *)v[I_TAXON], taxon) && !strcmp((char *)v[I_CONTAMINANT], contaminant)) {
+			Fixed x;
+			memcpy(&x, v[I_FIXED], sizeof(x));
+			memset(e, 0, sizeof(*e));
+			e->cont_tick = x.cont_tick;
+			e->tolerance = x.tolerance;
+			e->min_tick = x.min_tick;
+			e->max_tick = x.max_tick;
+			for (i = 0; i < PROGS; i++) {
+				e->prog[i] = (char *)v[I_PROG + i];
+				e->native[i] = (char *)v[I_NATIVE + i];
+				e->nk[i] = x.nk[i];
+				e->k[i] = (double *)v[I_K + i];
+				if (e->native[i] && l[I_K + i] != e->nk[i]*(int)sizeof(double)) e->native[i] = 0;
+			}
+			for (i = 0; i < LCS; i++) e->lc[i] = (char *)v[I_LC + i];
+			for (i = 0; i < 2; i++) {
+				e->table[i] = v[I_TABLE + i];
+				e->tablesz[i] = l[I_TABLE + i];
+			}
+			found = 1;
+		}
+		Free(v);
+		Free(l);
+	}
+	if (found) __sync_fetch_and_add(&hits, 1);
+	return found;
+}
+
+/*--- Add(char *taxon, char *contaminant, Entry *e) -- */
+// Another scenario may have started the file again since we opened
+// it, in which case it's theirs now and we leave it alone.
+void ContaminantSetupCache::Add(char *taxon, char *contaminant, Entry *e) {
+	void *v[ITEMS];
+	int l[ITEMS], i, sz;
+	Fixed x;
+	Header h;
+
+	assert(taxon && contaminant && e);
+	if (!Active()) return;
+
+	memset(&x, 0, sizeof(x));
+	x.cont_tick = e->cont_tick;
+	x.tolerance = e->tolerance;
+	x.min_tick = e->min_tick;
+	x.max_tick = e->max_tick;
+	v[I_FIXED] = &x;
+	l[I_FIXED] = sizeof(x);
+	v[I_TAXON] = taxon;
+	l[I_TAXON] = strlen(taxon)+1;
+	v[I_CONTAMINANT] = contaminant;
+	l[I_CONTAMINANT] = strlen(contaminant)+1;
+	for (i = 0; i < PROGS; i++) {
+		v[I_PROG + i] = e->prog[i];
+		l[I_PROG + i] = e->prog[i]?strlen(e->prog[i])+1:0;
+		v[I_NATIVE + i] = e->native[i];
+		l[I_NATIVE + i] = e->native[i]?strlen(e->native[i])+1:0;
+		x.nk[i] = e->native[i]?e->nk[i]:0;
+		v[I_K + i] = e->native[i]?e->k[i]:0;
+		l[I_K + i] = x.nk[i]*sizeof(double);
+	}
+	for (i = 0; i < LCS; i++) {
+		v[I_LC + i] = e->lc[i];
+		l[I_LC + i] = e->lc[i]?strlen(e->lc[i])+1:0;
+	}
+	for (i = 0; i < 2; i++) {
+		v[I_TABLE + i] = e->table[i];
+		l[I_TABLE + i] = e->table[i]?e->tablesz[i]:0;
+	}
+
+	void *block = pack_mem(v, l, ITEMS, &sz);
+	Record r;
+	r.size = ROUND8(sz);
+	r.pad = 0;
+	char *k[2] = { taxon, contaminant };
+	r.id = ParamCorpus::Hash(k, 2);
+	char *buf = (char *)Calloc(1, sizeof(Record) + r.size);
+	if (!buf) abort();
+	memcpy(buf + sizeof(Record), block, sz);
+	Free(block);
+	r.sum = hash(FNV_BASIS, buf + sizeof(Record), r.size);
+	memcpy(buf, &r, sizeof(r));
+
+	// the lock for our threads, flock() for other kernels
+	while (__sync_lock_test_and_set(&lock, 1)) ;
+	flock(fd, LOCK_EX);
+	if (current() && pread(fd, &h, sizeof(h), 0) == sizeof(h) && !memcmp(h.magic, CCACHE_MAGIC, 8) && h.key == key) {
+		off_t end = lseek(fd, 0, SEEK_END);
+		int n = sizeof(Record) + r.size;
+		if (pwrite(fd, buf, n, end) != n) {
+			warning("Unable to add %s's %s setup to the setup cache", taxon, contaminant);
+			if (ftruncate(fd, end) < 0) warning("and unable to take the pieces back out");
+		}
+	}
+	flock(fd, LOCK_UN);
+	__sync_lock_release(&lock);
+	Free(buf);
+}
+
+/*--- Hits() -- setups found so far */
+unsigned long ContaminantSetupCache::Hits() {
+	return hits;
+}
+
+/*-  The End  */
@@ -0,0 +1,104 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contcache.hxx -- the per-taxon contaminant setups, kept between runs
+
+  Everything Contamination::load_taxon_setup works out from the
+  parameters (the tick and the adaptive step, the program strings, the
+  LC strings, the tabulated lethal surfaces and the constants bound to
+  the compiled programs) is the same from one run of a scenario to the
+  next.  The first run appends each setup to the file named by
+  $CONT_SETUP_CACHE (or given to Open()), and later runs map the file
+  and take the setups from it instead of walking the parameters,
+  tabulating the surfaces and translating the programs again.
+
+  The file is keyed by a hash of the parameter files (those listed in
+  $CONT_PARAM_FILES or, without it, those the parameter corpus was made
+  from; see paramcorpus.hxx), of the corpus if there is one, and of the
+  compiled programs in the binary.  A change to any of them changes
+  the key, and a file with the wrong key is started again from
+  scratch, so there's nothing to remember to delete.  With neither a
+  corpus nor $CONT_PARAM_FILES there is nothing to key on, and no cache.
+  A file is started again by writing a new one and renaming it into
+  place, so that another kernel still mapping the old one can go on
+  reading it.
+
+  What isn't kept: the ensemble members (load_ensemble still does
+  those), the evaluator's programs and variable references (the
+  kernel's, and per agent anyway) and the profile slots.  The surfaces
+  are set from their LC strings again, which costs next to nothing;
+  it's the tables which are worth having.
+
+  Records are only ever appended, each with a checksum, under flock(),
+  so several kernels of one run can share a file; a record cut short
+  is dropped the next time the file is opened.  The strings in an
+  Entry point into the mapping, which stays until Close(); only close
+  the cache when the setups are going as well.  ContaminantTaxon::Flush
+  (a parameter reload) does, after the setups, and the next Find()
+  works the key out again and opens $CONT_SETUP_CACHE afresh.
+*/
+
+#ifndef _CONTCACHE_HXX_INCLUDED_
+#define _CONTCACHE_HXX_INCLUDED_
+
+#include <stdint.h>
+
+class ContaminantSetupCache
+{
+public:
+	enum { LC_ACUTE, LC_CHRONIC, LC_REPRODUCTION, LC_MOVEMENT, LC_FORAGING, LCS };
+	enum { P_UPDATE, P_FORAGE, P_REPRODUCE, P_MOVE, PROGS };
+
+	typedef struct {
+		double cont_tick, tolerance, min_tick, max_tick;
+		char *prog[PROGS];          // 0 where there isn't one
+		char *lc[LCS];              // the LC strings; 0 where there isn't one
+		void *table[2];             // EndpointTable::GetState(), acute and chronic; 0 if untabulated
+		int tablesz[2];
+		char *native[PROGS];        // ContaminantNativeProg text; 0 for the evaluator
+		int nk[PROGS];
+		double *k[PROGS];           // [nk]; not necessarily aligned
+	} Entry;
+
+	static int Open(char *file, uint64_t key);   // the key of what the setups came from
+	static void Close();                         // and look at $CONT_SETUP_CACHE again next time
+	static int Active();                         // whether there's a cache to Find() in or Add() to
+	static int Find(char *taxon, char *contaminant, Entry *e);  // 0 if it isn't there
+	static void Add(char *taxon, char *contaminant, Entry *e);
+
+	static uint64_t Key();                       // of the parameters; 0 if we can't tell
+	static unsigned long Hits();
+
+private:
+	typedef struct {
+		char magic[8];
+		uint64_t key;
+	} Header;
+
+	typedef struct {
+		int size;                   // of the pack_mem block which follows
+		int pad;
+		uint64_t id;                // of taxon/contaminant
+		uint64_t sum;               // of the block
+	} Record;
+
+	static void autoload();
+	static uint64_t hash(uint64_t h, const void *d, int n);
+	static int valid(char *m, int len);
+	static int start(char *file);
+	static int current();
+
+	static int fd;
+	static char *name;              // of the file
+	static char *map;
+	static int maplen;              // what's valid of it
+	static int mapsize;
+	static uint64_t key;
+	static int tried;
+	static volatile int lock;
+	static unsigned long hits;
+};
+
+#endif
+/*-  The End  */
@@ -0,0 +1,148 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contensemble.cxx -- contaminant parameter ensembles
+
+  The members' parameters are loaded with the rest of the taxon's
+  setup (Contamination::load_ensemble) and run from CommitIntoxicate
+  (Contamination::ensemble_tick); this is just their state.
+*/
+
+/*-  Included files  */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "prmagent.hxx"
+#include "contensemble.hxx"
+#include "cube.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+
+/*-  Code  */
+
+/*-- the per-taxon part */
+
+/*--- FreeMembers(Member *m, int n) -- */
+void ContaminantEnsemble::FreeMembers(Member *m, int n) {
+	if (!m) return;
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < m[i].n; j++) Free(m[i].name[j]);
+		if (m[i].name) Free(m[i].name);
+		if (m[i].value) Free(m[i].value);
+		if (m[i].base) Free(m[i].base);
+		if (m[i].acute) delete m[i].acute;
+		if (m[i].chronic) delete m[i].chronic;
+		ContaminantNative::Unbind(m[i].nupdate);
+	}
+	Free(m);
+}
+
+
+/*-- Constructors / destructors */
+
+/*--- ContaminantEnsemble(int members, int c) -- everything zero */
+ContaminantEnsemble::ContaminantEnsemble(int members, int c) {
+	assert(members > 1 && members <= ENSEMBLE_MAX);
+	assert(c > 0);
+	M = members - 1;
+	nc = c;
+	load = (cont_real *)Calloc(nc*M, sizeof(cont_real));
+	axis = (double *)Calloc(2*nc*M, sizeof(double));
+	if (!load || !axis) abort();
+	K = axis + nc*M;
+	ref = 0;
+}
+
+/*--- ContaminantEnsemble(void *state, int len) -- from PutState() */
+ContaminantEnsemble::ContaminantEnsemble(void *state, int len) {
+	int *h = (int *)state;
+
+	assert(len >= (int)(2*sizeof(int)));
+	M = h[0];
+	nc = h[1];
+	assert(M > 0 && M < ENSEMBLE_MAX && nc > 0);
+	assert(len == StateSize());
+	load = (cont_real *)Calloc(nc*M, sizeof(cont_real));
+	axis = (double *)Calloc(2*nc*M, sizeof(double));
+	if (!load || !axis) abort();
+	K = axis + nc*M;
+	double *d = (double *)(h + 2);
+	for (int i = 0; i < nc*M; i++) load[i] = d[i];
+	memcpy(axis, d + nc*M, nc*M*sizeof(double));
+	ref = 0;
+}
+
+/*--- ~ContaminantEnsemble() -- */
+ContaminantEnsemble::~ContaminantEnsemble() {
+	FreeRefs();
+	Free(load);
+	Free(axis);
+}
+
+/*--- Rehome() -- */
+void ContaminantEnsemble::Rehome() {
+	cont_real *l = (cont_real *)Malloc(nc*M*sizeof(cont_real));
+	double *a = (double *)Malloc(2*nc*M*sizeof(double));
+	if (!l || !a) abort();
+	memcpy(l, load, nc*M*sizeof(cont_real));
+	memcpy(a, axis, 2*nc*M*sizeof(double));
+	Free(load);
+	Free(axis);
+	load = l;
+	axis = a;
+	K = axis + nc*M;
+}
+
+/*--- FreeRefs() -- */
+void ContaminantEnsemble::FreeRefs() {
+	if (!ref) return;
+	for (int i = 0; i < nc*M; i++) {
+		if (!ref[i]) continue;
+		for (int j = 0; ref[i][j]; j++) CCalc::FreeCalcVar(ref[i][j]);
+		Free(ref[i]);
+	}
+	Free(ref);
+	ref = 0;
+}
+
+
+/*-- the members */
+
+/*--- Adjust() -- the member cubes' contaminant axes, all at once */
+void ContaminantEnsemble::Adjust() {
+	int n = nc*M;
+	double *a = axis, *k = K;
+
+	for (int i = 0; i < n; i++) a[i] += k[i] * (1.0 - a[i]);
+}
+
+/*--- Members(int m, Cube *base) -- */
+double ContaminantEnsemble::Members(int m, Cube *base) {
+	assert(m >= 0 && m < M);
+	assert(base);
+	return base->ValueWith(axis + m, M, 1, nc);
+}
+
+
+/*-- state -- int M, int nc, loads, axes; all double whatever the storage */
+
+/*--- StateSize() -- */
+int ContaminantEnsemble::StateSize() {
+	return 2*sizeof(int) + 2*nc*M*sizeof(double);
+}
+
+/*--- PutState(void *state) -- */
+void ContaminantEnsemble::PutState(void *state) {
+	int *h = (int *)state;
+	h[0] = M;
+	h[1] = nc;
+	double *d = (double *)(h + 2);
+	for (int i = 0; i < nc*M; i++) d[i] = load[i];
+	memcpy(d + nc*M, axis, nc*M*sizeof(double));
+}
+
+/*-  The End  */
@@ -0,0 +1,89 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contensemble.hxx -- contaminant parameter ensembles
+
+  For sensitivity work a taxon can carry an ensemble of contaminant
+  parameterisations in one run instead of one run per parameter set:
+
+	ContaminantSink {
+		ensemble { members = 4 }
+		contaminants {
+			AdministriviumIncapacitate {
+				...
+				ensemble {
+					member1 { const { decay_rate = 0.01 } }
+					member2 { const { decay_rate = 0.1  resp_uptake = 0.1 } }
+					member3 { chronic_lethal = "20% 30[ug/l] @ 200[hours], 50% 60[ug/l] @ 400[hours]" }
+				}
+			}
+		}
+	}
+
+  Member 0 is the agent itself, with the ordinary parameters.  The
+  other members may replace any of the contaminant's "const" values and
+  its acute and chronic surfaces; what they don't replace they share.
+  Every member sees the same exposure (the agent only moves and feeds
+  once), but has its own tissue loads and its own contaminant axes of
+  the member cube, so each ends up with its own load and survival.
+  The impairments, and so the agent's behaviour, follow member 0.
+
+  The per-member state lives here, laid out contaminant by contaminant
+  with the members side by side (load[i*M + m]), so that the sweeps
+  over the members are straight runs through memory.  The load update
+  uses the compiled program when there is one (each member gets a copy
+  with its constants replaced); otherwise the evaluator is run once per
+  member with the replaced constants set for the duration.
+*/
+
+#ifndef _CONTENSEMBLE_HXX_INCLUDED_
+#define _CONTENSEMBLE_HXX_INCLUDED_
+
+#include "prmenvexpr.hxx"
+#include "endpointsurf.hxx"
+#include "contnative.hxx"
+#include "conthot.hxx"
+
+#define ENSEMBLE_MAX 256
+
+class Cube;
+
+class ContaminantEnsemble
+{
+public:
+	// what a member changes for one contaminant; part of the taxon's setup
+	typedef struct {
+		int n;                            // constants replaced
+		char **name;                      // owned
+		double *value, *base;             // base is the ordinary value, to put back
+		EndpointSurf *acute, *chronic;    // owned; 0 to use the setup's
+		ContaminantNativeProg *nupdate;   // owned; 0 unless the setup's update is compiled
+	} Member;
+
+	static void FreeMembers(Member *m, int n);
+
+	ContaminantEnsemble(int members, int nc);   // members includes member 0
+	ContaminantEnsemble(void *state, int len);
+	~ContaminantEnsemble();
+
+	int M;              // members other than the agent
+	int nc;             // contaminants
+	cont_real *load;    // nc*M; stored as the agent's are
+	double *axis;       // nc*M; survival along contaminant i's axis is 1 - axis
+	double *K;          // nc*M, scratch
+	CCalc::CalcVar ***ref;  // [i*M+m], the Member's replaced constants in the agent's evaluator block
+
+	void FreeRefs();
+
+	// axis[i*M+m] += K[i*M+m] * (1 - axis[i*M+m]), as Cube::AdjustLevels
+	void Adjust();
+	double Members(int m, Cube *base);     // member m's count, given the agent's cube
+
+	void Rehome();                         // fresh copies of load and axis, made on this thread (contnuma.hxx)
+	int StateSize();
+	void PutState(void *state);            // StateSize() bytes
+};
+
+#endif
+/*-  The End  */
@@ -0,0 +1,175 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contexprc.cxx -- compile contaminant expressions to C++
+
+  Usage: contexprc [-c corpus] -o out.cxx taxon ...
+
+  e.g.   contexprc -c shark.pc -o contexpr_shark.cxx shark
+
+  For every contaminant a taxon is sensitive to, the load_update and
+  impairment programs are put through ContaminantNative::Translate()
+  and written out as functions, along with the table that registers
+  them.  Compile the output into the model; see contnative.hxx for how
+  the functions are found again at run time.  Programs which can't be
+  translated are reported and left to the evaluator.
+
+  That includes every load_update with an ode() in it, which is most
+  of them: a compiled ode() would have to integrate exactly as the
+  evaluator does to be used in its place, and the step the evaluator
+  takes isn't ours to copy.  The impairments, and load_updates written
+  as closed forms, are what this is for.
+
+  Link with the kernel's parameter library.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "prmagent.hxx"
+#include "paramcorpus.hxx"
+#include "contnative.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+static const char *programs[] = {
+	"load_update", "reproductive_impairment", "foraging_impairment", "movement_impairment", 0
+};
+
+typedef struct {
+	char *text;
+	char **names;
+	int nnames;
+} Func;
+
+static Func *func = 0;
+static int nfunc = 0;
+
+/*-  Code  */
+
+/*--- add_func(char *text, char **names, int nn) -- takes ownership; returns 0 if we have it already */
+static int add_func(char *text, char **names, int nn) {
+	for (int i = 0; i < nfunc; i++) {
+		if (strcmp(func[i].text, text)) continue;
+		for (int j = 0; j < nn; j++) Free(names[j]);
+		if (names) Free(names);
+		Free(text);
+		return 0;
+	}
+	func = (Func *)Realloc(func, (nfunc+1)*sizeof(Func));
+	if (!func) abort();
+	func[nfunc].text = text;
+	func[nfunc].names = names;
+	func[nfunc].nnames = nn;
+	nfunc++;
+	return 1;
+}
+
+/*--- quote(FILE *f, const char *s) -- as a C string */
+static void quote(FILE *f, const char *s) {
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') fputc('\\', f);
+		fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+/*--- do_taxon(char *taxon) -- */
+static void do_taxon(char *taxon) {
+	char *keys[PCORPUS_MAXDEPTH];
+	int n = 0;
+
+	keys[n++] = taxon;
+	keys[n++] = (char *)"ContaminantSink";
+	keys[n++] = (char *)"contaminants";
+	char **clist = ParamCorpus::GetNodes(keys, n);
+	if (!clist) {
+		fprintf(stderr, "contexprc: %s has no contaminants\n", taxon);
+		return;
+	}
+
+	for (int i = 0; clist[i]; i++) {
+		keys[n] = clist[i];
+		ContaminantNative::Defs *defs = ContaminantNative::LoadDefs(keys, n+1);
+
+		for (int j = 0; programs[j]; j++) {
+			keys[n+1] = (char *)programs[j];
+			char *expr = ParamCorpus::GetS(PARAM_OPT, keys, n+2);
+			if (!expr) continue;
+
+			char **names;
+			int nn;
+			char *text = ContaminantNative::Translate(expr, defs, &names, &nn);
+			if (!text) {
+				fprintf(stderr, "contexprc: %s %s %s stays with the evaluator%s: \"%s\"\n",
+					taxon, clist[i], programs[j], strstr(expr, "ode(")?" (it has an ode())":"", expr);
+				continue;
+			}
+			add_func(text, names, nn);
+		}
+		ContaminantNative::FreeDefs(defs);
+	}
+	Free(clist);
+}
+
+/*--- usage() -- */
+static void usage() {
+	fprintf(stderr, "Usage: contexprc [-c corpus] -o out.cxx taxon ...\n");
+	exit(1);
+}
+
+/*-- main */
+int main(int argc, char **argv) {
+	char *out = 0;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-o") && i+1 < argc) out = argv[++i];
+		else if (!strcmp(argv[i], "-c") && i+1 < argc) {
+			if (!ParamCorpus::Open(argv[++i])) fatal(1, "Unable to open corpus %s", argv[i]);
+		}
+		else usage();
+	}
+	if (!out || i >= argc) usage();
+
+	for (; i < argc; i++) do_taxon(argv[i]);
+
+	FILE *f = fopen(out, "w");
+	if (!f) fatal(1, "Unable to write %s", out);
+
+	fprintf(f, "// generated by contexprc -- do not edit\n\n");
+	fprintf(f, "#include <math.h>\n#include \"contnative.hxx\"\n\n");
+
+	for (i = 0; i < nfunc; i++) {
+		fprintf(f, "static double cx_%d(ContaminantNativeArgs *a) {\n", i);
+		fprintf(f, "\t(void)a;\n\treturn %s;\n}\n\n", func[i].text);
+		fprintf(f, "static const char *cx_%d_names[] = {", i);
+		for (int j = 0; j < func[i].nnames; j++) {
+			fprintf(f, j?", ":" ");
+			quote(f, func[i].names[j]);
+		}
+		fprintf(f, "%s 0 };\n\n", func[i].nnames?",":"");
+	}
+
+	fprintf(f, "static ContaminantNative::Record cx_records[] = {\n");
+	for (i = 0; i < nfunc; i++) {
+		fprintf(f, "\t{ ");
+		quote(f, func[i].text);
+		fprintf(f, ", cx_%d, %d, cx_%d_names },\n", i, func[i].nnames, i);
+	}
+	if (!nfunc) fprintf(f, "\t{ 0, 0, 0, 0 }\n");
+	fprintf(f, "};\n\n");
+	fprintf(f, "static ContaminantNative::Registrar cx_registrar(cx_records, %d);\n", nfunc);
+
+	if (fclose(f)) fatal(1, "Error writing %s", out);
+
+	printf("%s: %d functions\n", out, nfunc);
+	return 0;
+}
+
+/*-  The End  */
@@ -0,0 +1,387 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  conthalo.cxx -- sinks split across kernels by region, with halo copies of the sources
+
+  See conthalo.hxx.  Messages are a Msg header followed by the taxon
+  name (padded to eight bytes) and then the source's state.  Our own
+  sources' entries remember the hash and the regions sent to; the
+  others' entries hold the copies.  Both tables only change in
+  Publish(), Withdraw() and Sync(), which happen between ticks, so
+  Lookup() can be called from any thread while the sinks run.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <sched.h>
+
+#include "prmagent.hxx"
+#include "conthalo.hxx"
+#include "contshm.hxx"
+#include "contsrc.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define MAXREGIONS 64
+#define BUCKETS 1024
+#define HALO_ROUND(x) (((x)+7) & ~7)
+
+#define H_UPDATE 1   // here is its state
+#define H_REMOTE 2   // it reaches you, but it can't be copied
+#define H_DROP 3     // it doesn't reach you any more
+#define H_MARK 4     // that's all for the tick
+
+typedef struct {
+	int type;
+	int from;        // region
+	int xid;
+	int tlen;        // taxon name, with its NUL
+	int sz;          // state
+	unsigned epoch;  // the tick's Sync()
+} Msg;
+
+typedef struct HaloEntry {
+	int xid;
+	int owner;                // theirs: the region it came from
+	char *taxon;              // theirs
+	ContaminantSource *copy;  // theirs; 0 if it's to be asked
+	uint64_t hash;            // ours: the state and taxon as last sent
+	uint64_t sent;            // ours: the regions which have it
+	struct HaloEntry *next;
+} HaloEntry;
+
+static HaloEntry *ours[BUCKETS], *theirs[BUCKETS];
+static ContaminantRing *out[MAXREGIONS], *in[MAXREGIONS];
+static ContaminantRing **spare = 0;   // region 0's, between the others
+static int nspare = 0, ringsize = 0;
+static unsigned seen[MAXREGIONS];     // the last mark from each region
+static ContaminantHaloResolver resolver = 0;
+static ContaminantHaloFactory factory = 0;
+
+int ContaminantHalo::region = -1;
+int ContaminantHalo::nx = 1;
+int ContaminantHalo::ny = 1;
+R3 ContaminantHalo::lo;
+R3 ContaminantHalo::hi;
+unsigned ContaminantHalo::epoch = 0;
+long ContaminantHalo::updates = 0;
+
+/*-  Code  */
+
+/*-- the tables */
+
+/*--- find(HaloEntry **t, int xid) -- */
+static HaloEntry *find(HaloEntry **t, int xid) {
+	HaloEntry *e;
+	for (e = t[(unsigned)xid % BUCKETS]; e; e = e->next) {
+		if (e->xid == xid) return e;
+	}
+	return 0;
+}
+
+/*--- add(HaloEntry **t, int xid) -- */
+static HaloEntry *add(HaloEntry **t, int xid) {
+	HaloEntry *e = (HaloEntry *)Calloc(1, sizeof(HaloEntry));
+	if (!e) abort();
+	e->xid = xid;
+	e->next = t[(unsigned)xid % BUCKETS];
+	t[(unsigned)xid % BUCKETS] = e;
+	return e;
+}
+
+/*--- forget(HaloEntry **t, int xid) -- */
+static void forget(HaloEntry **t, int xid) {
+	HaloEntry **p;
+	for (p = &t[(unsigned)xid % BUCKETS]; *p; p = &(*p)->next) {
+		if ((*p)->xid != xid) continue;
+		HaloEntry *e = *p;
+		*p = e->next;
+		if (e->copy) delete e->copy;
+		if (e->taxon) Free(e->taxon);
+		Free(e);
+		return;
+	}
+}
+
+/*--- hash(uint64_t h, const void *p, int n) -- FNV-1a */
+static uint64_t hash(uint64_t h, const void *p, int n) {
+	const unsigned char *s = (const unsigned char *)p;
+	for (int i = 0; i < n; i++) {
+		h ^= s[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+
+/*-- joining */
+
+/*--- Join(char *base, int rg, int x, int y, R3 l, R3 h, int size) -- */
+// Region 0 makes every ring (and keeps the ones between the others,
+// so that they last until it leaves); the rest only attach their own.
+int ContaminantHalo::Join(char *base, int rg, int x, int y, R3 l, R3 h, int size) {
+	char nm[256];
+
+	assert(base && *base == '/');
+	if (region >= 0) Leave();
+	if (x < 1 || y < 1 || x*y > MAXREGIONS) {
+		warning("Can't split contamination into %d by %d regions", x, y);
+		return 0;
+	}
+	assert(rg >= 0 && rg < x*y);
+	assert(h.x > l.x && h.y > l.y);
+
+	region = rg;
+	nx = x;
+	ny = y;
+	lo = l;
+	hi = h;
+	epoch = 0;
+	ringsize = size;
+	for (int a = 0; a < nx*ny; a++) {
+		for (int b = 0; b < nx*ny; b++) {
+			if (a == b || (rg && a != rg && b != rg)) continue;
+			snprintf(nm, sizeof(nm), "%s.halo.%d.%d", base, a, b);
+			ContaminantRing *r = ContaminantRing::Open(nm, size, rg == 0);
+			if (!r) {
+				warning("Unable to attach halo ring %s", nm);
+				Leave();
+				return 0;
+			}
+			if (a == rg) out[b] = r;
+			else if (b == rg) in[a] = r;
+			else {
+				spare = (ContaminantRing **)Realloc(spare, (nspare+1)*sizeof(ContaminantRing *));
+				if (!spare) abort();
+				spare[nspare++] = r;
+			}
+		}
+	}
+	for (int r = 0; r < nx*ny; r++) seen[r] = 0;
+	VERBOSE("ContaminantHalo", "Region %d of %d by %d", region, nx, ny);
+	return 1;
+}
+
+/*--- Leave() -- */
+void ContaminantHalo::Leave() {
+	int i;
+
+	for (i = 0; i < MAXREGIONS; i++) {
+		if (out[i]) delete out[i];
+		if (in[i]) delete in[i];
+		out[i] = in[i] = 0;
+	}
+	for (i = 0; i < nspare; i++) delete spare[i];
+	if (spare) Free(spare);
+	spare = 0;
+	nspare = 0;
+
+	for (i = 0; i < BUCKETS; i++) {
+		while (ours[i]) forget(ours, ours[i]->xid);
+		while (theirs[i]) forget(theirs, theirs[i]->xid);
+	}
+	region = -1;
+	nx = ny = 1;
+	ContaminantList::SourcesChanged();
+}
+
+/*--- SetResolver(r, f) -- the kernel tells us how to find agents, and make copies */
+void ContaminantHalo::SetResolver(ContaminantHaloResolver r, ContaminantHaloFactory f) {
+	resolver = r;
+	factory = f;
+}
+
+/*--- RegionOf(R3 p) -- */
+int ContaminantHalo::RegionOf(R3 p) {
+	if (region < 0) return 0;
+	int ix = (int)floor((p.x - lo.x)/(hi.x - lo.x)*nx);
+	int iy = (int)floor((p.y - lo.y)/(hi.y - lo.y)*ny);
+	ix = Max(0, Min(ix, nx-1));
+	iy = Max(0, Min(iy, ny-1));
+	return iy*nx + ix;
+}
+
+/*--- reach(R3 c, double radius) -- the regions within radius of c */
+// The regions round the edge go on for ever, as RegionOf() has them.
+uint64_t ContaminantHalo::reach(R3 c, double radius) {
+	uint64_t m = 0;
+
+	for (int iy = 0; iy < ny; iy++) {
+		double y0 = iy?lo.y + iy*(hi.y - lo.y)/ny:-HUGE_VAL;
+		double y1 = (iy < ny-1)?lo.y + (iy+1)*(hi.y - lo.y)/ny:HUGE_VAL;
+		double dy = Max(Max(y0 - c.y, c.y - y1), 0.0);
+		for (int ix = 0; ix < nx; ix++) {
+			double x0 = ix?lo.x + ix*(hi.x - lo.x)/nx:-HUGE_VAL;
+			double x1 = (ix < nx-1)?lo.x + (ix+1)*(hi.x - lo.x)/nx:HUGE_VAL;
+			double dx = Max(Max(x0 - c.x, c.x - x1), 0.0);
+			if (dx*dx + dy*dy <= radius*radius) m |= 1ULL << (iy*nx + ix);
+		}
+	}
+	return m;
+}
+
+
+/*-- the owner's side */
+
+/*--- Publish(int xid, ContaminantSource *s) -- send what has changed */
+void ContaminantHalo::Publish(int xid, ContaminantSource *s) {
+	R3 c;
+	double radius;
+	int sz = 0;
+
+	if (region < 0) return;
+	assert(s);
+	uint64_t want = s->getFootprint(&c, &radius)?reach(c, radius):~0ULL;
+	want &= ((nx*ny < 64)?(1ULL << (nx*ny)) - 1:~0ULL) & ~(1ULL << region);
+
+	char *taxon = s->TaxonName();
+	void *st = s->getReplica(&sz);
+	uint64_t h = hash(14695981039346656037ULL, taxon, strlen(taxon)+1);
+	h = hash(h, st, st?sz:0);
+
+	HaloEntry *e = find(ours, xid);
+	if (!e) e = add(ours, xid);
+	for (int r = 0; r < nx*ny; r++) {
+		uint64_t bit = 1ULL << r;
+		if (want & bit) {
+			if (!(e->sent & bit) || e->hash != h) {
+				send(r, st?H_UPDATE:H_REMOTE, xid, taxon, st, st?sz:0);
+				updates++;
+			}
+		}
+		else if (e->sent & bit) send(r, H_DROP, xid, 0, 0, 0);
+	}
+	e->sent = want;
+	e->hash = h;
+	if (st) Free(st);
+}
+
+/*--- Withdraw(int xid) -- it's not ours any more */
+void ContaminantHalo::Withdraw(int xid) {
+	if (region < 0) return;
+	HaloEntry *e = find(ours, xid);
+	if (!e) return;
+	for (int r = 0; r < nx*ny; r++) {
+		if (e->sent & (1ULL << r)) send(r, H_DROP, xid, 0, 0, 0);
+	}
+	forget(ours, xid);
+}
+
+/*--- Sync() -- mark the end of the tick, and wait for everyone else's */
+void ContaminantHalo::Sync() {
+	int r;
+
+	if (region < 0) return;
+	for (r = 0; r < nx*ny; r++) {
+		if (r != region) send(r, H_MARK, 0, 0, 0, 0);
+	}
+	for (;;) {
+		drain();
+		for (r = 0; r < nx*ny; r++) {
+			if (r != region && seen[r] != epoch+1) break;
+		}
+		if (r == nx*ny) break;
+		sched_yield();
+	}
+	epoch++;
+	ContaminantList::SourcesChanged();  // which are ours, copied or out of reach
+}
+
+/*--- send(int to, int type, int xid, char *taxon, void *state, int sz) -- */
+// A full ring means the other end hasn't read this tick's yet, so we
+// read ours while we wait; it may be waiting for us.
+int ContaminantHalo::send(int to, int type, int xid, char *taxon, void *state, int sz) {
+	int tlen = taxon?strlen(taxon)+1:0;
+	int len = sizeof(Msg) + HALO_ROUND(tlen) + sz;
+	Msg *m;
+
+	assert(to != region && out[to]);
+	if (len > ringsize/2) fatal(1, "Halo copy of agent %d is too big (%d bytes) for the rings", xid, len);
+	while (!(m = (Msg *)out[to]->Reserve(len))) {
+		drain();
+		sched_yield();
+	}
+	m->type = type;
+	m->from = region;
+	m->xid = xid;
+	m->tlen = tlen;
+	m->sz = sz;
+	m->epoch = epoch+1;
+	if (tlen) memcpy(m + 1, taxon, tlen);
+	if (sz) memcpy((char *)(m + 1) + HALO_ROUND(tlen), state, sz);
+	out[to]->Commit();
+	return 1;
+}
+
+
+/*-- the other side */
+
+/*--- drain() -- everything sent to us this tick so far */
+void ContaminantHalo::drain() {
+	for (int r = 0; r < nx*ny; r++) {
+		void *m;
+		if (r == region) continue;
+		while (seen[r] != epoch+1 && (m = in[r]->Peek(0))) {
+			apply(m);
+			in[r]->Release();
+		}
+	}
+}
+
+/*--- apply(void *msg) -- */
+void ContaminantHalo::apply(void *msg) {
+	Msg *m = (Msg *)msg;
+	char *taxon = (char *)(m + 1);
+	HaloEntry *e;
+
+	assert(m->epoch == epoch+1);
+	switch (m->type) {
+	case H_MARK:
+		seen[m->from] = m->epoch;
+		break;
+	case H_UPDATE:
+	case H_REMOTE:
+		if (!(e = find(theirs, m->xid))) e = add(theirs, m->xid);
+		e->owner = m->from;
+		if (e->copy && (m->type == H_REMOTE || strcmp(e->taxon, taxon))) {
+			delete e->copy;
+			e->copy = 0;
+		}
+		if (!e->taxon || strcmp(e->taxon, taxon)) {
+			if (e->taxon) Free(e->taxon);
+			e->taxon = Strdup(taxon);
+		}
+		if (m->type == H_REMOTE) break;
+		if (!e->copy) {
+			if (!factory || !(e->copy = factory(taxon)))
+				fatal(1, "Unable to make a halo copy of a %s source", taxon);
+		}
+		if (!e->copy->setReplica(taxon + HALO_ROUND(m->tlen), m->sz))
+			fatal(1, "Halo copy of agent %d from region %d didn't take", m->xid, m->from);
+		break;
+	case H_DROP:
+		e = find(theirs, m->xid);
+		if (e && e->owner == m->from) forget(theirs, m->xid);
+		break;
+	default:
+		fatal(1, "Unknown halo message %d", m->type);
+	}
+}
+
+/*--- Lookup(int xid, ContaminantSource **r) -- */
+int ContaminantHalo::Lookup(int xid, ContaminantSource **r) {
+	assert(r);
+	if (region < 0 || !resolver) return 0;
+	if (resolver(xid, CLASS_CONTSRC)) return 0;  // ours
+	HaloEntry *e = find(theirs, xid);
+	if (e && !e->copy) return 0;                  // in reach, but it has to be asked
+	*r = e?e->copy:0;
+	return 1;
+}
+
+/*-  The End  */
@@ -0,0 +1,90 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  conthalo.hxx -- sinks split across kernels by region, with halo copies of the sources
+
+  A run too big for one kernel can be split into regions, a grid of
+  nx by ny rectangles over the area, with a kernel process on the
+  same host for each.  A kernel keeps the sinks in its region (the
+  kernel decides that, with RegionOf()) and the sources that are
+  there now.  Every tick each kernel Publish()es its sources and then
+  calls Sync() before any sink is intoxicated.  A source whose
+  footprint (ContaminantSource::getFootprint) reaches another region
+  is copied there: the owner sends its state (getReplica) to that
+  region's kernel, which keeps a read-only copy made by the factory
+  and setReplica().  ContaminantSource::GetCSValue() and friends then
+  answer from the copy.  A source that doesn't reach the region is
+  too far away to matter, and answers nothing.  Either way the sink
+  never makes a KGET to another kernel.  A source that can't be
+  copied (no getReplica) is listed as remote in the regions it
+  reaches, and is asked the usual way.
+
+  The copies are kept up to date automatically.  Publish() hashes the
+  state and the footprint's regions.  An update only goes out when
+  the hash changes, or when the source reaches a region it didn't.
+  A region the source no longer reaches gets a drop.  Withdraw() drops
+  it everywhere; the kernel calls it for a source that has left (or
+  died).  A source that moves to another region should be Publish()ed
+  by its new kernel in the tick its old one Withdraw()s it.  A drop
+  only applies to the copy from the kernel which sent it, so the two
+  can arrive in either order.
+
+  The kernels talk through ContaminantRings (contshm.hxx), one for
+  each ordered pair of regions, called <base>.halo.<from>.<to>.
+  Region 0 makes them all, so the others may only Join() once it has.
+  Sync() sends every other region a mark for the tick, and reads what
+  each has sent up to its mark.  A region is never more than a tick
+  ahead of the slowest, and every copy is the owner's state as of
+  this tick's Publish().  Which sources are ours, copies or out of
+  reach changes as they move, so the sinks forget what kind of source
+  each one was at every Sync() (ContaminantList::SourcesChanged).
+*/
+
+#ifndef _CONTHALO_HXX_INCLUDED_
+#define _CONTHALO_HXX_INCLUDED_
+
+#include <stdint.h>
+#include "r3.hxx"
+
+class ContaminantSource;
+
+typedef void *(*ContaminantHaloResolver)(int xid, int cls);      // agent in *this* kernel, or 0
+typedef ContaminantSource *(*ContaminantHaloFactory)(char *taxon); // a blank source to copy into
+
+class ContaminantHalo
+{
+public:
+	static int Join(char *base, int region, int nx, int ny, R3 lo, R3 hi, int size);
+	static void Leave();
+	static void SetResolver(ContaminantHaloResolver r, ContaminantHaloFactory f);
+
+	static int Region() { return region; }   // -1 when not split
+	static int Regions() { return nx*ny; }
+	static int RegionOf(R3 p);               // points outside go to the nearest region
+
+	// the owner's side, every tick
+	static void Publish(int xid, ContaminantSource *s);
+	static void Withdraw(int xid);
+	static void Sync();
+
+	// the sink's side: 0 to ask xid the usual way, otherwise *r is
+	// its halo copy, or 0 if it's too far away to matter
+	static int Lookup(int xid, ContaminantSource **r);
+
+	static long Updates() { return updates; } // copies sent so far
+
+private:
+	static int send(int to, int type, int xid, char *taxon, void *state, int sz);
+	static void drain();
+	static void apply(void *m);
+	static uint64_t reach(R3 c, double radius);
+
+	static int region, nx, ny;
+	static R3 lo, hi;
+	static unsigned epoch;
+	static long updates;
+};
+
+#endif
+/*-  The End  */
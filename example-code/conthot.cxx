@@ -0,0 +1,115 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  conthot.cxx -- the per-tick contaminant state of a taxon
+
+  Slots are only handed out and given back when agents are made,
+  migrate or die, so a spin lock is plenty.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "conthot.hxx"
+#include "contnuma.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+ContaminantHot *ContaminantHot::head = 0;
+volatile int ContaminantHot::head_lock = 0;
+
+/*-  Code  */
+
+/*-- Constructor */
+
+/*--- ContaminantHot(char *tax, int nc, int nd) -- */
+ContaminantHot::ContaminantHot(char *tax, int nc, int nd) {
+	assert(tax && *tax);
+	assert(nc > 0);
+	taxon = Strdup(tax);
+	if (!taxon) abort();
+	n = nc;
+	node = nd;
+	chunk = 0;
+	nchunk = 0;
+	top = 0;
+	freelist = 0;
+	nfree = maxfree = 0;
+	lock = 0;
+	next = 0;
+}
+
+
+/*-- registry */
+
+/*--- Get(char *tax, int nc, int nd) -- */
+ContaminantHot *ContaminantHot::Get(char *tax, int nc, int nd) {
+	ContaminantHot *p;
+
+	assert(tax);
+	while (__sync_lock_test_and_set(&head_lock, 1)) ;
+	for (p = head; p; p = p->next) {
+		if (p->node == nd && p->n == nc && !strcmp(p->taxon, tax)) break;
+	}
+	if (!p) {
+		p = new ContaminantHot(tax, nc, nd);
+		if (!p) abort();
+		p->next = head;
+		head = p;
+	}
+	__sync_lock_release(&head_lock);
+	return p;
+}
+
+
+/*-- slots */
+
+/*--- Alloc(Row *r) -- */
+int ContaminantHot::Alloc(Row *r) {
+	int slot;
+
+	assert(r);
+	while (__sync_lock_test_and_set(&lock, 1)) ;
+	if (nfree > 0) slot = freelist[--nfree];
+	else {
+		slot = top++;
+		if (slot/CHUNK >= nchunk) {
+			chunk = (Chunk *)Realloc(chunk, (nchunk+1)*sizeof(Chunk));
+			if (!chunk) abort();
+			cont_real *b = (cont_real *)ContaminantNuma::AllocOn(4*CHUNK*n*sizeof(cont_real), node);
+			chunk[nchunk].conc = b;
+			chunk[nchunk].ate = b + CHUNK*n;
+			chunk[nchunk].load = b + 2*CHUNK*n;
+			chunk[nchunk].tick = b + 3*CHUNK*n;
+			nchunk++;
+		}
+	}
+	GetRow(slot, r);
+	__sync_lock_release(&lock);
+
+	memset(r->conc, 0, n*sizeof(cont_real));
+	memset(r->ate, 0, n*sizeof(cont_real));
+	memset(r->load, 0, n*sizeof(cont_real));
+	memset(r->tick, 0, n*sizeof(cont_real));
+	return slot;
+}
+
+/*--- Release(int slot) -- */
+void ContaminantHot::Release(int slot) {
+	assert(slot >= 0 && slot < top);
+
+	while (__sync_lock_test_and_set(&lock, 1)) ;
+	if (nfree >= maxfree) {
+		maxfree = maxfree?2*maxfree:CHUNK;
+		freelist = (int *)Realloc(freelist, maxfree*sizeof(int));
+		if (!freelist) abort();
+	}
+	freelist[nfree++] = slot;
+	__sync_lock_release(&lock);
+}
+
+/*-  The End  */
@@ -0,0 +1,89 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  conthot.hxx -- the per-tick contaminant state of a taxon
+
+  The only things in a contaminant record which change from tick to
+  tick are the concentration, what has been eaten, the tissue load and
+  the tick.  They are kept here, one array per field for all the agents
+  of a taxon, so that a sweep over the uptake or the mortality reads
+  straight through memory instead of picking four doubles out of every
+  fat record.  Everything else is either per-taxon configuration
+  (ContaminantTaxon) or evaluator plumbing.
+
+  An agent owns a slot of N (the number of contaminants it is sensitive
+  to) entries in each array.  Agents of a taxon normally all have the
+  same N, but one whose list has been changed has a pool of its own
+  width.  Slots are handed out from
+  chunks which never move, so the pointers in a Row stay good until the
+  slot is released.  Pools are never freed: the state in them belongs
+  to live agents, and outlives a ContaminantTaxon::Flush().
+
+  On a NUMA machine a taxon has a pool on each node, with its chunks
+  allocated there (see contnuma.hxx); elsewhere there is just node 0.
+
+  Built with CONT_FLOAT_STORAGE the values are stored as floats, which
+  halves the pool.  Everything that reads them does its arithmetic in
+  double, so the only loss is the rounding on each store; use a
+  $CONT_PRECISION_DUMP from each build and contprec to see what that
+  does to a whole run.
+*/
+
+#ifndef _CONTHOT_HXX_INCLUDED_
+#define _CONTHOT_HXX_INCLUDED_
+
+#if defined(CONT_FLOAT_STORAGE)
+typedef float cont_real;
+#else
+typedef double cont_real;
+#endif
+
+class ContaminantHot
+{
+public:
+	typedef struct {
+		cont_real *conc, *ate, *load, *tick;  // N of each
+	} Row;
+
+	static ContaminantHot *Get(char *taxon, int n, int node = 0);  // makes one if necessary; one per n
+	int Node() { return node; }
+
+	int Alloc(Row *r);                                // a zeroed slot, and where it is
+	void Release(int slot);
+
+	// not while someone else may be calling Alloc()
+	void GetRow(int slot, Row *r) {
+		Chunk *c = &chunk[slot/CHUNK];
+		int o = (slot%CHUNK)*n;
+		r->conc = c->conc + o;
+		r->ate = c->ate + o;
+		r->load = c->load + o;
+		r->tick = c->tick + o;
+	}
+
+private:
+	ContaminantHot(char *taxon, int n, int node);
+
+	enum { CHUNK = 256 };        // slots
+	typedef struct {
+		cont_real *conc, *ate, *load, *tick;  // CHUNK*n of each, in one block
+	} Chunk;
+
+	char *taxon;
+	int n;
+	int node;
+	Chunk *chunk;
+	int nchunk;
+	int top;                     // slots ever handed out
+	int *freelist;
+	int nfree, maxfree;
+	volatile int lock;
+
+	ContaminantHot *next;
+	static ContaminantHot *head;
+	static volatile int head_lock;
+};
+
+#endif
+/*-  The End  */
@@ -0,0 +1,85 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contingest.cxx -- what an agent has eaten, waiting for its next commit
+
+  See contingest.hxx.  Post() pushes onto the head with a compare and
+  swap.  Take() swaps the whole list out, so the consumer never races
+  a producer over anything but the head, and there's no ABA problem.
+  The list comes out newest first, which doesn't matter once it's
+  Sorted().
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "contingest.hxx"
+#include "memchk.h"
+
+/*-  Code  */
+
+/*--- Post(Queue *q, int n, Item *item) -- */
+void ContaminantIngest::Post(Queue *q, int n, Item *item) {
+	assert(q && item);
+	if (n <= 0) return;
+
+	Event *e = (Event *)Malloc(sizeof(Event) + (n-1)*sizeof(Item));
+	if (!e) abort();
+	e->n = n;
+	memcpy(e->item, item, n*sizeof(Item));
+	Event *h;
+	do {
+		h = q->head;
+		e->next = h;
+	} while (!__sync_bool_compare_and_swap(&q->head, h, e));
+}
+
+/*--- Take(Queue *q) -- */
+ContaminantIngest::Event *ContaminantIngest::Take(Queue *q) {
+	assert(q);
+	if (!q->head) return 0;
+	return (Event *)__sync_lock_test_and_set(&q->head, (Event *)0);
+}
+
+/*--- by_item(const void *a, const void *b) -- contaminant, then mass */
+static int by_item(const void *a, const void *b) {
+	const ContaminantIngest::Item *x = (const ContaminantIngest::Item *)a, *y = (const ContaminantIngest::Item *)b;
+	if (x->id != y->id) return (x->id < y->id)?-1:1;
+	if (x->mass != y->mass) return (x->mass < y->mass)?-1:1;
+	return 0;
+}
+
+/*--- Sorted(Event *e, int *n) -- */
+ContaminantIngest::Item *ContaminantIngest::Sorted(Event *e, int *n) {
+	Event *f;
+	int m = 0;
+
+	assert(n);
+	for (f = e; f; f = f->next) m += f->n;
+	Item *all = (Item *)Malloc((m?m:1)*sizeof(Item));
+	if (!all) abort();
+	for (m = 0; e; e = f) {
+		memcpy(all + m, e->item, e->n*sizeof(Item));
+		m += e->n;
+		f = e->next;
+		Free(e);
+	}
+	if (m > 1) qsort(all, m, sizeof(Item), by_item);
+	*n = m;
+	return all;
+}
+
+/*--- Discard(Queue *q) -- */
+void ContaminantIngest::Discard(Queue *q) {
+	Event *e = Take(q), *f;
+	for (; e; e = f) {
+		f = e->next;
+		Free(e);
+	}
+}
+
+/*-  The End  */
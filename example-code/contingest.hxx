@@ -0,0 +1,51 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contingest.hxx -- what an agent has eaten, waiting for its next commit
+
+  Contamination::Ingest() doesn't touch the agent's loads.  It posts
+  an Event (a prey's contaminants, already scaled by how much of it
+  was eaten) to the agent's Queue, and CommitIntoxicate() takes the
+  lot at the start and adds them into hot.ate in one go.  So a
+  predator can feed on one thread while its uptake, or somebody
+  else's feeding on it, goes on on another.
+
+  The queue is a lock-free list which any number of threads can Post()
+  to.  Only the agent's own commit may Take() from it.  Sorted() puts
+  a batch in order of contaminant and then of mass, not of arrival,
+  and the commit adds them up in that order, so the loads don't depend
+  on which thread got there first.
+*/
+
+#ifndef _CONTINGEST_HXX_INCLUDED_
+#define _CONTINGEST_HXX_INCLUDED_
+
+class ContaminantIngest
+{
+public:
+	typedef struct {
+		int id;                  // ContaminantNames::Id()
+		double mass;
+	} Item;
+
+	typedef struct Event {
+		struct Event *next;
+		int n;
+		Item item[1];            // [n]
+	} Event;
+
+	typedef struct {
+		Event * volatile head;   // the newest; 0 when empty
+	} Queue;
+
+	static void Post(Queue *q, int n, Item *item);  // from any thread
+	static Event *Take(Queue *q);                   // everything so far; 0 if nothing
+	// a batch's items, sorted, in one block (Free() it), and the events freed
+	static Item *Sorted(Event *e, int *n);
+	static void Discard(Queue *q);
+	static int Empty(Queue *q) { return !q->head; }
+};
+
+#endif
+/*-  The End  */
@@ -0,0 +1,565 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contnative.cxx -- compiled versions of the contaminant expressions
+
+  The translator is a small recursive descent parser for the part of
+  the evaluator's language that the contaminant programs actually use:
+
+	cond   := or [ '?' cond ':' cond ]
+	or     := and { '||' and }
+	and    := cmp { '&&' cmp }
+	cmp    := add { ('<' | '>' | '<=' | '>=' | '==' | '!=') add }
+	add    := mul { ('+' | '-') mul }
+	mul    := unary { ('*' | '/') unary }
+	unary  := ('-' | '+' | '!') unary | pow
+	pow    := primary [ '^' unary ]
+	primary:= number [ '[' units ']' ] | name | name '(' cond { ',' cond } ')' | '(' cond ')'
+
+  Everything it emits is fully parenthesised, so the text doesn't
+  depend on how the expression was spaced or bracketed in the file.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <math.h>
+
+#include "prmagent.hxx"
+#include "prmenvexpr.hxx"
+#include "paramcorpus.hxx"
+#include "contnative.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define MAX_INLINE 16     // depth of variables referring to variables
+#define MAX_NAME 128
+
+ContaminantNative::Reg *ContaminantNative::bucket[NBUCKET];
+
+static const char *inputs[] = { "t", "dt", "conc", "imass", "ate", "current_load", 0 };
+
+static const struct {
+	const char *name, *c;
+	int args;
+} functions[] = {
+	{ "exp", "exp", 1 }, { "log", "log", 1 }, { "sqrt", "sqrt", 1 },
+	{ "fabs", "fabs", 1 }, { "abs", "fabs", 1 }, { "sin", "sin", 1 },
+	{ "cos", "cos", 1 }, { "pow", "pow", 2 }, { "floor", "floor", 1 },
+	{ "ceil", "ceil", 1 },
+	{ 0, 0, 0 }
+};
+
+/*-  Code  */
+
+/*-- the translator */
+
+typedef struct {
+	char *p;                               // where we are in the input
+	char *out;
+	int len, max;
+	char **names;                          // bound constants
+	int nnames;
+	ContaminantNative::Defs *defs;
+	int depth;
+	int bad;
+} Xlate;
+
+static void cond(Xlate *x);
+
+/*--- emit(Xlate *x, const char *s) -- */
+static void emit(Xlate *x, const char *s) {
+	int l = strlen(s);
+	if (x->len + l + 1 > x->max) {
+		while (x->len + l + 1 > x->max) x->max = x->max?2*x->max:256;
+		x->out = (char *)Realloc(x->out, x->max);
+		if (!x->out) abort();
+	}
+	memcpy(x->out + x->len, s, l+1);
+	x->len += l;
+}
+
+/*--- skip(Xlate *x) -- whitespace */
+static void skip(Xlate *x) {
+	while (*x->p && isspace((unsigned char)*x->p)) x->p++;
+}
+
+/*--- accept(Xlate *x, const char *tok) -- */
+static int accept(Xlate *x, const char *tok) {
+	skip(x);
+	int l = strlen(tok);
+	if (strncmp(x->p, tok, l)) return 0;
+	// don't take '<' out of '<=', or '=' out of '==', etc.
+	if (l == 1 && strchr("<>=!", tok[0]) && x->p[1] == '=') return 0;
+	if (l == 1 && (tok[0] == '&' || tok[0] == '|')) return 0;
+	x->p += l;
+	return 1;
+}
+
+/*--- constant(Xlate *x, const char *name) -- emit a reference to a bound constant */
+static void constant(Xlate *x, const char *name) {
+	char buf[64];
+	int i;
+	for (i = 0; i < x->nnames; i++) {
+		if (!strcmp(x->names[i], name)) break;
+	}
+	if (i == x->nnames) {
+		x->names = (char **)Realloc(x->names, (x->nnames+1)*sizeof(char *));
+		if (!x->names) abort();
+		x->names[x->nnames++] = Strdup((char *)name);
+	}
+	snprintf(buf, sizeof(buf), "a->k[%d]", i);
+	emit(x, buf);
+}
+
+/*--- name(Xlate *x, char *nm) -- an input, an inlined variable or a constant */
+static void name(Xlate *x, char *nm) {
+	int i;
+
+	for (i = 0; inputs[i]; i++) {
+		if (!strcmp(inputs[i], nm)) {
+			emit(x, "a->");
+			emit(x, nm);
+			return;
+		}
+	}
+
+	for (i = 0; x->defs && i < x->defs->n; i++) {
+		if (strcmp(x->defs->name[i], nm)) continue;
+		if (x->depth >= MAX_INLINE) {
+			x->bad = 1;
+			return;
+		}
+		char *save = x->p;
+		x->p = x->defs->expr[i];
+		x->depth++;
+		emit(x, "(");
+		cond(x);
+		emit(x, ")");
+		skip(x);
+		if (*x->p) x->bad = 1;
+		x->depth--;
+		x->p = save;
+		return;
+	}
+
+	for (i = 0; x->defs && i < x->defs->nconst; i++) {
+		if (!strcmp(x->defs->cname[i], nm)) {
+			constant(x, nm);
+			return;
+		}
+	}
+	x->bad = 1;
+}
+
+/*--- primary(Xlate *x) -- */
+static void primary(Xlate *x) {
+	char nm[MAX_NAME];
+
+	skip(x);
+	if (accept(x, "(")) {
+		emit(x, "(");
+		cond(x);
+		emit(x, ")");
+		if (!accept(x, ")")) x->bad = 1;
+		return;
+	}
+
+	if (isdigit((unsigned char)*x->p) || *x->p == '.') {
+		char *end;
+		strtod(x->p, &end);
+		int l = end - x->p;
+		if (l <= 0 || l >= MAX_NAME) {
+			x->bad = 1;
+			return;
+		}
+		if (*end == '[') {                   // number with units: bind it
+			char *close = strchr(end, ']');
+			if (!close || close - x->p + 1 >= MAX_NAME) {
+				x->bad = 1;
+				return;
+			}
+			l = close - x->p + 1;
+			memcpy(nm, x->p, l);
+			nm[l] = 0;
+			x->p += l;
+			constant(x, nm);
+			return;
+		}
+		memcpy(nm, x->p, l);
+		nm[l] = 0;
+		x->p = end;
+		emit(x, "(");
+		emit(x, nm);
+		if (!strpbrk(nm, ".eE")) emit(x, ".0");
+		emit(x, ")");
+		return;
+	}
+
+	if (isalpha((unsigned char)*x->p) || *x->p == '_') {
+		int l = 0;
+		while ((isalnum((unsigned char)x->p[l]) || x->p[l] == '_') && l < MAX_NAME-1) l++;
+		memcpy(nm, x->p, l);
+		nm[l] = 0;
+		x->p += l;
+
+		if (!accept(x, "(")) {
+			name(x, nm);
+			return;
+		}
+
+		int i;
+		for (i = 0; functions[i].name; i++) {
+			if (!strcmp(functions[i].name, nm)) break;
+		}
+		if (!functions[i].name) {              // ode() and friends
+			x->bad = 1;
+			return;
+		}
+		emit(x, functions[i].c);
+		emit(x, "(");
+		for (int k = 0; k < functions[i].args; k++) {
+			if (k) {
+				if (!accept(x, ",")) {
+					x->bad = 1;
+					return;
+				}
+				emit(x, ", ");
+			}
+			cond(x);
+		}
+		emit(x, ")");
+		if (!accept(x, ")")) x->bad = 1;
+		return;
+	}
+
+	x->bad = 1;
+}
+
+/*--- unary(Xlate *x) and pow -- */
+static void unary(Xlate *x) {
+	if (x->bad) return;
+	if (accept(x, "-")) {
+		emit(x, "(-");
+		unary(x);
+		emit(x, ")");
+	}
+	else if (accept(x, "+")) unary(x);
+	else if (accept(x, "!")) {
+		emit(x, "(!");
+		unary(x);
+		emit(x, ")");
+	}
+	else {
+		int mark = x->len;
+		primary(x);
+		if (accept(x, "^")) {
+			char *base = Strdup(x->out + mark);
+			x->len = mark;
+			x->out[mark] = 0;
+			emit(x, "pow(");
+			emit(x, base);
+			emit(x, ", ");
+			Free(base);
+			unary(x);
+			emit(x, ")");
+		}
+	}
+}
+
+/*--- binary(Xlate *x, ops, next) -- left associative levels */
+static void binary(Xlate *x, const char **ops, void (*next)(Xlate *)) {
+	int mark = x->len;
+	next(x);
+	for (;;) {
+		int i;
+		if (x->bad) return;
+		for (i = 0; ops[i]; i++) {
+			if (accept(x, ops[i])) break;
+		}
+		if (!ops[i]) return;
+
+		// wrap what we have so far: (lhs op rhs)
+		char *lhs = Strdup(x->out + mark);
+		x->len = mark;
+		x->out[mark] = 0;
+		emit(x, "(");
+		emit(x, lhs);
+		emit(x, " ");
+		emit(x, ops[i]);
+		emit(x, " ");
+		Free(lhs);
+		next(x);
+		emit(x, ")");
+	}
+}
+
+static const char *mulops[] = { "*", "/", 0 };
+static const char *addops[] = { "+", "-", 0 };
+static const char *cmpops[] = { "<=", ">=", "==", "!=", "<", ">", 0 };
+static const char *andops[] = { "&&", 0 };
+static const char *orops[] = { "||", 0 };
+
+static void mul(Xlate *x) { binary(x, mulops, unary); }
+static void add(Xlate *x) { binary(x, addops, mul); }
+static void cmp(Xlate *x) { binary(x, cmpops, add); }
+static void land(Xlate *x) { binary(x, andops, cmp); }
+static void lor(Xlate *x) { binary(x, orops, land); }
+
+/*--- cond(Xlate *x) -- */
+static void cond(Xlate *x) {
+	int mark = x->len;
+	lor(x);
+	if (x->bad || !accept(x, "?")) return;
+
+	char *test = Strdup(x->out + mark);
+	x->len = mark;
+	x->out[mark] = 0;
+	emit(x, "(");
+	emit(x, test);
+	Free(test);
+	emit(x, " ? ");
+	cond(x);
+	if (!accept(x, ":")) {
+		x->bad = 1;
+		return;
+	}
+	emit(x, " : ");
+	cond(x);
+	emit(x, ")");
+}
+
+/*--- Translate(char *expr, Defs *defs, char ***names, int *nnames) -- */
+char *ContaminantNative::Translate(char *expr, Defs *defs, char ***names, int *nnames) {
+	Xlate x;
+
+	assert(expr && names && nnames);
+	memset(&x, 0, sizeof(x));
+	x.p = expr;
+	x.defs = defs;
+	emit(&x, "");
+
+	cond(&x);
+	skip(&x);
+	if (*x.p) x.bad = 1;
+
+	if (x.bad) {
+		for (int i = 0; i < x.nnames; i++) Free(x.names[i]);
+		if (x.names) Free(x.names);
+		Free(x.out);
+		*names = 0;
+		*nnames = 0;
+		return 0;
+	}
+	*names = x.names;
+	*nnames = x.nnames;
+	return x.out;
+}
+
+
+/*-- the "variables" block */
+
+/*--- add_defs(Defs *d, char **keys, int n) -- leaves anywhere under keys */
+static void add_defs(ContaminantNative::Defs *d, char **keys, int n) {
+	if (n >= PCORPUS_MAXDEPTH) return;
+	char **child = ParamCorpus::GetNodes(keys, n);
+	if (child) {
+		for (int i = 0; child[i]; i++) {
+			keys[n] = child[i];
+			add_defs(d, keys, n+1);
+		}
+		Free(child);
+		return;
+	}
+	char *s = ParamCorpus::GetS(PARAM_OPT|PARAM_NOR, keys, n);
+	if (!s) return;
+
+	d->name = (char **)Realloc(d->name, (d->n+1)*sizeof(char *));
+	d->expr = (char **)Realloc(d->expr, (d->n+1)*sizeof(char *));
+	if (!d->name || !d->expr) abort();
+	d->name[d->n] = Strdup(keys[n-1]);
+	d->expr[d->n] = Strdup(s);
+	d->n++;
+}
+
+/*--- LoadDefs(char **keys, int n) -- */
+ContaminantNative::Defs *ContaminantNative::LoadDefs(char **keys, int n) {
+	char *k[PCORPUS_MAXDEPTH];
+
+	assert(n < PCORPUS_MAXDEPTH);
+	Defs *d = (Defs *)Calloc(1, sizeof(Defs));
+	if (!d) abort();
+	memcpy(k, keys, n*sizeof(char *));
+	k[n] = (char *)"variables";
+	add_defs(d, k, n+1);
+
+	k[n] = (char *)"const";
+	char **child = ParamCorpus::GetNodes(k, n+1);
+	for (int i = 0; child && child[i]; i++) {
+		d->cname = (char **)Realloc(d->cname, (d->nconst+1)*sizeof(char *));
+		if (!d->cname) abort();
+		d->cname[d->nconst++] = Strdup(child[i]);
+	}
+	if (child) Free(child);
+	return d;
+}
+
+/*--- FreeDefs(Defs *d) -- */
+void ContaminantNative::FreeDefs(Defs *d) {
+	if (!d) return;
+	for (int i = 0; i < d->n; i++) {
+		Free(d->name[i]);
+		Free(d->expr[i]);
+	}
+	if (d->name) Free(d->name);
+	if (d->expr) Free(d->expr);
+	for (int i = 0; i < d->nconst; i++) Free(d->cname[i]);
+	if (d->cname) Free(d->cname);
+	Free(d);
+}
+
+
+/*-- the registry */
+
+/*--- Hash(const char *s) -- FNV-1a */
+unsigned ContaminantNative::Hash(const char *s) {
+	unsigned h = 2166136261u;
+	for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+		h ^= *p;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*--- Registrar(Record *r, int n) -- run by the generated code before main() */
+ContaminantNative::Registrar::Registrar(Record *r, int n) {
+	for (int i = 0; i < n; i++) {
+		Reg *g = (Reg *)Malloc(sizeof(Reg));
+		if (!g) abort();
+		unsigned h = Hash(r[i].text) % NBUCKET;
+		g->r = &r[i];
+		g->next = bucket[h];
+		bucket[h] = g;
+	}
+}
+
+/*--- find(char *text) -- */
+ContaminantNative::Record *ContaminantNative::find(char *text) {
+	for (Reg *g = bucket[Hash(text) % NBUCKET]; g; g = g->next) {
+		if (!strcmp(g->r->text, text)) return g->r;
+	}
+	return 0;
+}
+
+/*--- Bind(char *expr, char **keys, int n, Defs *defs) -- */
+// Named constants come from the "const" block under keys (Translate()
+// takes no others), and numbers with units from UnitEvaluate().
+ContaminantNativeProg *ContaminantNative::Bind(char *expr, char **keys, int n, Defs *defs) {
+	char **names;
+	int nn;
+	char *k[PCORPUS_MAXDEPTH];
+
+	if (!expr) return 0;
+	char *text = Translate(expr, defs, &names, &nn);
+	if (!text) return 0;
+
+	Record *r = find(text);
+	Free(text);
+	ContaminantNativeProg *p = 0;
+
+	if (r && r->nk == nn) {
+		p = (ContaminantNativeProg *)Calloc(1, sizeof(*p));
+		if (!p) abort();
+		p->fn = r->fn;
+		p->nk = nn;
+		p->names = r->names;
+		p->text = r->text;
+		p->k = (double *)Calloc(nn?nn:1, sizeof(double));
+		if (!p->k) abort();
+
+		assert(n+2 <= PCORPUS_MAXDEPTH);
+		memcpy(k, keys, n*sizeof(char *));
+		k[n] = (char *)"const";
+		CCalc cc;
+		for (int i = 0; i < nn && p; i++) {
+			assert(!strcmp(r->names[i], names[i]));
+			k[n+1] = names[i];
+			if (isdigit((unsigned char)names[i][0]) || names[i][0] == '.')
+				p->k[i] = cc.UnitEvaluate(names[i]);
+			else if (ParamCorpus::GetS(PARAM_OPT|PARAM_NOR, k, n+2))
+				p->k[i] = ParamCorpus::GetN(PARAM_NOR, k, n+2);
+			else
+				p->k[i] = DNaN;
+			if (isnan(p->k[i])) {
+				VERBOSE("ContaminantNative", "Can't bind %s in \"%s\"", names[i], expr);
+				Unbind(p);
+				p = 0;
+			}
+		}
+	}
+
+	for (int i = 0; i < nn; i++) Free(names[i]);
+	if (names) Free(names);
+	return p;
+}
+
+/*--- Rebind(ContaminantNativeProg *p, int n, char **name, double *value) -- */
+ContaminantNativeProg *ContaminantNative::Rebind(ContaminantNativeProg *p, int n, char **name, double *value) {
+	assert(p);
+	ContaminantNativeProg *q = (ContaminantNativeProg *)Calloc(1, sizeof(*q));
+	if (!q) abort();
+	*q = *p;
+	q->k = (double *)Calloc(p->nk?p->nk:1, sizeof(double));
+	if (!q->k) abort();
+	memcpy(q->k, p->k, p->nk*sizeof(double));
+
+	for (int j = 0; j < n; j++) {
+		for (int i = 0; i < q->nk; i++) {
+			if (!strcmp(q->names[i], name[j])) q->k[i] = value[j];
+		}
+	}
+	return q;
+}
+
+/*--- Lookup(const char *text, int nk, const double *k) -- */
+ContaminantNativeProg *ContaminantNative::Lookup(const char *text, int nk, const double *k) {
+	assert(text);
+	Record *r = find((char *)text);
+	if (!r || r->nk != nk) return 0;
+
+	ContaminantNativeProg *p = (ContaminantNativeProg *)Calloc(1, sizeof(*p));
+	if (!p) abort();
+	p->fn = r->fn;
+	p->nk = nk;
+	p->names = r->names;
+	p->text = r->text;
+	p->k = (double *)Calloc(nk?nk:1, sizeof(double));
+	if (!p->k) abort();
+	if (nk) memcpy(p->k, k, nk*sizeof(double));
+	return p;
+}
+
+/*--- Signature() -- */
+uint64_t ContaminantNative::Signature() {
+	uint64_t s = 0;
+	for (int b = 0; b < NBUCKET; b++) {
+		for (Reg *g = bucket[b]; g; g = g->next) {
+			char *t = (char *)g->r->text;
+			s += ParamCorpus::Hash(&t, 1) + g->r->nk;
+		}
+	}
+	return s;
+}
+
+/*--- Unbind(ContaminantNativeProg *p) -- */
+void ContaminantNative::Unbind(ContaminantNativeProg *p) {
+	if (!p) return;
+	if (p->k) Free(p->k);
+	Free(p);
+}
+
+/*-  The End  */
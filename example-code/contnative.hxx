@@ -0,0 +1,107 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contnative.hxx -- compiled versions of the contaminant expressions
+
+  The README's advice for an evaluator call which turns out to be hot
+  is to replace it with a hard coded function.  contexprc does that
+  mechanically: it translates the contaminant programs in a parameter
+  corpus (load_update and the impairments) into C++ functions, which
+  are compiled into the binary and register themselves at start up.
+
+  The key for a function is the C++ text of its body, so at run time
+  we translate the expression again (with the same translator and the
+  same "variables" block) and only use a function if the text matches
+  exactly.  Change the parameter file and the key changes with it, so
+  the worst that can happen is that we go back to the evaluator.
+
+  Names in an expression are either one of the inputs below, something
+  from the "variables" block (which is inlined), or a constant bound
+  when the program is set up: a value from the "const" block or a
+  number with units ("28[ml/(sec*kg)]").  Anything else (environment
+  variables, ode() and the other evaluator specials) can't be
+  translated and stays with the evaluator.  That includes a bare unit
+  ("kg") which the "const" block doesn't declare: the evaluator might
+  well have a variable of that name.
+*/
+
+#ifndef _CONTNATIVE_HXX_INCLUDED_
+#define _CONTNATIVE_HXX_INCLUDED_
+
+#include <stdint.h>
+
+typedef struct {
+	double t, dt, conc, imass, ate, current_load;
+	double *k;                           // bound constants
+} ContaminantNativeArgs;
+
+typedef double (*ContaminantNativeFn)(ContaminantNativeArgs *a);
+
+typedef struct {
+	ContaminantNativeFn fn;
+	int nk;
+	double *k;
+	const char **names;                  // of the constants; the Record's
+	const char *text;                    // the Record's key
+} ContaminantNativeProg;
+
+class ContaminantNative
+{
+public:
+	// what contexprc generates
+	typedef struct {
+		const char *text;                  // the key
+		ContaminantNativeFn fn;
+		int nk;
+		const char **names;                // the constants it wants, in order
+	} Record;
+
+	class Registrar {
+	public:
+		Registrar(Record *r, int n);
+	};
+
+	// The "variables" block of a contaminant, and the names in its "const" block
+	typedef struct {
+		int n;
+		char **name, **expr;
+		int nconst;
+		char **cname;
+	} Defs;
+	static Defs *LoadDefs(char **keys, int n);    // keys is the path to the contaminant block
+	static void FreeDefs(Defs *d);
+
+	// expression -> C++ (0 if we can't); Free() the result and the names array
+	static char *Translate(char *expr, Defs *defs, char ***names, int *nnames);
+
+	// set up a program for the contaminant block at keys; 0 means use the evaluator
+	static ContaminantNativeProg *Bind(char *expr, char **keys, int n, Defs *defs);
+	static void Unbind(ContaminantNativeProg *p);
+	// a copy of p with some of its constants replaced (names it doesn't use are ignored)
+	static ContaminantNativeProg *Rebind(ContaminantNativeProg *p, int n, char **name, double *value);
+	// what Bind() made before, from its text and constants (the setup cache); 0 if this binary hasn't it
+	static ContaminantNativeProg *Lookup(const char *text, int nk, const double *k);
+	// of everything registered, in any order; a different binary may well have different functions
+	static uint64_t Signature();
+
+	static double Run(ContaminantNativeProg *p, ContaminantNativeArgs *a) {
+		a->k = p->k;
+		return p->fn(a);
+	}
+
+	static unsigned Hash(const char *s);
+
+private:
+	static Record *find(char *text);
+
+	typedef struct _Reg {
+		Record *r;
+		struct _Reg *next;
+	} Reg;
+	enum { NBUCKET = 127 };
+	static Reg *bucket[NBUCKET];
+};
+
+#endif
+/*-  The End  */
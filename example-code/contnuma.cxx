@@ -0,0 +1,141 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contnuma.cxx -- where the contaminant state lives, on NUMA machines
+
+  See contnuma.hxx.  Everything here is cheap enough to call once per
+  chunk, but not once per agent.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#if defined(HAVE_LIBNUMA)
+#include <sched.h>
+#include <numa.h>
+#endif
+
+#include "prmagent.hxx"
+#include "contnuma.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+int ContaminantNuma::nodes = 0;
+int ContaminantNuma::real = 0;
+__thread int ContaminantNuma::pinned = -1;
+volatile long ContaminantNuma::local = 0;
+volatile long ContaminantNuma::remote = 0;
+volatile long ContaminantNuma::moved = 0;
+
+/*-  Code  */
+
+/*-- nodes and threads */
+
+/*--- Nodes() -- */
+int ContaminantNuma::Nodes() {
+	if (nodes) return nodes;
+	int n = 1;
+#if defined(HAVE_LIBNUMA)
+	if (numa_available() >= 0) n = numa_num_configured_nodes();
+	if (n < 1) n = 1;
+	real = (n > 1);
+#endif
+	char *s = getenv("CONT_NUMA_NODES");
+	if (!real && s && atoi(s) > 1) n = atoi(s);
+	nodes = n;
+	VERBOSE("ContaminantNuma", "%d node%s%s", n, (n == 1)?"":"s", (n > 1 && !real)?" (pretend)":"");
+	return n;
+}
+
+/*--- Here() -- */
+int ContaminantNuma::Here() {
+	if (Nodes() == 1) return 0;
+	if (pinned >= 0) return pinned;
+	if (!real) return 0;
+#if defined(HAVE_LIBNUMA)
+	int cpu = sched_getcpu();
+	int node = (cpu >= 0)?numa_node_of_cpu(cpu):0;
+	if (node >= 0 && node < nodes) return node;
+#endif
+	return 0;
+}
+
+/*--- Pin(int node) -- */
+int ContaminantNuma::Pin(int node) {
+	assert(node >= 0);
+	if (Nodes() == 1) return 0;
+	if (!real) {
+		pinned = node % nodes;
+		return 1;
+	}
+#if defined(HAVE_LIBNUMA)
+	if (!numa_run_on_node(node % nodes)) {
+		pinned = node % nodes;
+		return 1;
+	}
+	warning("Unable to keep a contaminant thread on node %d", node % nodes);
+#endif
+	return 0;
+}
+
+
+/*-- memory */
+
+/*--- AllocOn(size_t sz, int node) -- */
+void *ContaminantNuma::AllocOn(size_t sz, int node) {
+	void *p = 0;
+
+	assert(sz > 0);
+#if defined(HAVE_LIBNUMA)
+	if (Nodes() > 1 && real) {
+		p = numa_alloc_onnode(sz, node % nodes);  // whole pages, already zero
+		if (!p) abort();
+		return p;
+	}
+#endif
+	p = Calloc(1, sz);
+	if (!p) abort();
+	return p;
+}
+
+/*--- FreeOn(void *p, size_t sz) -- as it was allocated */
+void ContaminantNuma::FreeOn(void *p, size_t sz) {
+	if (!p) return;
+#if defined(HAVE_LIBNUMA)
+	if (Nodes() > 1 && real) {
+		numa_free(p, sz);
+		return;
+	}
+#endif
+	Free(p);
+}
+
+
+/*-- the statistic */
+
+/*--- Count(long l, long r) -- */
+void ContaminantNuma::Count(long l, long r) {
+	if (l) __sync_fetch_and_add(&local, l);
+	if (r) __sync_fetch_and_add(&remote, r);
+}
+
+/*--- RemoteRatio() -- */
+double ContaminantNuma::RemoteRatio() {
+	long l = local, r = remote;
+	return (l + r)?(double)r/(l + r):0;
+}
+
+/*--- Report() -- the first time only; Contamination::ShutdownAll() asks */
+void ContaminantNuma::Report() {
+	static int done = 0;
+
+	if (done || (!local && !remote)) return;
+	done = 1;
+	VERBOSE("ContaminantNuma", "%d node%s, %ld agents committed at home and %ld away (remote ratio %g), %ld moved",
+		Nodes(), (nodes == 1)?"":"s", local, remote, RemoteRatio(), moved);
+}
+
+/*-  The End  */
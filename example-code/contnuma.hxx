@@ -0,0 +1,71 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contnuma.hxx -- where the contaminant state lives, on NUMA machines
+
+  Built with HAVE_LIBNUMA (and -lnuma) on a machine with more than one
+  node, this is how the contaminant code finds out which node a thread
+  is on, pins the ContaminantParallel workers to nodes, and allocates
+  the ContaminantHot pools on a given node.  Otherwise there is one
+  node, nobody is pinned, and AllocOn() is Calloc().
+
+  An agent's home is the node its hot row is on.  It starts as the
+  node of the thread which set the agent up.  A CommitIntoxicateMany
+  chunk is owned by the node most of its agents are on.  When a worker
+  of that node has found an agent from somewhere else in its chunks a
+  few commits in a row, the agent is moved: a new hot row from that
+  node's pool, and fresh copies of its cinfo, member cube, ensemble
+  and profile made on that thread.  The heap allocator keeps memory by thread, so
+  those land on the node too, as long as nothing much else is going
+  on.  Stolen chunks (a thread which has finished its own node's work
+  helping with another's) are done where they are and nothing moves.
+
+  Each chunk counts its agents as local or remote (home not the node
+  doing the work), and RemoteRatio() is the proportion of remote ones
+  so far; Moved() is how many agents have been moved.  Report() is
+  done at shutdown under VERBOSE.
+
+  The moving is done on the worker, in the middle of the parallel
+  pass, because that thread is on the node the copies should land on.
+  The agent is only touched by its chunk's thread, and what's shared
+  (ContaminantHot::Get(), and the pools' Alloc() and Release()) takes
+  its own lock; a hot row points into a pool's blocks, which never
+  move when the pool grows.
+
+  $CONT_NUMA_NODES pretends there are that many nodes (when there
+  aren't really): threads are "pinned" and agents moved just the same,
+  but nothing is really placed anywhere.  It is for trying out the
+  bookkeeping on an ordinary machine.
+*/
+
+#ifndef _CONTNUMA_HXX_INCLUDED_
+#define _CONTNUMA_HXX_INCLUDED_
+
+#include <stddef.h>
+
+class ContaminantNuma
+{
+public:
+	static int Nodes();                        // 1 without libnuma or without NUMA
+	static int Here();                         // the calling thread's node
+	static int Pin(int node);                  // keep the calling thread on node; 0 if it can't be done
+
+	static void *AllocOn(size_t sz, int node); // zeroed
+	static void FreeOn(void *p, size_t sz);
+
+	static void Count(long local, long remote);
+	static void Move() { __sync_fetch_and_add(&moved, 1); }
+	static double RemoteRatio();               // 0 before anything is counted
+	static long Moved() { return moved; }
+	static void Report();
+
+private:
+	static int nodes;                          // 0 until we've looked
+	static int real;                           // libnuma, and more than one node
+	static __thread int pinned;                // by Pin(); -1 if not
+	static volatile long local, remote, moved;
+};
+
+#endif
+/*-  The End  */
@@ -0,0 +1,198 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contparallel.cxx -- the deterministic parallel mode
+
+  See contparallel.hxx.  There is one job at a time.  Run() posts it
+  and wakes the pool; everyone, the caller included, then takes chunks
+  off the nodes' counters until there are none left.  A thread counts
+  itself busy while it is taking chunks, and Run() doesn't return (or
+  let go of the job) until nobody is, so a worker which wakes late
+  never sees the next job's counter with this one's function.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "prmagent.hxx"
+#include "contparallel.hxx"
+#include "contnuma.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define MAXTHREADS 256
+#define MAXNODES 64
+
+static pthread_mutex_t plock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pdone = PTHREAD_COND_INITIALIZER;
+static pthread_t *workers = 0;
+static int nworkers = 0, nodes = 1, stopping = 0, started = 0;
+
+static struct {
+	ContaminantParallel::ChunkFn fn;  // 0 between jobs
+	void *arg;
+	int chunks;
+	int nodes;                        // the chunks are shared out between
+	int *node;                        // each chunk's
+	int *order;                       // the chunks, node by node
+	int first[MAXNODES+1];            // where each node's start in order
+	volatile int next[MAXNODES];      // the next chunk of each node's nobody has taken
+} job;
+static int room = 0;                  // in job.node and job.order
+static unsigned generation = 0;       // of job
+static int busy = 0;                  // threads taking chunks
+
+/*-  Code  */
+
+/*--- Run(int chunks, ChunkFn fn, void *arg, const int *owner) -- every chunk, then back */
+void ContaminantParallel::Run(int chunks, ChunkFn fn, void *arg, const int *owner) {
+	assert(fn && chunks >= 0);
+	if (!started) start_from_env();
+
+	if (!nworkers || chunks < 2) {
+		job.nodes = 0;  // Owner() is wherever we are
+		for (int c = 0; c < chunks; c++) fn(arg, c);
+		return;
+	}
+
+	pthread_mutex_lock(&plock);
+	assert(!job.fn);  // not from inside a chunk
+	job.fn = fn;
+	job.arg = arg;
+	job.chunks = chunks;
+	job.nodes = Min(nodes, chunks);
+	if (chunks > room) {
+		room = chunks;
+		job.node = (int *)Realloc(job.node, 2*room*sizeof(int));
+		if (!job.node) abort();
+	}
+	job.order = job.node + room;
+	for (int c = 0; c < chunks; c++) {
+		int d = c*job.nodes/chunks;  // maybe one short of the run it's in
+		while ((d+1)*chunks/job.nodes <= c) d++;
+		job.node[c] = owner?owner[c] % job.nodes:d;
+	}
+	for (int d = 0, k = 0; d < job.nodes; d++) {
+		job.first[d] = k;
+		job.next[d] = 0;
+		for (int c = 0; c < chunks; c++) {
+			if (job.node[c] == d) job.order[k++] = c;
+		}
+	}
+	job.first[job.nodes] = chunks;
+	generation++;
+	busy++;
+	pthread_cond_broadcast(&pwork);
+	pthread_mutex_unlock(&plock);
+
+	work();
+
+	pthread_mutex_lock(&plock);
+	busy--;
+	while (busy) pthread_cond_wait(&pdone, &plock);
+	job.fn = 0;
+	pthread_mutex_unlock(&plock);
+}
+
+/*--- work() -- chunks until there are none, our node's first */
+void ContaminantParallel::work() {
+	int here = ContaminantNuma::Here() % job.nodes;
+
+	for (int k = 0; k < job.nodes; k++) {
+		int d = (here + k) % job.nodes;
+		int lo = job.first[d], hi = job.first[d+1];
+		for (;;) {
+			int c = lo + __sync_fetch_and_add(&job.next[d], 1);
+			if (c >= hi) break;
+			job.fn(job.arg, job.order[c]);
+		}
+	}
+}
+
+/*--- Owner(int chunk) -- */
+int ContaminantParallel::Owner(int chunk) {
+	if (!job.nodes) return ContaminantNuma::Here();
+	assert(chunk >= 0 && chunk < job.chunks);
+	return job.node[chunk];
+}
+
+
+/*-- the pool */
+
+/*--- worker(void *w) -- w is which worker, from 0 */
+void *ContaminantParallel::worker(void *w) {
+	unsigned seen = 0;
+
+	if (nodes > 1) ContaminantNuma::Pin(((long)w + 1) % nodes);  // the caller is usually on 0
+	pthread_mutex_lock(&plock);
+	seen = generation;
+	for (;;) {
+		while (seen == generation && !stopping) pthread_cond_wait(&pwork, &plock);
+		if (stopping) break;
+		seen = generation;
+		if (!job.fn) continue;  // over before we woke
+
+		busy++;
+		pthread_mutex_unlock(&plock);
+		work();
+		pthread_mutex_lock(&plock);
+		if (!--busy) pthread_cond_broadcast(&pdone);
+	}
+	pthread_mutex_unlock(&plock);
+	return 0;
+}
+
+/*--- Start(int threads) -- */
+// The caller works too, so threads-1 workers are started for threads.
+int ContaminantParallel::Start(int threads) {
+	Stop();
+	started = 1;
+	if (threads > MAXTHREADS) threads = MAXTHREADS;
+	if (threads <= 1) return 1;
+
+	workers = (pthread_t *)Calloc(threads-1, sizeof(pthread_t));
+	if (!workers) abort();
+	stopping = 0;
+	nodes = Min(Min(ContaminantNuma::Nodes(), threads), MAXNODES);
+	for (nworkers = 0; nworkers < threads-1; nworkers++) {
+		if (pthread_create(&workers[nworkers], 0, worker, (void *)(long)nworkers)) {
+			warning("Only %d of %d contaminant threads started", nworkers+1, threads);
+			break;
+		}
+	}
+	VERBOSE("ContaminantParallel", "%d contaminant threads on %d node%s", nworkers+1, nodes, (nodes == 1)?"":"s");
+	return nworkers > 0;
+}
+
+/*--- Stop() -- */
+void ContaminantParallel::Stop() {
+	if (!nworkers) return;
+	pthread_mutex_lock(&plock);
+	stopping = 1;
+	pthread_cond_broadcast(&pwork);
+	pthread_mutex_unlock(&plock);
+	for (int i = 0; i < nworkers; i++) pthread_join(workers[i], 0);
+	Free(workers);
+	workers = 0;
+	nworkers = 0;
+	stopping = 0;
+}
+
+/*--- Threads() -- including the caller */
+int ContaminantParallel::Threads() {
+	if (!started) start_from_env();
+	return nworkers+1;
+}
+
+/*--- start_from_env() -- $CONT_THREADS */
+void ContaminantParallel::start_from_env() {
+	char *s = getenv("CONT_THREADS");
+	Start(s?atoi(s):0);
+}
+
+/*-  The End  */
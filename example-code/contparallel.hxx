@@ -0,0 +1,56 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contparallel.hxx -- the deterministic parallel mode
+
+  Run() does fn(arg, 0) ... fn(arg, chunks-1) on a pool of worker
+  threads (and the calling thread) and returns when they're all done.
+  The work is split into chunks by the caller, never by the pool, so
+  which agents are in which chunk doesn't depend on the thread count;
+  a chunk's agents are done one after another by whichever thread took
+  the chunk.  Anything whose order matters (the death log, the
+  ContaminantStream rows, sums over agents) is kept per chunk while
+  the chunks run and put together in chunk order afterwards, which is
+  what makes the results the same, bit for bit, with any number of
+  threads.  Contamination::CommitIntoxicateMany is the main user;
+  Contamination::InitMany sets a scenario's agents up the same way.
+
+  On a NUMA machine (contnuma.hxx) the workers are pinned to the nodes
+  in turn, and each chunk belongs to a node: the caller's owner[chunk]
+  if it gives one (say, where most of the chunk's agents already are),
+  otherwise the chunks are shared out between the nodes in equal runs.
+  A thread takes its own node's chunks first, and only then helps with
+  the others'.  Owner() says whose a chunk is, so that the agents in it
+  can be kept on that node.
+
+  The pool is started by Start(), or from $CONT_THREADS the first time
+  Run() is called; with no threads (the default) Run() does the chunks
+  itself, in order.  As with the query workers (contquery.hxx) the
+  kernel's PrmEnvExpr (and, for InitMany, DeathLogger::Init) has to be
+  safe to call from any thread for this to be used.
+*/
+
+#ifndef _CONTPARALLEL_HXX_INCLUDED_
+#define _CONTPARALLEL_HXX_INCLUDED_
+
+class ContaminantParallel
+{
+public:
+	typedef void (*ChunkFn)(void *arg, int chunk);
+
+	static void Run(int chunks, ChunkFn fn, void *arg, const int *owner = 0);
+	static int Owner(int chunk);   // the node whose chunk it is, from inside Run()
+
+	static int Start(int threads); // counting the caller; 0 or 1 to do it all there
+	static void Stop();
+	static int Threads();
+
+private:
+	static void *worker(void *w);
+	static void work();
+	static void start_from_env();
+};
+
+#endif
+/*-  The End  */
@@ -0,0 +1,170 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contprec.cxx -- compare the final state of two runs
+
+  Usage: contprec [-t tolerance] reference.dump test.dump
+
+  The dumps are what Contamination writes to $CONT_PRECISION_DUMP at
+  shutdown.  The usual use is to run a reference scenario once with
+  the ordinary build and once with CONT_FLOAT_STORAGE and see how far
+  apart they end up: for each kind of value (loads, members, cube
+  axes) it reports how many were compared, the largest absolute and
+  relative differences (and where), and the mean relative difference.
+  Values which are in one run and not the other are counted as well.
+
+  The exit status is 1 if any relative difference is over the
+  tolerance (default 1e-3), so it can sit at the end of a script.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define LINE 1024
+
+typedef struct {
+	char *key;      // taxon \t agent \t what
+	char *kind;     // points into key: "load", "members" or "axis"
+	double v;
+} Value;
+
+typedef struct {
+	const char *kind;
+	int n;
+	double max_abs, max_rel, sum_rel;
+	char *worst;
+} Stats;
+
+static Stats stats[] = {
+	{ "load", 0, 0, 0, 0, 0 },
+	{ "members", 0, 0, 0, 0, 0 },
+	{ "axis", 0, 0, 0, 0, 0 },
+	{ 0, 0, 0, 0, 0, 0 }
+};
+
+/*-  Code  */
+
+/*--- by_key(const void *a, const void *b) -- */
+static int by_key(const void *a, const void *b) {
+	return strcmp(((Value *)a)->key, ((Value *)b)->key);
+}
+
+/*--- load(char *file, int *n) -- read and sort a dump */
+static Value *load(char *file, int *n) {
+	char line[LINE];
+	Value *v = 0;
+	int max = 0;
+
+	FILE *f = fopen(file, "r");
+	if (!f) {
+		fprintf(stderr, "contprec: can't read %s\n", file);
+		exit(2);
+	}
+	*n = 0;
+	while (fgets(line, sizeof(line), f)) {
+		char *tab = strrchr(line, '\t');
+		if (!tab) continue;
+		*tab++ = 0;
+
+		if (*n >= max) {
+			max = max?2*max:4096;
+			v = (Value *)Realloc(v, max*sizeof(Value));
+			if (!v) abort();
+		}
+		v[*n].key = Strdup(line);
+		if (!v[*n].key) abort();
+		v[*n].v = strtod(tab, 0);
+
+		// the kind is the third field, up to any ':'
+		char *k = strchr(v[*n].key, '\t');
+		k = k?strchr(k+1, '\t'):0;
+		v[*n].kind = k?k+1:v[*n].key;
+		(*n)++;
+	}
+	fclose(f);
+	qsort(v, *n, sizeof(Value), by_key);
+	return v;
+}
+
+/*--- stats_for(char *kind) -- */
+static Stats *stats_for(char *kind) {
+	for (int i = 0; stats[i].kind; i++) {
+		int l = strlen(stats[i].kind);
+		if (!strncmp(kind, stats[i].kind, l) && (kind[l] == 0 || kind[l] == ':')) return &stats[i];
+	}
+	return 0;
+}
+
+/*--- usage() -- */
+static void usage() {
+	fprintf(stderr, "Usage: contprec [-t tolerance] reference.dump test.dump\n");
+	exit(2);
+}
+
+/*-- main */
+int main(int argc, char **argv) {
+	double tol = 1e-3;
+	int i, j, na, nb, missing = 0, extra = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-t") && i+1 < argc) tol = atof(argv[++i]);
+		else usage();
+	}
+	if (argc - i != 2) usage();
+
+	Value *a = load(argv[i], &na);
+	Value *b = load(argv[i+1], &nb);
+
+	for (i = j = 0; i < na || j < nb; ) {
+		int c = (i >= na)?1:(j >= nb)?-1:strcmp(a[i].key, b[j].key);
+		if (c < 0) {
+			missing++;
+			i++;
+			continue;
+		}
+		if (c > 0) {
+			extra++;
+			j++;
+			continue;
+		}
+
+		Stats *s = stats_for(a[i].kind);
+		if (s) {
+			double d = fabs(a[i].v - b[j].v);
+			double m = fabs(a[i].v);
+			double r = (m > 0)?d/m:(d > 0?HUGE_VAL:0);
+			s->n++;
+			s->sum_rel += isinf(r)?0:r;
+			if (d > s->max_abs) s->max_abs = d;
+			if (r > s->max_rel) {
+				s->max_rel = r;
+				s->worst = a[i].key;
+			}
+		}
+		i++;
+		j++;
+	}
+
+	int bad = 0;
+	printf("%-8s %10s %12s %12s %12s  %s\n", "value", "compared", "max abs", "max rel", "mean rel", "worst");
+	for (i = 0; stats[i].kind; i++) {
+		Stats *s = &stats[i];
+		printf("%-8s %10d %12.4g %12.4g %12.4g  %s\n", s->kind, s->n, s->max_abs, s->max_rel,
+			s->n?s->sum_rel/s->n:0.0, s->worst?s->worst:"-");
+		if (s->max_rel > tol) bad = 1;
+	}
+	if (missing || extra) {
+		printf("%d values only in %s, %d only in %s\n", missing, argv[argc-2], extra, argv[argc-1]);
+		bad = 1;
+	}
+	return bad;
+}
+
+/*-  The End  */
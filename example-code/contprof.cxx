@@ -0,0 +1,208 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contprof.cxx -- counters and phase timers for the contaminant code
+
+  Slots are handed out when taxa and contaminants are set up, and
+  thread tables when a thread first counts something, so both are
+  behind spin locks.  Neither is ever freed: a thread which has gone
+  still has figures to report.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "prmagent.hxx"
+#include "contprof.hxx"
+#include "memchk.h"
+
+#if defined(CONT_PROFILE)
+
+/*-  Local variables, constants, and defines  */
+__thread ContaminantProf::Thread *ContaminantProf::mine = 0;
+
+ContaminantProf::Thread *ContaminantProf::threads = 0;
+static volatile int threads_lock = 0;
+
+typedef struct {
+	char *taxon, *contaminant;  // contaminant 0 for the taxon as a whole
+} SlotName;
+
+static SlotName *slots = 0;
+static int nslots = 0, maxslots = 0;
+static volatile int slots_lock = 0;
+
+// for turning ticks into seconds
+static uint64_t t0_ticks = 0;
+static double t0_clock = 0;
+static int dumped = 0;
+
+static const char *phase_name[CPROF_NPHASES] = {
+	"intoxicate", "local", "commit", "load_update",
+	"endpoint", "cube", "impair",
+	"native", "eval", "configure", "validate", "retry"
+};
+#define N_TIMED (CPROF_IMPAIR+1)
+
+/*-  Code  */
+
+/*--- clock_now() -- seconds */
+static double clock_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+/*-- slots */
+
+/*--- Slot(const char *taxon, const char *contaminant) -- */
+int ContaminantProf::Slot(const char *taxon, const char *contaminant) {
+	int i;
+
+	if (!taxon) return 0;
+	while (__sync_lock_test_and_set(&slots_lock, 1)) ;
+	if (!nslots) { // slot 0 is for figures we can't place
+		maxslots = 64;
+		slots = (SlotName *)Calloc(maxslots, sizeof(SlotName));
+		if (!slots) abort();
+		slots[0].taxon = Strdup("?");
+		if (!slots[0].taxon) abort();
+		nslots = 1;
+	}
+	for (i = 1; i < nslots; i++) {
+		if (strcmp(slots[i].taxon, taxon)) continue;
+		if (!contaminant && !slots[i].contaminant) break;
+		if (contaminant && slots[i].contaminant && !strcmp(slots[i].contaminant, contaminant)) break;
+	}
+	if (i == nslots) {
+		if (nslots >= BLOCK*BLOCKS) {
+			__sync_lock_release(&slots_lock);
+			warning("Out of profile slots for %s %s", taxon, contaminant?contaminant:"");
+			return 0;
+		}
+		if (nslots >= maxslots) {
+			maxslots *= 2;
+			slots = (SlotName *)Realloc(slots, maxslots*sizeof(SlotName));
+			if (!slots) abort();
+		}
+		slots[i].taxon = Strdup(taxon);
+		slots[i].contaminant = contaminant?Strdup(contaminant):0;
+		if (!slots[i].taxon || (contaminant && !slots[i].contaminant)) abort();
+		nslots++;
+	}
+	__sync_lock_release(&slots_lock);
+	return i;
+}
+
+
+/*-- thread tables */
+
+/*--- attach() -- this thread's table */
+ContaminantProf::Thread *ContaminantProf::attach() {
+	Thread *t = (Thread *)Calloc(1, sizeof(Thread));
+	if (!t) abort();
+
+	while (__sync_lock_test_and_set(&threads_lock, 1)) ;
+	if (!threads) {
+		t0_ticks = Now();
+		t0_clock = clock_now();
+	}
+	t->next = threads;
+	threads = t;
+	__sync_lock_release(&threads_lock);
+
+	mine = t;
+	return t;
+}
+
+/*--- grow(Thread *t, int slot) -- the block slot is in */
+ContaminantProf::Rec *ContaminantProf::grow(Thread *t, int slot) {
+	assert(slot >= 0 && slot < BLOCK*BLOCKS);
+	Rec *b = (Rec *)Calloc(BLOCK, sizeof(Rec));
+	if (!b) abort();
+	t->block[slot/BLOCK] = b;
+	return b;
+}
+
+
+/*-- reporting */
+
+/*--- Dump(FILE *f) -- totals over all threads */
+void ContaminantProf::Dump(FILE *f) {
+	Rec sum;
+	int i, j;
+
+	if (!f) return;
+
+	double sec_per_tick = 0;
+	uint64_t dt = Now() - t0_ticks;
+	if (threads && dt > 0) sec_per_tick = (clock_now() - t0_clock)/dt;
+
+	fprintf(f, "# taxon\tcontaminant\tphase\tcalls\tseconds\tns/call\n");
+	while (__sync_lock_test_and_set(&slots_lock, 1)) ;
+	for (i = 0; i < nslots; i++) {
+		memset(&sum, 0, sizeof(sum));
+		for (Thread *t = threads; t; t = t->next) {
+			Rec *r = t->block[i/BLOCK];
+			if (!r) continue;
+			r += i%BLOCK;
+			for (j = 0; j < CPROF_NPHASES; j++) {
+				sum.n[j] += r->n[j];
+				sum.ticks[j] += r->ticks[j];
+			}
+		}
+		for (j = 0; j < CPROF_NPHASES; j++) {
+			if (!sum.n[j]) continue;
+			fprintf(f, "%s\t%s\t%s\t%llu", slots[i].taxon, slots[i].contaminant?slots[i].contaminant:"-",
+				phase_name[j], (unsigned long long)sum.n[j]);
+			if (j < N_TIMED) {
+				double s = sum.ticks[j]*sec_per_tick;
+				fprintf(f, "\t%.6f\t%.1f", s, 1e9*s/sum.n[j]);
+			}
+			fprintf(f, "\n");
+		}
+	}
+	__sync_lock_release(&slots_lock);
+	fflush(f);
+}
+
+/*--- Shutdown() -- */
+void ContaminantProf::Shutdown() {
+	if (dumped) return;
+	dumped = 1;
+
+	char *file = getenv("CONT_PROFILE");
+	if (!file) return;
+	if (!strcmp(file, "-")) {
+		Dump(stderr);
+		return;
+	}
+	FILE *f = fopen(file, "w");
+	if (!f) {
+		warning("Unable to write %s", file);
+		return;
+	}
+	Dump(f);
+	fclose(f);
+}
+
+/*--- Clear() -- start counting again */
+void ContaminantProf::Clear() {
+	while (__sync_lock_test_and_set(&threads_lock, 1)) ;
+	for (Thread *t = threads; t; t = t->next) {
+		for (int b = 0; b < BLOCKS; b++) {
+			if (t->block[b]) memset(t->block[b], 0, BLOCK*sizeof(Rec));
+		}
+	}
+	t0_ticks = Now();
+	t0_clock = clock_now();
+	__sync_lock_release(&threads_lock);
+}
+
+#endif
+
+/*-  The End  */
@@ -0,0 +1,127 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contprof.hxx -- counters and phase timers for the contaminant code
+
+  Built with CONT_PROFILE, the hot paths count their calls and time
+  their phases: Intoxicate, LocalIntoxicate, CommitIntoxicate, the
+  load update, the endpoint surfaces, the member cube and the
+  impairment getters, along with how often the compiled programs and
+  the evaluator were used, how often the environment had to be
+  configured and validated, and how often an adaptive step's load
+  update was done again in shorter steps.  The times are inclusive: Intoxicate's
+  includes its LocalIntoxicate calls, and CommitIntoxicate's includes
+  the load updates, surfaces and cube.  Without CONT_PROFILE the
+  macros are empty and none of this is compiled.
+
+  Figures are kept per slot, a slot being a taxon (contaminant 0) or a
+  (taxon, contaminant) pair; Slot() hands them out and the code keeps
+  the ones it uses.  Each thread has its own table, so the counting
+  needs no locks; Dump() adds them up.  It is done once, by
+  Contamination::ShutdownAll(), to $CONT_PROFILE ("-" for stderr), and
+  Dump(f) can be called any time.  The totals are only as consistent as a read of other
+  threads' counters without locking can make them, which is plenty
+  for this.
+
+  The timer is the cycle counter where there is one (rdtsc), scaled
+  to seconds against the monotonic clock when the figures are dumped.
+
+  e.g.
+	CPROF_START(t0);
+	...
+	CPROF_STOP(t0, cs->prof, CPROF_ENDPOINT);
+	CPROF_COUNT(cs->prof, CPROF_NATIVE);
+*/
+
+#ifndef _CONTPROF_HXX_INCLUDED_
+#define _CONTPROF_HXX_INCLUDED_
+
+#if defined(CONT_PROFILE)
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum {
+	// timed
+	CPROF_INTOXICATE, CPROF_LOCAL, CPROF_COMMIT, CPROF_LOAD_UPDATE,
+	CPROF_ENDPOINT, CPROF_CUBE, CPROF_IMPAIR,
+	// counted
+	CPROF_NATIVE, CPROF_EVAL, CPROF_CONFIGURE, CPROF_VALIDATE, CPROF_RETRY,
+	CPROF_NPHASES
+};
+
+class ContaminantProf
+{
+public:
+	typedef struct {
+		uint64_t n[CPROF_NPHASES];
+		uint64_t ticks[CPROF_NPHASES];
+	} Rec;
+
+	static int Slot(const char *taxon, const char *contaminant);  // contaminant 0 for the taxon
+
+	static uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+	}
+
+	static Rec *Get(int slot) {
+		if (slot < 0) slot = 0;   // slot 0 is "unknown"
+		Thread *t = mine;
+		if (!t) t = attach();
+		Rec *b = t->block[slot/BLOCK];
+		if (!b) b = grow(t, slot);
+		return b + slot%BLOCK;
+	}
+	static void Count(int slot, int phase) { Get(slot)->n[phase]++; }
+	static void Add(int slot, int phase, uint64_t ticks) {
+		Rec *r = Get(slot);
+		r->n[phase]++;
+		r->ticks[phase] += ticks;
+	}
+
+	static void Dump(FILE *f);
+	static void Shutdown();   // Dump() to $CONT_PROFILE, the first time only
+	static void Clear();
+
+private:
+	enum { BLOCK = 64, BLOCKS = 256 };    // so up to 16384 slots
+
+	typedef struct Thread {
+		Rec *block[BLOCKS];
+		struct Thread *next;
+	} Thread;
+
+	static Thread *attach();
+	static Rec *grow(Thread *t, int slot);
+
+	static __thread Thread *mine;
+	static Thread *threads;     // all of them
+};
+
+#define CPROF_START(v) uint64_t v = ContaminantProf::Now()
+#define CPROF_STOP(v, slot, phase) ContaminantProf::Add((slot), (phase), ContaminantProf::Now() - (v))
+#define CPROF_COUNT(slot, phase) ContaminantProf::Count((slot), (phase))
+#define CPROF_SHUTDOWN() ContaminantProf::Shutdown()
+
+#else
+
+#define CPROF_START(v)
+#define CPROF_STOP(v, slot, phase)
+#define CPROF_COUNT(slot, phase)
+#define CPROF_SHUTDOWN()
+
+#endif
+
+#endif
+/*-  The End  */
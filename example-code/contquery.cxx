@@ -0,0 +1,214 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contquery.cxx -- batched, pipelined source queries for the sinks
+
+  See contquery.hxx.  Issued batches wait in a queue; a worker takes
+  the first request nobody has taken from the batch at the head, so
+  one sink's sources are spread over the pool rather than answered in
+  a line.  Wait() sleeps on a single condition which is signalled
+  whenever a batch's last request is answered.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "prmagent.hxx"
+#include "contquery.hxx"
+#include "contsrc.hxx"
+#ifdef CONTAMINANT_SHM
+#include "contshm.hxx"
+#endif
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define MAXTHREADS 256
+
+static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t qdone = PTHREAD_COND_INITIALIZER;
+static ContaminantQuery::Batch *qhead = 0, *qtail = 0;
+static pthread_t *workers = 0;
+static int nworkers = 0, stopping = 0, started = 0;
+
+/*-  Code  */
+
+/*-- batches */
+
+/*--- New() -- */
+ContaminantQuery::Batch *ContaminantQuery::New() {
+	Batch *b = (Batch *)Calloc(1, sizeof(Batch));
+	if (!b) abort();
+	return b;
+}
+
+/*--- Release(Batch *b) -- */
+void ContaminantQuery::Release(Batch *b) {
+	if (!b) return;
+	Wait(b);
+	for (int i = 0; i < b->max; i++) {
+		if (b->req[i].value) Free(b->req[i].value);
+	}
+	if (b->req) Free(b->req);
+	Free(b);
+}
+
+/*--- Clear(Batch *b) -- */
+void ContaminantQuery::Clear(Batch *b) {
+	assert(b);
+	assert(!b->pending);
+	b->n = 0;
+}
+
+/*--- Add(Batch *b, int agent, ContaminantTaxon::Pair *pair, double t, R3 loc) -- */
+void ContaminantQuery::Add(Batch *b, int agent, ContaminantTaxon::Pair *pair, double t, R3 loc) {
+	assert(b && pair);
+	assert(!b->pending);
+	if (b->n >= b->max) {
+		int m = b->max?2*b->max:16;
+		b->req = (Req *)Realloc(b->req, m*sizeof(Req));
+		if (!b->req) abort();
+		memset(b->req + b->max, 0, (m - b->max)*sizeof(Req));
+		b->max = m;
+	}
+	Req *r = b->req + b->n++;
+	r->agent = agent;
+	r->t = t;
+	r->loc = loc;
+	r->pair = pair;
+}
+
+/*--- answer(Batch *b, Req *r) -- a round trip per contaminant we share */
+void ContaminantQuery::answer(Batch *b, Req *r) {
+	ContaminantTaxon::Pair *p = r->pair;
+	if (!p->any) return;
+
+	if (r->max < p->n) {
+		r->value = (double *)Realloc(r->value, p->n*sizeof(double));
+		if (!r->value) abort();
+		r->max = p->n;
+	}
+	for (int i = 0; i < p->n; i++) {
+		if (p->cid[i] < 0) r->value[i] = DNaN;
+		else r->value[i] = ContaminantSource::GetCSValue(KID(r->agent), r->t, r->loc, p->cid[i]);
+	}
+}
+
+/*--- Issue(Batch *b) -- */
+void ContaminantQuery::Issue(Batch *b) {
+	assert(b);
+	assert(!b->pending);
+	if (!started) start_from_env();
+	if (!b->n) return;
+
+	if (!nworkers) {
+		for (int i = 0; i < b->n; i++) answer(b, b->req + i);
+		return;
+	}
+
+	pthread_mutex_lock(&qlock);
+	b->pending = b->n;
+	b->taken = 0;
+	b->next = 0;
+	if (qtail) qtail->next = b;
+	else qhead = b;
+	qtail = b;
+	pthread_cond_broadcast(&qwork);
+	pthread_mutex_unlock(&qlock);
+}
+
+/*--- Wait(Batch *b) -- */
+void ContaminantQuery::Wait(Batch *b) {
+	assert(b);
+	if (!b->pending) return;
+	pthread_mutex_lock(&qlock);
+	while (b->pending) pthread_cond_wait(&qdone, &qlock);
+	pthread_mutex_unlock(&qlock);
+}
+
+
+/*-- the pool */
+
+/*--- worker(void *) -- */
+void *ContaminantQuery::worker(void *) {
+	pthread_mutex_lock(&qlock);
+	for (;;) {
+		while (!qhead && !stopping) pthread_cond_wait(&qwork, &qlock);
+		if (!qhead) break;
+
+		Batch *b = qhead;
+		Req *r = b->req + b->taken++;
+		if (b->taken == b->n) { // all handed out; off the queue
+			qhead = b->next;
+			if (!qhead) qtail = 0;
+		}
+		pthread_mutex_unlock(&qlock);
+
+		answer(b, r);
+
+		pthread_mutex_lock(&qlock);
+		if (!--b->pending) pthread_cond_broadcast(&qdone);
+	}
+	pthread_mutex_unlock(&qlock);
+	return 0;
+}
+
+/*--- Start(int threads) -- */
+int ContaminantQuery::Start(int threads) {
+	Stop();
+	started = 1;
+#if defined(CONTAMINANT_SHM)
+	if (threads > 0 && ContaminantShm::Linked()) {
+		warning("The shared memory transport has one producer per ring; source queries will be answered inline");
+		threads = 0;
+	}
+#endif
+	if (threads > MAXTHREADS) threads = MAXTHREADS;
+	if (threads <= 0) return 1;
+
+	workers = (pthread_t *)Calloc(threads, sizeof(pthread_t));
+	if (!workers) abort();
+	stopping = 0;
+	for (nworkers = 0; nworkers < threads; nworkers++) {
+		if (pthread_create(&workers[nworkers], 0, worker, 0)) {
+			warning("Only %d of %d source query threads started", nworkers, threads);
+			break;
+		}
+	}
+	VERBOSE("ContaminantQuery", "%d source query threads", nworkers);
+	return nworkers > 0;
+}
+
+/*--- Stop() -- once the queue has drained */
+void ContaminantQuery::Stop() {
+	if (!nworkers) return;
+	pthread_mutex_lock(&qlock);
+	stopping = 1;
+	pthread_cond_broadcast(&qwork);
+	pthread_mutex_unlock(&qlock);
+	for (int i = 0; i < nworkers; i++) pthread_join(workers[i], 0);
+	Free(workers);
+	workers = 0;
+	nworkers = 0;
+	stopping = 0;
+}
+
+/*--- Threads() -- */
+int ContaminantQuery::Threads() {
+	if (!started) start_from_env();
+	return nworkers;
+}
+
+/*--- start_from_env() -- $CONT_QUERY_THREADS */
+void ContaminantQuery::start_from_env() {
+	char *s = getenv("CONT_QUERY_THREADS");
+	Start(s?atoi(s):0);
+}
+
+/*-  The End  */
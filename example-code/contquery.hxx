@@ -0,0 +1,81 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contquery.hxx -- batched, pipelined source queries for the sinks
+
+  A sink's exposure in a tick is a GetCSValue for every source and
+  every contaminant it cares about which that source gives off, and
+  in a distributed kernel each of those is a round trip.  Rather than
+  make them one after another, ContaminantSink::StartIntoxicate() puts
+  a request for each source in a Batch and Issue()s it;
+  FinishIntoxicate() waits for the answers and hands them to
+  LocalIntoxicate().  Which contaminants a source gives off, and under
+  what cid (a ContaminantTaxon::Pair), the sink has already said in
+  Add(), normally from what it remembers of the source, so answering
+  a request is just the GetCSValue()s and takes no locks.  In between
+  the kernel can get on with other agents (ContaminantSink::IntoxicateMany
+  starts a whole group before finishing any of them), so the waits
+  overlap.
+
+  The answering is done by a pool of worker threads, each taking one
+  request at a time from the queued batches.  The pool is started by
+  Start(), or from $CONT_QUERY_THREADS the first time a batch is
+  issued; with no threads (the default) a batch is answered in full by
+  Issue(), which gives the same answers, in the same order, as asking
+  one at a time.  Workers only make sense where the kernel's KGET can
+  be called from any thread, and where a round trip
+  costs more than passing the request to another thread (in one
+  process they are a loss).  The shared memory rings (CONTAMINANT_SHM)
+  have a single producer, so a kernel linked through them answers
+  inline.
+*/
+
+#ifndef _CONTQUERY_HXX_INCLUDED_
+#define _CONTQUERY_HXX_INCLUDED_
+
+#include "r3.hxx"
+#include "cont.hxx"
+#include "conttaxon.hxx"
+
+class ContaminantQuery
+{
+public:
+	typedef struct {
+		int agent;             // the source
+		double t;
+		R3 loc;
+		ContaminantTaxon::Pair *pair;  // what it gives off (the sink's to keep alive),
+		double *value;         // and how much; [pair->n], NaN where it doesn't
+		int max;               // room in value
+	} Req;
+
+	typedef struct Batch {
+		int n, max;
+		Req *req;
+		volatile int pending;  // issued and not yet answered
+		int taken;             // the next request for a worker
+		struct Batch *next;    // in the queue
+	} Batch;
+
+	static Batch *New();
+	static void Release(Batch *b);                  // waits for it first
+	static void Clear(Batch *b);   // empty it
+	static void Add(Batch *b, int agent, ContaminantTaxon::Pair *pair, double t, R3 loc);
+
+	static void Issue(Batch *b);   // start answering; with no workers, answer
+	static void Wait(Batch *b);    // until every request is answered
+	static int Done(Batch *b) { return !b->pending; }
+
+	static int Start(int threads); // 0 to answer inline
+	static void Stop();
+	static int Threads();
+
+private:
+	static void answer(Batch *b, Req *r);
+	static void *worker(void *);
+	static void start_from_env();
+};
+
+#endif
+/*-  The End  */
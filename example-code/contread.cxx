@@ -0,0 +1,236 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contread.cxx -- read a contaminant stream
+
+  Usage: contread [-i] [-m] [-t from:to] [-x taxon] [-a agent] [-c contaminant] file
+
+  Writes the rows of a ContaminantStream file (see contstream.hxx) as
+  tab separated text, one row per line, with the names filled in:
+
+	t taxon agent cx cy contaminant n load survival reproduction foraging movement
+
+  -t keeps the rows with from <= t <= to (either may be left out); if
+  the file was closed properly only the blocks which overlap that
+  range are read.  -x, -a and -c keep the rows for one taxon, agent
+  or contaminant ("-" is the whole-agent row).  -m divides the sums
+  in a file aggregated by cell by n, to give means.  -i lists the
+  blocks instead of the rows.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "contstream.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+static FILE *f;
+static char *file;
+static char **names = 0;
+static int nnames = 0;
+
+static double from = -HUGE_VAL, to = HUGE_VAL;
+static char *want_taxon = 0, *want_agent = 0, *want_contaminant = 0;
+static int means = 0, list = 0;
+static uint32_t mode;
+
+/*-  Code  */
+
+/*--- die(const char *what) -- */
+static void die(const char *what) {
+	fprintf(stderr, "contread: %s: %s\n", file, what);
+	exit(2);
+}
+
+/*--- name(uint32_t id) -- */
+static const char *name(uint32_t id) {
+	if (id == 0) return "-";
+	if ((int)id > nnames || !names[id-1]) return "?";
+	return names[id-1];
+}
+
+/*--- read_block(uint64_t at, uint32_t *tag, uint32_t *len) -- the body, or 0 at the end */
+static char *read_block(uint64_t at, uint32_t *tag, uint32_t *len) {
+	uint32_t h[2];
+
+	if (fseeko(f, at, SEEK_SET) || fread(h, 4, 2, f) != 2) return 0;
+	*tag = h[0];
+	*len = h[1];
+	char *b = (char *)Malloc(*len ? *len : 1);
+	if (!b) abort();
+	if (fread(b, 1, *len, f) != *len) {
+		Free(b);
+		return 0;  // cut short; the run died mid write
+	}
+	return b;
+}
+
+/*--- dict(char *b) -- add a DICT block's names */
+static void dict(char *b, uint32_t len) {
+	uint32_t first, n;
+	memcpy(&first, b, 4);
+	memcpy(&n, b+4, 4);
+
+	if ((int)(first + n - 1) > nnames) {
+		names = (char **)Realloc(names, (first + n - 1)*sizeof(char *));
+		if (!names) abort();
+		for (int i = nnames; i < (int)(first + n - 1); i++) names[i] = 0;
+		nnames = first + n - 1;
+	}
+	char *p = b + 8, *end = b + len;
+	for (uint32_t i = 0; i < n && p < end; i++) {
+		if (!names[first-1+i]) {
+			names[first-1+i] = Strdup(p);
+			if (!names[first-1+i]) abort();
+		}
+		p += strlen(p) + 1;
+	}
+}
+
+/*--- wanted(const char *want, uint32_t id) -- */
+static int wanted(const char *want, uint32_t id) {
+	return !want || !strcmp(want, name(id));
+}
+
+/*--- rows(char *b, uint64_t at) -- print a ROWS block */
+static void rows(char *b, uint64_t at) {
+	uint32_t n;
+	double tmin, tmax;
+
+	memcpy(&n, b, 4);
+	memcpy(&tmin, b+8, 8);
+	memcpy(&tmax, b+16, 8);
+	if (list) {
+		printf("ROWS\t%llu\t%u\t%.17g\t%.17g\n", (unsigned long long)at, n, tmin, tmax);
+		return;
+	}
+	if (tmax < from || tmin > to) return;
+
+	double *t = (double *)(b + 24);
+	uint32_t *taxon = (uint32_t *)(t + n);
+	uint32_t *who = taxon + n;
+	int32_t *cx = (int32_t *)(who + n);
+	int32_t *cy = cx + n;
+	uint32_t *cont = (uint32_t *)(cy + n);
+	uint32_t *cnt = cont + n;
+	double *v = (double *)(cnt + n);
+
+	for (uint32_t i = 0; i < n; i++) {
+		if (t[i] < from || t[i] > to) continue;
+		if (!wanted(want_taxon, taxon[i]) || !wanted(want_agent, who[i]) ||
+			 !wanted(want_contaminant, cont[i])) continue;
+
+		printf("%.17g\t%s\t%s\t%d\t%d\t%s\t%u", t[i], name(taxon[i]), name(who[i]),
+			cx[i], cy[i], name(cont[i]), cnt[i]);
+		for (int k = 0; k < 5; k++) {
+			double d = v[k*n + i];
+			if (means && mode == 1 && cnt[i] > 0) d /= cnt[i];
+			printf("\t%.10g", d);
+		}
+		printf("\n");
+	}
+}
+
+/*--- by_index() -- go straight to the blocks we want; 0 if there's no index */
+static int by_index() {
+	uint32_t tag, len, h[2];
+	uint64_t at;
+
+	if (fseeko(f, -16, SEEK_END) || fread(h, 4, 2, f) != 2 || h[0] != CSTREAM_TEND || h[1] != 8) return 0;
+	if (fread(&at, 8, 1, f) != 1) return 0;
+
+	char *idx = read_block(at, &tag, &len);
+	if (!idx || tag != CSTREAM_TIDX) die("bad index");
+	uint32_t n;
+	uint64_t dat;
+	memcpy(&n, idx, 4);
+	memcpy(&dat, idx+8, 8);
+
+	char *b = read_block(dat, &tag, &len);
+	if (b && tag == CSTREAM_DICT) dict(b, len);
+	if (b) Free(b);
+
+	for (uint32_t i = 0; i < n; i++) {
+		double e[2];
+		uint64_t off;
+		memcpy(e, idx + 16 + 32*i, 16);
+		memcpy(&off, idx + 16 + 32*i + 16, 8);
+		if (!list && (e[1] < from || e[0] > to)) continue;
+		b = read_block(off, &tag, &len);
+		if (!b || tag != CSTREAM_ROWS) die("index points at something other than rows");
+		rows(b, off);
+		Free(b);
+	}
+	Free(idx);
+	return 1;
+}
+
+/*--- by_walking() -- every block in turn */
+static void by_walking() {
+	uint64_t at = 32;
+	uint32_t tag, len;
+	char *b;
+
+	while ((b = read_block(at, &tag, &len))) {
+		if (tag == CSTREAM_DICT) dict(b, len);
+		else if (tag == CSTREAM_ROWS) rows(b, at);
+		Free(b);
+		at += 8 + len;
+	}
+}
+
+/*--- usage() -- */
+static void usage() {
+	fprintf(stderr, "Usage: contread [-i] [-m] [-t from:to] [-x taxon] [-a agent] [-c contaminant] file\n");
+	exit(2);
+}
+
+/*-- main */
+int main(int argc, char **argv) {
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-i")) list = 1;
+		else if (!strcmp(argv[i], "-m")) means = 1;
+		else if (!strcmp(argv[i], "-t") && i+1 < argc) {
+			char *s = argv[++i], *c = strchr(s, ':');
+			if (!c) usage();
+			if (c > s) from = atof(s);
+			if (c[1]) to = atof(c+1);
+		}
+		else if (!strcmp(argv[i], "-x") && i+1 < argc) want_taxon = argv[++i];
+		else if (!strcmp(argv[i], "-a") && i+1 < argc) want_agent = argv[++i];
+		else if (!strcmp(argv[i], "-c") && i+1 < argc) want_contaminant = argv[++i];
+		else usage();
+	}
+	if (argc - i != 1) usage();
+	file = argv[i];
+
+	if (!(f = fopen(file, "rb"))) die("can't read it");
+
+	char magic[8];
+	uint32_t version;
+	double cell, bin;
+	if (fread(magic, 8, 1, f) != 1 || memcmp(magic, CSTREAM_MAGIC, 8)) die("not a contaminant stream");
+	if (fread(&version, 4, 1, f) != 1 || fread(&mode, 4, 1, f) != 1 ||
+		 fread(&cell, 8, 1, f) != 1 || fread(&bin, 8, 1, f) != 1) die("short header");
+	if (version != CSTREAM_VERSION) die("unknown version");
+
+	if (list) printf("# %s, cell %g bin %g\n", mode?"by cell":"by agent", cell, bin);
+	else printf("# t\ttaxon\tagent\tcx\tcy\tcontaminant\tn\tload\tsurvival\treproduction\tforaging\tmovement\n");
+
+	if (!by_index()) {
+		if (list) printf("# no index; walking the blocks\n");
+		by_walking();
+	}
+	fclose(f);
+	return 0;
+}
+
+/*-  The End  */
@@ -0,0 +1,510 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contshm.cxx -- shared memory transport between kernels on the same host
+
+  The rings are single producer/single consumer, so all we need for
+  synchronisation is to make sure the record is in memory before the
+  head moves (and that we've finished with it before the tail moves).
+  Positions are free running unsigned counters; the data area is a
+  power of two so they wrap cleanly.
+
+  Records are an eight byte header (the length, or -1 for "go back to
+  the start") followed by the payload, padded to eight bytes.
+
+  A kernel waiting on the other end (for room in a ring, or for a
+  reply) answers its queries meanwhile, since it may be waiting on us;
+  with nothing to answer it yields for a while and then sleeps, for
+  longer each time round, rather than spin.  Serve() takes each query
+  off the ring before answering it, so that one which leads to a query
+  of our own (and so to Serve() again while we wait) is answered once.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "contshm.hxx"
+#include "contamination.hxx"
+#include "contsrc.hxx"
+#include "contsink.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define RING_MAGIC 0x436f6e52   // "ConR"
+#define RING_WRAP (-1)
+#define RING_ROUND(x) (((x)+7) & ~7)
+#define RING_HDR 8
+
+#define Q_CSVALUE 1
+#define Q_PROFILE 2
+
+#define YIELDS 64               // before back_off() starts to sleep
+#define NAP_MAX 1000000L        // nanoseconds
+
+ContaminantShm *ContaminantShm::link = 0;
+ContaminantShmResolver ContaminantShm::resolver = 0;
+ContaminantShmLocal ContaminantShm::local = 0;
+
+/*-  Code  */
+
+/*--- back_off(int *spins) -- wait a while, longer the more often we've had to */
+static void back_off(int *spins) {
+	int k = (*spins)++;
+	if (k < YIELDS) {
+		sched_yield();
+		return;
+	}
+	k = Min(k - YIELDS, 10);
+	struct timespec ts = { 0, Min(1000L << k, NAP_MAX) };
+	nanosleep(&ts, 0);
+}
+
+
+/*-- ContaminantRing */
+
+/*--- ContaminantRing() -- */
+ContaminantRing::ContaminantRing() {
+	name = 0;
+	h = 0;
+	data = 0;
+	mapped = 0;
+	pending = 0;
+	owner = 0;
+}
+
+/*--- ~ContaminantRing() -- */
+ContaminantRing::~ContaminantRing() {
+	if (h) munmap(h, mapped);
+	if (name) {
+		if (owner) shm_unlink(name);
+		Free(name);
+	}
+}
+
+/*--- Open(char *nm, int size, int create) -- map (and possibly make) a ring */
+ContaminantRing *ContaminantRing::Open(char *nm, int size, int create) {
+	assert(nm && *nm == '/');
+	if (size <= 0 || (size & (size-1))) {
+		warning("Shared memory ring %s must be a power of two in size (not %d)", nm, size);
+		return 0;
+	}
+
+	int fd = shm_open(nm, O_RDWR|(create?O_CREAT:0), 0600);
+	if (fd < 0) return 0;
+
+	int len = sizeof(Header) + size;
+	if (create && ftruncate(fd, len) < 0) {
+		close(fd);
+		shm_unlink(nm);
+		return 0;
+	}
+
+	void *m = mmap(0, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) return 0;
+
+	ContaminantRing *r = new ContaminantRing();
+	if (!r) abort();
+	r->name = Strdup(nm);
+	r->h = (Header *)m;
+	r->data = (char *)m + sizeof(Header);
+	r->mapped = len;
+	r->owner = create;
+
+	if (create) {
+		r->h->size = size;
+		r->h->head = 0;
+		r->h->tail = 0;
+		__sync_synchronize();
+		r->h->magic = RING_MAGIC;
+	}
+	else if (r->h->magic != RING_MAGIC || r->h->size != size) {
+		warning("Shared memory ring %s isn't one of ours", nm);
+		delete r;
+		return 0;
+	}
+	r->pending = r->h->head;
+	return r;
+}
+
+/*--- Reserve(int len) -- producer: space for len bytes */
+void *ContaminantRing::Reserve(int len) {
+	unsigned size = h->size;
+	unsigned need = RING_HDR + RING_ROUND(len);
+	unsigned head = h->head;
+	unsigned pos = head & (size-1);
+	unsigned skip = 0;
+
+	assert(len >= 0);
+	if (need > size) return 0;
+
+	if (pos + need > size) skip = size - pos;  // won't fit before the end
+	if (size - (head - h->tail) < skip + need) return 0;
+
+	if (skip) {
+		*(int *)(data + pos) = RING_WRAP;
+		head += skip;
+		pos = 0;
+	}
+	*(int *)(data + pos) = len;
+	pending = head + need;
+	return data + pos + RING_HDR;
+}
+
+/*--- Fits(int len) -- whether a record of len bytes will ever go in */
+int ContaminantRing::Fits(int len) {
+	return len >= 0 && RING_HDR + RING_ROUND((unsigned)len) <= (unsigned)h->size;
+}
+
+/*--- Commit() -- producer: the record is complete */
+void ContaminantRing::Commit() {
+	__sync_synchronize();
+	h->head = pending;
+}
+
+/*--- Peek(int *len) -- consumer: look at the next record */
+void *ContaminantRing::Peek(int *len) {
+	unsigned size = h->size;
+
+	for (;;) {
+		unsigned tail = h->tail;
+		if (tail == h->head) return 0;
+		__sync_synchronize();
+
+		unsigned pos = tail & (size-1);
+		int l = *(int *)(data + pos);
+		if (l == RING_WRAP) {
+			h->tail = tail + (size - pos);
+			continue;
+		}
+		assert(l >= 0);
+		if (len) *len = l;
+		return data + pos + RING_HDR;
+	}
+}
+
+/*--- Release() -- consumer: done with the record */
+void ContaminantRing::Release() {
+	unsigned tail = h->tail;
+	int l = *(int *)(data + (tail & (h->size-1)));
+
+	assert(tail != h->head);
+	assert(l >= 0);
+	__sync_synchronize();
+	h->tail = tail + RING_HDR + RING_ROUND(l);
+}
+
+
+/*-- ContaminantShm -- one end of a link */
+
+/*--- ContaminantShm() -- */
+ContaminantShm::ContaminantShm() {
+	for (int i = 0; i < NRING; i++) out[i] = in[i] = 0;
+	seq = 0;
+	stash = 0;
+	nstash = maxstash = 0;
+	held = 0;
+}
+
+/*--- ~ContaminantShm() -- */
+ContaminantShm::~ContaminantShm() {
+	for (int i = 0; i < NRING; i++) {
+		if (out[i]) delete out[i];
+		if (in[i]) delete in[i];
+	}
+	for (int i = 0; i < nstash; i++) Free(stash[i]);
+	if (stash) Free(stash);
+	if (held) Free(held);
+}
+
+/*--- Link(char *base, int side, int size) -- side 0 makes the segments, side 1 attaches */
+// The rings are called <base>.<kind>.<from side>, so both ends agree on
+// which is which.
+ContaminantShm *ContaminantShm::Link(char *base, int side, int size) {
+	static const char *kind[NRING] = { "mig", "qry", "rep" };
+	char nm[256];
+
+	assert(base && *base == '/');
+	assert(side == 0 || side == 1);
+	if (link) Unlink();
+
+	ContaminantShm *s = new ContaminantShm();
+	if (!s) abort();
+
+	// side 0 makes everything, so side 1 can only attach once it has
+	for (int i = 0; i < NRING; i++) {
+		snprintf(nm, sizeof(nm), "%s.%s.%d", base, kind[i], side);
+		s->out[i] = ContaminantRing::Open(nm, size, side == 0);
+		snprintf(nm, sizeof(nm), "%s.%s.%d", base, kind[i], 1-side);
+		s->in[i] = ContaminantRing::Open(nm, size, side == 0);
+		if (!s->out[i] || !s->in[i]) {
+			warning("Unable to attach shared memory link %s", base);
+			delete s;
+			return 0;
+		}
+	}
+	link = s;
+	return s;
+}
+
+/*--- Unlink() -- */
+void ContaminantShm::Unlink() {
+	if (link) delete link;
+	link = 0;
+}
+
+/*--- SetResolver(r, l) -- the kernel tells us how to find agents */
+void ContaminantShm::SetResolver(ContaminantShmResolver r, ContaminantShmLocal l) {
+	resolver = r;
+	local = l;
+}
+
+/*--- Linked() -- */
+int ContaminantShm::Linked() {
+	return link != 0;
+}
+
+/*--- Local(int xid) -- can we talk to xid through shared memory? */
+int ContaminantShm::Local(int xid) {
+	if (!link || !local) return 0;
+	return local(xid);
+}
+
+
+/*-- migration */
+
+/*--- SendAgents(Contamination **agents, int n) -- returns the number which fitted */
+// The kernel should retire the ones that went and send the rest the slow way
+// (or try again after the other end has drained the ring).
+int ContaminantShm::SendAgents(Contamination **agents, int n) {
+	int i;
+
+	if (!link) return 0;
+	for (i = 0; i < n; i++) {
+		int sz = agents[i]->StateSize();
+		void *p = link->out[MIGRATE]->Reserve(sz);
+		if (!p) break;
+		if (!agents[i]->PutState(p, sz)) abort();
+		link->out[MIGRATE]->Commit();
+	}
+	return i;
+}
+
+/*--- NextAgent(int *sz) -- an arriving agent for Contamination::SetStateInPlace */
+void *ContaminantShm::NextAgent(int *sz) {
+	if (!link) return 0;
+	return link->in[MIGRATE]->Peek(sz);
+}
+
+/*--- DoneAgent() -- */
+void ContaminantShm::DoneAgent() {
+	assert(link);
+	link->in[MIGRATE]->Release();
+}
+
+
+/*-- queries */
+
+/*--- reserve(int ring, int len) -- room for a record on one of ours, serving the other end until there is some */
+// Both ends may be asking at the same time, so we can't just sit here.
+void *ContaminantShm::reserve(int ring, int len) {
+	void *p;
+	int spins = 0;
+
+	if (!out[ring]->Fits(len)) fatal(1, "A %d byte record won't fit in a shared memory ring", len);
+	while (!(p = out[ring]->Reserve(len))) {
+		if (Serve()) spins = 0;
+		else back_off(&spins);
+	}
+	return p;
+}
+
+/*--- wait_reply(int s) -- wait for our reply, serving the other end while we do */
+// A query we make while answering one of the other end's is nested in
+// whatever we were waiting for then, whose reply may come first; that
+// is put aside, off the ring, until its own wait_reply() comes round.
+// Hand the reply back with done_reply().
+int *ContaminantShm::wait_reply(int s) {
+	int spins = 0, len;
+
+	for (;;) {
+		for (int i = 0; i < nstash; i++) {
+			if (stash[i][0] == s) {
+				assert(!held);
+				held = stash[i];
+				stash[i] = stash[--nstash];
+				return held;
+			}
+		}
+		int *r = (int *)in[REPLY]->Peek(&len);
+		if (r && r[0] == s) return r;
+		if (r) {
+			if (r[0] > s) fatal(1, "Shared memory reply %d doesn't match query %d", r[0], s);
+			if (nstash == maxstash) {
+				maxstash = maxstash?2*maxstash:4;
+				stash = (int **)Realloc(stash, maxstash*sizeof(int *));
+				if (!stash) abort();
+			}
+			if (!(stash[nstash] = (int *)Malloc(len))) abort();
+			memcpy(stash[nstash++], r, len);
+			in[REPLY]->Release();
+			spins = 0;
+		}
+		else if (Serve()) spins = 0;
+		else back_off(&spins);
+	}
+}
+
+/*--- done_reply(int *r) -- finished with what wait_reply() gave */
+void ContaminantShm::done_reply(int *r) {
+	if (r == held) {
+		Free(held);
+		held = 0;
+	}
+	else in[REPLY]->Release();
+}
+
+/*--- ask(int type, int xid, double t, R3 loc, int cid) -- send a query, and wait for the reply */
+// The reply is left on the ring, for the caller to Release().
+int *ContaminantShm::ask(int type, int xid, double t, R3 loc, int cid) {
+	Request *q = (Request *)reserve(QUERY, sizeof(Request));
+	memset(q, 0, sizeof(*q));
+	q->type = type;
+	q->seq = ++seq;
+	q->xid = xid;
+	q->cid = cid;
+	q->t = t;
+	q->loc = loc;
+	int s = q->seq;
+	out[QUERY]->Commit();
+	return wait_reply(s);
+}
+
+/*--- QueryCSValue(int xid, double t, R3 loc, int cid, double *d) -- ContaminantSource::GetCSValue */
+int ContaminantShm::QueryCSValue(int xid, double t, R3 loc, int cid, double *d) {
+	assert(d);
+	if (!Local(xid)) return 0;
+
+	int *r = link->ask(Q_CSVALUE, xid, t, loc, cid);
+	*d = *(double *)(r + 2);
+	link->done_reply(r);
+	return 1;
+}
+
+/*--- QueryProfile(int xid) -- ContaminantSink::GetProfile */
+// The caller gets a profile of its own, so the names come too, for any
+// contaminant nobody here has heard of.
+ContaminantProfile *ContaminantShm::QueryProfile(int xid) {
+	R3 nowhere = { 0, 0, 0 };
+	if (!Local(xid)) return 0;
+
+	int *r = link->ask(Q_PROFILE, xid, 0, nowhere, 0);
+	int n = r[1];
+	ContaminantProfile::Contaminant *c = (ContaminantProfile::Contaminant *)(r + 2);
+	char *name = (char *)(c + n);
+
+	ContaminantProfile *cp = new ContaminantProfile();
+	if (!cp) abort();
+	cp->Reserve(n);
+	for (int i = 0; i < n; i++) {
+		cp->AddContaminant(name, c[i].mass);
+		name += strlen(name)+1;
+	}
+	link->done_reply(r);
+	return cp;
+}
+
+/*--- QueryProfileView(int xid, ContaminantProfileView *pv) -- ContaminantSink::GetProfileView */
+// The entries are read straight off the ring into the view, which has
+// to outlive the record; the names are interned here, as QueryProfile's
+// are, so that one nobody here has heard of isn't left out.
+int ContaminantShm::QueryProfileView(int xid, ContaminantProfileView *pv) {
+	R3 nowhere = { 0, 0, 0 };
+	assert(pv);
+	if (!Local(xid)) return 0;
+
+	int *r = link->ask(Q_PROFILE, xid, 0, nowhere, 0);
+	int n = r[1];
+	pv->Release();
+	if (n) {
+		int sz = n*sizeof(ContaminantProfile::Contaminant);
+		void *v = pv->buf;
+		if (n > ContaminantProfileView::INPLACE && !(v = pv->own = Malloc(sz))) abort();
+		memcpy(v, r + 2, sz);
+		pv->c_list = (ContaminantProfile::Contaminant *)v;
+		pv->N = n;
+		char *name = (char *)(r + 2) + sz;
+		for (int i = 0; i < n; i++) {
+			pv->c_list[i].name = ContaminantNames::Intern(name);
+			name += strlen(name)+1;
+		}
+	}
+	link->done_reply(r);
+	return 1;
+}
+
+/*--- Serve() -- answer the other end's queries; returns the number answered */
+// A profile goes straight from the sink's own list into the reply: the
+// entries (whose name pointers mean nothing at the other end), then the
+// names.
+int ContaminantShm::Serve() {
+	Request *p, q;
+	int n = 0;
+
+	if (!link || !resolver) return 0;
+	while ((p = (Request *)link->in[QUERY]->Peek(0))) {
+		q = *p;
+		link->in[QUERY]->Release();
+
+		switch (q.type) {
+		case Q_CSVALUE: {
+			ContaminantSource *src = (ContaminantSource *)resolver(q.xid, CLASS_CONTSRC);
+			if (!src) fatal(1, "Shared memory query for agent %d which isn't here", q.xid);
+			double d = src->getCSValue(q.t, q.loc, q.cid);
+			int *r = (int *)link->reserve(REPLY, 2*sizeof(int) + sizeof(double));
+			r[0] = q.seq;
+			r[1] = 0;
+			*(double *)(r + 2) = d;
+			link->out[REPLY]->Commit();
+			break;
+		}
+		case Q_PROFILE: {
+			ContaminantSink *snk = (ContaminantSink *)resolver(q.xid, CLASS_CONTSINK);
+			if (!snk) fatal(1, "Shared memory query for agent %d which isn't here", q.xid);
+			ContaminantProfileView pv;
+			snk->viewProfile(&pv);
+			int i, sz = 2*sizeof(int) + pv.N*sizeof(ContaminantProfile::Contaminant);
+			for (i = 0; i < pv.N; i++) sz += strlen(pv.c_list[i].name)+1;
+
+			int *r = (int *)link->reserve(REPLY, sz);
+			r[0] = q.seq;
+			r[1] = pv.N;
+			memcpy(r + 2, pv.c_list, pv.N*sizeof(ContaminantProfile::Contaminant));
+			char *name = (char *)(r + 2) + pv.N*sizeof(ContaminantProfile::Contaminant);
+			for (i = 0; i < pv.N; i++) {
+				int l = strlen(pv.c_list[i].name)+1;
+				memcpy(name, pv.c_list[i].name, l);
+				name += l;
+			}
+			link->out[REPLY]->Commit();
+			break;
+		}
+		default:
+			fatal(1, "Unknown shared memory query %d", q.type);
+		}
+		n++;
+	}
+	return n;
+}
+
+/*-  The End  */
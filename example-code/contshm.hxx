@@ -0,0 +1,114 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contshm.hxx -- shared memory transport between kernels on the same host
+
+  Kernels which share a host don't need to push contaminated agents
+  (or the KGETs that sinks make of sources) through the message
+  layer.  A ContaminantRing is a single producer/single consumer ring
+  in a POSIX shared memory segment; records are written straight into
+  the ring and read where they sit.
+
+  A ContaminantShm is one end of a link between two kernels.  It has
+  three rings in each direction: migrating agents, queries and replies.
+  The queries and replies are used from one thread at a time, so a
+  kernel links before it starts any source query threads
+  (contquery.hxx), which then won't start.  Only compiled into the
+  kernel glue when CONTAMINANT_SHM is defined (as it is in bench/,
+  where contcheck's shm check links two kernels).
+*/
+
+#ifndef _CONTSHM_HXX_INCLUDED_
+#define _CONTSHM_HXX_INCLUDED_
+
+#include "r3.hxx"
+#include "cont.hxx"
+
+class Contamination;
+
+class ContaminantRing
+{
+public:
+	static ContaminantRing *Open(char *name, int size, int create);
+	~ContaminantRing();
+
+	void *Reserve(int len);   // producer: room for len bytes, 0 if the ring is full
+	int Fits(int len);        // whether there ever could be
+	void Commit();            // producer: publish the reserved record
+	void *Peek(int *len);     // consumer: the next record, in place; 0 if empty
+	void Release();           // consumer: finished with the record from Peek
+
+private:
+	ContaminantRing();
+
+	typedef struct {
+		int magic;
+		int size;               // bytes in the data area, a power of two
+		volatile unsigned head; // producer position
+		volatile unsigned tail; // consumer position
+	} Header;
+
+	char *name;
+	Header *h;
+	char *data;
+	int mapped;
+	unsigned pending;         // head after the reserved record
+	int owner;
+};
+
+typedef void *(*ContaminantShmResolver)(int xid, int cls); // agent in *this* kernel, as a cls, or 0
+typedef int (*ContaminantShmLocal)(int xid);              // agent lives in the kernel at the other end
+
+class ContaminantShm
+{
+public:
+	static ContaminantShm *Link(char *base, int side, int size);
+	static void Unlink();
+	static void SetResolver(ContaminantShmResolver r, ContaminantShmLocal l);
+	static int Linked();
+	static int Local(int xid);
+
+	// migration
+	static int SendAgents(Contamination **agents, int n);
+	static void *NextAgent(int *sz);
+	static void DoneAgent();
+
+	// queries which would otherwise be KGETs
+	static int QueryCSValue(int xid, double t, R3 loc, int cid, double *d);
+	static ContaminantProfile *QueryProfile(int xid);
+	static int QueryProfileView(int xid, ContaminantProfileView *pv);
+	static int Serve();
+
+private:
+	ContaminantShm();
+	~ContaminantShm();
+
+	enum { MIGRATE, QUERY, REPLY, NRING };
+
+	typedef struct {
+		int type;
+		int seq;
+		int xid;
+		int cid;
+		double t;
+		R3 loc;
+	} Request;
+
+	void *reserve(int ring, int len);
+	int *wait_reply(int seq);
+	void done_reply(int *r);
+	int *ask(int type, int xid, double t, R3 loc, int cid);
+
+	ContaminantRing *out[NRING], *in[NRING];
+	int seq;
+	int **stash, nstash, maxstash; // replies for outer wait_reply()s
+	int *held;                     // one of them, being read
+
+	static ContaminantShm *link;
+	static ContaminantShmResolver resolver;
+	static ContaminantShmLocal local;
+};
+
+#endif
+/*-  The End  */
@@ -2,8 +2,16 @@
 #include <string.h>
 #include "contsink.hxx"
 #include "contsrc.hxx"
+#include "paramcorpus.hxx"
+#include "paramhandle.hxx"
+#include "conttaxon.hxx"
+#ifdef CONTAMINANT_SHM
+#include "contshm.hxx"
+#endif
 #include "memchk.h"
 
+#define MAX_KINDS 4096  // sources a sink remembers; past that it starts again
+
 /* 
   2019-07-30-07:21:00 -- minor explanatory note
 
@@ -23,12 +31,21 @@ ContaminantSink::ContaminantSink() {
 	taxname = 0;
 	contaminants = 0;
 	profile = 0;
+	query = 0;
+	query_started = 0;
+	memset(&kinds, 0, sizeof(kinds));
+#if defined(CONT_PROFILE)
+	prof = -1;
+#endif
 }
 /*-- ~ContaminantSink() --  */
 ContaminantSink::~ContaminantSink() {
 	if (taxname) Free(taxname);
 	if (contaminants) delete contaminants;
 	if (profile) delete profile;
+	ContaminantQuery::Release(query);
+	start_kinds(0);
+	if (kinds.k) Free(kinds.k);
 }
 /*-- Reset() --  */
 void ContaminantSink::Reset() {
@@ -36,6 +53,12 @@ void ContaminantSink::Reset() {
 	contaminants = 0;
 	profile = 0;
 	taxname = 0;
+	query = 0;
+	query_started = 0;
+	memset(&kinds, 0, sizeof(kinds));
+#if defined(CONT_PROFILE)
+	prof = -1;
+#endif
 }
 /*-- Init(char *taxon) --  */
 int ContaminantSink::Init(char *taxon) {
@@ -43,6 +66,9 @@ int ContaminantSink::Init(char *taxon) {
 	taxname = 0;
 	if (!taxon) return 0;
 	taxname = Strdup(taxon);
+#if defined(CONT_PROFILE)
+	prof = -1;
+#endif
 
 //#warning also need to load up parameter based stuff here
 	if (contaminants) contaminants->ClearInterests();
@@ -51,9 +77,16 @@ int ContaminantSink::Init(char *taxon) {
 	if (profile) delete profile;
 	profile = 0;
 
-	if (PGetI(0, taxon, GetCName(CLASS_CONTSINK),	"contaminants", "disable", (char *)0)) return 1;
+	// every agent of the taxon asks the same questions
+	ContaminantTaxon *ct = ContaminantTaxon::Get(taxon);
+	if (!ct->sink_interests) {
+		ct->sink_disable = ParamHandle::Resolve(0, taxon, GetCName(CLASS_CONTSINK), "contaminants", "disable", (char *)0);
+		ct->sink_interests = ParamHandle::Resolve(0, taxon, GetCName(CLASS_CONTSINK), "contaminants", (char *)0);
+	}
+
+	if (ct->sink_disable->I()) return 1;
 
-	char **clist = PGetNodes(taxon, GetCName(CLASS_CONTSINK),"contaminants", (char *)0);
+	char **clist = ct->sink_interests->Nodes();
 	if (!clist) return 1; // nothing to do
 
 	profile = new ContaminantProfile();
@@ -64,7 +97,6 @@ int ContaminantSink::Init(char *taxon) {
 		contaminants->RegisterInterest(clist[i]);
 		profile->AddContaminant(clist[i], DNaN);
 	}
-	Free(clist);
 	assert(profile->N > 0);
 	return 1;
 }
@@ -115,6 +147,9 @@ void ContaminantSink::SetState(void *d, int sz) {
 	int n = unpack_mem(d, sz, &v, &l);
 	assert(n == 3);
 	if (v[0]) taxname = Strdup((char*)v[0]);
+#if defined(CONT_PROFILE)
+	prof = -1;
+#endif
 	if (v[1]) profile = new ContaminantProfile(v[1], l[1]);
 	if (v[2]) {
 		contaminants = new ContaminantList();
@@ -136,6 +171,15 @@ void *ContaminantSink::Get(int attribute, void *args, int args_size,	void *data,
 		assert(!args);
 		assert(!args_size);
 		return profile->GetState(size);
+	case ATTR_CONTSINK_PROFILEVIEW:
+		assert(!args);
+		assert(!args_size);
+		if (!profile || !profile->N) {
+			assert(size);
+			*size = 0;
+			return data;
+		}
+		return GetReturn(data, size, profile->c_list, profile->N*sizeof(ContaminantProfile::Contaminant));
 	}
 	abort();
 }
@@ -145,22 +189,156 @@ double ContaminantSink::Intoxicate(double t, double dt) {
 	// call LocalIntoxicate for each one
 
 	if (!contaminants) return dt;
+	R3 loc;
+	if (query_location(&loc)) {
+		StartIntoxicate(t);
+		return FinishIntoxicate(t, dt);
+	}
+
+	CPROF_START(t0);
 	int num;
 	int *ia = FindAgentsByClass(CLASS_CONTSRC, &num);
-	if (!ia) return dt;
+	if (!ia) {
+		CPROF_STOP(t0, prof_slot(), CPROF_INTOXICATE);
+		return dt;
+	}
 
+	ContaminantTaxon *ct = ContaminantTaxon::Get(taxname);
+	start_kinds(ct);
 	for (int i=0;i<num;i++) {
-		int nc = contaminants->NumInterest();
-		for (int j=0;j<nc;j++) {
-			char *c = contaminants->GetInterest(j);
-			if (ContaminantSource::GetCSNum(KID(ia[i]), c) >= 0)
-				dt = LocalIntoxicate(ia[i], t, dt, c);
+		ContaminantTaxon::Pair *p = source_kind(ct, ia[i]);
+		if (!p->any) continue;
+		for (int j=0;j<p->n;j++) {
+			if (p->cid[j] >= 0)
+				dt = LocalIntoxicate(ia[i], t, dt, p->name[j]);
 		}
 	}
 	Free(ia);
+	CPROF_STOP(t0, prof_slot(), CPROF_INTOXICATE);
+	return dt;
+}
+
+/*-- start_kinds(ContaminantTaxon *ct) -- at the start of a tick, what we remember of our sources */
+// The last tick's spare pairs go (their answers have been taken), and
+// with them everything if a source list has changed since, or ours has,
+// or our taxon has gone (ct 0: we're going).
+void ContaminantSink::start_kinds(ContaminantTaxon *ct) {
+	while (kinds.spare) {
+		ContaminantTaxon::Pair *p = kinds.spare;
+		kinds.spare = p->next;
+		ContaminantTaxon::FreePair(p);
+	}
+	if (!ct) return;
+	uint64_t isig = contaminants->InterestSignature();
+	unsigned long epoch = ContaminantList::SourceEpoch();
+	if (kinds.taxon == ct->serial && kinds.interests == isig && kinds.epoch == epoch) return;
+	if (kinds.n) memset(kinds.k, 0, kinds.size*sizeof(Kind));
+	kinds.n = 0;
+	kinds.taxon = ct->serial;
+	kinds.interests = isig;
+	kinds.epoch = epoch;
+}
+
+/*-- source_kind(ContaminantTaxon *ct, int agent) -- which of our interests it gives off */
+// Only the first time we meet a source (since start_kinds() last forgot)
+// do we ask it for its list and look in the taxon's table.
+ContaminantTaxon::Pair *ContaminantSink::source_kind(ContaminantTaxon *ct, int agent) {
+	unsigned h = 0;
+	if (kinds.size) {
+		for (h = ((unsigned)agent*2654435761u) & (kinds.size-1); kinds.k[h].pair; h = (h+1) & (kinds.size-1)) {
+			if (kinds.k[h].agent == agent) return kinds.k[h].pair;
+		}
+	}
+
+	int ni, ns;
+	char **iname;
+	int *iid = contaminants->InterestIds(&ni, &iname);
+	int *sid = ContaminantSource::GetIds(KID(agent), &ns);
+	uint64_t s = ContaminantList::Signature(ns, sid);
+	ContaminantTaxon::Pair *p = ct->FindPair(kinds.interests, ni, iid, s, ns, sid);
+	if (!p) p = ct->AddPair(kinds.interests, ni, iid, iname, s, ns, sid);
+	if (sid) Free(sid);
+	if (p->spare) {
+		p->next = kinds.spare;
+		kinds.spare = p;
+		return p;
+	}
+
+	if (2*(kinds.n+1) > kinds.size) {  // half full at most; the old slots go
+		int size = kinds.size?2*kinds.size:64;
+		if (size > MAX_KINDS) size = MAX_KINDS;
+		if (size != kinds.size) {
+			if (kinds.k) Free(kinds.k);
+			kinds.k = (Kind *)Calloc(size, sizeof(Kind));
+			if (!kinds.k) abort();
+			kinds.size = size;
+		}
+		else memset(kinds.k, 0, kinds.size*sizeof(Kind));
+		kinds.n = 0;
+	}
+	for (h = ((unsigned)agent*2654435761u) & (kinds.size-1); kinds.k[h].pair; h = (h+1) & (kinds.size-1)) ;
+	kinds.k[h].agent = agent;
+	kinds.k[h].pair = p;
+	kinds.n++;
+	return p;
+}
+
+/*-- StartIntoxicate(double t) -- issue this tick's source queries */
+void ContaminantSink::StartIntoxicate(double t) {
+	R3 loc;
+
+	if (!contaminants || !query_location(&loc)) return;
+	CPROF_START(t0);
+	if (!query) query = ContaminantQuery::New();
+	ContaminantQuery::Wait(query);  // a tick that was started and never finished
+	ContaminantQuery::Clear(query);
+	query_started = 1;
+
+	ContaminantTaxon *ct = ContaminantTaxon::Get(taxname);
+	start_kinds(ct);
+	int num;
+	int *ia = FindAgentsByClass(CLASS_CONTSRC, &num);
+	if (ia) {
+		for (int i = 0; i < num; i++) ContaminantQuery::Add(query, ia[i], source_kind(ct, ia[i]), t, loc);
+		Free(ia);
+	}
+	ContaminantQuery::Issue(query);
+	CPROF_STOP(t0, prof_slot(), CPROF_INTOXICATE);
+}
+
+/*-- FinishIntoxicate(double t, double dt) -- the answers to LocalIntoxicate, in the order Intoxicate would have asked */
+double ContaminantSink::FinishIntoxicate(double t, double dt) {
+	if (!query_started) return Intoxicate(t, dt);
+	CPROF_START(t0);
+	query_started = 0;
+	ContaminantQuery::Wait(query);
+	for (int i = 0; i < query->n; i++) {
+		ContaminantQuery::Req *r = query->req + i;
+		ContaminantTaxon::Pair *p = r->pair;
+		if (!p->any) continue;
+		for (int j = 0; j < p->n; j++) {
+			if (p->cid[j] >= 0) dt = LocalIntoxicate(r->agent, t, dt, p->name[j], p->cid[j], r->value[j]);
+		}
+	}
+	CPROF_STOP(t0, prof_slot(), CPROF_INTOXICATE);
 	return dt;
 }
 
+/*-- IntoxicateMany(ContaminantSink **s, int n, double t, double dt, double *dts) -- every sink's queries in flight at once */
+// dts[i] is what s[i]->Intoxicate(t, dt) would have returned.
+void ContaminantSink::IntoxicateMany(ContaminantSink **s, int n, double t, double dt, double *dts) {
+	int i;
+
+	assert(s && dts);
+	for (i = 0; i < n; i++) s[i]->StartIntoxicate(t);
+	for (i = 0; i < n; i++) dts[i] = s[i]->FinishIntoxicate(t, dt);
+}
+
+/*-- LocalIntoxicate(int agent, double t, double dt, char *contaminant, int cidx, double value) -- */
+double ContaminantSink::LocalIntoxicate(int agent, double t, double dt, char *contaminant, int cidx, double value) {
+	return LocalIntoxicate(agent, t, dt, contaminant);
+}
+
 int ContaminantSink::SetProfile(ContaminantProfile *p) {
 	assert(p);
 	if (profile) delete profile;
@@ -173,6 +351,10 @@ ContaminantProfile *ContaminantSink::GetProfile(KID2(xid)) {
 #ifdef PRODUCTION_KERNEL
 	return PKDACCESS(ContaminantSink,xid)getProfile();
 #else
+#ifdef CONTAMINANT_SHM
+	ContaminantProfile *sp = ContaminantShm::QueryProfile(xid);
+	if (sp) return sp;
+#endif
 	int sz = 0;
 	void *v = KGET(xid, ATTR_CONTSINK_PROFILE, 0, 0, 0, &sz);
 	if (!v) abort();
@@ -182,8 +364,54 @@ ContaminantProfile *ContaminantSink::GetProfile(KID2(xid)) {
 #endif
 }
 
+// Predators look at their prey's profile on every ingestion, so this
+// avoids building (and freeing) a copy when all they want is the numbers.
+int ContaminantSink::GetProfileView(KID2(xid), ContaminantProfileView *pv) {
+	assert(pv);
+	pv->Release();
+#ifdef PRODUCTION_KERNEL
+	PKDACCESS(ContaminantSink,xid)viewProfile(pv);
+#else
+#ifdef CONTAMINANT_SHM
+	if (ContaminantShm::QueryProfileView(xid, pv)) return 1;
+#endif
+	// KGET fills our buffer if the profile fits, otherwise we get a fresh block
+	int sz = sizeof(pv->buf);
+	void *v = KGET(xid, ATTR_CONTSINK_PROFILEVIEW, 0, 0, pv->buf, &sz);
+	if (!sz) return 1;
+	if (!v) abort();
+	if (v != pv->buf) pv->own = v;
+	assert(sz % sizeof(ContaminantProfile::Contaminant) == 0);
+	pv->c_list = (ContaminantProfile::Contaminant *)v;
+	pv->N = sz / sizeof(ContaminantProfile::Contaminant);
+
+	// the name pointers belong to the other agent, so ours go in; if the
+	// prey carries something nobody here has heard of, its whole profile
+	// (which has the names) is fetched once to register them
+	int unknown = 0;
+	for (int i = 0; i < pv->N; i++) {
+		pv->c_list[i].name = ContaminantNames::Name(pv->c_list[i].id);
+		if (!pv->c_list[i].name) unknown = 1;
+	}
+	if (unknown) {
+		delete GetProfile(KID(xid));
+		for (int i = 0; i < pv->N; i++) {
+			pv->c_list[i].name = ContaminantNames::Name(pv->c_list[i].id);
+			if (!pv->c_list[i].name) fatal(1, "Agent %d's profile has contaminant %d, which it can't name", xid, pv->c_list[i].id);
+		}
+	}
+#endif
+	return 1;
+}
+
 ContaminantProfile *ContaminantSink::getProfile()
 {
 	return new ContaminantProfile(profile);
 }
 
+void ContaminantSink::viewProfile(ContaminantProfileView *pv)
+{
+	assert(pv);
+	pv->Borrow(profile);
+}
+
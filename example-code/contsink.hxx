@@ -4,6 +4,8 @@
 #include "prmagent.hxx"
 #include "searchagent.hxx"
 #include "cont.hxx"
+#include "contprof.hxx"
+#include "contquery.hxx"
 
 class ContaminantSink : virtual public PrmAgent, virtual public SearchAgent
 {
@@ -20,23 +22,59 @@ public:
 	virtual void SetState(void*, int);
 
 	virtual double Intoxicate(double t, double dt);
+	// Intoxicate in two halves: ask every source at once, then take the
+	// answers (see contquery.hxx); the agent mustn't move in between
+	void StartIntoxicate(double t);
+	double FinishIntoxicate(double t, double dt);
+	static void IntoxicateMany(ContaminantSink **sinks, int n, double t, double dt, double *dts);
 	virtual int CommitIntoxicate(double t, double dt, double dt2)=0;
 	
 	virtual int SetProfile(ContaminantProfile*);
 	static ContaminantProfile *GetProfile(KID2(xid));
+	static int GetProfileView(KID2(xid), ContaminantProfileView *pv);
 protected:
 	virtual double LocalIntoxicate(int agent, double t, double dt, char *contaminant)=0;
+	// with the source's answers already in hand; by default asks again
+	virtual double LocalIntoxicate(int agent, double t, double dt, char *contaminant, int cidx, double value);
+	// where the sources are to be asked about; 0 if we can't say
+	virtual int query_location(R3 *loc) { return 0; }
 
 	ContaminantList *contaminants;
 	ContaminantProfile *profile;
+	ContaminantQuery::Batch *query;   // this tick's, between StartIntoxicate and FinishIntoxicate
+	int query_started;
+#if defined(CONT_PROFILE)
+	int prof;      // the taxon's profile slot, -1 until it's looked up
+	int prof_slot() { if (prof < 0) prof = ContaminantProf::Slot(taxname, 0); return prof; }
+#endif
 
 private:
 	int *get_contaminant_agent_list(int *num);
+	void start_kinds(ContaminantTaxon *ct);
+	ContaminantTaxon::Pair *source_kind(ContaminantTaxon *ct, int agent);
 	char *taxname;
+	// which Pair each source we've met is, for our taxon (its serial) and
+	// interests while ContaminantList::SourceEpoch() stays put; open
+	// addressed on the agent, an empty slot has no pair
+	typedef struct {
+		int agent;
+		ContaminantTaxon::Pair *pair;
+	} Kind;
+	struct {
+		Kind *k;
+		int size, n;
+		int taxon;
+		uint64_t interests;
+		unsigned long epoch;
+		ContaminantTaxon::Pair *spare;  // ones the taxon had no room for; ours until the next tick
+	} kinds;
 Attribute:
 	virtual ContaminantProfile *getProfile();
+	virtual void viewProfile(ContaminantProfileView *pv);
 };
 
 #define ATTR_CONTSINK_PROFILE		(CLASS_CONTSINK|0x0001)
+// The raw c_list; the names are only meaningful as ids at the other end
+#define ATTR_CONTSINK_PROFILEVIEW	(CLASS_CONTSINK|0x0002)
 
 #endif
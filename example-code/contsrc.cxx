@@ -1,6 +1,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include "contsrc.hxx"
+#include "paramhandle.hxx"
+#include "conttaxon.hxx"
+#ifdef CONTAMINANT_SHM
+#include "contshm.hxx"
+#endif
+#ifdef CONTAMINANT_HALO
+#include "conthalo.hxx"
+#endif
 #include "memchk.h"
 
 /* 
@@ -43,14 +51,17 @@ int ContaminantSource::Init(char *taxon)
 	if (contaminants) contaminants->ClearSources();
 	else contaminants = new ContaminantList();
 
-	char **clist = PGetNodes(taxon, GetCName(CLASS_CONTSRC), "contaminants", (char *)0);
+	ContaminantTaxon *ct = ContaminantTaxon::Get(taxon);
+	if (!ct->source_list)
+		ct->source_list = ParamHandle::Resolve(0, taxon, GetCName(CLASS_CONTSRC), "contaminants", (char *)0);
+
+	char **clist = ct->source_list->Nodes();
 	if (!clist) return 1; // nothing to do
 	for (int i=0;clist[i];i++) {
 		VERBOSE("ContaminantSource", "Init %s", clist[i]);
 		contaminants->RegisterAsContaminantSource(clist[i]);
 		
 	}
-	Free(clist);
 	return 1;
 }
 
@@ -91,6 +102,10 @@ void *ContaminantSource::Get(int attribute, void *args, int args_size,
 		int i = getCSNum((char*)args);
 		return GetReturn(data, size, &i, sizeof(i));
 	}
+	case ATTR_CONTSRC_IDS: {
+		int n, *id = getIds(&n);
+		return GetReturn(data, size, id, n*sizeof(int));
+	}
 	case ATTR_CONTSRC_CSID:
 		abort();	// how did we get here?
 
@@ -109,6 +124,10 @@ int ContaminantSource::GetCSNum(KID2(xid), char *contaminant)
 #ifdef PRODUCTION_KERNEL
 	return PKDACCESS(ContaminantSource,xid)getCSNum(contaminant);
 #else
+#ifdef CONTAMINANT_HALO
+	ContaminantSource *r;
+	if (ContaminantHalo::Lookup(xid, &r)) return r?r->getCSNum(contaminant):-1;
+#endif
 	int i, sz = sizeof(int);
 	if (!KGET(xid, ATTR_CONTSRC_CSNUM, 
 			(void*)contaminant, strlen(contaminant)+1, &i, &sz)) abort();
@@ -122,6 +141,15 @@ double ContaminantSource::GetCSValue(KID2(xid), double t, R3 loc, int cid)
 	return PKDACCESS(ContaminantSource,xid)getCSValue(t, loc, cid);
 #else
 	double d;
+#ifdef CONTAMINANT_HALO
+	// a source in another region answers from its halo copy, if it reaches us at all
+	ContaminantSource *r;
+	if (ContaminantHalo::Lookup(xid, &r)) return r?r->getCSValue(t, loc, cid):0;
+#endif
+#ifdef CONTAMINANT_SHM
+	// a kernel on this host can answer through shared memory
+	if (ContaminantShm::QueryCSValue(xid, t, loc, cid, &d)) return d;
+#endif
 	// pack up arguments and send through to agent
 	void *v[3], *data;
 	int l[3], sz, dsz;
@@ -136,6 +164,44 @@ double ContaminantSource::GetCSValue(KID2(xid), double t, R3 loc, int cid)
 #endif
 }
 
+int *ContaminantSource::GetIds(KID2(xid), int *n)
+{
+	assert(n);
+#ifdef PRODUCTION_KERNEL
+	int *id = PKDACCESS(ContaminantSource,xid)getIds(n);
+	int *r = (int *)Malloc((*n?*n:1)*sizeof(int));
+	if (!r) abort();
+	memcpy(r, id, *n*sizeof(int));
+	return r;
+#else
+#ifdef CONTAMINANT_HALO
+	ContaminantSource *c;
+	if (ContaminantHalo::Lookup(xid, &c)) {
+		int *id = c?c->getIds(n):0;
+		if (!c) *n = 0;
+		int *r = (int *)Malloc((*n?*n:1)*sizeof(int));
+		if (!r) abort();
+		if (*n) memcpy(r, id, *n*sizeof(int));
+		return r;
+	}
+#endif
+	int sz = 0;
+	int *r = (int *)KGET(xid, ATTR_CONTSRC_IDS, 0, 0, 0, &sz);
+	*n = sz/sizeof(int);
+	return r;
+#endif
+}
+
+int *ContaminantSource::getIds(int *n)
+{
+	assert(n);
+	if (!contaminants) {
+		*n = 0;
+		return 0;
+	}
+	return contaminants->SourceIds(n, 0);
+}
+
 int ContaminantSource::getCSNum(char* contaminant)
 {
 	assert(contaminants);
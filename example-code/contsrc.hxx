@@ -24,9 +24,19 @@ public:
 	static int IsSource(KID2(xid), char *contaminant);
 	static int GetCSNum(KID2(xid), char *contaminant);
 	static double GetCSValue(KID2(xid), double, R3, int);
+	// what the source gives off, in cid order (see ContaminantList::SourceIds)
+	static int *GetIds(KID2(xid), int *n);  // Free() it
+	char *TaxonName() { return taxname; }
 Attribute:
 	virtual double getCSValue(double t, R3 location, int cid)=0;
 	virtual int getCSNum(char* contaminant);
+	virtual int *getIds(int *n);             // ours, don't free it
+	// for halo copies in other regions' kernels (conthalo.hxx): where
+	// we give off anything worth having, and what a copy needs to know;
+	// by default we can't say, and can't be copied
+	virtual int getFootprint(R3 *centre, double *radius) { return 0; }
+	virtual void *getReplica(int *sz) { return 0; }  // Free() it
+	virtual int setReplica(void *d, int sz) { return 0; }
 private:
 	char *taxname;
 	ContaminantList *contaminants;
@@ -38,6 +48,8 @@ private:
 #define ATTR_CONTSRC_CSID		(CLASS_CONTSRC|0x0002) // int
 // Contaminant value at location
 #define ATTR_CONTSRC_CSVALUE	(CLASS_CONTSRC|0x0003) // double
+// The source list as contaminant ids
+#define ATTR_CONTSRC_IDS		(CLASS_CONTSRC|0x0005) // int[]
 
 #endif
 
@@ -0,0 +1,644 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contstream.cxx -- per-tick contaminant state to a columnar file
+
+  See contstream.hxx for the file layout.  The simulation threads
+  fill batches of rows and queue them; one writer thread turns each
+  batch (or, when aggregating, each finished time bin) into a ROWS
+  block in a large output buffer which goes to the file with a single
+  write() when it fills.  If the writer falls behind by more than
+  MAXQUEUE batches, the simulation waits for it rather than letting
+  the queue eat the machine.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "prmagent.hxx"
+#include "contstream.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+volatile int ContaminantStream::state = ContaminantStream::UNTRIED;
+int ContaminantStream::columns = ContaminantStream::IMPAIRMENTS;
+
+#define BATCH 4096                  // rows
+#define MAXQUEUE 64                 // batches
+#define OUTBUF (4 << 20)            // bytes
+#define ROW_BYTES (8 + 6*4 + 5*8)   // in a ROWS block
+#define ROUND8(x) (((x) + 7) & ~7)
+
+typedef struct Producer {
+	struct Batch *cur;
+	int64_t bin;                    // the writer's: the latest it has had, when aggregating
+	struct Producer *next;
+} Producer;
+
+typedef struct Batch {
+	ContaminantStream::Row row[BATCH];
+	int n;
+	Producer *from;
+	struct Batch *next;
+} Batch;
+
+// what goes into a ROWS block
+typedef struct {
+	double t;
+	uint32_t taxon, who;
+	int32_t cx, cy;
+	uint32_t contaminant, n;
+	double v[5];   // load, survival, reproduction, foraging, movement
+} Out;
+
+typedef struct {
+	int used;
+	int64_t bin;
+	uint32_t taxon, contaminant;
+	int32_t cx, cy;
+	uint32_t n;
+	double v[5];
+} Agg;
+
+typedef struct {
+	double tmin, tmax;
+	uint64_t offset, nrows;
+} Index;
+
+static pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t qroom = PTHREAD_COND_INITIALIZER;
+static Batch *qhead = 0, *qtail = 0, *freebatch = 0;
+static int queued = 0, stopping = 0;
+static Producer *producers = 0;
+static __thread Producer *me = 0;
+static pthread_t writer;
+static volatile int env_lock = 0;
+
+// the dictionary
+static char **names = 0;
+static int nnames = 0, maxnames = 0;
+static int *dhash = 0, dsize = 0;
+static volatile int dict_lock = 0;
+
+// the writer's
+static char *path = 0;
+static int fd = -1;
+static char *obuf = 0;
+static int olen = 0, omax = 0;
+static uint64_t offset = 0;         // of obuf[0] in the file
+static int dict_written = 0;
+static double cell = 0, bin = 3600;
+static Index *tindex = 0;
+static int nindex = 0, maxindex = 0;
+static Out *out = 0;
+static int maxout = 0;
+static Agg *agg = 0;
+static int nagg = 0, aggsize = 0;
+static int64_t written = INT64_MIN; // the bins before this are in the file
+static long late = 0;               // rows for them since
+
+/*-  Code  */
+
+/*-- the dictionary */
+
+/*--- dict_hash(const char *s) -- */
+static unsigned dict_hash(const char *s) {
+	unsigned h = 2166136261u;
+	for (const unsigned char *p = (const unsigned char *)s; *p; p++) {
+		h ^= *p;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*--- Id(const char *name) -- */
+uint32_t ContaminantStream::Id(const char *name) {
+	if (!name) return 0;
+
+	unsigned h = dict_hash(name);
+	while (__sync_lock_test_and_set(&dict_lock, 1)) ;
+	if (2*(nnames+1) > dsize) { // rehash, keeping it at most half full
+		Free(dhash);
+		dsize = dsize?2*dsize:256;
+		dhash = (int *)Calloc(dsize, sizeof(int));
+		if (!dhash) abort();
+		for (int i = 0; i < nnames; i++) {
+			unsigned j = dict_hash(names[i]) & (dsize-1);
+			while (dhash[j]) j = (j+1) & (dsize-1);
+			dhash[j] = i+1;
+		}
+	}
+	unsigned j = h & (dsize-1);
+	while (dhash[j] && strcmp(names[dhash[j]-1], name)) j = (j+1) & (dsize-1);
+	if (!dhash[j]) {
+		if (nnames >= maxnames) {
+			maxnames = maxnames?2*maxnames:256;
+			names = (char **)Realloc(names, maxnames*sizeof(char *));
+			if (!names) abort();
+		}
+		names[nnames] = Strdup(name);
+		if (!names[nnames]) abort();
+		dhash[j] = ++nnames;
+	}
+	uint32_t id = dhash[j];
+	__sync_lock_release(&dict_lock);
+	return id;
+}
+
+/*--- Name(uint32_t id) -- */
+const char *ContaminantStream::Name(uint32_t id) {
+	const char *s = 0;
+	while (__sync_lock_test_and_set(&dict_lock, 1)) ;
+	if (id > 0 && (int)id <= nnames) s = names[id-1];
+	__sync_lock_release(&dict_lock);
+	return s;
+}
+
+
+/*-- the writer's output buffer */
+
+/*--- flush_out() -- one big write */
+static void flush_out() {
+	char *p = obuf;
+	int left = olen;
+
+	while (left > 0) {
+		ssize_t w = write(fd, p, left);
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) {
+			warning("Error writing the contaminant stream %s; the rest is lost", path);
+			close(fd);
+			fd = -1;
+			break;
+		}
+		p += w;
+		left -= w;
+	}
+	offset += olen;
+	olen = 0;
+}
+
+/*--- reserve(int n) -- room for n more bytes */
+static char *reserve(int n) {
+	if (olen + n > omax && olen > 0) {
+		if (fd >= 0) flush_out();
+		else { // lost already
+			offset += olen;
+			olen = 0;
+		}
+	}
+	if (n > omax) {
+		omax = n;
+		obuf = (char *)Realloc(obuf, omax);
+		if (!obuf) abort();
+	}
+	char *p = obuf + olen;
+	memset(p, 0, n);
+	olen += n;
+	return p;
+}
+
+/*--- block(uint32_t tag, int len) -- a block header, and where its body goes */
+static char *block(uint32_t tag, int len) {
+	assert(len%8 == 0);
+	char *p = reserve(8 + len);
+	memcpy(p, &tag, 4);
+	uint32_t l = len;
+	memcpy(p+4, &l, 4);
+	return p + 8;
+}
+
+/*--- write_dict() -- the names added since the last time */
+static void write_dict() {
+	while (__sync_lock_test_and_set(&dict_lock, 1)) ;
+	int first = dict_written, n = nnames - dict_written;
+	char **list = n?names + first:0;
+	int len = 8;
+	for (int i = 0; i < n; i++) len += strlen(list[i]) + 1;
+	// the strings don't move, but the array might once we let go
+	char **copy = 0;
+	if (n) {
+		copy = (char **)Malloc(n*sizeof(char *));
+		if (!copy) abort();
+		memcpy(copy, list, n*sizeof(char *));
+	}
+	__sync_lock_release(&dict_lock);
+	if (!n) return;
+
+	char *p = block(CSTREAM_DICT, ROUND8(len));
+	uint32_t u = first + 1;
+	memcpy(p, &u, 4);
+	u = n;
+	memcpy(p+4, &u, 4);
+	p += 8;
+	for (int i = 0; i < n; i++) {
+		int l = strlen(copy[i]) + 1;
+		memcpy(p, copy[i], l);
+		p += l;
+	}
+	Free(copy);
+	dict_written = first + n;
+}
+
+/*--- write_rows(Out *o, int n) -- a ROWS block, column by column */
+static void write_rows(Out *o, int n) {
+	int i, k;
+
+	if (!n) return;
+	write_dict();
+
+	double tmin = o[0].t, tmax = o[0].t;
+	for (i = 1; i < n; i++) {
+		if (o[i].t < tmin) tmin = o[i].t;
+		if (o[i].t > tmax) tmax = o[i].t;
+	}
+
+	if (nindex >= maxindex) {
+		maxindex = maxindex?2*maxindex:256;
+		tindex = (Index *)Realloc(tindex, maxindex*sizeof(Index));
+		if (!tindex) abort();
+	}
+
+	char *p = block(CSTREAM_ROWS, 24 + n*ROW_BYTES);
+	tindex[nindex].tmin = tmin;
+	tindex[nindex].tmax = tmax;
+	tindex[nindex].offset = offset + (p - obuf) - 8;
+	tindex[nindex].nrows = n;
+	nindex++;
+
+	uint32_t u = n;
+	memcpy(p, &u, 4);
+	memcpy(p+8, &tmin, 8);
+	memcpy(p+16, &tmax, 8);
+	p += 24;
+
+#define COLUMN(field, size) for (i = 0; i < n; i++, p += size) memcpy(p, &o[i].field, size)
+	COLUMN(t, 8);
+	COLUMN(taxon, 4);
+	COLUMN(who, 4);
+	COLUMN(cx, 4);
+	COLUMN(cy, 4);
+	COLUMN(contaminant, 4);
+	COLUMN(n, 4);
+	for (k = 0; k < 5; k++) COLUMN(v[k], 8);
+#undef COLUMN
+}
+
+/*--- out_room(int n) -- */
+static void out_room(int n) {
+	if (n <= maxout) return;
+	maxout = n;
+	out = (Out *)Realloc(out, maxout*sizeof(Out));
+	if (!out) abort();
+}
+
+
+/*-- aggregation by cell */
+
+/*--- agg_slot(Agg *key) -- find or make */
+static Agg *agg_slot(Agg *key) {
+	if (2*(nagg+1) > aggsize) {
+		Agg *old = agg;
+		int osize = aggsize;
+		aggsize = aggsize?2*aggsize:4096;
+		agg = (Agg *)Calloc(aggsize, sizeof(Agg));
+		if (!agg) abort();
+		nagg = 0;
+		for (int i = 0; i < osize; i++) {
+			if (old[i].used) *agg_slot(&old[i]) = old[i];
+		}
+		if (old) Free(old);
+	}
+
+	unsigned h = (unsigned)key->bin*2654435761u ^ key->taxon*40503u ^ key->contaminant*9973u
+		^ (unsigned)key->cx*73856093u ^ (unsigned)key->cy*19349663u;
+	unsigned j = h & (aggsize-1);
+	for (;;) {
+		Agg *a = &agg[j];
+		if (!a->used) {
+			memset(a, 0, sizeof(*a));
+			a->used = 1;
+			a->bin = key->bin;
+			a->taxon = key->taxon;
+			a->contaminant = key->contaminant;
+			a->cx = key->cx;
+			a->cy = key->cy;
+			nagg++;
+			return a;
+		}
+		if (a->bin == key->bin && a->taxon == key->taxon && a->contaminant == key->contaminant &&
+			 a->cx == key->cx && a->cy == key->cy) return a;
+		j = (j+1) & (aggsize-1);
+	}
+}
+
+/*--- agg_flush(int64_t upto) -- write out the bins before upto, and forget them */
+static void agg_flush(int64_t upto) {
+	int i, n = 0;
+
+	if (upto <= written) return;
+	written = upto;
+
+	out_room(nagg);
+	for (i = 0; i < aggsize; i++) {
+		Agg *a = &agg[i];
+		if (!a->used || a->bin >= upto) continue;
+		Out *o = &out[n++];
+		o->t = a->bin*bin;
+		o->taxon = a->taxon;
+		o->who = 0;
+		o->cx = a->cx;
+		o->cy = a->cy;
+		o->contaminant = a->contaminant;
+		o->n = a->n;
+		memcpy(o->v, a->v, sizeof(o->v));
+	}
+	if (!n) return;
+	write_rows(out, n);
+
+	// rebuild without them
+	Agg *old = agg;
+	int osize = aggsize;
+	agg = 0;
+	aggsize = nagg = 0;
+	for (i = 0; i < osize; i++) {
+		if (old[i].used && old[i].bin >= upto) *agg_slot(&old[i]) = old[i];
+	}
+	Free(old);
+}
+
+/*--- aggregate(Batch *b) -- */
+static void aggregate(Batch *b) {
+	Agg key;
+
+	for (int i = 0; i < b->n; i++) {
+		ContaminantStream::Row *r = &b->row[i];
+		key.bin = (int64_t)floor(r->t/bin);
+		if (key.bin < written) {
+			late++;
+			continue;
+		}
+		key.taxon = r->taxon;
+		key.contaminant = r->contaminant;
+		key.cx = (int32_t)floor(r->x/cell);
+		key.cy = (int32_t)floor(r->y/cell);
+		Agg *a = agg_slot(&key);
+		a->n++;
+		a->v[0] += r->load;
+		a->v[1] += r->survival;
+		a->v[2] += r->reproduction;
+		a->v[3] += r->foraging;
+		a->v[4] += r->movement;
+		if (key.bin > b->from->bin) b->from->bin = key.bin;
+	}
+
+	// a thread's rows from now on are from the latest bin we've had from
+	// it or the one before, so the bins before that, for the thread
+	// furthest behind, are finished; and nothing is until every thread
+	// has sent a batch
+	int64_t upto = INT64_MAX;
+	pthread_mutex_lock(&qlock);
+	for (Producer *p = producers; p; p = p->next) {
+		if (p->bin < upto) upto = p->bin;
+	}
+	pthread_mutex_unlock(&qlock);
+	if (upto != INT64_MAX && upto != INT64_MIN) agg_flush(upto - 1);
+}
+
+/*--- per_agent(Batch *b) -- */
+static void per_agent(Batch *b) {
+	out_room(b->n);
+	for (int i = 0; i < b->n; i++) {
+		ContaminantStream::Row *r = &b->row[i];
+		Out *o = &out[i];
+		o->t = r->t;
+		o->taxon = r->taxon;
+		o->who = r->who;
+		o->cx = o->cy = 0;
+		o->contaminant = r->contaminant;
+		o->n = 1;
+		o->v[0] = r->load;
+		o->v[1] = r->survival;
+		o->v[2] = r->reproduction;
+		o->v[3] = r->foraging;
+		o->v[4] = r->movement;
+	}
+	write_rows(out, b->n);
+}
+
+/*--- finish() -- what's left, the index and the end marker */
+static void finish() {
+	if (cell > 0) agg_flush(INT64_MAX);
+	if (late) warning("%ld rows of the contaminant stream %s came after their bin had been written, and were left out", late, path);
+
+	// all of the names again, for readers going by the index
+	uint64_t dict = offset + olen;
+	dict_written = 0;
+	write_dict();
+
+	uint64_t at = offset + olen;
+	char *p = block(CSTREAM_TIDX, 16 + nindex*sizeof(Index));
+	uint32_t u = nindex;
+	memcpy(p, &u, 4);
+	memcpy(p+8, &dict, 8);
+	if (nindex) memcpy(p+16, tindex, nindex*sizeof(Index));
+	p = block(CSTREAM_TEND, 8);
+	memcpy(p, &at, 8);
+
+	if (fd >= 0) {
+		flush_out();
+		if (fd >= 0 && close(fd)) warning("Error closing the contaminant stream %s", path);
+	}
+	fd = -1;
+}
+
+/*--- writer_main(void *) -- the writer thread */
+static void *writer_main(void *) {
+	for (;;) {
+		pthread_mutex_lock(&qlock);
+		while (!qhead && !stopping) pthread_cond_wait(&qwork, &qlock);
+		Batch *b = qhead;
+		if (b) {
+			qhead = b->next;
+			if (!qhead) qtail = 0;
+			queued--;
+			pthread_cond_signal(&qroom);
+		}
+		pthread_mutex_unlock(&qlock);
+		if (!b) break; // stopping, and nothing left
+
+		if (cell > 0) aggregate(b);
+		else per_agent(b);
+
+		pthread_mutex_lock(&qlock);
+		b->n = 0;
+		b->next = freebatch;
+		freebatch = b;
+		pthread_mutex_unlock(&qlock);
+	}
+	finish();
+	return 0;
+}
+
+
+/*-- opening and closing */
+
+/*--- Open(const char *file, double cellsize, double binsize, int cols) -- */
+int ContaminantStream::Open(const char *file, double cellsize, double binsize, int cols) {
+	assert(file);
+	if (state == OPEN) return 0;
+
+	fd = open(file, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) {
+		warning("Unable to write the contaminant stream %s", file);
+		return 0;
+	}
+	if (path) Free(path);
+	path = Strdup(file);
+	if (!path) abort();
+
+	cell = (cellsize > 0)?cellsize:0;
+	bin = (binsize > 0)?binsize:3600;
+	omax = OUTBUF;
+	obuf = (char *)Realloc(obuf, omax);
+	if (!obuf) abort();
+	olen = 0;
+	offset = 0;
+	dict_written = 0;
+	nindex = 0;
+	written = INT64_MIN;
+	late = 0;
+	columns = cols & IMPAIRMENTS;
+	stopping = 0;
+	for (Producer *p = producers; p; p = p->next) p->bin = INT64_MIN;
+
+	char *p = reserve(32);
+	uint32_t u;
+	memcpy(p, CSTREAM_MAGIC, 8);
+	u = CSTREAM_VERSION;
+	memcpy(p+8, &u, 4);
+	u = (cell > 0);
+	memcpy(p+12, &u, 4);
+	memcpy(p+16, &cell, 8);
+	memcpy(p+24, &bin, 8);
+
+	if (pthread_create(&writer, 0, writer_main, 0)) {
+		warning("Unable to start the contaminant stream writer");
+		close(fd);
+		fd = -1;
+		return 0;
+	}
+	VERBOSE("ContaminantStream", "Writing %s, %s", file, (cell > 0)?"by cell":"by agent");
+	state = OPEN;
+	return 1;
+}
+
+/*--- open_from_env() -- $CONT_STREAM, $CONT_STREAM_CELL, $CONT_STREAM_BIN and $CONT_STREAM_COLUMNS */
+void ContaminantStream::open_from_env() {
+	static const char *column[] = { "reproduction", "foraging", "movement", 0 };
+
+	while (__sync_lock_test_and_set(&env_lock, 1)) ;
+	if (state == UNTRIED) {
+		char *file = getenv("CONT_STREAM");
+		char *c = getenv("CONT_STREAM_CELL");
+		char *b = getenv("CONT_STREAM_BIN");
+		char *w = getenv("CONT_STREAM_COLUMNS");
+		int cols = IMPAIRMENTS;
+		if (w) {
+			cols = 0;
+			for (int k = 0; column[k]; k++) {
+				if (strstr(w, column[k])) cols |= 1 << k;
+			}
+		}
+		if (!file || !*file || !Open(file, c?atof(c):0, b?atof(b):0, cols)) state = CLOSED;
+	}
+	__sync_lock_release(&env_lock);
+}
+
+/*--- Close() -- */
+void ContaminantStream::Close() {
+	if (state != OPEN) return;
+	state = CLOSED;
+
+	pthread_mutex_lock(&qlock);
+	for (Producer *p = producers; p; p = p->next) {
+		Batch *b = p->cur;
+		p->cur = 0;
+		if (!b || !b->n) {
+			if (b) {
+				b->next = freebatch;
+				freebatch = b;
+			}
+			continue;
+		}
+		b->next = 0;
+		if (qtail) qtail->next = b;
+		else qhead = b;
+		qtail = b;
+		queued++;
+	}
+	stopping = 1;
+	pthread_cond_signal(&qwork);
+	pthread_mutex_unlock(&qlock);
+
+	pthread_join(writer, 0);
+}
+
+
+/*-- the simulation's side */
+
+/*--- Add(Row *r) -- */
+void ContaminantStream::Add(Row *r) {
+	if (state != OPEN) return;
+
+	if (!me) {
+		me = (Producer *)Calloc(1, sizeof(Producer));
+		if (!me) abort();
+		me->bin = INT64_MIN;
+		pthread_mutex_lock(&qlock);
+		me->next = producers;
+		producers = me;
+		pthread_mutex_unlock(&qlock);
+	}
+
+	Batch *b = me->cur;
+	if (!b) {
+		pthread_mutex_lock(&qlock);
+		b = freebatch;
+		if (b) freebatch = b->next;
+		pthread_mutex_unlock(&qlock);
+		if (!b) {
+			b = (Batch *)Malloc(sizeof(Batch));
+			if (!b) abort();
+		}
+		b->n = 0;
+		b->from = me;
+		b->next = 0;
+		me->cur = b;
+	}
+
+	b->row[b->n++] = *r;
+	if (b->n < BATCH) return;
+
+	me->cur = 0;
+	pthread_mutex_lock(&qlock);
+	while (queued >= MAXQUEUE && !stopping) pthread_cond_wait(&qroom, &qlock);
+	if (qtail) qtail->next = b;
+	else qhead = b;
+	qtail = b;
+	queued++;
+	pthread_cond_signal(&qwork);
+	pthread_mutex_unlock(&qlock);
+}
+
+/*-  The End  */
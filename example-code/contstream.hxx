@@ -0,0 +1,101 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  contstream.hxx -- per-tick contaminant state to a columnar file
+
+  When $CONT_STREAM names a file (or Open() has been called), every
+  CommitIntoxicate() adds rows describing the agent after the tick:
+  one per contaminant with its tissue load and the survival along that
+  contaminant's axis of the member cube, and one for the agent as a
+  whole (contaminant 0) with its members (in the survival column) and
+  its impairments.  Columns which don't apply to a row are NaN.
+
+  With $CONT_STREAM_CELL (metres) the rows are not written per agent
+  but summed per taxon, cell and contaminant over $CONT_STREAM_BIN
+  seconds (default an hour); n says how many rows went into each sum,
+  so means are a division away.  A bin is written once the rows from
+  every thread adding them have reached the bin after next (agents
+  don't all tick together), so a thread which has yet to fill a batch,
+  or has stopped adding rows, holds the rest open until Close(); a row
+  which comes in after its bin has gone is left out, and Close() says
+  how many were.
+
+  $CONT_STREAM_COLUMNS (a list of reproduction, foraging and movement,
+  by default all three) says which of the impairments are wanted; the
+  others are left NaN and never worked out.
+
+  The simulation only appends to a per-thread batch; full batches go
+  to a writer thread which lays them out column by column and writes
+  in large sequential chunks.  Close() (called by Contamination::ShutdownAll)
+  writes whatever is left, then the time index.  It should only be
+  called once the agents have stopped ticking.
+
+  The file is a header and a sequence of tagged blocks:
+
+	header   "CSTREAM1" u32 version, u32 mode (0 agents, 1 cells), f64 cell, f64 bin
+	block    u32 tag, u32 length of what follows; always a multiple of 8
+	  DICT   u32 first id, u32 count, count NUL terminated strings
+	  ROWS   u32 nrows, u32 0, f64 tmin, f64 tmax, then the columns:
+	         f64 t, u32 taxon, u32 who, i32 cx, i32 cy, u32 contaminant, u32 n,
+	         f64 load, f64 survival, f64 reproduction, f64 foraging, f64 movement
+	  TIDX   u32 count, u32 0, u64 offset of a DICT block with every name,
+	         count * {f64 tmin, f64 tmax, u64 offset, u64 nrows}, one per ROWS block
+	  TEND   u64 offset of the TIDX block (always the last block)
+
+  Names (taxa, agents and contaminants) are ids into the dictionary,
+  which is written as it grows, ahead of the first rows which use its
+  new entries; 0 is "none".  At Close() the whole dictionary is
+  written again so that a reader can go from the TEND to the index, the
+  names and the blocks it wants without reading the rest.  A file
+  without a TEND (the run died) can still be read by walking the
+  blocks.  contread reads them.
+*/
+
+#ifndef _CONTSTREAM_HXX_INCLUDED_
+#define _CONTSTREAM_HXX_INCLUDED_
+
+#include <stdint.h>
+
+#define CSTREAM_MAGIC "CSTREAM1"
+#define CSTREAM_VERSION 1
+#define CSTREAM_TAG(a,b,c,d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define CSTREAM_DICT CSTREAM_TAG('D','I','C','T')
+#define CSTREAM_ROWS CSTREAM_TAG('R','O','W','S')
+#define CSTREAM_TIDX CSTREAM_TAG('T','I','D','X')
+#define CSTREAM_TEND CSTREAM_TAG('T','E','N','D')
+
+class ContaminantStream
+{
+public:
+	typedef struct {
+		double t;
+		uint32_t taxon, who, contaminant;
+		double x, y;
+		double load, survival, reproduction, foraging, movement;
+	} Row;
+
+	enum { REPRODUCTION = 1, FORAGING = 2, MOVEMENT = 4, IMPAIRMENTS = 7 };
+
+	// cell 0 for a row per agent; otherwise sums per cell over bin seconds
+	static int Open(const char *file, double cell, double bin, int columns = IMPAIRMENTS);
+	static void Close();
+	static int Active() {
+		if (state == UNTRIED) open_from_env();
+		return state == OPEN;
+	}
+	static int Columns() { return columns; }  // the impairments wanted
+
+	static uint32_t Id(const char *name);   // dictionary id; 0 for null
+	static const char *Name(uint32_t id);   // the dictionary's copy; good forever
+	static void Add(Row *r);                 // copied
+
+private:
+	enum { UNTRIED, OPEN, CLOSED };
+	static volatile int state;
+	static int columns;
+	static void open_from_env();
+};
+
+#endif
+/*-  The End  */
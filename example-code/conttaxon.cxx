@@ -0,0 +1,249 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  conttaxon.cxx -- per-taxon contaminant setup
+
+  There are only ever a handful of taxa in a scenario, so a list is
+  quite good enough here.
+*/
+
+/*-  Included files  */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "conttaxon.hxx"
+#include "paramcorpus.hxx"
+#include "contcache.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+ContaminantTaxon * volatile ContaminantTaxon::head = 0;
+ContaminantTaxon *ContaminantTaxon::attic = 0;
+volatile int ContaminantTaxon::head_lock = 0;
+static volatile int serials = 0;
+#define MAX_PAIRS 64  // kinds of source a taxon keeps; its sinks normally meet a handful
+
+/*-  Code  */
+
+/*-- Constructors/destructors */
+
+/*--- ContaminantTaxon(char *tax) */
+ContaminantTaxon::ContaminantTaxon(char *tax) {
+	assert(tax && *tax);
+	taxon = Strdup(tax);
+	if (!taxon) abort();
+	N = 0;
+	setup = 0;
+	next = 0;
+	sink_disable = sink_interests = source_list = 0;
+	pairs = 0;
+	npairs = 0;
+	pair_lock = 0;
+	held = 0;
+	serial = __sync_add_and_fetch(&serials, 1);
+}
+
+/*--- ~ContaminantTaxon() */
+ContaminantTaxon::~ContaminantTaxon() {
+	for (int i = 0; i < N; i++) {
+		assert(setup[i]);
+		if (setup[i]->name) Free(setup[i]->name);
+		if (setup[i]->update) Free(setup[i]->update);
+		if (setup[i]->forage) Free(setup[i]->forage);
+		if (setup[i]->reproduce) Free(setup[i]->reproduce);
+		if (setup[i]->move) Free(setup[i]->move);
+		if (setup[i]->acute_table) delete setup[i]->acute_table;
+		if (setup[i]->chronic_table) delete setup[i]->chronic_table;
+		ContaminantNative::Unbind(setup[i]->nupdate);
+		ContaminantNative::Unbind(setup[i]->nforage);
+		ContaminantNative::Unbind(setup[i]->nreproduce);
+		ContaminantNative::Unbind(setup[i]->nmove);
+		ContaminantEnsemble::FreeMembers(setup[i]->member, setup[i]->members-1);
+		Free(setup[i]);
+	}
+	if (setup) Free(setup);
+	if (taxon) Free(taxon);
+	while (pairs) {
+		Pair *p = pairs;
+		pairs = p->next;
+		FreePair(p);
+	}
+}
+
+/*-- registry */
+
+/*--- Find(char *tax) -- */
+ContaminantTaxon *ContaminantTaxon::Find(char *tax) {
+	assert(tax);
+	for (ContaminantTaxon *p = head; p; p = p->next) {
+		if (!strcmp(p->taxon, tax)) return p;
+	}
+	return 0;
+}
+
+/*--- Get(char *tax) -- */
+ContaminantTaxon *ContaminantTaxon::Get(char *tax) {
+	ContaminantTaxon *p = Find(tax);
+	if (p) return p;
+
+	while (__sync_lock_test_and_set(&head_lock, 1)) ;
+	if (!(p = Find(tax))) {
+		p = new ContaminantTaxon(tax);
+		if (!p) abort();
+		p->next = head;
+		__sync_synchronize();  // all of it before anyone can find it
+		head = p;
+	}
+	__sync_lock_release(&head_lock);
+	return p;
+}
+
+/*--- Flush() -- */
+// A taxon is deleted here or by the last Drop(), whichever is later.
+void ContaminantTaxon::Flush() {
+	while (__sync_lock_test_and_set(&head_lock, 1)) ;
+	while (head) {
+		ContaminantTaxon *p = head;
+		head = p->next;
+		if (p->held) {
+			p->next = attic;
+			attic = p;
+		}
+		else delete p;
+	}
+	__sync_lock_release(&head_lock);
+	ParamHandle::Forget();
+	ParamCorpus::Recheck();
+	ContaminantSetupCache::Close();  // the setups, held or not, have copies of what they took from it; it's keyed again next time
+}
+
+/*-- per contaminant setup */
+
+/*--- GetSetup(char *contaminant) -- */
+ContaminantTaxon::Setup *ContaminantTaxon::GetSetup(char *contaminant) {
+	assert(contaminant);
+	for (int i = 0; i < N; i++) {
+		if (!strcmp(setup[i]->name, contaminant)) return setup[i];
+	}
+	return 0;
+}
+
+/*--- AddSetup(char *contaminant) -- the caller fills in the rest */
+ContaminantTaxon::Setup *ContaminantTaxon::AddSetup(char *contaminant) {
+	assert(contaminant && *contaminant);
+	assert(!GetSetup(contaminant));
+
+	setup = (Setup **)Realloc(setup, (N+1)*sizeof(Setup *));
+	if (!setup) abort();
+	setup[N] = (Setup *)Calloc(1, sizeof(Setup));
+	if (!setup[N]) abort();
+	setup[N]->name = Strdup(contaminant);
+	if (!setup[N]->name) abort();
+	setup[N]->owner = this;
+	setup[N]->serial = __sync_add_and_fetch(&serials, 1);
+	return setup[N++];
+}
+
+/*--- Hold(Setup *cs) -- an agent points at cs */
+void ContaminantTaxon::Hold(Setup *cs) {
+	assert(cs && cs->owner);
+	__sync_fetch_and_add(&cs->owner->held, 1);
+}
+
+/*--- Drop(Setup *cs) -- and doesn't any more */
+void ContaminantTaxon::Drop(Setup *cs) {
+	assert(cs && cs->owner);
+	ContaminantTaxon *ct = cs->owner, *gone = 0;
+	if (__sync_sub_and_fetch(&ct->held, 1)) return;
+
+	// the last of a flushed taxon?  Flush() may have deleted it already,
+	// so it's only looked at once it's been found in the attic
+	while (__sync_lock_test_and_set(&head_lock, 1)) ;
+	for (ContaminantTaxon **p = &attic; *p; p = &(*p)->next) {
+		if (*p == ct && !ct->held) {
+			*p = ct->next;
+			gone = ct;
+			break;
+		}
+	}
+	__sync_lock_release(&head_lock);
+	if (gone) delete gone;
+}
+
+/*-- source kinds */
+
+/*--- same(int n, int *a, int m, int *b) -- two lists of ids */
+static int same(int n, int *a, int m, int *b) {
+	return n == m && (!n || !memcmp(a, b, n*sizeof(int)));
+}
+
+/*--- FindPair(interests, ni, iid, sources, ns, sid) -- */
+ContaminantTaxon::Pair *ContaminantTaxon::FindPair(uint64_t interests, int ni, int *iid,
+	uint64_t sources, int ns, int *sid) {
+	for (Pair *p = pairs; p; p = p->next) {
+		if (p->interests != interests || p->sources != sources) continue;
+		if (same(p->n, p->iid, ni, iid) && same(p->ns, p->sid, ns, sid)) return p;
+	}
+	return 0;
+}
+
+/*--- AddPair(interests, ni, iid, iname, sources, ns, sid) -- unless somebody beat us to it */
+// iid and iname are our interests' ids and names, sid the source's ids;
+// cid[i] is where iid[i] is in sid.
+ContaminantTaxon::Pair *ContaminantTaxon::AddPair(uint64_t interests, int ni, int *iid, char **iname,
+	uint64_t sources, int ns, int *sid) {
+	while (__sync_lock_test_and_set(&pair_lock, 1)) ;
+	Pair *p = FindPair(interests, ni, iid, sources, ns, sid);
+	if (p) {
+		__sync_lock_release(&pair_lock);
+		return p;
+	}
+
+	p = (Pair *)Calloc(1, sizeof(Pair));
+	if (!p) abort();
+	p->interests = interests;
+	p->sources = sources;
+	p->n = ni;
+	p->ns = ns;
+	p->name = (char **)Calloc(ni?ni:1, sizeof(char *));
+	p->cid = (int *)Calloc(ni?ni:1, sizeof(int));
+	p->iid = (int *)Calloc(ni?ni:1, sizeof(int));
+	p->sid = (int *)Calloc(ns?ns:1, sizeof(int));
+	if (!p->name || !p->cid || !p->iid || !p->sid) abort();
+	if (ni) memcpy(p->iid, iid, ni*sizeof(int));
+	if (ns) memcpy(p->sid, sid, ns*sizeof(int));
+	for (int i = 0; i < ni; i++) {
+		p->name[i] = iname[i];
+		p->cid[i] = -1;
+		for (int j = 0; j < ns; j++) {
+			if (sid[j] == iid[i]) {
+				p->cid[i] = j;
+				p->any = 1;
+				break;
+			}
+		}
+	}
+
+	if (npairs >= MAX_PAIRS) p->spare = 1;
+	else {
+		p->next = pairs;
+		__sync_synchronize();  // all of it before anyone can see it
+		pairs = p;
+		npairs++;
+	}
+	__sync_lock_release(&pair_lock);
+	return p;
+}
+
+/*--- FreePair(Pair *p) -- */
+void ContaminantTaxon::FreePair(Pair *p) {
+	if (!p) return;
+	Free(p->name);
+	Free(p->cid);
+	Free(p->iid);
+	Free(p->sid);
+	Free(p);
+}
+
+/*-  The End  */
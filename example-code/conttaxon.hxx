@@ -0,0 +1,117 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  conttaxon.hxx -- per-taxon contaminant setup
+
+  The parts of a contaminant setup which come straight out of the
+  parameter corpus (the tick, the program strings and the LC surfaces)
+  are the same for every agent of a taxon.  They are loaded once by
+  the first agent through Contamination::ContaminantSetup and every
+  agent of the taxon (including the ones which arrive from another
+  kernel) points at them.  The per-tick state is in ContaminantHot.
+
+  An agent Hold()s a setup for as long as it points at it, and Drop()s
+  it after.  Flush() forgets every taxon at a parameter reload, but one
+  whose setups are still held (by agents not yet set up again) is only
+  put aside, and deleted when the last of them is dropped.
+
+  The taxon also keeps, for each kind of source its sinks have met,
+  which of their interests that source gives off and under what cid
+  (a Pair).  A kind of source is its source list and the table is for
+  our interest list, so that an agent whose lists have been changed
+  just finds (or makes) another Pair; every agent of a taxon normally
+  has the same lists, so in practice it's one table per sink taxon and
+  source taxon.  The lists' signatures find a Pair quickly, and the
+  lists themselves are compared before it's used.  A sink remembers
+  which Pair each of its sources is (see ContaminantSink::source_kind),
+  so the table is only looked at when it meets a new source or a source
+  list changes.  Past MAX_PAIRS kinds the table takes no more, and a
+  new Pair is the asker's to FreePair() once it's done with it.
+*/
+
+#ifndef _CONTTAXON_HXX_INCLUDED_
+#define _CONTTAXON_HXX_INCLUDED_
+
+#include "endpointsurf.hxx"
+#include "endpointtab.hxx"
+#include "paramhandle.hxx"
+#include "contnative.hxx"
+#include "contprof.hxx"
+#include "contensemble.hxx"
+#include <stdint.h>
+
+class ContaminantTaxon
+{
+public:
+	typedef struct {
+		char *name;                  // owned
+		double cont_tick;
+		double tolerance, min_tick, max_tick; // the adaptive step; tolerance 0 without one
+		char *update, *forage, *reproduce, *move; // owned
+		EndpointSurf acute_lethal, chronic_lethal, foraging, reproduction, movement;
+		EndpointTable *acute_table, *chronic_table;  // owned; 0 unless lc_table asks for them
+		ContaminantNativeProg *nupdate, *nforage, *nreproduce, *nmove; // owned; 0 unless contexprc made them
+		uint32_t stream_id;          // ContaminantStream::Id(name) if the stream was open when it was made, or 0
+		int members;                 // ensemble size, including the agent itself; 1 without one
+		ContaminantEnsemble::Member *member; // owned; members-1 of them, 0 without an ensemble
+		class ContaminantTaxon *owner;
+		int serial;                  // never the same for two setups, even across a Flush()
+#if defined(CONT_PROFILE)
+		int prof;                    // profile slot
+#endif
+	} Setup;
+
+	// Find() and Get() are safe from any thread; setups and handles are
+	// only added by a taxon's first agent (see Contamination::InitMany)
+	static ContaminantTaxon *Find(char *taxon);  // null if the taxon hasn't been seen
+	static ContaminantTaxon *Get(char *taxon);   // makes one if necessary
+	static void Flush();                         // forget everything (parameter reload)
+
+	Setup *GetSetup(char *contaminant);          // null if not yet loaded
+	Setup *AddSetup(char *contaminant);
+	static void Hold(Setup *cs);
+	static void Drop(Setup *cs);
+
+	typedef struct Pair {
+		uint64_t interests, sources;   // the two lists' signatures
+		int n, ns;                     // our interests, and what the source gives off
+		int *iid, *sid;                // [n] and [ns]; the lists themselves
+		char **name;                   // interned, in interest order
+		int *cid;                      // [n]; -1 where the source doesn't give it off
+		int any;                       // any cid >= 0
+		int spare;                     // not in the table (it was full); the asker's
+		struct Pair *next;
+	} Pair;
+	// Safe from any thread; pairs are never changed once made.  The
+	// signatures are ContaminantList::Signature() of iid and sid.
+	Pair *FindPair(uint64_t interests, int ni, int *iid, uint64_t sources, int ns, int *sid);
+	Pair *AddPair(uint64_t interests, int ni, int *iid, char **iname, uint64_t sources, int ns, int *sid);
+	static void FreePair(Pair *p);               // a spare one
+
+	char *taxon;
+	int serial;                                  // never the same for two taxa, even at the same address
+	int N;
+	Setup **setup;
+
+	// parameter paths every agent of the taxon looks at (0 until someone resolves them)
+	ParamHandle *sink_disable, *sink_interests, *source_list;
+
+private:
+	ContaminantTaxon(char *taxon);
+	~ContaminantTaxon();
+
+	Pair * volatile pairs;
+	int npairs;
+	volatile int pair_lock;
+
+	volatile int held;            // setups agents point at
+
+	ContaminantTaxon *next;
+	static ContaminantTaxon * volatile head;
+	static ContaminantTaxon *attic;  // flushed, but still held
+	static volatile int head_lock;
+};
+
+#endif
+/*-  The End  */
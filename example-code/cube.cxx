@@ -117,6 +117,26 @@ void *Cube::GetState(int *sz) {
 	return d;
 }
 
+/*--- StateSize() -- */
+
+int Cube::StateSize() {
+	return (n+2)*sizeof(double);
+}
+
+/*--- PutState(void *data, int sz) -- same layout as GetState, but in place */
+
+void Cube::PutState(void *data, int sz) {
+	double *d = (double*)data;
+	assert(data);
+	assert(sz >= StateSize());
+
+	d[0] = (double)n;
+	d[1] = value;
+	for (int i = 0; i < n; i++) {
+		d[i+2] = v[i];
+	}
+}
+
 /*--- SetState(void *data, int sz) -- */
 
 void Cube::SetState(void *data, int sz) {
@@ -131,7 +151,9 @@ void Cube::SetState(void *data, int sz) {
 	v = (double *)Calloc(n, sizeof(double));
 	if (!v) abort();
 
-	memcpy(v, d+2, (sizeof(double)*n));
+	for (int i = 0; i < n; i++) {
+		v[i] = d[i+2];
+	}
 }
 
 // This class gets handed the new load at the end of each time step, and it updates the contact cube 
@@ -196,34 +218,62 @@ int Cube::add_dimension() {
 
 /*-- service calls: getting data and changing data */
 
+/*--- level(int i) -- where we are along axis i */
+
+double Cube::level(int i) {
+	assert(i >= 0 && i < n);
+	return v[i];
+}
+
 /*--- Value() -- */
 
 double Cube::Value() {
-	return ceil(value * proportion_of_box(v, n)); 
+	return ceil(value * survival(-1)); 
 };
 
+/*--- ValueWith(const double *a, int stride, int base, int m) -- what Value() would be with other levels on some axes */
+
+double Cube::ValueWith(const double *a, int stride, int base, int m) {
+	double prod = 1.0;
+
+	assert(base >= 0 && base + m <= n);
+	for (int i = 0; i < n; i++) {
+		double x = (i >= base && i < base + m)?a[(i-base)*stride]:v[i];
+		if (x > 1 || x < 0) abort();
+		prod *= (1.0 - x);
+	}
+	return ceil(value * prod);
+}
+
 /*--- LValue() -- */
 
 double Cube::LValue() {
-	return value * proportion_of_box(v, n); 
+	return value * survival(-1); 
 };
 
+/*--- survival(int skip) -- proportion_of_box for our own axes */
+
+double Cube::survival(int skip) {
+	double prod = 1.0;
+
+	for (int i = 0; i < n; i++) {
+		if (i == skip) continue;
+		double a = v[i];
+		if (a > 1 || a < 0) abort();
+		prod *= (1.0 - a);
+	}
+	return prod;
+}
+
 /*--- AdjustN(double K, int I) -- */
 
 double Cube::AdjustN(double K, int I) { // Removes a number against axis I
 	double Q = 1.0;
-	int i = 0;
 	double cv = LValue();
 
 	if (!v || !value) return 0.0; 
 
-	Q = 1.0;  
-	for (i = 0; i < n; i++) {
-		if (i == I) continue;
-		if (v[i] > 1 || v[i] < 0) abort();
-
-		Q *= (1.0 - v[i]);
-	} // Q = Surviorship w.r.t. other axes
+	Q = survival(I); // Q = Surviorship w.r.t. other axes
 
 	if (Q > 1) {
 		abort();
@@ -272,7 +322,8 @@ double Cube::AdjustLevels(double *level, int base, int n) {
 	double K;
 
 	for (i = 0; i < n; i++) {
-		v[i+base] = v[i+base] + level[i] * (1.0 - v[i+base]);
+		double a = v[i+base];
+		v[i+base] = a + level[i] * (1.0 - a);
 	}
 
 	K = Value();
@@ -280,6 +331,22 @@ double Cube::AdjustLevels(double *level, int base, int n) {
 	else return K;
 }
 
+/*--- AdjustLevels(Cube **cubes, double **level, int m, int base, int n) -- many cubes in one pass */
+// level[j] is for cubes[j].  Nobody wants the member counts back here
+// (they ask Value() when they do), so they aren't worked out.
+
+void Cube::AdjustLevels(Cube **cubes, double **level, int m, int base, int n) {
+	for (int j = 0; j < m; j++) {
+		Cube *c = cubes[j];
+		double *l = level[j];
+		assert(base + n <= c->n);
+		for (int i = 0; i < n; i++) {
+			double a = c->v[i+base];
+			c->v[i+base] = a + l[i] * (1.0 - a);
+		}
+	}
+}
+
 
 
 /*-  The End  */
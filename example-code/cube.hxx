@@ -54,9 +54,12 @@
 class Cube {
 private:
 	int n;
+	// the axes stay double with CONT_FLOAT_STORAGE; a tick's chronic
+	// mortality can add less to one than 32 bits could resolve
 	double value, *v;
 
 	double LValue();
+	double survival(int skip);   // product of (1 - axis) over the axes, bar skip
 
 public:
 	Cube(int N);
@@ -64,11 +67,13 @@ public:
 	virtual ~Cube();
 	
 	double Value();
+	double ValueWith(const double *a, int stride, int base, int n); // Value() with axes base.. replaced by a[0], a[stride], ...
 	double level(int i);
 	void setMembers(double d);
 	int add_dimension();
 	double AdjustN(double K, int i); // Adjusts by a number removed
 	double AdjustLevels(double *level, int base, int n); // Adjusts the levels by the proportion of the remaining range	
+	static void AdjustLevels(Cube **cubes, double **level, int m, int base, int n); // the same for m cubes
 	double proportion_of_box(double *v, int dim);
 #if 0
 	double AdjustLevel(double level, int i); // Adjust according to a level in one of the other indices
@@ -76,6 +81,8 @@ public:
   
 	virtual void *GetState(int *sz);
 	virtual void SetState(void *v, int sz);
+	int StateSize();                     // bytes needed by PutState
+	void PutState(void *d, int sz);      // GetState into a buffer we don't own
 
 };
 
@@ -0,0 +1,272 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  endpointtab.cxx -- tabulated EndpointSurf
+
+  The samples are kept with dt varying fastest; a lookup touches two
+  adjacent pairs, so it is two cache lines at most.
+*/
+
+/*-  Included files  */
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "endpointtab.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define START_CELLS 16
+#define PROBES 4           // per cell per axis, for measure()
+#define MARGIN 1.25        // for the error between the probes
+
+/*-  Code  */
+
+/*-- Constructor/destructor */
+
+/*--- EndpointTable() -- */
+EndpointTable::EndpointTable() {
+	surf = 0;
+	lcmin = lcmax = dtmax = 0;
+	hx = ht = rhx = rht = 0;
+	nc = nt = 0;
+	f = 0;
+	zero = 0;
+	err = HUGE_VAL;
+	ok = 0;
+}
+
+/*--- ~EndpointTable() -- */
+EndpointTable::~EndpointTable() {
+	if (f) Free(f);
+	if (zero) Free(zero);
+}
+
+
+/*-- Building */
+
+/*--- Build(EndpointSurf *es, double cmin, double cmax, double dtm, double tolerance) -- */
+// Returns Ok(): whether the surface could be tabulated to within tolerance.
+int EndpointTable::Build(EndpointSurf *es, double cmin, double cmax, double dtm, double tolerance) {
+	assert(es);
+	assert(cmin > 0 && cmax > cmin);
+	assert(dtm > 0);
+	assert(tolerance > 0);
+
+	surf = es;
+	lcmin = log(cmin);
+	lcmax = log(cmax);
+	dtmax = dtm;
+	ok = 0;
+
+	for (int n = START_CELLS; n <= MAXCELLS; n *= 2) {
+		if (!fill(n, n)) return 0;
+		err = measure();
+		if (err <= tolerance) {
+			ok = 1;
+			break;
+		}
+	}
+	return ok;
+}
+
+/*--- fill(int c, int t) -- sample the surface on a c x t cell grid */
+int EndpointTable::fill(int c, int t) {
+	nc = c;
+	nt = t;
+	hx = (lcmax - lcmin)/nc;
+	ht = dtmax/nt;
+	rhx = 1.0/hx;
+	rht = 1.0/ht;
+
+	if (f) Free(f);
+	if (zero) Free(zero);
+	f = (double *)Malloc((nc+1)*(nt+1)*sizeof(double));
+	zero = (double *)Malloc((nt+1)*sizeof(double));
+	if (!f || !zero) abort();
+
+	for (int i = 0; i <= nc; i++) {
+		double conc = exp(lcmin + i*hx);
+		for (int j = 0; j <= nt; j++) {
+			double v = surf->value(conc, j*ht);
+			if (isnan(v)) return 0;
+			f[i*(nt+1) + j] = v;
+		}
+	}
+	for (int j = 0; j <= nt; j++) {
+		zero[j] = surf->value(0, j*ht);
+		if (isnan(zero[j])) return 0;
+	}
+	return 1;
+}
+
+/*--- measure() -- worst error over a PROBES x PROBES lattice in every cell, with a MARGIN */
+// The lattice takes in the centres and edge midpoints, where the error
+// of a cell is largest if its second derivatives are even; where they
+// aren't (steep rows near dt == 0, say) the worst point moves off them,
+// and the rest of the lattice and the margin are for that.  The nodes
+// themselves are exact and aren't probed.
+double EndpointTable::measure() {
+	double e = 0;
+
+	for (int i = 0; i < nc; i++) {
+		for (int j = 0; j < nt; j++) {
+			for (int a = 0; a < PROBES; a++) {
+				double conc = exp(lcmin + (i + (double)a/PROBES)*hx);
+				for (int b = a?0:1; b < PROBES; b++) {
+					double dt = (j + (double)b/PROBES)*ht;
+					double d = fabs(lookup(conc, dt) - surf->value(conc, dt));
+					if (d > e) e = d;
+				}
+			}
+		}
+	}
+	for (int j = 0; j < nt; j++) {
+		for (int b = 1; b < PROBES; b++) {
+			double ft = (double)b/PROBES;
+			double d = fabs(zero[j] + ft*(zero[j+1] - zero[j]) - surf->value(0, (j+ft)*ht));
+			if (d > e) e = d;
+		}
+	}
+	return MARGIN*e;
+}
+
+
+/*-- Service calls */
+
+/*--- Ok() -- */
+int EndpointTable::Ok() {
+	return ok;
+}
+
+/*--- Error() -- */
+double EndpointTable::Error() {
+	return err;
+}
+
+/*--- GetState(int *sz) -- */
+void *EndpointTable::GetState(int *sz) {
+	assert(sz);
+	int nf = (nc+1)*(nt+1), nz = nt+1;
+	*sz = sizeof(State) + (nf+nz)*sizeof(double);
+	State *s = (State *)Calloc(1, *sz);
+	if (!s) abort();
+	s->lcmin = lcmin;
+	s->lcmax = lcmax;
+	s->dtmax = dtmax;
+	s->err = err;
+	s->nc = nc;
+	s->nt = nt;
+	s->ok = ok;
+	memcpy(s+1, f, nf*sizeof(double));
+	memcpy((double *)(s+1) + nf, zero, nz*sizeof(double));
+	return s;
+}
+
+/*--- SetState(EndpointSurf *es, void *d, int sz) -- the grid GetState() gave, without sampling anything */
+// d need not be aligned.
+int EndpointTable::SetState(EndpointSurf *es, void *d, int sz) {
+	State s;
+
+	assert(es && d);
+	if (sz < (int)sizeof(State)) return 0;
+	memcpy(&s, d, sizeof(State));
+	if (s.nc < 1 || s.nc > MAXCELLS || s.nt < 1 || s.nt > MAXCELLS) return 0;
+	int nf = (s.nc+1)*(s.nt+1), nz = s.nt+1;
+	if (sz != (int)(sizeof(State) + (nf+nz)*sizeof(double))) return 0;
+
+	surf = es;
+	lcmin = s.lcmin;
+	lcmax = s.lcmax;
+	dtmax = s.dtmax;
+	err = s.err;
+	ok = s.ok;
+	nc = s.nc;
+	nt = s.nt;
+	hx = (lcmax - lcmin)/nc;
+	ht = dtmax/nt;
+	rhx = 1.0/hx;
+	rht = 1.0/ht;
+
+	if (f) Free(f);
+	if (zero) Free(zero);
+	f = (double *)Malloc(nf*sizeof(double));
+	zero = (double *)Malloc(nz*sizeof(double));
+	if (!f || !zero) abort();
+	memcpy(f, (char *)d + sizeof(State), nf*sizeof(double));
+	memcpy(zero, (char *)d + sizeof(State) + nf*sizeof(double), nz*sizeof(double));
+	return 1;
+}
+
+/*--- lookup(double conc, double dt) -- bilinear interpolation, conc and dt in the domain */
+double EndpointTable::lookup(double conc, double dt) {
+	double x = (log(conc) - lcmin)*rhx;
+	double t = dt*rht;
+	int i = (int)x, j = (int)t;
+	if (i >= nc) i = nc-1;
+	if (j >= nt) j = nt-1;
+	double fx = x - i, ft = t - j;
+	double *p = f + i*(nt+1) + j, *q = p + (nt+1);
+
+	return (1-fx)*((1-ft)*p[0] + ft*p[1]) + fx*((1-ft)*q[0] + ft*q[1]);
+}
+
+/*--- value(double conc, double dt) -- a drop in for EndpointSurf::value */
+double EndpointTable::value(double conc, double dt) {
+	assert(ok);
+	if (dt < 0 || dt > dtmax) return surf->value(conc, dt);
+	if (conc <= 0) {
+		double t = dt*rht;
+		int j = (int)t;
+		if (j >= nt) j = nt-1;
+		return zero[j] + (t-j)*(zero[j+1] - zero[j]);
+	}
+	double lc = log(conc);
+	if (lc < lcmin || lc > lcmax) return surf->value(conc, dt);
+	return lookup(conc, dt);
+}
+
+/*--- values(const double *conc, double dt, double *out, int n) -- many at once */
+// The first loop has no branches the compiler can't turn into selects,
+// so it vectorises (with gathers for the samples); anything off the
+// grid is marked with a NaN and done analytically afterwards.  The
+// arithmetic is value()'s, so the answers are the same to the bit.
+void EndpointTable::values(const double *conc, double dt, double *out, int n) {
+	int k;
+
+	assert(ok);
+	if (dt < 0 || dt > dtmax) {
+		for (k = 0; k < n; k++) out[k] = surf->value(conc[k], dt);
+		return;
+	}
+
+	const int stride = nt+1;
+	double t = dt*rht;
+	int j = (int)t;
+	if (j >= nt) j = nt-1;
+	double ft = t - j;
+	double z = zero[j] + ft*(zero[j+1] - zero[j]);
+
+#pragma GCC ivdep
+	for (k = 0; k < n; k++) {
+		int pos = conc[k] > 0;
+		double lc = log(pos?conc[k]:1.0);   // conc <= 0 is the zero row
+		int inside = (lc >= lcmin) & (lc <= lcmax);
+		double x = inside?(lc - lcmin)*rhx:0;
+		int i = (int)x;
+		i = (i >= nc)?nc-1:i;
+		double fx = x - i;
+		const double *p = f + i*stride + j, *q = p + stride;
+		double v = (1-fx)*((1-ft)*p[0] + ft*p[1]) + fx*((1-ft)*q[0] + ft*q[1]);
+		out[k] = pos?(inside?v:NAN):z;
+	}
+
+	for (k = 0; k < n; k++) {
+		if (isnan(out[k])) out[k] = surf->value(conc[k], dt);
+	}
+}
+
+
+/*-  The End  */
@@ -0,0 +1,76 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  endpointtab.hxx -- tabulated EndpointSurf
+
+  An EndpointSurf is fixed once load_LC has set it up, but it gets
+  evaluated for every contaminant of every agent on every tick.  An
+  EndpointTable samples it once on a grid over log(concentration) x dt
+  and answers from the grid by bilinear interpolation.
+
+  Error bound: for a surface with bounded second derivatives the
+  bilinear error in a cell of size hx x ht is at most
+  (hx^2 |f_xx| + ht^2 |f_tt|)/8, and it is largest near the middle of
+  the cell and of its edges if those derivatives are even across it.
+  They aren't quite, so Build() measures the error against the analytic
+  surface on a lattice of points in every cell, centres and edge
+  midpoints among them, adds a margin for the error between the points,
+  refines the grid until that is within the tolerance (or the grid
+  limit is reached) and reports it through Error().  contcheck's
+  lc_table check sweeps a table against its surface.  Callers should
+  treat Error() as the bound, and should not use the table at all if
+  Ok() says the tolerance couldn't be met.
+
+  Concentrations of zero (by far the most common case) have their own
+  row; anything else outside the grid goes to the analytic surface.
+*/
+
+#ifndef _ENDPOINTTAB_HXX_INCLUDED_
+#define _ENDPOINTTAB_HXX_INCLUDED_
+
+#include "endpointsurf.hxx"
+
+class EndpointTable
+{
+public:
+	EndpointTable();
+	~EndpointTable();
+
+	int Build(EndpointSurf *es, double cmin, double cmax, double dtmax, double tolerance);
+	int Ok();
+	double Error();
+
+	double value(double conc, double dt);
+	// value() for n concentrations at one dt, into out; the per-tick sweeps use it
+	void values(const double *conc, double dt, double *out, int n);
+
+	// the grid, for the setup cache (contcache.hxx); es is the surface it was built from
+	void *GetState(int *sz);                   // Free() it
+	int SetState(EndpointSurf *es, void *d, int sz);
+
+private:
+	enum { MAXCELLS = 1024 };     // per axis
+
+	int fill(int nc, int nt);
+	double measure();
+	double lookup(double conc, double dt);
+
+	EndpointSurf *surf;
+	double lcmin, lcmax, dtmax;   // domain (log concentration)
+	double hx, ht;                // cell size
+	double rhx, rht;
+	int nc, nt;                   // cells per axis
+	double *f;                    // (nc+1) x (nt+1) samples, dt fastest
+	double *zero;                 // nt+1 samples at conc == 0
+	double err;
+	int ok;
+
+	typedef struct {
+		double lcmin, lcmax, dtmax, err;
+		int nc, nt, ok, pad;
+	} State;                      // then f and zero
+};
+
+#endif
+/*-  The End  */
@@ -0,0 +1,247 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  paramcc.cxx -- compile a parameter corpus
+
+  Usage: paramcc -o corpus [-p paramfile ...] taxon:Class[/key...] ...
+
+  e.g.   paramcc -o shark.pc -p shark.prm -p fish.prm shark:ContaminantSink shark:Fish shark:BufPredFish
+
+  Each root is walked through the parameter tree (the files are found
+  exactly as the kernel finds them), so inheritance and aliases are
+  resolved by the same code that would have resolved them at run time.
+  Leaves which look like numbers ("20[min]", "0.03", "28[ml/(sec*kg)]")
+  are converted with CCalc::UnitEvaluate and stored as numbers as well
+  as strings.  See paramcorpus.hxx for how the result is used.
+
+  The parameter files named with -p (or, without any, those in
+  $CONT_PARAM_FILES, colon separated) are stamped into the corpus, so
+  that it can be refused once they change; there must be at least one.
+  Two paths with the same hash are an error, since the corpus couldn't
+  tell them apart.
+
+  Link with the kernel's parameter and calculator libraries.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+
+#include "prmenvexpr.hxx"
+#include "paramcorpus.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+static ParamCorpus::Entry *ent = 0;
+static int nent = 0, maxent = 0;
+static int *nodes = 0;
+static int nnodes = 0, maxnodes = 0;
+static char *strs = 0;
+static int nstrs = 0, maxstrs = 0;
+static ParamCorpus::Source *src = 0;
+static int nsrc = 0;
+static CCalc *calc = 0;
+
+/*-  Code  */
+
+/*-- pools */
+
+/*--- add_string(char *s) -- returns the offset in the string pool */
+static int add_string(char *s) {
+	int l = strlen(s)+1;
+	if (nstrs + l > maxstrs) {
+		while (nstrs + l > maxstrs) maxstrs = maxstrs?2*maxstrs:4096;
+		strs = (char *)Realloc(strs, maxstrs);
+		if (!strs) abort();
+	}
+	memcpy(strs + nstrs, s, l);
+	nstrs += l;
+	return nstrs - l;
+}
+
+/*--- add_entry(char **keys, int n) -- */
+static ParamCorpus::Entry *add_entry(char **keys, int n) {
+	if (nent >= maxent) {
+		maxent = maxent?2*maxent:1024;
+		ent = (ParamCorpus::Entry *)Realloc(ent, maxent*sizeof(*ent));
+		if (!ent) abort();
+	}
+	char path[4096];
+	int l = 0;
+	for (int i = 0; i < n; i++) {
+		int kl = strlen(keys[i]);
+		if (l + kl + 2 > (int)sizeof(path)) fatal(1, "Parameter path under %s is too long", keys[0]);
+		if (i) path[l++] = '/';
+		memcpy(path + l, keys[i], kl+1);
+		l += kl;
+	}
+
+	ParamCorpus::Entry *e = &ent[nent++];
+	memset(e, 0, sizeof(*e));
+	e->hash = ParamCorpus::Hash(keys, n);
+	e->str = -1;
+	e->nodes = -1;
+	e->path = add_string(path);
+	return e;
+}
+
+/*--- add_source(char *file) -- */
+static void add_source(char *file) {
+	struct stat st;
+	uint64_t h = 14695981039346656037ULL;
+
+	if (stat(file, &st) < 0 || !ParamCorpus::SumFile(file, &h)) fatal(1, "Unable to read parameter file %s", file);
+	src = (ParamCorpus::Source *)Realloc(src, (nsrc+1)*sizeof(*src));
+	if (!src) abort();
+	ParamCorpus::Source *s = &src[nsrc++];
+	memset(s, 0, sizeof(*s));
+	s->name = add_string(file);
+	s->size = st.st_size;
+	s->mtime = st.st_mtime;
+	s->sum = h;
+}
+
+/*--- numeric(char *s) -- does this look like a number (with or without units)? */
+static int numeric(char *s) {
+	char *end;
+	while (*s == ' ' || *s == '\t') s++;
+	strtod(s, &end);
+	if (end == s) return 0;
+	while (*end == ' ' || *end == '\t') end++;
+	return (!*end || *end == '[');
+}
+
+
+/*-- walk(char **keys, int n) -- record everything under keys */
+static void walk(char **keys, int n) {
+	if (n >= PCORPUS_MAXDEPTH) fatal(1, "Parameter tree is too deep under %s", keys[0]);
+
+	char **child = ParamCorpus::TreeNodes(keys, n);
+	if (child) {
+		int i, k;
+		for (k = 0; child[k]; k++) ;
+
+		ParamCorpus::Entry *e = add_entry(keys, n);
+		e->kind = ParamCorpus::PC_BLOCK;
+		e->nnodes = k;
+		if (nnodes + k > maxnodes) {
+			while (nnodes + k > maxnodes) maxnodes = maxnodes?2*maxnodes:1024;
+			nodes = (int *)Realloc(nodes, maxnodes*sizeof(int));
+			if (!nodes) abort();
+		}
+		e->nodes = nnodes*sizeof(int);
+		int base = nnodes;
+		nnodes += k;
+		for (i = 0; i < k; i++) nodes[base+i] = add_string(child[i]);
+
+		for (i = 0; i < k; i++) {
+			keys[n] = child[i];
+			walk(keys, n+1);
+		}
+		Free(child);
+		return;
+	}
+
+	char *s = ParamCorpus::TreeS(PARAM_OPT|PARAM_NOR, keys, n);
+	if (!s) return;
+
+	ParamCorpus::Entry *e = add_entry(keys, n);
+	e->kind = ParamCorpus::PC_STRING;
+	e->str = add_string(s);
+	if (numeric(s)) {
+		e->kind |= ParamCorpus::PC_NUMBER;
+		e->num = calc->UnitEvaluate(s);
+	}
+}
+
+/*--- by_hash(const void *a, const void *b) -- */
+static int by_hash(const void *a, const void *b) {
+	uint64_t x = ((ParamCorpus::Entry *)a)->hash, y = ((ParamCorpus::Entry *)b)->hash;
+	return (x < y)?-1:(x > y)?1:0;
+}
+
+/*--- usage() -- */
+static void usage() {
+	fprintf(stderr, "Usage: paramcc -o corpus [-p paramfile ...] taxon:Class[/key...] ...\n");
+	exit(1);
+}
+
+/*-- main */
+int main(int argc, char **argv) {
+	char *out = 0;
+	char *keys[PCORPUS_MAXDEPTH];
+	int i, j;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-o") && i+1 < argc) out = argv[++i];
+		else if (!strcmp(argv[i], "-p") && i+1 < argc) add_source(argv[++i]);
+		else usage();
+	}
+	if (!out || i >= argc) usage();
+	if (!nsrc) {
+		char *files = getenv("CONT_PARAM_FILES"), *s, *save = 0;
+		if (files) files = Strdup(files);
+		for (s = files?strtok_r(files, ":", &save):0; s; s = strtok_r(0, ":", &save)) add_source(s);
+	}
+	if (!nsrc) fatal(1, "Name the parameter files with -p or $CONT_PARAM_FILES, so that the corpus can tell when it's out of date");
+
+	calc = new CCalc();
+
+	for (; i < argc; i++) {
+		char *root = Strdup(argv[i]);
+		char *p = strchr(root, ':');
+		if (!p) usage();
+		*p++ = 0;
+
+		int n = 0;
+		keys[n++] = root;
+		while (p && *p && n < PCORPUS_MAXDEPTH) {
+			keys[n++] = p;
+			if ((p = strchr(p, '/'))) *p++ = 0;
+		}
+		walk(keys, n);
+		// root is left allocated: the keys in it are only copied, but
+		// it's a one-shot program and there's no point being clever
+	}
+
+	// sort and weed out the paths we've seen twice
+	qsort(ent, nent, sizeof(*ent), by_hash);
+	for (i = j = 0; i < nent; i++) {
+		if (j > 0 && ent[j-1].hash == ent[i].hash) {
+			if (strcmp(strs + ent[j-1].path, strs + ent[i].path))
+				fatal(1, "%s and %s have the same hash; the corpus can't represent them both", strs + ent[j-1].path, strs + ent[i].path);
+			continue;
+		}
+		ent[j++] = ent[i];
+	}
+	nent = j;
+
+	FILE *f = fopen(out, "wb");
+	if (!f) fatal(1, "Unable to write %s", out);
+
+	ParamCorpus::Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "PCORPUS2", 8);
+	h.n = nent;
+	h.nsrc = nsrc;
+	h.nodebytes = nnodes*sizeof(int);
+	h.strbytes = nstrs;
+
+	if (fwrite(&h, sizeof(h), 1, f) != 1 ||
+		 (nent && fwrite(ent, sizeof(*ent), nent, f) != (size_t)nent) ||
+		 fwrite(src, sizeof(*src), nsrc, f) != (size_t)nsrc ||
+		 (nnodes && fwrite(nodes, sizeof(int), nnodes, f) != (size_t)nnodes) ||
+		 (nstrs && fwrite(strs, 1, nstrs, f) != (size_t)nstrs)) {
+		fatal(1, "Error writing %s", out);
+	}
+	fclose(f);
+
+	printf("%s: %d paths from %d files, %d bytes of strings\n", out, nent, nsrc, nstrs);
+	return 0;
+}
+
+/*-  The End  */
@@ -0,0 +1,400 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  paramcorpus.cxx -- compiled parameter corpus
+
+  File layout (all native byte order, it is only ever read on the
+  machine which wrote it):
+
+	Header
+	Entry[n]           sorted by hash
+	Source[nsrc]
+	int nodepool[]     for each block: offsets of its children's names
+	char strpool[]     names, paths and strings
+
+  Paths the corpus doesn't cover fall through to the parameter tree.
+  Optional strings and integers inside a block the corpus does cover
+  are known to be absent, which is the common case for the optional
+  contaminant parameters, and are answered without touching the tree.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "prmagent.hxx"
+#include "paramcorpus.hxx"
+#include "paramhandle.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+#define PCORPUS_MAGIC "PCORPUS2"
+#define FNV_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+void *ParamCorpus::map = 0;
+int ParamCorpus::maplen = 0;
+ParamCorpus::Header *ParamCorpus::head = 0;
+ParamCorpus::Entry *ParamCorpus::entry = 0;
+ParamCorpus::Source *ParamCorpus::source = 0;
+int *ParamCorpus::nodepool = 0;
+char *ParamCorpus::strpool = 0;
+char *ParamCorpus::name = 0;
+int ParamCorpus::tried = 0;
+uint64_t ParamCorpus::sig = 0;
+
+/*-  Code  */
+
+/*-- opening and closing */
+
+/*--- Open(char *file) -- map a corpus made by paramcc */
+int ParamCorpus::Open(char *file) {
+	struct stat st;
+
+	assert(file);
+	Close();
+	tried = 1;
+
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		warning("Unable to open parameter corpus %s", file);
+		return 0;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(Header)) {
+		close(fd);
+		warning("Parameter corpus %s is too short", file);
+		return 0;
+	}
+
+	void *m = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) return 0;
+
+	Header *h = (Header *)m;
+	if (memcmp(h->magic, PCORPUS_MAGIC, 8) ||
+		 sizeof(Header) + h->n*sizeof(Entry) + h->nsrc*sizeof(Source) + h->nodebytes + h->strbytes != (size_t)st.st_size) {
+		munmap(m, st.st_size);
+		warning("%s is not a parameter corpus (or was written by a different paramcc)", file);
+		return 0;
+	}
+
+	map = m;
+	maplen = st.st_size;
+	head = h;
+	entry = (Entry *)(h+1);
+	source = (Source *)(entry + h->n);
+	nodepool = (int *)(source + h->nsrc);
+	strpool = (char *)nodepool + h->nodebytes;
+	if (!fresh(file)) {
+		Close();
+		return 0;
+	}
+	name = Strdup(file);
+	if (!name) abort();
+	VERBOSE("ParamCorpus", "%s: %d paths from %d files", file, h->n, h->nsrc);
+	return 1;
+}
+
+/*--- fresh(char *file) -- whether the parameter files are still what the corpus was made from */
+// Only a file whose size or time has changed is read again.
+int ParamCorpus::fresh(char *file) {
+	struct stat st;
+
+	for (int i = 0; i < head->nsrc; i++) {
+		Source *s = &source[i];
+		char *name = String(s->name);
+		if (stat(name, &st) == 0 && st.st_size == s->size && st.st_mtime == s->mtime) continue;
+
+		uint64_t h = FNV_BASIS;
+		if (!SumFile(name, &h) || h != s->sum) {
+			warning("%s has changed since the parameter corpus %s was made from it; run paramcc again (the corpus isn't being used)", name, file);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*--- Close() -- */
+void ParamCorpus::Close() {
+	if (map) munmap(map, maplen);
+	map = 0;
+	maplen = 0;
+	sig = 0;
+	head = 0;
+	entry = 0;
+	source = 0;
+	nodepool = 0;
+	strpool = 0;
+	if (name) Free(name);
+	name = 0;
+}
+
+/*--- Recheck() -- 1 if there's still a corpus */
+// Nothing may still be pointing into it (ParamHandle::Forget() first).
+int ParamCorpus::Recheck() {
+	if (!map) return 0;
+	if (fresh(name)) return 1;
+	Close();
+	return 0;
+}
+
+/*--- autoload() -- look at $PARAM_CORPUS the first time through */
+void ParamCorpus::autoload() {
+	if (tried) return;
+	tried = 1;
+	char *f = getenv("PARAM_CORPUS");
+	if (f && *f) Open(f);
+}
+
+/*--- Signature() -- FNV-1a over the file, the first time it's asked for */
+uint64_t ParamCorpus::Signature() {
+	if (!Loaded()) return 0;
+	if (!sig) {
+		uint64_t h = FNV_BASIS;
+		for (unsigned char *p = (unsigned char *)map; p < (unsigned char *)map + maplen; p++) {
+			h ^= *p;
+			h *= FNV_PRIME;
+		}
+		sig = h?h:1;
+	}
+	return sig;
+}
+
+/*--- SourceFile(int i) -- */
+char *ParamCorpus::SourceFile(int i) {
+	if (!Loaded() || i < 0 || i >= head->nsrc) return 0;
+	return String(source[i].name);
+}
+
+/*--- SumFile(char *file, uint64_t *h) -- 0 if it can't be read */
+int ParamCorpus::SumFile(char *file, uint64_t *h) {
+	unsigned char buf[65536];
+	int fd = open(file, O_RDONLY), n;
+	if (fd < 0) return 0;
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (int i = 0; i < n; i++) {
+			*h ^= buf[i];
+			*h *= FNV_PRIME;
+		}
+	}
+	close(fd);
+	return n == 0;
+}
+
+/*--- Loaded() -- */
+int ParamCorpus::Loaded() {
+	autoload();
+	return map?1:0;
+}
+
+
+/*-- lookup */
+
+/*--- Hash(char **keys, int n) -- FNV-1a over the components, separated by '/' */
+uint64_t ParamCorpus::Hash(char **keys, int n) {
+	uint64_t h = FNV_BASIS;
+	for (int i = 0; i < n; i++) {
+		for (unsigned char *p = (unsigned char *)keys[i]; *p; p++) {
+			h ^= *p;
+			h *= FNV_PRIME;
+		}
+		h ^= '/';
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+/*--- same(Entry *e, char **keys, int n) -- whether e is for this path and not just its hash */
+int ParamCorpus::same(Entry *e, char **keys, int n) {
+	char *p = String(e->path);
+	for (int i = 0; i < n; i++) {
+		int l = strlen(keys[i]);
+		if (strncmp(p, keys[i], l)) return 0;
+		p += l;
+		if (*p != ((i < n-1)?'/':0)) return 0;
+		if (*p) p++;
+	}
+	return 1;
+}
+
+/*--- Find(char **keys, int n) -- */
+ParamCorpus::Entry *ParamCorpus::Find(char **keys, int n) {
+	if (!Loaded()) return 0;
+
+	uint64_t h = Hash(keys, n);
+	int lo = 0, hi = head->n - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi)/2;
+		if (entry[mid].hash == h) return same(&entry[mid], keys, n)?&entry[mid]:0;
+		if (entry[mid].hash < h) lo = mid+1;
+		else hi = mid-1;
+	}
+	return 0;
+}
+
+/*--- Absent(char **keys, int n) -- */
+int ParamCorpus::Absent(char **keys, int n) {
+	if (n < 2) return 0;
+	Entry *e = Find(keys, n-1);
+	return (e && (e->kind & PC_BLOCK))?1:0;
+}
+
+/*--- String(int off) -- */
+char *ParamCorpus::String(int off) {
+	assert(strpool);
+	if (off < 0) return 0;
+	assert(off < head->strbytes);
+	return strpool + off;
+}
+
+/*--- Nodes(Entry *e) -- */
+char **ParamCorpus::Nodes(Entry *e) {
+	assert(e && (e->kind & PC_BLOCK));
+	char **v = (char **)Calloc(e->nnodes+1, sizeof(char *));
+	if (!v) abort();
+	int *p = (int *)((char *)nodepool + e->nodes);
+	for (int i = 0; i < e->nnodes; i++) v[i] = String(p[i]);
+	v[e->nnodes] = 0;
+	return v;
+}
+
+
+/*-- the parameter tree, with a path that isn't known at compile time */
+// The tree only has the variadic interface, so we unroll.
+
+#define K(i) ((i) < n?keys[i]:(char *)0)
+#define KEYS K(0),K(1),K(2),K(3),K(4),K(5),K(6),K(7),K(8),K(9),K(10),K(11),(char *)0
+
+/*--- TreeS(int flags, char **keys, int n) -- */
+char *ParamCorpus::TreeS(int flags, char **keys, int n) {
+	assert(n > 0 && n <= PCORPUS_MAXDEPTH);
+	return PGetS(flags, KEYS);
+}
+
+/*--- TreeN(int flags, char **keys, int n) -- */
+double ParamCorpus::TreeN(int flags, char **keys, int n) {
+	assert(n > 0 && n <= PCORPUS_MAXDEPTH);
+	return PGetN(flags, KEYS);
+}
+
+/*--- TreeI(int flags, char **keys, int n) -- */
+int ParamCorpus::TreeI(int flags, char **keys, int n) {
+	assert(n > 0 && n <= PCORPUS_MAXDEPTH);
+	return PGetI(flags, KEYS);
+}
+
+/*--- TreeNodes(char **keys, int n) -- */
+char **ParamCorpus::TreeNodes(char **keys, int n) {
+	assert(n > 0 && n <= PCORPUS_MAXDEPTH);
+	return PGetNodes(keys[0], K(1),K(2),K(3),K(4),K(5),K(6),K(7),K(8),K(9),K(10),K(11),(char *)0);
+}
+
+#undef KEYS
+#undef K
+
+
+/*-- corpus first, then the tree */
+
+/*--- collect(va_list ap, char *first, char **keys) -- gather a (char *)0 terminated path */
+int ParamCorpus::collect(va_list ap, char *first, char **keys) {
+	int n = 0;
+	char *k = first;
+	while (k) {
+		if (n >= PCORPUS_MAXDEPTH) fatal(1, "Parameter path is too deep for the corpus (%d components)", n);
+		keys[n++] = k;
+		k = va_arg(ap, char *);
+	}
+	return n;
+}
+
+/*--- GetS(int flags, char **keys, int n) -- */
+char *ParamCorpus::GetS(int flags, char **keys, int n) {
+	Entry *e = Find(keys, n);
+	if (e && (e->kind & PC_STRING)) return String(e->str);
+	if (!e && !(flags & PARAM_REQ) && Absent(keys, n)) return 0;
+	return TreeS(flags, keys, n);
+}
+
+/*--- GetN(int flags, char **keys, int n) -- */
+double ParamCorpus::GetN(int flags, char **keys, int n) {
+	Entry *e = Find(keys, n);
+	if (e && (e->kind & PC_NUMBER)) return e->num;
+	return TreeN(flags, keys, n);
+}
+
+/*--- GetI(int flags, char **keys, int n) -- */
+int ParamCorpus::GetI(int flags, char **keys, int n) {
+	Entry *e = Find(keys, n);
+	if (e && (e->kind & PC_NUMBER)) return (int)e->num;
+	if (!e && !(flags & PARAM_REQ) && Absent(keys, n)) return 0;
+	return TreeI(flags, keys, n);
+}
+
+/*--- GetNodes(char **keys, int n) -- */
+char **ParamCorpus::GetNodes(char **keys, int n) {
+	Entry *e = Find(keys, n);
+	if (e && (e->kind & PC_BLOCK)) return Nodes(e);
+	if (!e && Absent(keys, n)) return 0;
+	return TreeNodes(keys, n);
+}
+
+
+/*-- CPGetS, CPGetN, CPGetI and CPGetNodes -- variadic front ends */
+
+/*--- CPGetS(int flags, ...) -- */
+char *CPGetS(int flags, ...) {
+	char *keys[PCORPUS_MAXDEPTH];
+	va_list ap;
+	va_start(ap, flags);
+	int n = ParamCorpus::collect(ap, va_arg(ap, char *), keys);
+	va_end(ap);
+
+	ParamHandle::Note(keys, n);
+	return ParamCorpus::GetS(flags, keys, n);
+}
+
+/*--- CPGetN(int flags, ...) -- */
+double CPGetN(int flags, ...) {
+	char *keys[PCORPUS_MAXDEPTH];
+	va_list ap;
+	va_start(ap, flags);
+	int n = ParamCorpus::collect(ap, va_arg(ap, char *), keys);
+	va_end(ap);
+
+	ParamHandle::Note(keys, n);
+	return ParamCorpus::GetN(flags, keys, n);
+}
+
+/*--- CPGetI(int flags, ...) -- */
+int CPGetI(int flags, ...) {
+	char *keys[PCORPUS_MAXDEPTH];
+	va_list ap;
+	va_start(ap, flags);
+	int n = ParamCorpus::collect(ap, va_arg(ap, char *), keys);
+	va_end(ap);
+
+	ParamHandle::Note(keys, n);
+	return ParamCorpus::GetI(flags, keys, n);
+}
+
+/*--- CPGetNodes(char *k0, ...) -- */
+char **CPGetNodes(char *k0, ...) {
+	char *keys[PCORPUS_MAXDEPTH];
+	va_list ap;
+	va_start(ap, k0);
+	int n = ParamCorpus::collect(ap, k0, keys);
+	va_end(ap);
+
+	ParamHandle::Note(keys, n);
+	return ParamCorpus::GetNodes(keys, n);
+}
+
+/*-  The End  */
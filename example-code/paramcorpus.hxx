@@ -0,0 +1,125 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  paramcorpus.hxx -- compiled parameter corpus
+
+  paramcc walks the parameter tree for a set of taxa (through the
+  ordinary PGet* calls, so &inherit, ~aliases and units are resolved
+  exactly as they would be at run time) and writes the answers into a
+  flat, sorted, mmap-able file.  At run time the CPGet* calls below
+  look there first and only fall back to the parameter tree for paths
+  the corpus knows nothing about.
+
+  A path is keyed by a 64 bit hash of its components, so
+  CPGetN(f, "shark", "ContaminantSink", "contaminants", "X", "contaminant_tick", (char *)0)
+  is a binary search and a comparison with the path stored alongside,
+  so that a path which only shares a hash with one in the corpus goes
+  to the tree.  paramcc refuses to write a corpus with two paths of the
+  same hash.
+
+  The corpus records the size, time and checksum of each parameter
+  file it was made from, and one whose files have changed since (by
+  content; touching them doesn't count) is refused with a warning
+  rather than quietly shadowing the edits.  The files are looked at
+  again by Recheck(), which ContaminantTaxon::Flush calls when the
+  parameters are reloaded.
+
+  The corpus is picked up from $PARAM_CORPUS the first time it is
+  needed, or explicitly with ParamCorpus::Open().
+*/
+
+#ifndef _PARAMCORPUS_HXX_INCLUDED_
+#define _PARAMCORPUS_HXX_INCLUDED_
+
+#include <stdint.h>
+#include <stdarg.h>
+
+#define PCORPUS_MAXDEPTH 12
+
+class ParamCorpus
+{
+public:
+	static int Open(char *file);
+	static void Close();
+	static int Loaded();
+	static int Recheck();         // close the corpus if its files have changed since it was opened
+	static uint64_t Signature();  // of the whole file; 0 without one
+	static char *SourceFile(int i);  // the parameter files it was made from; 0 past the last
+
+	// The corpus record for a path; kind is a mask of the PC_ bits
+	enum { PC_STRING = 0x01, PC_NUMBER = 0x02, PC_BLOCK = 0x04 };
+	typedef struct {
+		uint64_t hash;
+		int kind;
+		int str;      // offset in the string pool, -1 if none
+		int nodes;    // offset in the node pool (of string offsets)
+		int nnodes;
+		int path;     // offset in the string pool of "a/b/c"
+		int pad;
+		double num;
+	} Entry;
+
+	// a parameter file the corpus was made from, as it was then
+	typedef struct {
+		int name;     // offset in the string pool
+		int pad;
+		int64_t size;
+		int64_t mtime;
+		uint64_t sum;
+	} Source;
+
+	static Entry *Find(char **keys, int n);
+	static int Absent(char **keys, int n);  // the parent block is in the corpus and this isn't in it
+	static char *String(int off);
+	static char **Nodes(Entry *e);           // Free() the array, not the strings
+
+	static uint64_t Hash(char **keys, int n);
+	static int SumFile(char *file, uint64_t *h);  // FNV-1a over its contents, carrying on from *h
+
+	// corpus first, then the tree
+	static char *GetS(int flags, char **keys, int n);
+	static double GetN(int flags, char **keys, int n);
+	static int GetI(int flags, char **keys, int n);
+	static char **GetNodes(char **keys, int n);
+	static int collect(va_list ap, char *first, char **keys);
+
+	// the parameter tree with a path built at run time
+	static char *TreeS(int flags, char **keys, int n);
+	static double TreeN(int flags, char **keys, int n);
+	static int TreeI(int flags, char **keys, int n);
+	static char **TreeNodes(char **keys, int n);
+
+	typedef struct {
+		char magic[8];
+		int n;          // entries
+		int nodebytes;  // node pool
+		int strbytes;   // string pool
+		int nsrc;       // sources
+	} Header;
+
+private:
+	static void autoload();
+	static int same(Entry *e, char **keys, int n);
+	static int fresh(char *file);
+
+	static void *map;
+	static int maplen;
+	static Header *head;
+	static Entry *entry;
+	static Source *source;
+	static int *nodepool;
+	static char *strpool;
+	static char *name;            // of the corpus file
+	static int tried;
+	static uint64_t sig;
+};
+
+// Drop in replacements for PGetS, PGetN, PGetI and PGetNodes
+char *CPGetS(int flags, ...);
+double CPGetN(int flags, ...);
+int CPGetI(int flags, ...);
+char **CPGetNodes(char *k0, ...);
+
+#endif
+/*-  The End  */
@@ -0,0 +1,243 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  paramhandle.cxx -- parameter paths resolved once
+
+  Handles are never freed; there is one per distinct path and flag
+  combination that anyone has asked for, which is a few hundred at most.
+  A handle is put at the head of its bucket once it's complete, so
+  find() doesn't need the lock; the one lock covers making handles and
+  the first walk of each, which are both rare.
+*/
+
+/*-  Included files  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+
+#include "prmagent.hxx"
+#include "paramcorpus.hxx"
+#include "paramhandle.hxx"
+#include "memchk.h"
+
+/*-  Local variables, constants, and defines  */
+ParamHandle * volatile ParamHandle::bucket[NBUCKET];
+volatile int ParamHandle::lock = 0;
+ParamHandle::Tally *ParamHandle::tallies = 0;
+int ParamHandle::ntally = 0;
+int ParamHandle::maxtally = 0;
+int ParamHandle::counting = 0;
+
+/*-  Code  */
+
+/*-- ParamHandle() -- */
+ParamHandle::ParamHandle() {
+	hash = 0;
+	flags = 0;
+	path = 0;
+	keys = 0;
+	n = 0;
+	have = 0;
+	num = 0;
+	str = 0;
+	ival = 0;
+	nodes = 0;
+	lookups = 0;
+	next = 0;
+}
+
+/*-- find(uint64_t h, int f) -- */
+ParamHandle *ParamHandle::find(uint64_t h, int f) {
+	for (ParamHandle *p = bucket[h % NBUCKET]; p; p = p->next) {
+		if (p->hash == h && p->flags == f) return p;
+	}
+	return 0;
+}
+
+/*-- Resolve(int flags, char *k0, ...) -- */
+ParamHandle *ParamHandle::Resolve(int f, char *k0, ...) {
+	char *k[PCORPUS_MAXDEPTH];
+	va_list ap;
+	va_start(ap, k0);
+	int m = ParamCorpus::collect(ap, k0, k);
+	va_end(ap);
+	assert(m > 0);
+
+	uint64_t h = ParamCorpus::Hash(k, m);
+	ParamHandle *p = find(h, f);
+	if (p) return p;
+
+	while (__sync_lock_test_and_set(&lock, 1)) ;
+	if ((p = find(h, f))) {  // somebody beat us to it
+		__sync_lock_release(&lock);
+		return p;
+	}
+
+	// take our own copy of the path; the caller's strings may not last
+	int i, len = 0;
+	for (i = 0; i < m; i++) len += strlen(k[i])+1;
+
+	p = new ParamHandle();
+	if (!p) abort();
+	p->hash = h;
+	p->flags = f;
+	p->n = m;
+	p->path = (char *)Malloc(len);
+	p->keys = (char **)Calloc(m, sizeof(char *));
+	if (!p->path || !p->keys) abort();
+
+	char *s = p->path;
+	for (i = 0; i < m; i++) {
+		int l = strlen(k[i]);
+		memcpy(s, k[i], l);
+		p->keys[i] = s;
+		s[l] = 0;
+		s += l+1;
+	}
+
+	p->next = bucket[h % NBUCKET];
+	__sync_synchronize();  // all of it before anyone can find it
+	bucket[h % NBUCKET] = p;
+	__sync_lock_release(&lock);
+	return p;
+}
+
+
+/*-- getters -- walk the first time, remember after that */
+
+/*--- fill(int what) -- the first walk, for what (one of the HAVE_s) */
+void ParamHandle::fill(int what) {
+	while (__sync_lock_test_and_set(&lock, 1)) ;
+	if (!(have & what)) {
+		switch (what) {
+		case HAVE_N: num = ParamCorpus::GetN(flags, keys, n); break;
+		case HAVE_S: str = ParamCorpus::GetS(flags, keys, n); break;
+		case HAVE_I: ival = ParamCorpus::GetI(flags, keys, n); break;
+		case HAVE_NODES: nodes = ParamCorpus::GetNodes(keys, n); break;
+		default: abort();
+		}
+		__sync_synchronize();  // the answer before the flag
+		have |= what;
+	}
+	__sync_lock_release(&lock);
+}
+
+/*--- N() -- */
+double ParamHandle::N() {
+	lookups++;
+	if (!(have & HAVE_N)) fill(HAVE_N);
+	return num;
+}
+
+/*--- S() -- */
+char *ParamHandle::S() {
+	lookups++;
+	if (!(have & HAVE_S)) fill(HAVE_S);
+	return str;
+}
+
+/*--- I() -- */
+int ParamHandle::I() {
+	lookups++;
+	if (!(have & HAVE_I)) fill(HAVE_I);
+	return ival;
+}
+
+/*--- Nodes() -- */
+char **ParamHandle::Nodes() {
+	lookups++;
+	if (!(have & HAVE_NODES)) fill(HAVE_NODES);
+	return nodes;
+}
+
+
+/*--- Forget() -- */
+// The node arrays are ours; the strings belong to the corpus or the tree.
+void ParamHandle::Forget() {
+	while (__sync_lock_test_and_set(&lock, 1)) ;
+	for (int b = 0; b < NBUCKET; b++) {
+		for (ParamHandle *p = bucket[b]; p; p = p->next) {
+			if (p->nodes) Free(p->nodes);
+			p->have = 0;
+			p->num = 0;
+			p->str = 0;
+			p->ival = 0;
+			p->nodes = 0;
+		}
+	}
+	__sync_lock_release(&lock);
+}
+
+
+/*-- lookup statistics */
+
+/*--- Count(int on) -- */
+void ParamHandle::Count(int on) {
+	counting = on;
+}
+
+/*--- tally(char **keys, int n, uint64_t h) -- find or make the tally for a path */
+// A straight scan; it only runs while we're counting.
+ParamHandle::Tally *ParamHandle::tally(char **k, int m, uint64_t h) {
+	int i;
+	for (i = 0; i < ntally; i++) {
+		if (tallies[i].hash == h) return &tallies[i];
+	}
+	if (ntally >= maxtally) {
+		maxtally = maxtally?2*maxtally:256;
+		tallies = (Tally *)Realloc(tallies, maxtally*sizeof(Tally));
+		if (!tallies) abort();
+	}
+
+	int len = 1;
+	for (i = 0; i < m; i++) len += strlen(k[i])+1;
+	Tally *t = &tallies[ntally++];
+	t->hash = h;
+	t->walks = t->handled = 0;
+	t->path = (char *)Malloc(len);
+	if (!t->path) abort();
+	t->path[0] = 0;
+	for (i = 0; i < m; i++) {
+		if (i) strcat(t->path, "/");
+		strcat(t->path, k[i]);
+	}
+	return t;
+}
+
+/*--- Note(char **keys, int n) -- */
+void ParamHandle::Note(char **k, int m) {
+	if (!counting) return;
+	tally(k, m, ParamCorpus::Hash(k, m))->walks++;
+}
+
+/*--- by_count(const void *a, const void *b) -- busiest first */
+int ParamHandle::by_count(const void *a, const void *b) {
+	unsigned long x = ((Tally *)a)->walks + ((Tally *)a)->handled;
+	unsigned long y = ((Tally *)b)->walks + ((Tally *)b)->handled;
+	return (x > y)?-1:(x < y)?1:0;
+}
+
+/*--- Stats(FILE *f, int max) -- the max busiest paths (all of them if max <= 0) */
+void ParamHandle::Stats(FILE *f, int max) {
+	assert(f);
+
+	// fold the handle counts in
+	for (int b = 0; b < NBUCKET; b++) {
+		for (ParamHandle *p = bucket[b]; p; p = p->next) {
+			if (!p->lookups) continue;
+			tally(p->keys, p->n, p->hash)->handled += p->lookups;
+			p->lookups = 0;
+		}
+	}
+
+	qsort(tallies, ntally, sizeof(Tally), by_count);
+	fprintf(f, "%12s %12s  %s\n", "string walks", "handled", "path");
+	for (int i = 0; i < ntally && (max <= 0 || i < max); i++) {
+		fprintf(f, "%12lu %12lu  %s\n", tallies[i].walks, tallies[i].handled, tallies[i].path);
+	}
+}
+
+/*-  The End  */
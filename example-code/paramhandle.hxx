@@ -0,0 +1,90 @@
+// -*- outline-regexp: "/\\*-+";  -*-
+/*-  Identification and Changes  */
+
+/*
+  paramhandle.hxx -- parameter paths resolved once
+
+  The parameter corpus doesn't change once a scenario is running, so a
+  path like (taxon, "ContaminantSink", "contaminants", name, tag) only
+  needs to be walked once.  ParamHandle::Resolve() returns the same
+  handle for the same path and flags, and the N(), S(), I() and Nodes()
+  getters remember the answer.  Keep the handles somewhere per-taxon
+  (see ContaminantTaxon) and the lookup costs nothing at all.  When
+  the parameters are reloaded, Forget() drops every remembered answer
+  (ContaminantTaxon::Flush does it); the handles themselves stay good.
+
+  Resolve() and the getters are safe from any thread (agents are set up
+  in parallel by Contamination::InitMany).  Only the first walk of a
+  path takes a lock, and the kernel's PGet* calls are only ever made
+  under it.
+
+  With ParamHandle::Count(1) every lookup is counted against its path,
+  both through handles and through the CPGet* calls, and Stats() lists
+  the busiest paths: anything near the top which isn't a handle is a
+  string walk that still wants converting.
+*/
+
+#ifndef _PARAMHANDLE_HXX_INCLUDED_
+#define _PARAMHANDLE_HXX_INCLUDED_
+
+#include <stdio.h>
+#include <stdint.h>
+
+class ParamHandle
+{
+public:
+	static ParamHandle *Resolve(int flags, char *k0, ...);  // (char *)0 terminated, like PGetS
+
+	double N();
+	char *S();
+	int I();
+	char **Nodes();        // belongs to the handle, don't Free it
+
+	static void Forget();  // the answers, not the handles; not while anyone's using them
+
+	static void Count(int on);
+	static void Note(char **keys, int n);    // a string walk (from CPGet*)
+	static void Stats(FILE *f, int max);
+
+private:
+	ParamHandle();
+
+	enum { HAVE_N = 1, HAVE_S = 2, HAVE_I = 4, HAVE_NODES = 8 };
+
+	uint64_t hash;
+	int flags;
+	char *path;            // the components, each ending in a NUL
+	char **keys;           // point into path
+	int n;
+
+	volatile int have;
+	double num;
+	char *str;
+	int ival;
+	char **nodes;
+
+	unsigned long lookups;
+	ParamHandle *next;
+
+	static ParamHandle *find(uint64_t h, int flags);
+	void fill(int what);
+
+	// lookup counts by path
+	typedef struct {
+		uint64_t hash;
+		char *path;        // "a/b/c", for Stats
+		unsigned long walks, handled;
+	} Tally;
+	static Tally *tally(char **keys, int n, uint64_t h);
+	static int by_count(const void *a, const void *b);
+
+	enum { NBUCKET = 256 };
+	static ParamHandle * volatile bucket[NBUCKET];
+	static volatile int lock;
+	static Tally *tallies;
+	static int ntally, maxtally;
+	static int counting;
+};
+
+#endif
+/*-  The End  */